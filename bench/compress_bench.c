@@ -0,0 +1,360 @@
+/*
+ *  Image-Formats - Compression Backend Benchmark
+ *      Compares the compression backends on a fixed corpus of images.
+ *
+ *  Usage: compress_bench.exe [file.png ...]
+ *      Every PNG file given is decoded and encoded again by every
+ *      backend that was built, at a fast, the default and the highest
+ *      level.  Without arguments, a synthetic corpus of photo-like,
+ *      flat and noisy images is used instead.  Every encoded image is
+ *      decoded to check it against its source.
+ *
+ *      The bundled backend is also run with segments on 1, 2, 4 and 8
+ *      threads, which must all produce the same datastreams.  The exit
+ *      status is 1 if they differ.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "engine.h"
+#include "writer.h"
+
+static uint32_t const kRepeats = 3;
+static uint32_t const kSyntheticSize = 512;
+static uint32_t const kSegmentSize = 256 * 1024;
+static uint32_t const kSegmentThreads[] = {1, 2, 4, 8};
+#define SYNTHETIC_COUNT 3
+#define MAX_IMAGES 64
+
+typedef struct {
+    char_t const *name;
+    ihdr_t ihdr;
+    palette_table_t palette;
+    uint8_t *pixels;
+    size_t size;
+} image_t;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *read_file(char_t const *path, size_t *length)
+{
+    FILE *file;
+    uint8_t *data;
+    long size;
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = (uint8_t *)malloc(size > 0 ? (size_t)size : 1);
+    if (data && fread(data, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = (size_t)size;
+    return data;
+}
+
+/* Decodes a datastream into the serialized rows of its image. */
+static bool_t decode_image(
+    uint8_t const *data, size_t length, image_t *image)
+{
+    decoder_t decoder;
+    size_t row_size;
+    bool_t decoded;
+
+    if (decoder_open(data, length, NULL, &decoder) != STATUS_OK)
+    {
+        return false;
+    }
+    image->ihdr = decoder.ihdr;
+    image->palette = decoder.palette;
+    ihdr_get_row_size(&decoder.ihdr, decoder.ihdr.width, &row_size);
+    image->size = row_size * decoder.ihdr.height;
+    image->pixels = (uint8_t *)malloc(image->size > 0 ? image->size : 1);
+    decoded = image->pixels && decoder_decode_region(
+        &decoder, NULL, image->pixels, &image->size) == STATUS_OK;
+    decoder_close(&decoder);
+    image->ihdr.interlace_method = 0;
+    return decoded;
+}
+
+/* Builds an 8-bit RGB image of one of the synthetic kinds. */
+static void synthetic_image(uint32_t kind, image_t *image)
+{
+    static char_t const *const kNames[SYNTHETIC_COUNT] = {
+        "synthetic gradient", "synthetic flat", "synthetic noise"
+    };
+    uint32_t x, y, seed;
+    uint8_t *pixel;
+
+    memset(image, 0, sizeof(image_t));
+    image->name = kNames[kind];
+    image->ihdr.width = kSyntheticSize;
+    image->ihdr.height = kSyntheticSize;
+    image->ihdr.bit_depth = 8;
+    image->ihdr.color_type = color_type_to_code(COLOR_TYPE_REALCOLOR);
+    image->size = (size_t)kSyntheticSize * kSyntheticSize * 3;
+    image->pixels = (uint8_t *)malloc(image->size);
+    if (!image->pixels)
+    {
+        exit(1);
+    }
+
+    seed = 1;
+    pixel = image->pixels;
+    for (y = 0; y < kSyntheticSize; y++)
+    {
+        for (x = 0; x < kSyntheticSize; x++, pixel += 3)
+        {
+            seed = seed * 1103515245u + 12345u;
+            if (kind == 0)
+            {
+                /* Smooth gradients with a little sensor noise. */
+                pixel[0] = (uint8_t)(x / 2 + ((seed >> 16) & 3));
+                pixel[1] = (uint8_t)(y / 2 + ((seed >> 18) & 3));
+                pixel[2] = (uint8_t)((x + y) / 4 + ((seed >> 20) & 3));
+            }
+            else if (kind == 1)
+            {
+                /* Large blocks of a few colors, like a screenshot. */
+                pixel[0] = (uint8_t)((x / 64) * 40);
+                pixel[1] = (uint8_t)((y / 32) * 30);
+                pixel[2] = (uint8_t)(((x / 64 + y / 32) & 1) * 255);
+            }
+            else
+            {
+                pixel[0] = (uint8_t)(seed >> 16);
+                pixel[1] = (uint8_t)(seed >> 8);
+                pixel[2] = (uint8_t)(seed >> 24);
+            }
+        }
+    }
+}
+
+/* Checks that a datastream decodes back to the rows of an image. */
+static bool_t check_image(
+    uint8_t const *data, size_t length, image_t const *source)
+{
+    image_t decoded;
+    bool_t same;
+
+    memset(&decoded, 0, sizeof(image_t));
+    same = decode_image(data, length, &decoded) &&
+        decoded.size == source->size &&
+        memcmp(decoded.pixels, source->pixels, source->size) == 0;
+    free(decoded.pixels);
+    return same;
+}
+
+/* FNV-1a hash of encoded datastreams. */
+static uint64_t hash_bytes(uint64_t hash, uint8_t const *data, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* Encodes every image and returns the hash of the datastreams. */
+static uint64_t bench_encoder(
+    char_t const *label, encoder_options_t const *options,
+    image_t const *images, uint32_t count)
+{
+    encoder_t encoder;
+    writer_t writer;
+    uint8_t const *data;
+    size_t length, raw, compressed;
+    uint32_t i, repeat;
+    uint64_t hash;
+    double start, seconds, best;
+    bool_t valid;
+
+    if (encoder_init(options, &encoder) != STATUS_OK)
+    {
+        fprintf(stderr, "%s: cannot initialize level %u\n",
+                label, options->level);
+        exit(1);
+    }
+    writer_init_memory(&writer);
+
+    hash = 0xcbf29ce484222325ull;
+    raw = 0;
+    compressed = 0;
+    seconds = 0.0;
+    valid = true;
+    for (i = 0; i < count; i++)
+    {
+        best = 0.0;
+        for (repeat = 0; repeat < kRepeats; repeat++)
+        {
+            writer_reset(&writer);
+            start = now_seconds();
+            if (encoder_encode(
+                    &encoder, &images[i].ihdr,
+                    images[i].palette.size > 0 ? &images[i].palette : NULL,
+                    images[i].pixels, &writer) != STATUS_OK)
+            {
+                fprintf(stderr, "%s: cannot encode %s\n",
+                        label, images[i].name);
+                exit(1);
+            }
+            start = now_seconds() - start;
+            if (repeat == 0 || start < best)
+            {
+                best = start;
+            }
+        }
+        writer_get_memory(&writer, &data, &length);
+        valid = valid && check_image(data, length, &images[i]);
+        hash = hash_bytes(hash, data, length);
+        raw += images[i].size;
+        compressed += length;
+        seconds += best;
+    }
+
+    printf("  %-10s level %2u %10zu bytes %6.2f%% %8.1f MB/s %s\n",
+           label, options->level, compressed,
+           100.0 * (double)compressed / (double)raw,
+           (double)raw / seconds / 1e6, valid ? "ok" : "MISMATCH");
+
+    writer_free(&writer);
+    encoder_free(&encoder);
+    return hash;
+}
+
+static void bench_backend(
+    engine_compressor_t const *compressor, uint32_t level,
+    image_t const *images, uint32_t count)
+{
+    encoder_options_t options;
+
+    encoder_options_default(&options);
+    options.compressor = compressor;
+    options.level = level;
+    bench_encoder(compressor->name, &options, images, count);
+}
+
+/*
+ * Encodes with segments on every thread count and checks that the
+ * datastreams do not depend on it.
+ */
+static bool_t bench_segments(image_t const *images, uint32_t count)
+{
+    encoder_options_t options;
+    char_t label[32];
+    uint64_t hash, first;
+    uint32_t i;
+    bool_t same;
+
+    encoder_options_default(&options);
+    options.compressor = &kDeflateCompressor;
+    options.segment_size = kSegmentSize;
+    printf("segments of %u KiB:\n", kSegmentSize / 1024);
+
+    first = 0;
+    same = true;
+    for (i = 0; i < sizeof(kSegmentThreads) / sizeof(uint32_t); i++)
+    {
+        options.threads = kSegmentThreads[i];
+        snprintf(label, sizeof(label), "%u threads", options.threads);
+        hash = bench_encoder(label, &options, images, count);
+        if (i == 0)
+        {
+            first = hash;
+        }
+        same = same && hash == first;
+    }
+    printf("  output %016llx %s\n", (unsigned long long)first,
+           same ? "same on every thread count" : "DIFFERS");
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    image_t images[MAX_IMAGES];
+    engine_compressor_t const *compressor;
+    uint8_t *data;
+    size_t length, raw;
+    uint32_t count, i, levels[3], level;
+    bool_t same;
+    int arg;
+
+    count = 0;
+    for (arg = 1; arg < argc && count < MAX_IMAGES; arg++)
+    {
+        data = read_file(argv[arg], &length);
+        memset(&images[count], 0, sizeof(image_t));
+        images[count].name = argv[arg];
+        if (!data || !decode_image(data, length, &images[count]))
+        {
+            fprintf(stderr, "%s: cannot decode\n", argv[arg]);
+            free(images[count].pixels);
+        }
+        else
+        {
+            count++;
+        }
+        free(data);
+    }
+    if (argc == 1)
+    {
+        for (count = 0; count < SYNTHETIC_COUNT; count++)
+        {
+            synthetic_image(count, &images[count]);
+        }
+    }
+    if (count == 0)
+    {
+        return 1;
+    }
+
+    raw = 0;
+    for (i = 0; i < count; i++)
+    {
+        raw += images[i].size;
+    }
+    printf("corpus: %u images, %zu bytes of pixels\n", count, raw);
+
+    for (i = 0; (compressor = engine_get_compressor_at(i)) != NULL; i++)
+    {
+        levels[0] = 1;
+        levels[1] = 6;
+        levels[2] = compressor->max_level;
+        for (level = 0; level < 3; level++)
+        {
+            bench_backend(compressor, levels[level], images, count);
+        }
+    }
+    same = bench_segments(images, count);
+
+    for (i = 0; i < count; i++)
+    {
+        free(images[i].pixels);
+    }
+    return same ? 0 : 1;
+}
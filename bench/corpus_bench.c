@@ -0,0 +1,688 @@
+/*
+ *  Image-Formats - Corpus Benchmark
+ *      Measures end-to-end encoding and decoding on a synthetic corpus
+ *      and compares the results with a baseline.
+ *
+ *  Usage: corpus_bench.exe [options]
+ *      --max-pixels N       Skip images of more than N pixels, such as
+ *                           2100000 to stop at 1920x1080.  The whole
+ *                           corpus is run by default.
+ *      --baseline FILE      Compare with a baseline and exit with 1 if
+ *                           any image regressed.
+ *      --write-baseline FILE
+ *                           Save the results as a new baseline.
+ *      --threshold F        Allowed relative slowdown or RSS growth
+ *                           before a regression is reported, 0.2 by
+ *                           default.  Throughput is compared by its
+ *                           geometric mean over the corpus, peak RSS
+ *                           image by image, and allocation counts must
+ *                           not grow at all.
+ *
+ *  The corpus holds every color type and bit depth allowed by
+ *  `ihdr_is_valid()`, interlaced and not, from 16x16 icons up to 100
+ *  megapixels.  Images are generated from a fixed seed, so every run
+ *  measures the same data.  Each image is encoded at the default level
+ *  and decoded to 8-bit RGBA on one thread, and the decoded image data
+ *  is checked against its source.  Throughput is in megabytes of
+ *  serialized image data per second.  Allocations are counted by
+ *  wrapping malloc, calloc and realloc at link time.  Every image runs
+ *  in a child process of its own, so its peak RSS is not hidden by the
+ *  images before it.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "encoder.h"
+#include "writer.h"
+
+static size_t const kDefaultMaxPixels = 100000000;
+static double const kDefaultThreshold = 0.2;
+/* Measurements are repeated until they took this long in total. */
+static double const kMinSeconds = 0.2;
+static uint32_t const kMaxRepeats = 1000;
+
+#define FORMAT_COUNT 15
+#define SIZE_COUNT 5
+#define NAME_SIZE 64
+
+typedef struct {
+    color_type_t color_type;
+    uint8_t bit_depth;
+    char_t const *name;
+} format_t;
+
+static format_t const kFormats[FORMAT_COUNT] = {
+    { COLOR_TYPE_GRAYSCALE, 1, "gray" },
+    { COLOR_TYPE_GRAYSCALE, 2, "gray" },
+    { COLOR_TYPE_GRAYSCALE, 4, "gray" },
+    { COLOR_TYPE_GRAYSCALE, 8, "gray" },
+    { COLOR_TYPE_GRAYSCALE, 16, "gray" },
+    { COLOR_TYPE_REALCOLOR, 8, "rgb" },
+    { COLOR_TYPE_REALCOLOR, 16, "rgb" },
+    { COLOR_TYPE_PALETTE, 1, "palette" },
+    { COLOR_TYPE_PALETTE, 2, "palette" },
+    { COLOR_TYPE_PALETTE, 4, "palette" },
+    { COLOR_TYPE_PALETTE, 8, "palette" },
+    { COLOR_TYPE_GRAYSCALE_ALPHA, 8, "graya" },
+    { COLOR_TYPE_GRAYSCALE_ALPHA, 16, "graya" },
+    { COLOR_TYPE_REALCOLOR_ALPHA, 8, "rgba" },
+    { COLOR_TYPE_REALCOLOR_ALPHA, 16, "rgba" }
+};
+
+static uint32_t const kSizes[SIZE_COUNT][2] = {
+    { 16, 16 }, { 256, 256 }, { 1920, 1080 }, { 8192, 6144 },
+    { 10000, 10000 }
+};
+
+typedef struct {
+    char_t name[NAME_SIZE];
+    double encode_mbps;
+    double decode_mbps;
+    uint64_t encode_allocs;
+    uint64_t decode_allocs;
+    long peak_rss_kb;
+} result_t;
+
+typedef struct {
+    result_t *results;
+    uint32_t count;
+    uint32_t capacity;
+} results_t;
+
+/* Allocations made since the counter was last cleared. */
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* High-water mark of the RSS of the calling process. */
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+/*
+ * Fills the serialized rows of an image with smooth gradients, a few
+ * hard edges and low amplitude noise, which compress about like
+ * photographs and screenshots do.
+ */
+static void generate_pixels(
+    ihdr_t const *ihdr, size_t row_size, uint8_t *pixels)
+{
+    uint32_t channels, x, y, c, value, seed, depth, max;
+    size_t bit;
+    uint8_t *row;
+
+    ihdr_get_channel_count(ihdr, &channels);
+    depth = ihdr->bit_depth;
+    max = (1u << depth) - 1;
+    seed = ihdr->width * 31u + ihdr->height * 17u + ihdr->color_type * 7u +
+        depth;
+    memset(pixels, 0, row_size * ihdr->height);
+
+    for (y = 0; y < ihdr->height; y++)
+    {
+        row = pixels + row_size * y;
+        for (x = 0; x < ihdr->width; x++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                /* 16-bit value, reduced to the sample depth. */
+                value = (uint32_t)(((uint64_t)x * 65535u / ihdr->width) *
+                                   (c + 1) +
+                                   (uint64_t)y * 65535u / ihdr->height);
+                if (((x / 97) + (y / 61)) % 5 == 0)
+                {
+                    value = 0xffffu * (c & 1);
+                }
+                value = (value + (next_random(&seed) & 0xff)) & 0xffffu;
+                value >>= 16 - depth;
+                if (c == channels - 1 &&
+                    ihdr_color_type_is_alpha_channel(ihdr->color_type) &&
+                    (x + y) % 3 != 0)
+                {
+                    value = max;
+                }
+
+                if (depth == 16)
+                {
+                    row[((size_t)x * channels + c) * 2] = (uint8_t)(value >> 8);
+                    row[((size_t)x * channels + c) * 2 + 1] = (uint8_t)value;
+                }
+                else if (depth == 8)
+                {
+                    row[(size_t)x * channels + c] = (uint8_t)value;
+                }
+                else
+                {
+                    bit = (size_t)x * depth;
+                    row[bit >> 3] |= (uint8_t)(
+                        value << (8 - depth - (bit & 7)));
+                }
+            }
+        }
+    }
+}
+
+static void generate_palette(uint8_t bit_depth, palette_table_t *palette)
+{
+    uint8_t entries[PALETTE_MAX_ENTRIES * 3];
+    uint32_t count, i, length;
+
+    count = 1u << bit_depth;
+    for (i = 0; i < count; i++)
+    {
+        entries[i * 3] = (uint8_t)(i * 255 / (count - 1));
+        entries[i * 3 + 1] = (uint8_t)(255 - i * 255 / (count - 1));
+        entries[i * 3 + 2] = (uint8_t)(i * 37);
+    }
+    length = count * 3;
+    palette_table_deserialize(entries, &length, palette);
+}
+
+static void add_result(results_t *results, result_t const *result)
+{
+    result_t *grown;
+
+    if (results->count == results->capacity)
+    {
+        results->capacity = results->capacity ? results->capacity * 2 : 64;
+        grown = (result_t *)realloc(
+            results->results, sizeof(result_t) * results->capacity);
+        if (!grown)
+        {
+            exit(EXIT_FAILURE);
+        }
+        results->results = grown;
+    }
+    results->results[results->count++] = *result;
+}
+
+static result_t const *find_result(results_t const *results, char_t const *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < results->count; i++)
+    {
+        if (strcmp(results->results[i].name, name) == 0)
+        {
+            return &results->results[i];
+        }
+    }
+    return NULL;
+}
+
+static bool_t read_baseline(char_t const *path, results_t *baseline)
+{
+    char_t line[256];
+    result_t result;
+    unsigned long long encode_allocs, decode_allocs;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        memset(&result, 0, sizeof(result_t));
+        if (sscanf(line, "%63s %lf %lf %llu %llu %ld", result.name,
+                   &result.encode_mbps, &result.decode_mbps, &encode_allocs,
+                   &decode_allocs, &result.peak_rss_kb) == 6)
+        {
+            result.encode_allocs = encode_allocs;
+            result.decode_allocs = decode_allocs;
+            add_result(baseline, &result);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static bool_t write_baseline(char_t const *path, results_t const *results)
+{
+    result_t const *result;
+    FILE *file;
+    uint32_t i;
+
+    file = fopen(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+    fprintf(file,
+            "# Corpus benchmark baseline, written by corpus_bench.exe.\n"
+            "# Timings depend on the machine and build flags.\n"
+            "# name encode_mbps decode_mbps encode_allocs decode_allocs "
+            "peak_rss_kb\n");
+    for (i = 0; i < results->count; i++)
+    {
+        result = &results->results[i];
+        fprintf(file, "%s %.1f %.1f %llu %llu %ld\n", result->name,
+                result->encode_mbps, result->decode_mbps,
+                (unsigned long long)result->encode_allocs,
+                (unsigned long long)result->decode_allocs,
+                result->peak_rss_kb);
+    }
+    fclose(file);
+    return true;
+}
+
+/*
+ * Describes how the allocations or peak RSS of a result regressed from
+ * its baseline, if they did.  Throughput is too noisy to judge one
+ * image at a time and is compared over the whole corpus instead.
+ */
+static bool_t compare_result(
+    result_t const *result, result_t const *base, double threshold,
+    char_t *reason, size_t reason_size)
+{
+    if (result->encode_allocs > base->encode_allocs ||
+        result->decode_allocs > base->decode_allocs)
+    {
+        snprintf(reason, reason_size, "allocations %llu/%llu > %llu/%llu",
+                 (unsigned long long)result->encode_allocs,
+                 (unsigned long long)result->decode_allocs,
+                 (unsigned long long)base->encode_allocs,
+                 (unsigned long long)base->decode_allocs);
+        return true;
+    }
+    if ((double)result->peak_rss_kb >
+        (double)base->peak_rss_kb * (1.0 + threshold))
+    {
+        snprintf(reason, reason_size, "peak RSS %ld > %ld KB",
+                 result->peak_rss_kb, base->peak_rss_kb);
+        return true;
+    }
+    return false;
+}
+
+/* Decodes a datastream to RGBA, counting allocations. */
+static status_t decode_rgba8(
+    uint8_t const *data, size_t length, uint8_t *rgba, size_t rgba_size)
+{
+    decoder_t decoder;
+    status_t status;
+
+    status = decoder_open(data, length, NULL, &decoder);
+    if (status == STATUS_OK)
+    {
+        status = decoder_decode_rgba8(&decoder, 1, rgba, &rgba_size);
+    }
+    decoder_close(&decoder);
+    return status;
+}
+
+/* Checks that a datastream decodes back to its source rows. */
+static bool_t check_image(
+    uint8_t const *data, size_t length, uint8_t const *pixels, size_t size)
+{
+    decoder_t decoder;
+    uint8_t *decoded;
+    size_t decoded_size;
+    bool_t same;
+
+    decoded = (uint8_t *)malloc(size);
+    decoded_size = size;
+    same = decoded && decoder_open(data, length, NULL, &decoder) == STATUS_OK;
+    if (same)
+    {
+        same = decoder_decode_region(
+            &decoder, NULL, decoded, &decoded_size) == STATUS_OK &&
+            decoded_size == size && memcmp(decoded, pixels, size) == 0;
+        decoder_close(&decoder);
+    }
+    free(decoded);
+    return same;
+}
+
+static bool_t bench_image(
+    format_t const *format, uint32_t width, uint32_t height,
+    uint8_t interlace, result_t *result)
+{
+    ihdr_t ihdr;
+    palette_table_t palette;
+    encoder_t encoder;
+    writer_t writer;
+    uint8_t const *data;
+    uint8_t *pixels, *rgba;
+    size_t row_size, size, rgba_size, length;
+    uint32_t repeat;
+    double start, seconds, total, best;
+    bool_t valid;
+
+    memset(&ihdr, 0, sizeof(ihdr_t));
+    ihdr.width = width;
+    ihdr.height = height;
+    ihdr.bit_depth = format->bit_depth;
+    ihdr.color_type = color_type_to_code(format->color_type);
+    ihdr.interlace_method = interlace;
+    ihdr_get_row_size(&ihdr, width, &row_size);
+    size = row_size * height;
+    rgba_size = (size_t)width * height * 4;
+
+    memset(result, 0, sizeof(result_t));
+    snprintf(result->name, NAME_SIZE, "%s%u%s-%ux%u", format->name,
+             format->bit_depth, interlace ? "-adam7" : "", width, height);
+
+    pixels = (uint8_t *)malloc(size);
+    rgba = (uint8_t *)malloc(rgba_size);
+    if (!pixels || !rgba)
+    {
+        fprintf(stderr, "%s: out of memory\n", result->name);
+        free(pixels);
+        free(rgba);
+        return false;
+    }
+    generate_pixels(&ihdr, row_size, pixels);
+    if (format->color_type == COLOR_TYPE_PALETTE)
+    {
+        generate_palette(format->bit_depth, &palette);
+    }
+
+    writer_init_memory(&writer);
+    encoder_init(NULL, &encoder);
+    valid = true;
+
+    /* Encoding, allocations counted on the first run. */
+    total = 0.0;
+    best = 0.0;
+    for (repeat = 0; repeat < kMaxRepeats && total < kMinSeconds; repeat++)
+    {
+        writer_reset(&writer);
+        allocations = 0;
+        start = now_seconds();
+        valid = encoder_encode(
+            &encoder, &ihdr,
+            format->color_type == COLOR_TYPE_PALETTE ? &palette : NULL,
+            pixels, &writer) == STATUS_OK;
+        seconds = now_seconds() - start;
+        if (repeat == 0)
+        {
+            result->encode_allocs = allocations;
+        }
+        if (!valid)
+        {
+            break;
+        }
+        total += seconds;
+        if (repeat == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    result->encode_mbps = (double)size / best / 1e6;
+    writer_get_memory(&writer, &data, &length);
+
+    /* Decoding, from a fresh decoder every time. */
+    total = 0.0;
+    for (repeat = 0;
+         valid && repeat < kMaxRepeats && total < kMinSeconds;
+         repeat++)
+    {
+        allocations = 0;
+        start = now_seconds();
+        valid = decode_rgba8(data, length, rgba, rgba_size) == STATUS_OK;
+        seconds = now_seconds() - start;
+        if (repeat == 0)
+        {
+            result->decode_allocs = allocations;
+        }
+        total += seconds;
+        if (repeat == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    result->decode_mbps = (double)size / best / 1e6;
+    valid = valid && check_image(data, length, pixels, size);
+    result->peak_rss_kb = peak_rss_kb();
+
+    if (valid)
+    {
+        printf("%-28s %10zu %9zu %8.1f %8.1f %6llu %6llu %8ld",
+               result->name, size, length, result->encode_mbps,
+               result->decode_mbps,
+               (unsigned long long)result->encode_allocs,
+               (unsigned long long)result->decode_allocs,
+               result->peak_rss_kb);
+    }
+    else
+    {
+        printf("%-28s FAILED", result->name);
+    }
+
+    encoder_free(&encoder);
+    writer_free(&writer);
+    free(rgba);
+    free(pixels);
+    return valid;
+}
+
+/*
+ * Runs `bench_image()` in a child process and receives its result.
+ * The parent only ever holds the results, so the peak RSS measured in
+ * the child is that of the image plus a small constant.
+ */
+static bool_t bench_image_isolated(
+    format_t const *format, uint32_t width, uint32_t height,
+    uint8_t interlace, result_t *result)
+{
+    int fds[2], wstatus;
+    pid_t pid;
+    ssize_t received;
+    bool_t valid;
+
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        valid = bench_image(format, width, height, interlace, result) &&
+            write(fds[1], result, sizeof(result_t)) ==
+            (ssize_t)sizeof(result_t);
+        fflush(stdout);
+        _exit(valid ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    received = read(fds[0], result, sizeof(result_t));
+    close(fds[0]);
+    if (waitpid(pid, &wstatus, 0) != pid)
+    {
+        return false;
+    }
+    if (WIFSIGNALED(wstatus))
+    {
+        printf("killed by signal %d", WTERMSIG(wstatus));
+    }
+    return received == (ssize_t)sizeof(result_t) && WIFEXITED(wstatus) &&
+        WEXITSTATUS(wstatus) == EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    results_t results, baseline;
+    result_t result;
+    result_t const *base;
+    char_t const *baseline_path, *output_path;
+    char_t reason[128];
+    size_t max_pixels;
+    double threshold, encode_log, decode_log;
+    uint32_t size, format, regressions, failures, compared;
+    uint8_t interlace;
+    int i;
+
+    max_pixels = kDefaultMaxPixels;
+    threshold = kDefaultThreshold;
+    baseline_path = NULL;
+    output_path = NULL;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-pixels") == 0 && i + 1 < argc)
+        {
+            max_pixels = (size_t)strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            threshold = strtod(argv[++i], NULL);
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    memset(&results, 0, sizeof(results_t));
+    memset(&baseline, 0, sizeof(results_t));
+    if (baseline_path && !read_baseline(baseline_path, &baseline))
+    {
+        fprintf(stderr, "%s: cannot read baseline\n", baseline_path);
+        return 2;
+    }
+
+    printf("%-28s %10s %9s %8s %8s %6s %6s %8s\n", "image", "raw", "png",
+           "enc MB/s", "dec MB/s", "e-allc", "d-allc", "rss KB");
+    regressions = 0;
+    failures = 0;
+    compared = 0;
+    encode_log = 0.0;
+    decode_log = 0.0;
+    for (size = 0; size < SIZE_COUNT; size++)
+    {
+        if ((size_t)kSizes[size][0] * kSizes[size][1] > max_pixels)
+        {
+            break;
+        }
+        for (format = 0; format < FORMAT_COUNT; format++)
+        {
+            for (interlace = 0; interlace <= 1; interlace++)
+            {
+                if (!bench_image_isolated(&kFormats[format], kSizes[size][0],
+                                          kSizes[size][1], interlace,
+                                          &result))
+                {
+                    printf("\n");
+                    failures++;
+                    continue;
+                }
+                add_result(&results, &result);
+
+                base = find_result(&baseline, result.name);
+                if (base)
+                {
+                    encode_log += log(result.encode_mbps / base->encode_mbps);
+                    decode_log += log(result.decode_mbps / base->decode_mbps);
+                    compared++;
+                }
+                if (base && compare_result(
+                        &result, base, threshold, reason, sizeof(reason)))
+                {
+                    printf("  REGRESSED: %s", reason);
+                    regressions++;
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    if (output_path && !write_baseline(output_path, &results))
+    {
+        fprintf(stderr, "%s: cannot write baseline\n", output_path);
+        return 2;
+    }
+    if (baseline_path && compared > 0)
+    {
+        /* Geometric means of the throughput relative to the baseline. */
+        encode_log = exp(encode_log / compared);
+        decode_log = exp(decode_log / compared);
+        printf("throughput relative to baseline: encode %.3f, decode %.3f\n",
+               encode_log, decode_log);
+        if (encode_log < 1.0 - threshold || decode_log < 1.0 - threshold)
+        {
+            printf("REGRESSED: throughput fell more than %.0f%%\n",
+                   threshold * 100.0);
+            regressions++;
+        }
+        printf("%u regressions over %u images\n", regressions, compared);
+    }
+
+    free(results.results);
+    free(baseline.results);
+    return (regressions > 0 || failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+/*
+ *  Image-Formats - CRC Policy Benchmark
+ *      Measures the cost of chunk CRC verification on large IDATs.
+ *
+ *  Usage: crc_bench.exe [file.png ...]
+ *      Without arguments, deserializes a synthetic datastream of large
+ *      IDAT chunks under every CRC policy.  Every PNG file given is
+ *      also fully decoded under every policy.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "decoder.h"
+#include "imgchunk.h"
+#include "writer.h"
+
+static uint32_t const kIdatLength = 1024 * 1024;
+static uint32_t const kIdatCount = 64;
+static uint32_t const kRepeats = 5;
+
+static char_t const *const kPolicyNames[] = {
+    "all", "critical", "none"
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Best time of deserializing every chunk of `stream`. */
+static double time_chunks(
+    uint8_t const *stream, size_t length, chunk_crc_policy_t policy)
+{
+    double best, start, elapsed;
+    size_t offset, used;
+    chunk_t chunk;
+    uint32_t i;
+
+    best = 0.0;
+    for (i = 0; i < kRepeats; i++)
+    {
+        start = now_seconds();
+        offset = PNG_SIGNATURE_SIZE;
+        while (offset < length)
+        {
+            used = length - offset;
+            chunk_clear(&chunk);
+            if (chunk_deserialize_checked(
+                    stream + offset, &used, policy, &chunk) != STATUS_OK)
+            {
+                fprintf(stderr, "chunk at %zu failed\n", offset);
+                exit(1);
+            }
+            chunk_free(&chunk);
+            offset += used;
+        }
+        elapsed = now_seconds() - start;
+        if (i == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+static void bench_synthetic(void)
+{
+    uint8_t const *stream;
+    uint8_t *payload;
+    size_t length;
+    writer_t writer;
+    uint32_t i, seed;
+    chunk_crc_policy_t policy;
+    double seconds, baseline;
+
+    payload = (uint8_t *)malloc(kIdatLength);
+    if (!payload)
+    {
+        exit(1);
+    }
+    seed = 1;
+    for (i = 0; i < kIdatLength; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        payload[i] = (uint8_t)(seed >> 16);
+    }
+
+    writer_init_memory(&writer);
+    writer_write_signature(&writer);
+    for (i = 0; i < kIdatCount; i++)
+    {
+        writer_write_data(&writer, IDAT_TYPE, payload, kIdatLength);
+    }
+    writer_write_data(&writer, IEND_TYPE, NULL, 0);
+    writer_get_memory(&writer, &stream, &length);
+
+    printf("synthetic: %u IDAT chunks of %u bytes\n", kIdatCount, kIdatLength);
+    baseline = 0.0;
+    for (policy = CHUNK_CRC_CHECK_ALL; policy <= CHUNK_CRC_CHECK_NONE;
+         policy++)
+    {
+        seconds = time_chunks(stream, length, policy);
+        if (policy == CHUNK_CRC_CHECK_ALL)
+        {
+            baseline = seconds;
+        }
+        printf("  crc %-8s %8.2f ms %8.1f MB/s %6.2f ns/byte  x%.2f\n",
+               kPolicyNames[policy], seconds * 1e3,
+               (double)length / seconds / 1e6,
+               seconds * 1e9 / (double)length, baseline / seconds);
+    }
+
+    writer_free(&writer);
+    free(payload);
+}
+
+static uint8_t *read_file(char_t const *path, size_t *length)
+{
+    FILE *file;
+    uint8_t *data;
+    long size;
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = (uint8_t *)malloc(size > 0 ? (size_t)size : 1);
+    if (data && fread(data, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = (size_t)size;
+    return data;
+}
+
+static void bench_file(char_t const *path)
+{
+    decoder_options_t options;
+    decoder_t decoder;
+    uint8_t *data, *pixels;
+    size_t length, outlen;
+    uint32_t i;
+    double start, seconds, best;
+
+    data = read_file(path, &length);
+    if (!data)
+    {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return;
+    }
+
+    printf("%s: %zu bytes\n", path, length);
+    decoder_options_default(&options);
+    for (options.crc_policy = CHUNK_CRC_CHECK_ALL;
+         options.crc_policy <= CHUNK_CRC_CHECK_NONE; options.crc_policy++)
+    {
+        best = 0.0;
+        pixels = NULL;
+        for (i = 0; i < kRepeats; i++)
+        {
+            start = now_seconds();
+            if (decoder_open(data, length, &options, &decoder) != STATUS_OK)
+            {
+                fprintf(stderr, "%s: cannot open\n", path);
+                break;
+            }
+            outlen = (size_t)decoder.ihdr.width * decoder.ihdr.height * 4;
+            if (!pixels)
+            {
+                pixels = (uint8_t *)malloc(outlen);
+            }
+            if (!pixels || decoder_decode_rgba8(
+                    &decoder, 1, pixels, &outlen) != STATUS_OK)
+            {
+                fprintf(stderr, "%s: cannot decode\n", path);
+                decoder_close(&decoder);
+                break;
+            }
+            decoder_close(&decoder);
+            seconds = now_seconds() - start;
+            if (i == 0 || seconds < best)
+            {
+                best = seconds;
+            }
+        }
+        free(pixels);
+        printf("  crc %-8s %8.2f ms\n",
+               kPolicyNames[options.crc_policy], best * 1e3);
+    }
+    free(data);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    bench_synthetic();
+    for (i = 1; i < argc; i++)
+    {
+        bench_file(argv[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ *  Image-Formats - Chunk Fuzzer
+ *      Deserializes a datastream of chunks, both copied and viewed,
+ *      under every CRC policy.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include "chunk.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    chunk_crc_policy_t policy;
+    chunk_t chunk;
+    size_t offset, length;
+    status_t status;
+
+    for (policy = CHUNK_CRC_CHECK_ALL; policy <= CHUNK_CRC_CHECK_NONE;
+         policy++)
+    {
+        for (offset = 0; offset < size; offset += length)
+        {
+            length = size - offset;
+            chunk_clear(&chunk);
+            status = chunk_deserialize_checked(
+                data + offset, &length, policy, &chunk);
+            chunk_free(&chunk);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+        }
+
+        for (offset = 0; offset < size; offset += length)
+        {
+            length = size - offset;
+            chunk_clear(&chunk);
+            status = chunk_view(data + offset, &length, policy, &chunk);
+            chunk_clear(&chunk);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ *  Image-Formats - Decoder Fuzzer
+ *      Decodes a PNG datastream to one of the pixel formats, reads one
+ *      of its texts and decodes a region of it in its serialized format.
+ *
+ *  CRCs are not verified, so that mutated inputs reach the image data
+ *  instead of failing on their first chunk; the chunk fuzzer covers
+ *  verification.  Images whose decoded form exceeds `kMaxOutput` are
+ *  only opened, as a server would refuse to allocate their output.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+
+#include "decoder.h"
+#include "fuzz.h"
+
+static size_t const kMaxOutput = 16 * 1024 * 1024;
+
+/* Decodes the image in a format picked by the size of the input. */
+static void decode_pixels(
+    uint8_t const *data, size_t size, decoder_options_t const *options)
+{
+    decoder_t decoder;
+    decoder_text_t const *text;
+    pixel_format_t format;
+    uint8_t *outbuf;
+    uint64_t total;
+    size_t outlen;
+
+    if (decoder_open(data, size, options, &decoder) != STATUS_OK)
+    {
+        return;
+    }
+    format = (pixel_format_t)(size % PIXEL_FORMAT_COUNT);
+    pixconv_format_size(
+        format, decoder.ihdr.width, decoder.ihdr.height, &total);
+    if (total <= kMaxOutput)
+    {
+        outlen = (size_t)total;
+        outbuf = (uint8_t *)malloc(outlen > 0 ? outlen : 1);
+        if (outbuf)
+        {
+            decoder_decode_pixels(&decoder, format, 1, outbuf, &outlen);
+            free(outbuf);
+        }
+    }
+    decoder_get_text(&decoder, "Comment", &text);
+    decoder_close(&decoder);
+}
+
+/* Decodes the bottom right quarter of the image. */
+static void decode_region(
+    uint8_t const *data, size_t size, decoder_options_t const *options)
+{
+    decoder_t decoder;
+    region_t region;
+    uint8_t *outbuf;
+    size_t row_size, outlen;
+
+    if (decoder_open(data, size, options, &decoder) != STATUS_OK)
+    {
+        return;
+    }
+    region.x = decoder.ihdr.width / 2;
+    region.y = decoder.ihdr.height / 2;
+    region.width = decoder.ihdr.width - region.x;
+    region.height = decoder.ihdr.height - region.y;
+    ihdr_get_row_size(&decoder.ihdr, region.width, &row_size);
+    outlen = row_size * region.height;
+    if (outlen <= kMaxOutput)
+    {
+        outbuf = (uint8_t *)malloc(outlen > 0 ? outlen : 1);
+        if (outbuf)
+        {
+            decoder_decode_region(&decoder, &region, outbuf, &outlen);
+            free(outbuf);
+        }
+    }
+    decoder_close(&decoder);
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    decoder_options_t options;
+
+    decoder_options_default(&options);
+    options.crc_policy = CHUNK_CRC_CHECK_NONE;
+    decode_pixels(data, size, &options);
+    decode_region(data, size, &options);
+    return 0;
+}
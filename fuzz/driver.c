@@ -0,0 +1,507 @@
+/*
+ *  Image-Formats - Standalone Fuzzing Driver
+ *      Runs a fuzzer without libFuzzer, for compilers that lack it and
+ *      for AFL, which runs the driver once per input file.
+ *
+ *  Usage: X_fuzz.exe [options] [file|directory ...]
+ *      Every file given, and every file in every directory given, is
+ *      run once.  Then inputs made by mutating them are run.
+ *      -runs=N        Number of mutated inputs to run, 0 by default.
+ *      -seed=N        Seed of the mutations, 1 by default.  A run is
+ *                     reproduced by the same corpus, seed and run.
+ *      -max_len=N     Largest mutated input in bytes, 65536 by default.
+ *      -timeout_ms=N  Flags inputs that run longer, 1000 by default.
+ *      -alloc_mb=N    Flags inputs that allocate more in total, 256 by
+ *                     default.
+ *      -save_run=N    Writes mutated input N to run-N and exits
+ *                     without running it.
+ *
+ *  The driver reports the executions per second of the corpus and of
+ *  the mutated inputs, so that parser slowdowns show up.  Flagged
+ *  mutated inputs are written to slow-HASH or alloc-HASH in the
+ *  current directory, and the driver exits with 1 if any input was
+ *  flagged.  Allocations are measured by wrapping malloc, calloc and
+ *  realloc at link time.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "base.h"
+#include "fuzz.h"
+
+typedef struct {
+    char_t *name;
+    uint8_t *data;
+    size_t size;
+} input_t;
+
+typedef struct {
+    input_t *inputs;
+    uint32_t count;
+    uint32_t capacity;
+} corpus_t;
+
+typedef struct {
+    uint64_t runs;
+    uint32_t seed;
+    size_t max_len;
+    double timeout;
+    size_t alloc_limit;
+    int64_t save_run;
+} driver_options_t;
+
+/* 32-bit values that are likely to hit the edges of length fields. */
+static uint32_t const kInteresting[] = {
+    0x00000000, 0x00000001, 0x000000ff, 0x0000ffff, 0x00010000,
+    0x7ffffffe, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff
+};
+#define INTERESTING_COUNT (sizeof(kInteresting) / sizeof(kInteresting[0]))
+
+/* Bytes requested from the allocator since the counter was cleared. */
+static size_t allocated = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocated += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocated += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocated += size;
+    return __real_realloc(ptr, size);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static uint32_t hash_input(uint8_t const *data, size_t size)
+{
+    uint32_t hash;
+    size_t i;
+
+    hash = 2166136261u;
+    for (i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool_t write_input(
+    char_t const *name, uint8_t const *data, size_t size)
+{
+    FILE *file;
+    bool_t written;
+
+    file = fopen(name, "wb");
+    if (!file)
+    {
+        return false;
+    }
+    written = fwrite(data, 1, size, file) == size;
+    fclose(file);
+    return written;
+}
+
+static void add_input(corpus_t *corpus, char_t const *path)
+{
+    input_t *grown, *input;
+    FILE *file;
+    long size;
+
+    if (corpus->count == corpus->capacity)
+    {
+        corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+        grown = (input_t *)realloc(
+            corpus->inputs, sizeof(input_t) * corpus->capacity);
+        if (!grown)
+        {
+            exit(EXIT_FAILURE);
+        }
+        corpus->inputs = grown;
+    }
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    input = &corpus->inputs[corpus->count];
+    input->size = size > 0 ? (size_t)size : 0;
+    input->data = (uint8_t *)malloc(input->size + 1);
+    input->name = (char_t *)malloc(strlen(path) + 1);
+    if (!input->data || !input->name ||
+        fread(input->data, 1, input->size, file) != input->size)
+    {
+        fprintf(stderr, "%s: cannot read\n", path);
+        free(input->data);
+        free(input->name);
+    }
+    else
+    {
+        strcpy(input->name, path);
+        corpus->count++;
+    }
+    fclose(file);
+}
+
+static void add_path(corpus_t *corpus, char_t const *path)
+{
+    struct stat info;
+    struct dirent *entry;
+    DIR *dir;
+    char_t *child;
+
+    if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        add_input(corpus, path);
+        return;
+    }
+    dir = opendir(path);
+    if (!dir)
+    {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        child = (char_t *)malloc(strlen(path) + strlen(entry->d_name) + 2);
+        if (!child)
+        {
+            break;
+        }
+        sprintf(child, "%s/%s", path, entry->d_name);
+        if (stat(child, &info) == 0 && S_ISREG(info.st_mode))
+        {
+            add_input(corpus, child);
+        }
+        free(child);
+    }
+    closedir(dir);
+}
+
+/*
+ * Runs one input and flags it when it was slow or allocated too much.
+ * Returns the time the input took.
+ */
+static double run_input(
+    uint8_t const *data, size_t size, char_t const *name, bool_t save,
+    driver_options_t const *options, uint32_t *flagged)
+{
+    char_t path[32];
+    double start, seconds;
+    size_t bytes;
+
+    allocated = 0;
+    start = now_seconds();
+    LLVMFuzzerTestOneInput(data, size);
+    seconds = now_seconds() - start;
+    bytes = allocated;
+
+    if (seconds > options->timeout)
+    {
+        snprintf(path, sizeof(path), "slow-%08x", hash_input(data, size));
+        printf("SLOW: %s took %.0f ms%s%s\n", name, seconds * 1e3,
+               save ? ", saved to " : "", save ? path : "");
+        if (save)
+        {
+            write_input(path, data, size);
+        }
+        (*flagged)++;
+    }
+    if (bytes > options->alloc_limit)
+    {
+        snprintf(path, sizeof(path), "alloc-%08x", hash_input(data, size));
+        printf("ALLOC: %s allocated %zu bytes%s%s\n", name, bytes,
+               save ? ", saved to " : "", save ? path : "");
+        if (save)
+        {
+            write_input(path, data, size);
+        }
+        (*flagged)++;
+    }
+    return seconds;
+}
+
+/* Applies one to four random mutations to an input. */
+static size_t mutate(
+    uint8_t *data, size_t size, size_t capacity, uint32_t *seed)
+{
+    uint32_t count, i, value;
+    size_t offset, length, source;
+
+    count = 1 + next_random(seed) % 4;
+    for (i = 0; i < count; i++)
+    {
+        offset = size > 0 ? next_random(seed) % size : 0;
+        switch (next_random(seed) % 6)
+        {
+            case 0:
+                if (size > 0)
+                {
+                    data[offset] ^= (uint8_t)(1u << (next_random(seed) % 8));
+                }
+                break;
+            case 1:
+                if (size > 0)
+                {
+                    data[offset] = (uint8_t)next_random(seed);
+                }
+                break;
+            case 2:
+                /* Big endian, as every PNG field is. */
+                if (size >= 4)
+                {
+                    offset = next_random(seed) % (size - 3);
+                    value = kInteresting[next_random(seed) % INTERESTING_COUNT];
+                    data[offset] = (uint8_t)(value >> 24);
+                    data[offset + 1] = (uint8_t)(value >> 16);
+                    data[offset + 2] = (uint8_t)(value >> 8);
+                    data[offset + 3] = (uint8_t)value;
+                }
+                break;
+            case 3:
+                length = 1 + next_random(seed) % 16;
+                if (size + length <= capacity)
+                {
+                    memmove(data + offset + length, data + offset,
+                            size - offset);
+                    for (source = 0; source < length; source++)
+                    {
+                        data[offset + source] = (uint8_t)next_random(seed);
+                    }
+                    size += length;
+                }
+                break;
+            case 4:
+                if (size > 0)
+                {
+                    length = 1 + next_random(seed) % (size - offset);
+                    memmove(data + offset, data + offset + length,
+                            size - offset - length);
+                    size -= length;
+                }
+                break;
+            default:
+                /* Copies a range over another, such as a whole chunk. */
+                if (size > 0)
+                {
+                    source = next_random(seed) % size;
+                    length = 1 + next_random(seed) % (size - source);
+                    if (length > size - offset)
+                    {
+                        length = size - offset;
+                    }
+                    memmove(data + offset, data + source, length);
+                }
+                break;
+        }
+    }
+    return size;
+}
+
+static bool_t parse_option(
+    char_t const *arg, char_t const *name, unsigned long long *value)
+{
+    size_t length;
+
+    length = strlen(name);
+    if (strncmp(arg, name, length) != 0 || arg[length] != '=')
+    {
+        return false;
+    }
+    *value = strtoull(arg + length + 1, NULL, 10);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    driver_options_t options;
+    corpus_t corpus;
+    input_t const *input;
+    char_t name[48];
+    unsigned long long value;
+    uint8_t *buffer;
+    uint8_t empty;
+    bool_t saved;
+    size_t size;
+    uint64_t run;
+    uint32_t i, seed, flagged;
+    double start, seconds, slowest;
+    char_t const *slowest_name;
+    int arg;
+
+    options.runs = 0;
+    options.seed = 1;
+    options.max_len = 65536;
+    options.timeout = 1.0;
+    options.alloc_limit = (size_t)256 * 1024 * 1024;
+    options.save_run = -1;
+    memset(&corpus, 0, sizeof(corpus_t));
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (parse_option(argv[arg], "-runs", &value))
+        {
+            options.runs = value;
+        }
+        else if (parse_option(argv[arg], "-seed", &value))
+        {
+            options.seed = (uint32_t)value;
+        }
+        else if (parse_option(argv[arg], "-max_len", &value))
+        {
+            options.max_len = (size_t)value;
+        }
+        else if (parse_option(argv[arg], "-timeout_ms", &value))
+        {
+            options.timeout = (double)value / 1e3;
+        }
+        else if (parse_option(argv[arg], "-alloc_mb", &value))
+        {
+            options.alloc_limit = (size_t)value * 1024 * 1024;
+        }
+        else if (parse_option(argv[arg], "-save_run", &value))
+        {
+            options.save_run = (int64_t)value;
+        }
+        else if (argv[arg][0] == '-')
+        {
+            fprintf(stderr, "unknown option %s\n", argv[arg]);
+            return 2;
+        }
+        else
+        {
+            add_path(&corpus, argv[arg]);
+        }
+    }
+
+    /* The corpus, timed input by input. */
+    flagged = 0;
+    slowest = 0.0;
+    slowest_name = NULL;
+    start = now_seconds();
+    for (i = 0; i < corpus.count; i++)
+    {
+        input = &corpus.inputs[i];
+        seconds = run_input(input->data, input->size, input->name, false,
+                            &options, &flagged);
+        if (!slowest_name || seconds > slowest)
+        {
+            slowest = seconds;
+            slowest_name = input->name;
+        }
+    }
+    if (corpus.count > 0)
+    {
+        seconds = now_seconds() - start;
+        printf("corpus: %u inputs in %.3f s, %.0f execs/s, slowest %s "
+               "%.3f ms\n", corpus.count, seconds,
+               (double)corpus.count / (seconds > 0.0 ? seconds : 1e-9),
+               slowest_name, slowest * 1e3);
+    }
+
+    /* Mutated inputs, seeded run by run so that any run can be redone. */
+    buffer = (uint8_t *)malloc(options.max_len > 0 ? options.max_len : 1);
+    if (!buffer)
+    {
+        return 2;
+    }
+    empty = 0;
+    saved = false;
+    start = now_seconds();
+    for (run = 0; run < options.runs; run++)
+    {
+        seed = options.seed ^ (uint32_t)(run * 2654435761u);
+        next_random(&seed);
+        if (corpus.count > 0)
+        {
+            input = &corpus.inputs[next_random(&seed) % corpus.count];
+            size = input->size < options.max_len ?
+                input->size : options.max_len;
+            memcpy(buffer, input->data, size);
+        }
+        else
+        {
+            size = 0;
+        }
+        size = mutate(buffer, size, options.max_len, &seed);
+
+        snprintf(name, sizeof(name), "run-%llu", (unsigned long long)run);
+        if ((int64_t)run == options.save_run)
+        {
+            saved = write_input(name, size > 0 ? buffer : &empty, size);
+            break;
+        }
+        run_input(size > 0 ? buffer : &empty, size, name, true, &options,
+                  &flagged);
+
+        if (((run + 1) & run) == 0 && run >= 1023)
+        {
+            seconds = now_seconds() - start;
+            printf("#%llu %.0f execs/s\n", (unsigned long long)(run + 1),
+                   (double)(run + 1) / seconds);
+        }
+    }
+    if (options.runs > 0 && options.save_run < 0)
+    {
+        seconds = now_seconds() - start;
+        printf("mutations: %llu runs in %.3f s, %.0f execs/s\n",
+               (unsigned long long)options.runs, seconds,
+               (double)options.runs / (seconds > 0.0 ? seconds : 1e-9));
+    }
+    if (flagged > 0)
+    {
+        printf("%u inputs flagged\n", flagged);
+    }
+
+    for (i = 0; i < corpus.count; i++)
+    {
+        free(corpus.inputs[i].name);
+        free(corpus.inputs[i].data);
+    }
+    free(corpus.inputs);
+    free(buffer);
+    if (options.save_run >= 0)
+    {
+        return saved ? 0 : 2;
+    }
+    return flagged > 0 ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+/*
+ *  Image-Formats - Fuzzing Entry Point
+ *      Every fuzzer defines the libFuzzer entry point, so that it can
+ *      be linked either with libFuzzer or with the standalone driver.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _FUZZ_H_
+#define _FUZZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Function: LLVMFuzzerTestOneInput
+ *  Runs one input through the code under test.
+ * Return:
+ *    Always 0.
+ */
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size);
+
+#endif /* _FUZZ_H_ */
@@ -0,0 +1,27 @@
+/*
+ *  Image-Formats - IHDR Fuzzer
+ *      Deserializes an IHDR payload and, when it is valid, derives
+ *      the sizes of its rows.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include "fuzz.h"
+#include "imgchunk.h"
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    ihdr_t ihdr;
+    uint32_t length, channels;
+    size_t row_size;
+
+    length = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    if (ihdr_deserialize(data, &length, &ihdr) != STATUS_OK ||
+        !ihdr_is_valid(&ihdr))
+    {
+        return 0;
+    }
+    ihdr_get_channel_count(&ihdr, &channels);
+    ihdr_get_row_size(&ihdr, ihdr.width, &row_size);
+    return 0;
+}
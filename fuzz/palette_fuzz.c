@@ -0,0 +1,27 @@
+/*
+ *  Image-Formats - Palette Fuzzer
+ *      Deserializes a PLTE payload both as a palette and as a palette
+ *      table.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include "clrchunk.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    palette_t palette;
+    palette_table_t table;
+    uint32_t length;
+
+    length = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    if (palette_deserialize(data, &length, &palette) == STATUS_OK)
+    {
+        palette_free(&palette);
+    }
+
+    length = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    palette_table_deserialize(data, &length, &table);
+    return 0;
+}
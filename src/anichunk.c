@@ -0,0 +1,302 @@
+/*
+ *  Image-Formats - PNG Animation Chunks
+ *      acTL, fcTL and fdAT chunks of the APNG extension.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <arpa/inet.h>  /* htonl / ntohl */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#include "anichunk.h"
+
+/*
+ * acTL specific constants.
+ */
+
+static uint32_t const kActlType = ACTL_TYPE;
+static uint32_t const kActlSize = sizeof(uint32_t) * 2;
+
+/*
+ * fcTL specific constants.
+ */
+
+static uint32_t const kFctlType = FCTL_TYPE;
+static uint32_t const kFctlSize =
+    (sizeof(uint32_t) * 5) + (sizeof(uint16_t) * 2) + (sizeof(uint8_t) * 2);
+
+/*
+ * fdAT specific constants.
+ */
+
+static uint32_t const kFdatType = FDAT_TYPE;
+
+static void put_u32(uint8_t **optr, uint32_t value)
+{
+    uint32_t nvalue;
+    nvalue = htonl(value);
+    memcpy(*optr, &nvalue, sizeof(uint32_t));
+    *optr += sizeof(uint32_t);
+}
+
+static uint32_t get_u32(uint8_t const **iptr)
+{
+    uint32_t nvalue;
+    memcpy(&nvalue, *iptr, sizeof(uint32_t));
+    *iptr += sizeof(uint32_t);
+    return ntohl(nvalue);
+}
+
+bool_t chunk_is_actl(chunk_t const *chunk)
+{
+    return (chunk && chunk->type == kActlType && chunk->length == kActlSize);
+}
+
+status_t actl_serialize(actl_t const *actl, uint8_t *outbuf, uint32_t *outlen)
+{
+    uint8_t *optr;
+
+    if (!actl || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (*outlen < kActlSize)
+    {
+        *outlen = kActlSize;
+        return STATUS_FAILURE;
+    }
+    *outlen = kActlSize;
+
+    optr = outbuf;
+    put_u32(&optr, actl->num_frames);
+    put_u32(&optr, actl->num_plays);
+    return STATUS_OK;
+}
+
+status_t actl_deserialize(uint8_t const *inbuf, uint32_t *inlen, actl_t *actl)
+{
+    uint8_t const *iptr;
+
+    if (!inbuf || !inlen || !actl)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (*inlen < kActlSize)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+    *inlen = kActlSize;
+
+    iptr = inbuf;
+    actl->num_frames = get_u32(&iptr);
+    actl->num_plays = get_u32(&iptr);
+    return STATUS_OK;
+}
+
+status_t chunk_new_actl(actl_t const *actl, chunk_t *chunk)
+{
+    uint32_t actl_data_len;
+    uint8_t actl_data[kActlSize];
+    status_t status;
+
+    if (!actl || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    actl_data_len = kActlSize;
+    status = actl_serialize(actl, actl_data, &actl_data_len);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    return chunk_new(kActlType, actl_data, kActlSize, chunk);
+}
+
+status_t actl_from_chunk(chunk_t const *chunk, actl_t *actl)
+{
+    uint32_t actl_data_len;
+
+    if (!actl || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!chunk_is_actl(chunk))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    actl_data_len = chunk->length;
+    return actl_deserialize(chunk->data, &actl_data_len, actl);
+}
+
+bool_t chunk_is_fctl(chunk_t const *chunk)
+{
+    return (chunk && chunk->type == kFctlType && chunk->length == kFctlSize);
+}
+
+bool_t chunk_is_fdat(chunk_t const *chunk)
+{
+    return (chunk && chunk->type == kFdatType &&
+            chunk->length >= FDAT_SEQUENCE_SIZE);
+}
+
+bool_t fctl_is_valid(fctl_t const *fctl, ihdr_t const *ihdr)
+{
+    if (!fctl || !ihdr)
+    {
+        return false;
+    }
+
+    if (fctl->width == 0 || fctl->height == 0 ||
+        fctl->x_offset > ihdr->width ||
+        fctl->width > ihdr->width - fctl->x_offset ||
+        fctl->y_offset > ihdr->height ||
+        fctl->height > ihdr->height - fctl->y_offset)
+    {
+        return false;
+    }
+
+    return fctl->dispose_op <= FCTL_DISPOSE_PREVIOUS &&
+        fctl->blend_op <= FCTL_BLEND_OVER;
+}
+
+status_t fctl_serialize(fctl_t const *fctl, uint8_t *outbuf, uint32_t *outlen)
+{
+    uint16_t nvalue;
+    uint8_t *optr;
+
+    if (!fctl || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (*outlen < kFctlSize)
+    {
+        *outlen = kFctlSize;
+        return STATUS_FAILURE;
+    }
+    *outlen = kFctlSize;
+
+    optr = outbuf;
+    put_u32(&optr, fctl->sequence_number);
+    put_u32(&optr, fctl->width);
+    put_u32(&optr, fctl->height);
+    put_u32(&optr, fctl->x_offset);
+    put_u32(&optr, fctl->y_offset);
+
+    /* Delay - 16-bit */
+    nvalue = htons(fctl->delay_num);
+    memcpy(optr, &nvalue, sizeof(uint16_t));
+    optr += sizeof(uint16_t);
+    nvalue = htons(fctl->delay_den);
+    memcpy(optr, &nvalue, sizeof(uint16_t));
+    optr += sizeof(uint16_t);
+
+    /* 8-bit values */
+    *optr++ = fctl->dispose_op;
+    *optr = fctl->blend_op;
+    return STATUS_OK;
+}
+
+status_t fctl_deserialize(uint8_t const *inbuf, uint32_t *inlen, fctl_t *fctl)
+{
+    uint16_t nvalue;
+    uint8_t const *iptr;
+
+    if (!inbuf || !inlen || !fctl)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (*inlen < kFctlSize)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+    *inlen = kFctlSize;
+
+    iptr = inbuf;
+    fctl->sequence_number = get_u32(&iptr);
+    fctl->width = get_u32(&iptr);
+    fctl->height = get_u32(&iptr);
+    fctl->x_offset = get_u32(&iptr);
+    fctl->y_offset = get_u32(&iptr);
+
+    /* Delay - 16-bit */
+    memcpy(&nvalue, iptr, sizeof(uint16_t));
+    fctl->delay_num = ntohs(nvalue);
+    iptr += sizeof(uint16_t);
+    memcpy(&nvalue, iptr, sizeof(uint16_t));
+    fctl->delay_den = ntohs(nvalue);
+    iptr += sizeof(uint16_t);
+
+    /* 8-bit values */
+    fctl->dispose_op = *iptr++;
+    fctl->blend_op = *iptr;
+    return STATUS_OK;
+}
+
+status_t chunk_new_fctl(fctl_t const *fctl, chunk_t *chunk)
+{
+    uint32_t fctl_data_len;
+    uint8_t fctl_data[kFctlSize];
+    status_t status;
+
+    if (!fctl || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    fctl_data_len = kFctlSize;
+    status = fctl_serialize(fctl, fctl_data, &fctl_data_len);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    return chunk_new(kFctlType, fctl_data, kFctlSize, chunk);
+}
+
+status_t fctl_from_chunk(chunk_t const *chunk, fctl_t *fctl)
+{
+    uint32_t fctl_data_len;
+
+    if (!fctl || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!chunk_is_fctl(chunk))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    fctl_data_len = chunk->length;
+    return fctl_deserialize(chunk->data, &fctl_data_len, fctl);
+}
+
+status_t fdat_get_sequence_number(chunk_t const *chunk, uint32_t *sequence)
+{
+    uint8_t const *iptr;
+
+    if (!chunk || !sequence)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!chunk_is_fdat(chunk))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    iptr = chunk->data;
+    *sequence = get_u32(&iptr);
+    return STATUS_OK;
+}
@@ -0,0 +1,182 @@
+/*
+ *  Image-Formats - PNG Animation Chunks
+ *      acTL, fcTL and fdAT chunks of the APNG extension.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _ANICHUNK_H_
+#define _ANICHUNK_H_
+
+#include "base.h"
+#include "chunk.h"
+#include "imgchunk.h"
+
+/* Numeric value of "acTL" in ASCII. */
+#define ACTL_TYPE 0x6163544cu
+/* Numeric value of "fcTL" in ASCII. */
+#define FCTL_TYPE 0x6663544cu
+/* Numeric value of "fdAT" in ASCII. */
+#define FDAT_TYPE 0x66644154u
+
+/* Size of the sequence number leading the data of fdAT chunks. */
+#define FDAT_SEQUENCE_SIZE 4
+
+/*
+ *  acTL API.
+ */
+
+typedef struct {
+    /* Number of frames, must not be 0. */
+    uint32_t num_frames;
+    /* Number of times to loop the animation, 0 loops forever. */
+    uint32_t num_plays;
+} actl_t;
+
+/*
+ * Function: chunk_is_actl
+ *  Determines if the provide chunk is of type Animation Control.
+ * Return:
+ *    `true` if the chunk is type is acTL and the length of the chunk
+ *    data is large enough to fit all of the acTL fields.
+ */
+bool_t chunk_is_actl(chunk_t const *chunk);
+
+/*
+ * Function: actl_serialize
+ *  Serializes an acTL struct into its chunk data form.
+ * Return:
+ *    As `ihdr_serialize()`.
+ */
+status_t actl_serialize(actl_t const *actl, uint8_t *outbuf, uint32_t *outlen);
+
+/*
+ * Function: actl_deserialize
+ *  Deserializes an acTL struct from the provided buffer, without
+ *  checking its values.
+ * Return:
+ *    As `ihdr_deserialize()`.
+ */
+status_t actl_deserialize(uint8_t const *inbuf, uint32_t *inlen, actl_t *actl);
+
+/*
+ * Function: chunk_new_actl
+ *  Initializes a chunk struct containing an acTL as its data.
+ */
+status_t chunk_new_actl(actl_t const *actl, chunk_t *chunk);
+
+/*
+ * Function: actl_from_chunk
+ *  Initializes an acTL struct from a chunk containing an acTL payload.
+ * Return:
+ *    OK if acTL was successfully deserialized from the chunk.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not an acTL.
+ */
+status_t actl_from_chunk(chunk_t const *chunk, actl_t *actl);
+
+/*
+ *  fcTL API.
+ */
+
+/* Treatment of the frame region before rendering the next frame. */
+typedef enum {
+    FCTL_DISPOSE_NONE,
+    /* Clear the region to fully transparent black. */
+    FCTL_DISPOSE_BACKGROUND,
+    /* Restore the region to its content before the frame. */
+    FCTL_DISPOSE_PREVIOUS
+} fctl_dispose_op_t;
+
+/* Combination of the frame with the region of the output buffer. */
+typedef enum {
+    /* Replace the region, alpha included. */
+    FCTL_BLEND_SOURCE,
+    /* Alpha composite the frame over the region. */
+    FCTL_BLEND_OVER
+} fctl_blend_op_t;
+
+typedef struct {
+    /* Position of the chunk in the shared fcTL and fdAT sequence. */
+    uint32_t sequence_number;
+    /* Frame region, which must lie within the image. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t x_offset;
+    uint32_t y_offset;
+    /* Frame delay of `delay_num` / `delay_den` seconds, 0 as 1/100. */
+    uint16_t delay_num;
+    uint16_t delay_den;
+    uint8_t dispose_op;
+    uint8_t blend_op;
+} fctl_t;
+
+/*
+ * Function: chunk_is_fctl
+ *  Determines if the provide chunk is of type Frame Control.
+ * Return:
+ *    `true` if the chunk is type is fcTL and the length of the chunk
+ *    data is large enough to fit all of the fcTL fields.
+ */
+bool_t chunk_is_fctl(chunk_t const *chunk);
+
+/*
+ * Function: chunk_is_fdat
+ *  Determines if the provide chunk is of type Frame Data.
+ * Return:
+ *    `true` if the chunk is type is fdAT and its data is large enough
+ *    to hold a sequence number.
+ */
+bool_t chunk_is_fdat(chunk_t const *chunk);
+
+/*
+ * Function: fctl_is_valid
+ *  Determines if the provide fcTL describes a valid frame of the image
+ *  described by `ihdr`.
+ */
+bool_t fctl_is_valid(fctl_t const *fctl, ihdr_t const *ihdr);
+
+/*
+ * Function: fctl_serialize
+ *  Serializes an fcTL struct into its chunk data form.
+ * Return:
+ *    As `ihdr_serialize()`.
+ */
+status_t fctl_serialize(fctl_t const *fctl, uint8_t *outbuf, uint32_t *outlen);
+
+/*
+ * Function: fctl_deserialize
+ *  Deserializes an fcTL struct from the provided buffer, without
+ *  checking its values.
+ * Return:
+ *    As `ihdr_deserialize()`.
+ */
+status_t fctl_deserialize(uint8_t const *inbuf, uint32_t *inlen, fctl_t *fctl);
+
+/*
+ * Function: chunk_new_fctl
+ *  Initializes a chunk struct containing an fcTL as its data.
+ */
+status_t chunk_new_fctl(fctl_t const *fctl, chunk_t *chunk);
+
+/*
+ * Function: fctl_from_chunk
+ *  Initializes an fcTL struct from a chunk containing an fcTL payload.
+ * Return:
+ *    OK if fcTL was successfully deserialized from the chunk.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not an fcTL.
+ */
+status_t fctl_from_chunk(chunk_t const *chunk, fctl_t *fctl);
+
+/*
+ * Function: fdat_get_sequence_number
+ *  Reads the sequence number of an fdAT chunk.
+ * Return:
+ *    OK if the sequence number was read.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not an fdAT.
+ */
+status_t fdat_get_sequence_number(chunk_t const *chunk, uint32_t *sequence);
+
+#endif /* _ANICHUNK_H_ */
@@ -0,0 +1,616 @@
+/*
+ *  Image-Formats - APNG Decoder
+ *      Decodes and composites the frames of animated PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "workers.h"
+
+#include "apngdec.h"
+
+/* Length + Type + CRC fields surrounding the chunk data. */
+static size_t const kChunkOverhead = sizeof(uint32_t) * 3;
+/* Size of a complete fcTL chunk, which bounds the number of frames. */
+static size_t const kFctlChunkSize = sizeof(uint32_t) * 3 + 26;
+/* Data offset of a frame whose fdAT chunks were not reached yet. */
+static size_t const kNoData = 0;
+
+typedef struct {
+    apng_decoder_t *apng;
+    /* Index of the frame decoded by the first slot. */
+    uint32_t first;
+} apng_batch_t;
+
+/* Reads the chunk at `*offset` and advances past it. */
+static status_t apng_next_chunk(
+    apng_decoder_t const *apng, size_t *offset, chunk_t *chunk)
+{
+    size_t length;
+    status_t status;
+
+    if (apng->image.inlen - *offset < kChunkOverhead)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+
+    length = apng->image.inlen - *offset;
+    chunk_clear(chunk);
+    status = chunk_view(
+        apng->image.inbuf + *offset, &length,
+        apng->image.options.crc_policy, chunk);
+    if (status != STATUS_OK)
+    {
+        chunk_clear(chunk);
+        return status;
+    }
+    *offset += length;
+    return STATUS_OK;
+}
+
+/* Indexes the single frame of an image without an acTL chunk. */
+static status_t apng_index_still(apng_decoder_t *apng)
+{
+    apng_frame_t *frame;
+
+    apng->frames = (apng_frame_t *)engine_allocate(sizeof(apng_frame_t));
+    if (!apng->frames)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    apng->frame_count = 1;
+
+    frame = &apng->frames[0];
+    memset(frame, 0, sizeof(apng_frame_t));
+    frame->fctl.width = apng->image.ihdr.width;
+    frame->fctl.height = apng->image.ihdr.height;
+    frame->fctl.dispose_op = FCTL_DISPOSE_NONE;
+    frame->fctl.blend_op = FCTL_BLEND_SOURCE;
+    frame->data_offset = apng->image.data_offset;
+    frame->data_type = IDAT_TYPE;
+    return STATUS_OK;
+}
+
+/*
+ * Walks the whole datastream once, recording the frame control and
+ * first data chunk of every frame.  fcTL and fdAT chunks must carry
+ * consecutive sequence numbers starting at 0.
+ */
+static status_t apng_index(apng_decoder_t *apng)
+{
+    chunk_t chunk;
+    apng_frame_t *frame;
+    size_t offset, chunk_offset;
+    uint32_t sequence, expected;
+    chunk_kind_t kind;
+    bool_t seen_idat, handled;
+    status_t status;
+
+    offset = PNG_SIGNATURE_SIZE;
+    expected = 0;
+    seen_idat = false;
+    frame = NULL;
+    for (;;)
+    {
+        chunk_offset = offset;
+        status = apng_next_chunk(apng, &offset, &chunk);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+
+        kind = chunk_kind_of(chunk.type);
+        if (kind == CHUNK_KIND_IEND)
+        {
+            break;
+        }
+
+        switch (kind)
+        {
+            case CHUNK_KIND_IDAT:
+                seen_idat = true;
+                break;
+            case CHUNK_KIND_ACTL:
+                if (seen_idat || apng->animated ||
+                    actl_from_chunk(&chunk, &apng->actl) != STATUS_OK ||
+                    apng->actl.num_frames == 0 ||
+                    apng->actl.num_frames >
+                        (apng->image.inlen - offset) / kFctlChunkSize)
+                {
+                    return STATUS_BAD_PACKET;
+                }
+                apng->frames = (apng_frame_t *)engine_allocate(
+                    sizeof(apng_frame_t) * apng->actl.num_frames);
+                if (!apng->frames)
+                {
+                    return STATUS_OUT_OF_MEMORY;
+                }
+                apng->animated = true;
+                break;
+            case CHUNK_KIND_FCTL:
+                if (!apng->animated)
+                {
+                    break;
+                }
+                if ((frame && frame->data_offset == kNoData) ||
+                    apng->frame_count == apng->actl.num_frames)
+                {
+                    return STATUS_BAD_PACKET;
+                }
+                frame = &apng->frames[apng->frame_count];
+                memset(frame, 0, sizeof(apng_frame_t));
+                if (fctl_from_chunk(&chunk, &frame->fctl) != STATUS_OK ||
+                    frame->fctl.sequence_number != expected++ ||
+                    !fctl_is_valid(&frame->fctl, &apng->image.ihdr))
+                {
+                    return STATUS_BAD_PACKET;
+                }
+                if (!seen_idat)
+                {
+                    /* The default image is the first frame. */
+                    if (frame->fctl.x_offset != 0 ||
+                        frame->fctl.y_offset != 0 ||
+                        frame->fctl.width != apng->image.ihdr.width ||
+                        frame->fctl.height != apng->image.ihdr.height)
+                    {
+                        return STATUS_BAD_PACKET;
+                    }
+                    frame->data_offset = apng->image.data_offset;
+                    frame->data_type = IDAT_TYPE;
+                }
+                else
+                {
+                    frame->data_offset = kNoData;
+                    frame->data_type = FDAT_TYPE;
+                }
+                apng->frame_count++;
+                break;
+            case CHUNK_KIND_FDAT:
+                if (!apng->animated)
+                {
+                    break;
+                }
+                if (fdat_get_sequence_number(&chunk, &sequence) !=
+                        STATUS_OK ||
+                    sequence != expected++ ||
+                    !frame || frame->data_type != FDAT_TYPE)
+                {
+                    return STATUS_BAD_PACKET;
+                }
+                if (frame->data_offset == kNoData)
+                {
+                    frame->data_offset = chunk_offset;
+                }
+                break;
+            case CHUNK_KIND_UNKNOWN:
+                /* Chunks before the image data were dispatched on load. */
+                if (!seen_idat)
+                {
+                    break;
+                }
+                status = chunk_registry_dispatch(
+                    apng->image.options.registry, &chunk, &handled);
+                if (status != STATUS_OK)
+                {
+                    return status;
+                }
+                if (!handled && chunk_type_is_critical(chunk.type))
+                {
+                    return STATUS_UNKNOWN_TYPE;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!apng->animated)
+    {
+        return apng_index_still(apng);
+    }
+
+    if (apng->frame_count != apng->actl.num_frames ||
+        frame->data_offset == kNoData)
+    {
+        return STATUS_BAD_PACKET;
+    }
+    return STATUS_OK;
+}
+
+status_t apng_decoder_open(
+    uint8_t const *inbuf, size_t inlen, decoder_options_t const *options,
+    apng_decoder_t *apng)
+{
+    status_t status;
+
+    if (!inbuf || !apng)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(apng, 0, sizeof(apng_decoder_t));
+    status = decoder_open(inbuf, inlen, options, &apng->image);
+    if (status != STATUS_OK)
+    {
+        memset(apng, 0, sizeof(apng_decoder_t));
+        return status;
+    }
+
+    status = apng_index(apng);
+    if (status != STATUS_OK)
+    {
+        apng_decoder_close(apng);
+    }
+    return status;
+}
+
+/* Makes room for `count` slots, keeping the existing ones. */
+static status_t apng_reserve_slots(apng_decoder_t *apng, uint32_t count)
+{
+    apng_slot_t *slots;
+    uint32_t i;
+
+    if (apng->slot_count >= count)
+    {
+        return STATUS_OK;
+    }
+
+    slots = (apng_slot_t *)engine_allocate(sizeof(apng_slot_t) * count);
+    if (!slots)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    if (apng->slot_count > 0)
+    {
+        memcpy(slots, apng->slots, sizeof(apng_slot_t) * apng->slot_count);
+    }
+    for (i = apng->slot_count; i < count; i++)
+    {
+        memset(&slots[i], 0, sizeof(apng_slot_t));
+        decoder_init(&apng->image.options, &slots[i].decoder);
+    }
+    free(apng->slots);
+    apng->slots = slots;
+    apng->slot_count = count;
+    return STATUS_OK;
+}
+
+/*
+ * Checks the RGBA8 size of a frame region against the pixel limit of
+ * the decoder options.  Regions lie within the image, so this only
+ * fails for limits lowered after the image was opened.
+ */
+static status_t apng_check_region(
+    apng_decoder_t const *apng, fctl_t const *fctl, size_t *size)
+{
+    uint64_t pixels;
+
+    pixels = (uint64_t)fctl->width * fctl->height;
+    if (apng->image.options.limits.max_pixels > 0 &&
+        pixels > apng->image.options.limits.max_pixels)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    if (pixels > SIZE_MAX / 4)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    *size = (size_t)pixels * 4;
+    return STATUS_OK;
+}
+
+/* Inflates, unfilters and expands one frame of a batch into its slot. */
+static void apng_decode_task(void *context, uint32_t index)
+{
+    apng_batch_t *batch;
+    apng_slot_t *slot;
+    apng_frame_t const *frame;
+    size_t size, length;
+
+    batch = (apng_batch_t *)context;
+    slot = &batch->apng->slots[index];
+    frame = &batch->apng->frames[batch->first + index];
+
+    slot->status = decoder_load_frame(
+        &batch->apng->image, &frame->fctl, frame->data_offset,
+        frame->data_type, &slot->decoder);
+    if (slot->status != STATUS_OK)
+    {
+        return;
+    }
+
+    slot->status = apng_check_region(batch->apng, &frame->fctl, &size);
+    if (slot->status != STATUS_OK)
+    {
+        return;
+    }
+    if (slot->size < size)
+    {
+        free(slot->pixels);
+        slot->size = 0;
+        slot->pixels = (uint8_t *)engine_allocate_large(size);
+        if (!slot->pixels)
+        {
+            slot->status = STATUS_OUT_OF_MEMORY;
+            return;
+        }
+        slot->size = size;
+    }
+
+    length = size;
+    slot->status = decoder_decode_rgba8(
+        &slot->decoder, 1, slot->pixels, &length);
+}
+
+/*
+ * Alpha composites a run of RGBA8 pixels over another (PNG
+ * Specification, Section 12.4 of the 2nd edition).  Opaque and fully
+ * transparent source pixels, which make up most animation frames, are
+ * handled as copies and skips of whole runs.
+ */
+static void blend_over(uint8_t const *src, uint8_t *dst, uint32_t count)
+{
+    uint32_t i, run, sa, da, alpha, c;
+
+    i = 0;
+    while (i < count)
+    {
+        sa = src[i * 4 + 3];
+        if (sa == 0xff || sa == 0)
+        {
+            for (run = i + 1; run < count && src[run * 4 + 3] == sa; run++)
+            {
+            }
+            if (sa == 0xff)
+            {
+                memcpy(dst + (size_t)i * 4, src + (size_t)i * 4,
+                       (size_t)(run - i) * 4);
+            }
+            i = run;
+            continue;
+        }
+
+        /* Both weights are scaled by 255. */
+        da = dst[i * 4 + 3] * (0xff - sa);
+        sa *= 0xff;
+        alpha = sa + da;
+        for (c = 0; c < 3; c++)
+        {
+            dst[i * 4 + c] = (uint8_t)(
+                (src[i * 4 + c] * sa + dst[i * 4 + c] * da + alpha / 2) /
+                alpha);
+        }
+        dst[i * 4 + 3] = (uint8_t)((alpha + 0x7f) / 0xff);
+        i++;
+    }
+}
+
+/* Applies the blend operation of a decoded frame to the canvas. */
+static void apng_blend(
+    apng_decoder_t const *apng, fctl_t const *fctl, uint8_t const *pixels,
+    uint8_t *canvas)
+{
+    size_t canvas_stride, frame_stride;
+    uint32_t y;
+    uint8_t *dst;
+
+    canvas_stride = (size_t)apng->image.ihdr.width * 4;
+    frame_stride = (size_t)fctl->width * 4;
+    dst = canvas + (size_t)fctl->y_offset * canvas_stride +
+        (size_t)fctl->x_offset * 4;
+    for (y = 0; y < fctl->height; y++)
+    {
+        if (fctl->blend_op == FCTL_BLEND_OVER)
+        {
+            blend_over(pixels, dst, fctl->width);
+        }
+        else
+        {
+            memcpy(dst, pixels, frame_stride);
+        }
+        pixels += frame_stride;
+        dst += canvas_stride;
+    }
+}
+
+/* Copies the frame region between the canvas and a packed buffer. */
+static void apng_copy_region(
+    apng_decoder_t const *apng, fctl_t const *fctl, uint8_t *canvas,
+    uint8_t *region, bool_t save)
+{
+    size_t canvas_stride, frame_stride;
+    uint32_t y;
+    uint8_t *ptr;
+
+    canvas_stride = (size_t)apng->image.ihdr.width * 4;
+    frame_stride = (size_t)fctl->width * 4;
+    ptr = canvas + (size_t)fctl->y_offset * canvas_stride +
+        (size_t)fctl->x_offset * 4;
+    for (y = 0; y < fctl->height; y++)
+    {
+        if (save)
+        {
+            memcpy(region, ptr, frame_stride);
+        }
+        else if (region)
+        {
+            memcpy(ptr, region, frame_stride);
+        }
+        else
+        {
+            memset(ptr, 0, frame_stride);
+        }
+        if (region)
+        {
+            region += frame_stride;
+        }
+        ptr += canvas_stride;
+    }
+}
+
+/*
+ * Blends a decoded frame, hands the canvas to the handler and applies
+ * the dispose operation of the frame.
+ */
+static status_t apng_compose(
+    apng_decoder_t *apng, uint32_t index, uint8_t const *pixels,
+    uint8_t *canvas, apng_frame_handler_t handler, void *context)
+{
+    fctl_t const *fctl;
+    uint8_t dispose_op;
+    size_t size;
+    status_t status;
+
+    fctl = &apng->frames[index].fctl;
+    dispose_op = fctl->dispose_op;
+    if (index == 0 && dispose_op == FCTL_DISPOSE_PREVIOUS)
+    {
+        /* Nothing precedes the first frame but a cleared canvas. */
+        dispose_op = FCTL_DISPOSE_BACKGROUND;
+    }
+
+    if (dispose_op == FCTL_DISPOSE_PREVIOUS)
+    {
+        status = apng_check_region(apng, fctl, &size);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        if (apng->previous_size < size)
+        {
+            free(apng->previous);
+            apng->previous_size = 0;
+            apng->previous = (uint8_t *)engine_allocate_large(size);
+            if (!apng->previous)
+            {
+                return STATUS_OUT_OF_MEMORY;
+            }
+            apng->previous_size = size;
+        }
+        apng_copy_region(apng, fctl, canvas, apng->previous, true);
+    }
+
+    apng_blend(apng, fctl, pixels, canvas);
+
+    status = handler(context, index, fctl, canvas);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    if (dispose_op == FCTL_DISPOSE_BACKGROUND)
+    {
+        apng_copy_region(apng, fctl, canvas, NULL, false);
+    }
+    else if (dispose_op == FCTL_DISPOSE_PREVIOUS)
+    {
+        apng_copy_region(apng, fctl, canvas, apng->previous, false);
+    }
+    return STATUS_OK;
+}
+
+status_t apng_decoder_decode(
+    apng_decoder_t *apng, uint32_t threads, uint8_t *outbuf, size_t *outlen,
+    apng_frame_handler_t handler, void *context)
+{
+    apng_batch_t batch;
+    uint32_t batch_size, slot_count, i;
+    uint64_t total;
+    status_t status;
+
+    if (!apng || !outbuf || !outlen || !handler)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    total = (uint64_t)apng->image.ihdr.width * apng->image.ihdr.height * 4;
+    if (total > SIZE_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    if (*outlen < total)
+    {
+        *outlen = (size_t)total;
+        return STATUS_FAILURE;
+    }
+    *outlen = (size_t)total;
+
+    slot_count = threads > 1 ? threads : 1;
+    if (slot_count > WORKERS_MAX_THREADS)
+    {
+        slot_count = WORKERS_MAX_THREADS;
+    }
+    if (slot_count > apng->frame_count)
+    {
+        slot_count = apng->frame_count;
+    }
+    status = apng_reserve_slots(apng, slot_count);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    /* The output buffer starts fully transparent black. */
+    memset(outbuf, 0, (size_t)total);
+
+    batch.apng = apng;
+    for (batch.first = 0; batch.first < apng->frame_count;
+         batch.first += batch_size)
+    {
+        batch_size = apng->frame_count - batch.first;
+        if (batch_size > slot_count)
+        {
+            batch_size = slot_count;
+        }
+
+        status = workers_run(
+            threads > 1 ? batch_size : 1, batch_size, apng_decode_task,
+            &batch);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+
+        for (i = 0; i < batch_size; i++)
+        {
+            if (apng->slots[i].status != STATUS_OK)
+            {
+                return apng->slots[i].status;
+            }
+            status = apng_compose(
+                apng, batch.first + i, apng->slots[i].pixels, outbuf,
+                handler, context);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t apng_decoder_close(apng_decoder_t *apng)
+{
+    uint32_t i;
+
+    if (!apng)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (i = 0; i < apng->slot_count; i++)
+    {
+        decoder_close(&apng->slots[i].decoder);
+        free(apng->slots[i].pixels);
+    }
+    free(apng->slots);
+    free(apng->frames);
+    free(apng->previous);
+    decoder_close(&apng->image);
+    memset(apng, 0, sizeof(apng_decoder_t));
+    return STATUS_OK;
+}
@@ -0,0 +1,128 @@
+/*
+ *  Image-Formats - APNG Decoder
+ *      Decodes and composites the frames of animated PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _APNGDEC_H_
+#define _APNGDEC_H_
+
+#include "anichunk.h"
+#include "base.h"
+#include "decoder.h"
+
+/*
+ * Type: apng_frame_handler_t
+ *  Receives every frame of the animation in order, composited onto the
+ *  output buffer before its dispose operation is applied.  Anything
+ *  other than OK stops decoding and is returned to the caller.
+ * Args:
+ *    context - Opaque pointer given to `apng_decoder_decode()`.
+ *    index - Index of the frame.
+ *    fctl - Frame control of the frame, for its delay.
+ *    canvas - The whole RGBA8 output buffer.
+ */
+typedef status_t (*apng_frame_handler_t)(
+    void *context, uint32_t index, fctl_t const *fctl, uint8_t const *canvas);
+
+typedef struct {
+    fctl_t fctl;
+    /* Offset of the first data chunk of the frame. */
+    size_t data_offset;
+    /* IDAT for a default image that is the first frame, else fdAT. */
+    uint32_t data_type;
+} apng_frame_t;
+
+/* Frame decoded by a worker thread ahead of composition. */
+typedef struct {
+    decoder_t decoder;
+    /* RGBA8 pixels of the frame region. */
+    uint8_t *pixels;
+    size_t size;
+    status_t status;
+} apng_slot_t;
+
+typedef struct {
+    /* Image of the datastream, holding its header and palette. */
+    decoder_t image;
+    /* Only populated for animated images. */
+    actl_t actl;
+    bool_t animated;
+    /* Frames in display order. */
+    apng_frame_t *frames;
+    uint32_t frame_count;
+    /* Grown on demand and reused by every decode. */
+    apng_slot_t *slots;
+    uint32_t slot_count;
+    /* Region saved for frames disposed to the previous content. */
+    uint8_t *previous;
+    size_t previous_size;
+} apng_decoder_t;
+
+/*
+ * Function: apng_decoder_open
+ *  Opens a PNG datastream as an animation and indexes its frames.
+ *  Images without an acTL chunk are opened as a single frame.
+ * Note:
+ *  The decoder does not copy `inbuf`, which must remain valid until
+ *  the decoder is closed.
+ * Args:
+ *    inbuf - Buffer containing a complete PNG datastream.
+ *    inlen - Length of `inbuf`.
+ *    options - Decoding options.  NULL for the defaults.
+ *    apng - Pointer to an uninitialized APNG decoder.
+ * Return:
+ *    OK if the frames were indexed.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    BAD_PACKET if the datastream or its animation chunks are
+ *      malformed or out of sequence.
+ *    OUT_OF_MEM if the frame index could not be allocated.
+ *    Otherwise as `decoder_open()`.
+ */
+status_t apng_decoder_open(
+    uint8_t const *inbuf, size_t inlen, decoder_options_t const *options,
+    apng_decoder_t *apng);
+
+/*
+ * Function: apng_decoder_decode
+ *  Decodes every frame and streams the composited output to `handler`.
+ *
+ *  Every frame is a separate zlib datastream, so batches of up to
+ *  `threads` frames are inflated, unfiltered and expanded to RGBA8 in
+ *  parallel.  The calling thread then blends each frame of the batch
+ *  onto the output buffer, hands it to `handler` and applies its
+ *  dispose operation.  Memory is bounded by the batch, not the length
+ *  of the animation.
+ * Args:
+ *    apng - Pointer to an opened APNG decoder.
+ *    threads - Number of worker threads.  0 or 1 decodes on the
+ *              calling thread only.
+ *    outbuf - Output buffer of width * height * 4 bytes.
+ *    outlen - On input, it should point to the length of `outbuf`.
+ *             On output, it will contain the number of bytes used if
+ *             decoding was successful or the number of bytes expected
+ *             if the buffer was not large enough.
+ *    handler - Callback receiving every frame.
+ *    context - Opaque pointer handed to `handler`.
+ * Return:
+ *    OK if every frame was decoded.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    FAILURE if the image could not fit into the provided buffer.
+ *    BAD_PACKET if the image data of a frame is malformed.
+ *    LIMIT_EXCEEDED if a frame is larger than the pixel limit of the
+ *      decoder options.  Frame buffers are only bounded by that limit.
+ *    OUT_OF_MEM if the frame buffers could not be allocated.
+ *    Otherwise the status returned by `handler`.
+ */
+status_t apng_decoder_decode(
+    apng_decoder_t *apng, uint32_t threads, uint8_t *outbuf, size_t *outlen,
+    apng_frame_handler_t handler, void *context);
+
+/*
+ * Function: apng_decoder_close
+ *  Frees the resources of an opened APNG decoder and clears it.
+ */
+status_t apng_decoder_close(apng_decoder_t *apng);
+
+#endif /* _APNGDEC_H_ */
@@ -0,0 +1,608 @@
+/*
+ *  Image-Formats - APNG Encoder
+ *      Writes animated PNG datastreams from full RGBA8 frames.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <arpa/inet.h>  /* htonl / ntohl */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "workers.h"
+
+#include "apngenc.h"
+
+static uint32_t const kPixelBytes = 4;
+static uint32_t const kFctlSize = 26;
+static uint64_t const kDefaultMaxPixels = (uint64_t)1 << 28;
+
+/* Output under a frame: `base`, with the region of `clear` zeroed. */
+typedef struct {
+    uint8_t const *base;
+    fctl_t const *clear;
+} apng_canvas_t;
+
+/* Pixels of a frame that differ from the output under it. */
+typedef struct {
+    /* Bounding rectangle, empty if `x_end` is 0. */
+    uint32_t x;
+    uint32_t y;
+    uint32_t x_end;
+    uint32_t y_end;
+    uint64_t changed;
+    /* Every changed pixel is opaque or drawn onto a transparent one. */
+    bool_t over;
+} apng_diff_t;
+
+typedef struct {
+    apng_encoder_t *apng;
+    /* Index of the frame compressed by the first task. */
+    uint32_t first;
+} apng_batch_t;
+
+static uint32_t canvas_pixel(
+    apng_canvas_t const *canvas, uint32_t width, uint32_t x, uint32_t y)
+{
+    fctl_t const *clear;
+    uint32_t pixel;
+
+    clear = canvas->clear;
+    if (clear && x - clear->x_offset < clear->width &&
+        y - clear->y_offset < clear->height)
+    {
+        return 0;
+    }
+    memcpy(&pixel, canvas->base + ((size_t)y * width + x) * kPixelBytes,
+           kPixelBytes);
+    return pixel;
+}
+
+static void apng_diff(
+    apng_canvas_t const *canvas, uint8_t const *target, uint32_t width,
+    uint32_t height, apng_diff_t *diff)
+{
+    uint32_t x, y, under, pixel;
+    uint8_t const *ptr;
+
+    memset(diff, 0, sizeof(apng_diff_t));
+    diff->x = width;
+    diff->y = height;
+    diff->over = true;
+    ptr = target;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++, ptr += kPixelBytes)
+        {
+            memcpy(&pixel, ptr, kPixelBytes);
+            under = canvas_pixel(canvas, width, x, y);
+            if (pixel == under)
+            {
+                continue;
+            }
+
+            diff->changed++;
+            /*
+             * OVER reproduces a changed pixel only if it is opaque, or
+             * drawn onto a transparent one without being transparent
+             * itself, which would leave the pixel below in place.
+             */
+            if (ptr[3] == 0 ||
+                (ptr[3] != 0xff && ((uint8_t const *)&under)[3] != 0))
+            {
+                diff->over = false;
+            }
+            diff->x = x < diff->x ? x : diff->x;
+            diff->y = y < diff->y ? y : diff->y;
+            diff->x_end = x + 1 > diff->x_end ? x + 1 : diff->x_end;
+            diff->y_end = y + 1;
+        }
+    }
+}
+
+/*
+ * Estimated cost of a frame.  Pixels of the region left transparent by
+ * the OVER operation are counted as half of a changed pixel.
+ */
+static uint64_t apng_cost(apng_diff_t const *diff, uint8_t blend_op)
+{
+    uint64_t area;
+
+    if (diff->x_end == 0)
+    {
+        return 0;
+    }
+    area = (uint64_t)(diff->x_end - diff->x) * (diff->y_end - diff->y);
+    return blend_op == FCTL_BLEND_OVER ? area + diff->changed : area * 2;
+}
+
+/* Returns a buffer of at least `size` bytes, growing it if needed. */
+static uint8_t *apng_reserve(uint8_t **buffer, size_t *capacity, size_t size)
+{
+    if (*capacity < size)
+    {
+        free(*buffer);
+        *capacity = 0;
+        *buffer = (uint8_t *)engine_allocate_large(size);
+        if (!*buffer)
+        {
+            return NULL;
+        }
+        *capacity = size;
+    }
+    return *buffer;
+}
+
+status_t apng_encoder_init(
+    encoder_options_t const *options, uint32_t threads, apng_encoder_t *apng)
+{
+    uint32_t i;
+    status_t status;
+
+    if (!apng)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(apng, 0, sizeof(apng_encoder_t));
+    if (options)
+    {
+        apng->options = *options;
+    }
+    else
+    {
+        encoder_options_default(&apng->options);
+    }
+    apng->threads = threads > WORKERS_MAX_THREADS ?
+        WORKERS_MAX_THREADS : threads;
+    apng->max_pixels = kDefaultMaxPixels;
+
+    /* One batch of frames, and the frame before it awaiting its dispose. */
+    apng->slot_count = (apng->threads > 1 ? apng->threads : 1) + 1;
+    apng->slots = (apng_encoder_slot_t *)engine_allocate(
+        sizeof(apng_encoder_slot_t) * apng->slot_count);
+    if (!apng->slots)
+    {
+        apng->slot_count = 0;
+        return STATUS_OUT_OF_MEMORY;
+    }
+    memset(apng->slots, 0, sizeof(apng_encoder_slot_t) * apng->slot_count);
+
+    status = STATUS_OK;
+    for (i = 0; i < apng->slot_count && status == STATUS_OK; i++)
+    {
+        status = encoder_init(&apng->options, &apng->slots[i].encoder);
+    }
+    if (status == STATUS_OK)
+    {
+        apng->fdat = (uint8_t *)engine_allocate(
+            (size_t)apng->options.idat_size + FDAT_SEQUENCE_SIZE);
+        if (!apng->fdat)
+        {
+            status = STATUS_OUT_OF_MEMORY;
+        }
+    }
+    if (status != STATUS_OK)
+    {
+        apng_encoder_free(apng);
+    }
+    return status;
+}
+
+/*
+ * Chooses the region, blend operation and the dispose operation of the
+ * previous frame for frame `index`, then copies the region into the
+ * slot of the frame.  On return the canvas holds the output under the
+ * frame.
+ */
+static status_t apng_plan_frame(
+    apng_encoder_t *apng, uint32_t width, uint32_t height,
+    apng_source_frame_t const *frames, uint32_t index)
+{
+    apng_canvas_t canvases[3], under;
+    apng_diff_t diff, best_diff;
+    apng_encoder_slot_t *slot, *prior;
+    fctl_t *fctl;
+    uint64_t cost, best_cost;
+    uint32_t dispose_op, best_dispose, blend_op, best_blend, x, y, pixel;
+    uint8_t const *src;
+    uint8_t *dst;
+
+    slot = &apng->slots[index % apng->slot_count];
+    fctl = &slot->fctl;
+    memset(fctl, 0, sizeof(fctl_t));
+    fctl->delay_num = frames[index].delay_num;
+    fctl->delay_den = frames[index].delay_den;
+    fctl->dispose_op = FCTL_DISPOSE_NONE;
+    fctl->blend_op = FCTL_BLEND_SOURCE;
+
+    if (index == 0)
+    {
+        /* The default image covers the whole animation. */
+        memset(apng->canvas, 0, (size_t)width * height * kPixelBytes);
+        memset(&best_diff, 0, sizeof(best_diff));
+        best_diff.x_end = width;
+        best_diff.y_end = height;
+        best_blend = FCTL_BLEND_SOURCE;
+    }
+    else
+    {
+        prior = &apng->slots[(index - 1) % apng->slot_count];
+        canvases[FCTL_DISPOSE_NONE].base = frames[index - 1].pixels;
+        canvases[FCTL_DISPOSE_NONE].clear = NULL;
+        canvases[FCTL_DISPOSE_BACKGROUND].base = frames[index - 1].pixels;
+        canvases[FCTL_DISPOSE_BACKGROUND].clear = &prior->fctl;
+        canvases[FCTL_DISPOSE_PREVIOUS].base = apng->canvas;
+        canvases[FCTL_DISPOSE_PREVIOUS].clear = NULL;
+
+        best_cost = UINT64_MAX;
+        best_dispose = FCTL_DISPOSE_NONE;
+        best_blend = FCTL_BLEND_SOURCE;
+        memset(&best_diff, 0, sizeof(best_diff));
+        for (dispose_op = FCTL_DISPOSE_NONE;
+             dispose_op <= FCTL_DISPOSE_PREVIOUS;
+             dispose_op++)
+        {
+            if (dispose_op == FCTL_DISPOSE_PREVIOUS && index == 1)
+            {
+                /* Same as disposing the first frame to the background. */
+                break;
+            }
+            apng_diff(&canvases[dispose_op], frames[index].pixels,
+                      width, height, &diff);
+            for (blend_op = FCTL_BLEND_SOURCE;
+                 blend_op <= FCTL_BLEND_OVER;
+                 blend_op++)
+            {
+                if (blend_op == FCTL_BLEND_OVER && !diff.over)
+                {
+                    continue;
+                }
+                cost = apng_cost(&diff, (uint8_t)blend_op);
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_dispose = dispose_op;
+                    best_blend = blend_op;
+                    best_diff = diff;
+                }
+            }
+        }
+
+        prior->fctl.dispose_op = (uint8_t)best_dispose;
+        if (best_dispose != FCTL_DISPOSE_PREVIOUS)
+        {
+            memcpy(apng->canvas, frames[index - 1].pixels,
+                   (size_t)width * height * kPixelBytes);
+        }
+        if (best_dispose == FCTL_DISPOSE_BACKGROUND)
+        {
+            for (y = 0; y < prior->fctl.height; y++)
+            {
+                memset(apng->canvas +
+                       ((size_t)(prior->fctl.y_offset + y) * width +
+                        prior->fctl.x_offset) * kPixelBytes,
+                       0, (size_t)prior->fctl.width * kPixelBytes);
+            }
+        }
+
+        if (best_diff.x_end == 0)
+        {
+            /* Nothing changed, draw a single transparent pixel. */
+            best_diff.x = 0;
+            best_diff.y = 0;
+            best_diff.x_end = 1;
+            best_diff.y_end = 1;
+            best_blend = FCTL_BLEND_OVER;
+        }
+    }
+
+    fctl->x_offset = best_diff.x;
+    fctl->y_offset = best_diff.y;
+    fctl->width = best_diff.x_end - best_diff.x;
+    fctl->height = best_diff.y_end - best_diff.y;
+    fctl->blend_op = (uint8_t)best_blend;
+
+    slot->source.format = SOURCE_FORMAT_RGBA8;
+    if (fctl->blend_op == FCTL_BLEND_SOURCE)
+    {
+        /* The region is encoded from the frame itself. */
+        slot->source.pixels = frames[index].pixels +
+            ((size_t)fctl->y_offset * width + fctl->x_offset) * kPixelBytes;
+        slot->source.stride = (size_t)width * kPixelBytes;
+        return STATUS_OK;
+    }
+
+    dst = apng_reserve(
+        &slot->pixels, &slot->pixels_size,
+        (size_t)fctl->width * fctl->height * kPixelBytes);
+    if (!dst)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    slot->source.pixels = slot->pixels;
+    slot->source.stride = 0;
+
+    under.base = apng->canvas;
+    under.clear = NULL;
+    for (y = fctl->y_offset; y < fctl->y_offset + fctl->height; y++)
+    {
+        src = frames[index].pixels +
+            ((size_t)y * width + fctl->x_offset) * kPixelBytes;
+        for (x = fctl->x_offset; x < fctl->x_offset + fctl->width; x++)
+        {
+            memcpy(&pixel, src, kPixelBytes);
+            if (pixel == canvas_pixel(&under, width, x, y))
+            {
+                pixel = 0;
+            }
+            memcpy(dst, &pixel, kPixelBytes);
+            src += kPixelBytes;
+            dst += kPixelBytes;
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Appends compressed data to the slot of a frame. */
+static status_t apng_data_sink(
+    void *context, uint8_t const *data, size_t length)
+{
+    apng_encoder_slot_t *slot;
+    uint8_t *grown;
+    size_t capacity;
+
+    slot = (apng_encoder_slot_t *)context;
+    if (slot->data_capacity - slot->data_length < length)
+    {
+        capacity = slot->data_capacity * 2;
+        if (capacity < slot->data_length + length)
+        {
+            capacity = slot->data_length + length;
+        }
+        grown = (uint8_t *)engine_allocate_large(capacity);
+        if (!grown)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        if (slot->data_length > 0)
+        {
+            memcpy(grown, slot->data, slot->data_length);
+        }
+        free(slot->data);
+        slot->data = grown;
+        slot->data_capacity = capacity;
+    }
+    memcpy(slot->data + slot->data_length, data, length);
+    slot->data_length += length;
+    return STATUS_OK;
+}
+
+/* Compresses the region of one frame of a batch. */
+static void apng_compress_task(void *context, uint32_t index)
+{
+    apng_batch_t *batch;
+    apng_encoder_slot_t *slot;
+    ihdr_t ihdr;
+
+    batch = (apng_batch_t *)context;
+    slot = &batch->apng->slots[(batch->first + index) %
+                               batch->apng->slot_count];
+
+    memset(&ihdr, 0, sizeof(ihdr_t));
+    ihdr.width = slot->fctl.width;
+    ihdr.height = slot->fctl.height;
+    ihdr.bit_depth = 8;
+    ihdr.color_type = color_type_to_code(COLOR_TYPE_REALCOLOR_ALPHA);
+
+    slot->data_length = 0;
+    slot->status = encoder_compress_source(
+        &slot->encoder, &ihdr, &slot->source, apng_data_sink, slot);
+}
+
+/* Writes the fcTL chunk and image data of a compressed frame. */
+static status_t apng_write_frame(
+    apng_encoder_t *apng, uint32_t index, writer_t *writer)
+{
+    apng_encoder_slot_t *slot;
+    uint8_t buffer[kFctlSize];
+    uint32_t length, nvalue;
+    size_t offset, piece;
+    status_t status;
+
+    slot = &apng->slots[index % apng->slot_count];
+    slot->fctl.sequence_number = apng->sequence++;
+    length = sizeof(buffer);
+    status = fctl_serialize(&slot->fctl, buffer, &length);
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, FCTL_TYPE, buffer, length);
+    }
+
+    for (offset = 0;
+         offset < slot->data_length && status == STATUS_OK;
+         offset += piece)
+    {
+        piece = slot->data_length - offset;
+        if (piece > apng->options.idat_size)
+        {
+            piece = apng->options.idat_size;
+        }
+        if (index == 0)
+        {
+            status = writer_write_data(
+                writer, IDAT_TYPE, slot->data + offset, (uint32_t)piece);
+            continue;
+        }
+
+        nvalue = htonl(apng->sequence++);
+        memcpy(apng->fdat, &nvalue, FDAT_SEQUENCE_SIZE);
+        memcpy(apng->fdat + FDAT_SEQUENCE_SIZE, slot->data + offset, piece);
+        status = writer_write_data(
+            writer, FDAT_TYPE, apng->fdat,
+            (uint32_t)(piece + FDAT_SEQUENCE_SIZE));
+    }
+    return status;
+}
+
+/* Writes the chunks preceding the first frame. */
+static status_t apng_write_header(
+    uint32_t width, uint32_t height, uint32_t num_plays, uint32_t frame_count,
+    writer_t *writer)
+{
+    ihdr_t ihdr;
+    actl_t actl;
+    chunk_t chunk;
+    status_t status;
+
+    status = writer_write_signature(writer);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    memset(&ihdr, 0, sizeof(ihdr_t));
+    ihdr.width = width;
+    ihdr.height = height;
+    ihdr.bit_depth = 8;
+    ihdr.color_type = color_type_to_code(COLOR_TYPE_REALCOLOR_ALPHA);
+    status = chunk_new_ihdr(&ihdr, &chunk);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = writer_write_chunk(writer, &chunk);
+    chunk_free(&chunk);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    actl.num_frames = frame_count;
+    actl.num_plays = num_plays;
+    status = chunk_new_actl(&actl, &chunk);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = writer_write_chunk(writer, &chunk);
+    chunk_free(&chunk);
+    return status;
+}
+
+status_t apng_encoder_encode(
+    apng_encoder_t *apng, uint32_t width, uint32_t height, uint32_t num_plays,
+    apng_source_frame_t const *frames, uint32_t frame_count,
+    writer_t *writer)
+{
+    apng_batch_t batch;
+    uint32_t batch_size, i;
+    uint64_t total;
+    status_t status;
+
+    if (!apng || !frames || !writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    total = (uint64_t)width * height * kPixelBytes;
+    if (width == 0 || height == 0 || width > kSigned32Max ||
+        height > kSigned32Max || total > SIZE_MAX ||
+        frame_count == 0 || frame_count > kSigned32Max)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    if (apng->max_pixels > 0 && (uint64_t)width * height > apng->max_pixels)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    for (i = 0; i < frame_count; i++)
+    {
+        if (!frames[i].pixels)
+        {
+            return STATUS_NULL_ARGUMENT;
+        }
+    }
+
+    if (!apng_reserve(&apng->canvas, &apng->canvas_size, (size_t)total))
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    apng->sequence = 0;
+    status = apng_write_header(width, height, num_plays, frame_count, writer);
+
+    batch.apng = apng;
+    for (batch.first = 0;
+         batch.first < frame_count && status == STATUS_OK;
+         batch.first += batch_size)
+    {
+        batch_size = frame_count - batch.first;
+        if (batch_size > apng->slot_count - 1)
+        {
+            batch_size = apng->slot_count - 1;
+        }
+
+        for (i = 0; i < batch_size && status == STATUS_OK; i++)
+        {
+            status = apng_plan_frame(
+                apng, width, height, frames, batch.first + i);
+        }
+        if (status != STATUS_OK)
+        {
+            break;
+        }
+
+        status = workers_run(
+            apng->threads > 1 ? batch_size : 1, batch_size,
+            apng_compress_task, &batch);
+        for (i = 0; i < batch_size && status == STATUS_OK; i++)
+        {
+            status = apng->slots[(batch.first + i) % apng->slot_count].status;
+        }
+
+        /*
+         * Planning a frame decides the dispose operation of the one
+         * before it, so the last frame of a batch is written with the
+         * next batch.
+         */
+        i = batch.first > 0 ? batch.first - 1 : 0;
+        for (; i + 1 < batch.first + batch_size && status == STATUS_OK; i++)
+        {
+            status = apng_write_frame(apng, i, writer);
+        }
+    }
+
+    if (status == STATUS_OK)
+    {
+        status = apng_write_frame(apng, frame_count - 1, writer);
+    }
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, IEND_TYPE, NULL, 0);
+    }
+    return status;
+}
+
+status_t apng_encoder_free(apng_encoder_t *apng)
+{
+    uint32_t i;
+
+    if (!apng)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (i = 0; i < apng->slot_count; i++)
+    {
+        encoder_free(&apng->slots[i].encoder);
+        free(apng->slots[i].pixels);
+        free(apng->slots[i].data);
+    }
+    free(apng->slots);
+    free(apng->canvas);
+    free(apng->fdat);
+    memset(apng, 0, sizeof(apng_encoder_t));
+    return STATUS_OK;
+}
@@ -0,0 +1,120 @@
+/*
+ *  Image-Formats - APNG Encoder
+ *      Writes animated PNG datastreams from full RGBA8 frames.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _APNGENC_H_
+#define _APNGENC_H_
+
+#include "anichunk.h"
+#include "base.h"
+#include "encoder.h"
+#include "writer.h"
+
+typedef struct {
+    /* RGBA8 pixels of the whole animation, width * height * 4 bytes. */
+    uint8_t const *pixels;
+    /* Frame delay of `delay_num` / `delay_den` seconds. */
+    uint16_t delay_num;
+    uint16_t delay_den;
+} apng_source_frame_t;
+
+/* Frame compressed by a worker thread ahead of being written. */
+typedef struct {
+    encoder_t encoder;
+    fctl_t fctl;
+    /*
+     * Pixels of the frame region, in the source frame when it replaces
+     * the region, otherwise in `pixels`.
+     */
+    encoder_source_t source;
+    /* RGBA8 pixels of a blended frame region. */
+    uint8_t *pixels;
+    size_t pixels_size;
+    /* Compressed image data of the frame region. */
+    uint8_t *data;
+    size_t data_length;
+    size_t data_capacity;
+    status_t status;
+} apng_encoder_slot_t;
+
+typedef struct {
+    encoder_options_t options;
+    uint32_t threads;
+    /*
+     * Width times height of an animation, 2^28 by default, 0 for no
+     * limit.  Every buffer of the encoder is bounded by it.
+     */
+    uint64_t max_pixels;
+    /* Ring of frames being compressed, grown on demand. */
+    apng_encoder_slot_t *slots;
+    uint32_t slot_count;
+    /* Output as displayed before the frame being encoded. */
+    uint8_t *canvas;
+    size_t canvas_size;
+    /* Sequence number and data of the fdAT chunk being written. */
+    uint8_t *fdat;
+    uint32_t sequence;
+} apng_encoder_t;
+
+/*
+ * Function: apng_encoder_init
+ *  Initializes a long-lived APNG encoder.
+ * Args:
+ *    options - Options used to compress every frame.  NULL for the
+ *              defaults of `encoder_options_default()`.
+ *    threads - Number of frames compressed at once.  0 or 1 compresses
+ *              on the calling thread only.
+ *    apng - Pointer to an uninitialized APNG encoder.
+ * Return:
+ *    OK if the encoder was initialized.
+ *    NULL_ARG if `apng` is NULL.
+ *    ILLEGAL_ARG if the options are out of range.
+ */
+status_t apng_encoder_init(
+    encoder_options_t const *options, uint32_t threads, apng_encoder_t *apng);
+
+/*
+ * Function: apng_encoder_encode
+ *  Writes an animated 8-bit RGBA PNG datastream.
+ *
+ *  The first frame is stored whole as the default image.  Every later
+ *  frame is compared with the output it is drawn onto under each
+ *  dispose operation of the frame before it, and cropped to the
+ *  bounding rectangle of the changed pixels.  The dispose and blend
+ *  operations giving the smallest estimated frame are kept; with the
+ *  OVER blend operation, unchanged pixels become transparent so that
+ *  they compress to almost nothing.  Frames are then compressed in
+ *  batches on `threads` threads and written in order.  The decoded
+ *  animation matches the source frames exactly.
+ * Args:
+ *    apng - Pointer to an initialized APNG encoder.
+ *    width - Width of the animation.
+ *    height - Height of the animation.
+ *    num_plays - Number of times to loop the animation, 0 loops
+ *                forever.
+ *    frames - Source frames in display order.
+ *    frame_count - Number of frames, at least 1.
+ *    writer - Destination of the datastream.  It is not flushed.
+ * Return:
+ *    OK if the animation was encoded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the size or frame count is out of range.
+ *    LIMIT_EXCEEDED if width times height exceeds `max_pixels`.
+ *    OUT_OF_MEM if the frame buffers could not be allocated.
+ *    Otherwise the status returned by the writer.
+ */
+status_t apng_encoder_encode(
+    apng_encoder_t *apng, uint32_t width, uint32_t height, uint32_t num_plays,
+    apng_source_frame_t const *frames, uint32_t frame_count,
+    writer_t *writer);
+
+/*
+ * Function: apng_encoder_free
+ *  Frees the resources of an initialized APNG encoder and clears it.
+ */
+status_t apng_encoder_free(apng_encoder_t *apng);
+
+#endif /* _APNGENC_H_ */
@@ -30,6 +30,8 @@ char_t const *status_string(status_t status)
             return "INCOMPLETE_PACKET";
         case STATUS_BAD_PACKET:
             return "BAD_PACKET";
+        case STATUS_LIMIT_EXCEEDED:
+            return "LIMIT_EXCEEDED";
     }
     return "UNKNOWN";
 }
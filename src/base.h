@@ -24,7 +24,8 @@ typedef enum {
     STATUS_UNKNOWN_TYPE,
     STATUS_OUT_OF_MEMORY,
     STATUS_INCOMPLETE_PACKET,
-    STATUS_BAD_PACKET
+    STATUS_BAD_PACKET,
+    STATUS_LIMIT_EXCEEDED
 } status_t;
 
 typedef size_t index_t;
@@ -8,6 +8,9 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "engine.h"
 
@@ -20,6 +23,11 @@ static uint32_t const kU32Mask = 0xffffffffu;
 
 static uint32_t const kCrcPolynomial = 0xedb88320u;
 
+/* Datastream signature.  Defined in RFC2083 Section 3.1. */
+static uint8_t const kPngSignature[PNG_SIGNATURE_SIZE] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a
+};
+
 /* The following bit masks are to be used on host-order type fields. */
 static uint32_t const kAncillaryBitMask = 0x20000000u;
 static uint32_t const kPrivateBitMask = 0x00200000u;
@@ -129,16 +137,45 @@ status_t chunk_serialize(chunk_t const *chunk, uint8_t *outbuf, size_t *outlen)
     memcpy(optr, &nvalue, sizeof(uint32_t));
     optr += sizeof(uint32_t);
 
-    memcpy(optr, chunk->data, chunk->length);
-    optr += chunk->length;
+    if (chunk->length > 0)
+    {
+        memcpy(optr, chunk->data, chunk->length);
+        optr += chunk->length;
+    }
 
     nvalue = htonl(crc);
-    memcpy(optr, &crc, sizeof(uint32_t));
+    memcpy(optr, &nvalue, sizeof(uint32_t));
 
     return STATUS_OK;
 }
 
 status_t chunk_deserialize(uint8_t const *inbuf, size_t *inlen, chunk_t *chunk)
+{
+    return chunk_deserialize_checked(inbuf, inlen, CHUNK_CRC_CHECK_ALL, chunk);
+}
+
+/* Determines if the CRC of a chunk is verified under a policy. */
+static bool_t chunk_crc_is_checked(
+    uint32_t type, chunk_crc_policy_t crc_policy)
+{
+    switch (crc_policy)
+    {
+        case CHUNK_CRC_CHECK_NONE:
+            return false;
+        case CHUNK_CRC_CHECK_CRITICAL:
+            return chunk_type_is_critical(type);
+        default:
+            return true;
+    }
+}
+
+/*
+ * Deserializes a chunk, either copying its data to the heap or
+ * pointing it into `inbuf`.
+ */
+static status_t chunk_parse(
+    uint8_t const *inbuf, size_t *inlen, chunk_crc_policy_t crc_policy,
+    bool_t copy, chunk_t *chunk)
 {
     uint32_t nvalue, crc, calc_crc;
     uint8_t const *iptr;
@@ -153,6 +190,12 @@ status_t chunk_deserialize(uint8_t const *inbuf, size_t *inlen, chunk_t *chunk)
         return STATUS_ILLEGAL_ARGUMENT;
     }
 
+    /* The length, type and CRC fields must all be present. */
+    if (*inlen < sizeof(uint32_t) * 3)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+
     /* Length field */
     iptr = inbuf;
     memcpy(&nvalue, iptr, sizeof(uint32_t));
@@ -177,16 +220,28 @@ status_t chunk_deserialize(uint8_t const *inbuf, size_t *inlen, chunk_t *chunk)
     iptr += sizeof(uint32_t);
 
     /* Data */
-    /* Check that the data file is within allocation limit. */
-    chunk->data = (uint8_t *)engine_allocate(chunk->length);
-    if (!chunk->data)
+    if (copy)
+    {
+        /* Check that the data file is within allocation limit. */
+        chunk->data = (uint8_t *)engine_allocate(chunk->length);
+        if (!chunk->data)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        memcpy(chunk->data, iptr, chunk->length);
+    }
+    else
     {
-        return STATUS_OUT_OF_MEMORY;
+        /* Views never write through `data`. */
+        chunk->data = (uint8_t *)iptr;
     }
-    memcpy(chunk->data, iptr, chunk->length);
     iptr += chunk->length;
 
     /* CRC */
+    if (!chunk_crc_is_checked(chunk->type, crc_policy))
+    {
+        return STATUS_OK;
+    }
     memcpy(&nvalue, iptr, sizeof(uint32_t));
     calc_crc = ntohl(nvalue);
     status = chunk_calculate_crc(chunk, &crc);
@@ -203,6 +258,20 @@ status_t chunk_deserialize(uint8_t const *inbuf, size_t *inlen, chunk_t *chunk)
     return STATUS_OK;
 }
 
+status_t chunk_deserialize_checked(
+    uint8_t const *inbuf, size_t *inlen, chunk_crc_policy_t crc_policy,
+    chunk_t *chunk)
+{
+    return chunk_parse(inbuf, inlen, crc_policy, true, chunk);
+}
+
+status_t chunk_view(
+    uint8_t const *inbuf, size_t *inlen, chunk_crc_policy_t crc_policy,
+    chunk_t *chunk)
+{
+    return chunk_parse(inbuf, inlen, crc_policy, false, chunk);
+}
+
 static void crc_table_gen(uint32_t *table)
 {
     uint32_t coef, idx, it;
@@ -211,7 +280,7 @@ static void crc_table_gen(uint32_t *table)
         coef = idx;
         for (it = 0; it < 8; it++)
         {
-            if (it & 1) coef = kCrcPolynomial ^ (coef >> 1);
+            if (coef & 1) coef = kCrcPolynomial ^ (coef >> 1);
             else coef >>= 1;
         }
         table[idx] = coef;
@@ -251,11 +320,12 @@ status_t chunk_calculate_crc(chunk_t const *chunk, uint32_t *crc_out)
         return STATUS_ILLEGAL_ARGUMENT;
     }
 
+    /* The CRC covers the type field followed by the data field. */
     crc = kU32Mask;
-    crc = crc_update(crc, chunk->data, chunk->length);
     nvalue = htonl(chunk->type);
     crc = crc_update(crc, &nvalue, sizeof(nvalue));
-    *crc_out = crc;
+    crc = crc_update(crc, chunk->data, chunk->length);
+    *crc_out = crc ^ kU32Mask;
 
     return STATUS_OK;
 }
@@ -277,11 +347,6 @@ status_t chunk_free(chunk_t *chunk)
         return STATUS_NULL_ARGUMENT;
     }
 
-    if (chunk->length > 0 && chunk->data)
-    {
-        memset(chunk->data, 0, chunk->length);
-    }
-
     if (chunk->data)
     {
         free(chunk->data);
@@ -330,20 +395,129 @@ bool_t chunk_type_to_string(uint32_t type, char_t *out, size_t outlen)
     return true;
 }
 
+bool_t png_signature_is_valid(uint8_t const *inbuf, size_t inlen)
+{
+    return (inbuf && inlen >= PNG_SIGNATURE_SIZE &&
+            memcmp(inbuf, kPngSignature, PNG_SIGNATURE_SIZE) == 0);
+}
+
+status_t png_signature_serialize(uint8_t *outbuf, size_t *outlen)
+{
+    if (!outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (*outlen < PNG_SIGNATURE_SIZE)
+    {
+        *outlen = PNG_SIGNATURE_SIZE;
+        return STATUS_FAILURE;
+    }
+    *outlen = PNG_SIGNATURE_SIZE;
+
+    memcpy(outbuf, kPngSignature, PNG_SIGNATURE_SIZE);
+    return STATUS_OK;
+}
+
 bool_t chunk_type_is_valid(uint32_t type)
 {
     uint32_t i;
-    uint8_t *ptr;
+    uint8_t letter;
     /* Check that all type characters are ASCII A-Z or a-z (isalpha()) */
-    ptr = (uint8_t *) &type;
     for (i = 0; i < kChunkTypeSize; i++)
     {
-        if (!(65 <= *ptr && *ptr <= 90) && !(97 <= *ptr && *ptr <= 122))
+        /* Setting bit 5 lowers case, so one range covers both. */
+        letter = (uint8_t)(type >> (i * 8)) | 0x20;
+        if (letter < 'a' || letter > 'z')
+        {
             return false;
+        }
     }
     return true;
 }
 
+/* Adds the classes of a single type as bit `bit` of the masks. */
+static void classify_type(
+    uint32_t type, uint32_t bit, chunk_type_masks_t *masks)
+{
+    uint64_t flag;
+
+    flag = (uint64_t)1 << bit;
+    masks->is_valid |= chunk_type_is_valid(type) ? flag : 0;
+    masks->is_critical |= chunk_type_is_critical(type) ? flag : 0;
+    masks->is_private |= chunk_type_is_private(type) ? flag : 0;
+    masks->is_reserved |= chunk_type_is_reserved(type) ? flag : 0;
+    masks->is_safe_to_copy |= chunk_type_is_safe_to_copy(type) ? flag : 0;
+}
+
+#ifdef __SSE2__
+/*
+ * Classifies four types at once, one per 32-bit lane.  The property
+ * bits are bit 5 of each letter, shifted to the top of the lane so
+ * that the sign mask gathers them.
+ */
+static void classify_four(
+    uint32_t const *types, uint32_t bit, chunk_type_masks_t *masks)
+{
+    __m128i lanes, letters, valid;
+    uint64_t ancillary;
+
+    lanes = _mm_loadu_si128((__m128i const *)types);
+
+    /* Letters lowered to a-z map to the 26 smallest signed bytes. */
+    letters = _mm_add_epi8(
+        _mm_or_si128(lanes, _mm_set1_epi8(0x20)),
+        _mm_set1_epi8((char)(0x80 - 'a')));
+    valid = _mm_cmplt_epi8(letters, _mm_set1_epi8((char)(0x80 + 26)));
+    valid = _mm_cmpeq_epi32(valid, _mm_set1_epi32(-1));
+
+    masks->is_valid |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(valid))
+        << bit;
+    ancillary = (uint64_t)_mm_movemask_ps(
+        _mm_castsi128_ps(_mm_slli_epi32(lanes, 2)));
+    masks->is_critical |= (~ancillary & 0xf) << bit;
+    masks->is_private |= (uint64_t)_mm_movemask_ps(
+        _mm_castsi128_ps(_mm_slli_epi32(lanes, 10))) << bit;
+    masks->is_reserved |= (uint64_t)_mm_movemask_ps(
+        _mm_castsi128_ps(_mm_slli_epi32(lanes, 18))) << bit;
+    masks->is_safe_to_copy |= (uint64_t)_mm_movemask_ps(
+        _mm_castsi128_ps(_mm_slli_epi32(lanes, 26))) << bit;
+}
+#endif
+
+status_t chunk_type_classify(
+    uint32_t const *types, size_t count, chunk_type_masks_t *masks)
+{
+    size_t index, word;
+    uint32_t bit;
+
+    if ((!types && count > 0) || !masks)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (word = 0; word * CHUNK_TYPE_MASK_BITS < count; word++)
+    {
+        memset(&masks[word], 0, sizeof(chunk_type_masks_t));
+    }
+
+    index = 0;
+#ifdef __SSE2__
+    for (; index + 4 <= count; index += 4)
+    {
+        classify_four(
+            types + index, (uint32_t)(index % CHUNK_TYPE_MASK_BITS),
+            &masks[index / CHUNK_TYPE_MASK_BITS]);
+    }
+#endif
+    for (; index < count; index++)
+    {
+        bit = (uint32_t)(index % CHUNK_TYPE_MASK_BITS);
+        classify_type(types[index], bit, &masks[index / CHUNK_TYPE_MASK_BITS]);
+    }
+    return STATUS_OK;
+}
+
 bool_t chunk_type_is_critical(uint32_t type)
 {
     return (type & kAncillaryBitMask) == 0;
@@ -8,6 +8,33 @@
 #define _CHUNK_H_
 
 #include "base.h"
+#include "engine.h"
+
+/* Size of the PNG datastream signature in bytes. */
+#define PNG_SIGNATURE_SIZE 8
+
+/* Chunks whose CRC is verified during deserialization. */
+typedef enum {
+    CHUNK_CRC_CHECK_ALL,
+    CHUNK_CRC_CHECK_CRITICAL,
+    CHUNK_CRC_CHECK_NONE
+} chunk_crc_policy_t;
+
+/* Whether chunk data is wiped before its memory is released. */
+typedef enum {
+    CHUNK_WIPE_NONE,
+    CHUNK_WIPE_ALL
+} chunk_wipe_policy_t;
+
+/*
+ * Memory context of buffers that are allocated and released often,
+ * such as decoder scratch buffers.  Released buffers go back to `pool`
+ * when it is not NULL.
+ */
+typedef struct {
+    chunk_wipe_policy_t wipe_policy;
+    engine_pool_t *pool;
+} chunk_memory_t;
 
 typedef struct {
     /* Length of `data` only. */
@@ -84,6 +111,28 @@ status_t chunk_serialize(
 status_t chunk_deserialize(
     uint8_t const *inbuf, size_t *inlen, chunk_t *chunk);
 
+/*
+ * Function: chunk_deserialize_checked
+ *  Same as `chunk_deserialize()`, but only verifies the CRC of the
+ *  chunks selected by `crc_policy`.  Skipping verification is meant
+ *  for trusted datastreams, such as ones protected by an outer
+ *  checksum.
+ */
+status_t chunk_deserialize_checked(
+    uint8_t const *inbuf, size_t *inlen, chunk_crc_policy_t crc_policy,
+    chunk_t *chunk);
+
+/*
+ * Function: chunk_view
+ *  Same as `chunk_deserialize_checked()`, but the chunk data points
+ *  into `inbuf` instead of being copied, so that no memory is
+ *  allocated.  The chunk must be cleared with `chunk_clear()` rather
+ *  than freed.
+ */
+status_t chunk_view(
+    uint8_t const *inbuf, size_t *inlen, chunk_crc_policy_t crc_policy,
+    chunk_t *chunk);
+
 /*
  * Function: chunk_calculate_crc
  *  Calculates the CRC of a PNG chunk using ISO 3309 algorithm.
@@ -110,7 +159,8 @@ status_t chunk_clear(chunk_t *chunk);
 
 /*
  * Function: chunk_free
- *  Frees the resouces of an initialized chunk and clears it.
+ *  Frees the resouces of an initialized chunk and clears it.  The
+ *  data is not wiped.
  * Args:
  *    chunk - Chunk to be cleared.
  * Return:
@@ -132,10 +182,69 @@ status_t chunk_swap(chunk_t *chunk_a, chunk_t *chunk_b);
  */
 bool_t chunk_type_to_string(uint32_t type, char_t *out, size_t outlen);
 
+/*
+ * Function: png_signature_is_valid
+ *  Determines if the provided buffer starts with the 8 byte PNG
+ *  datastream signature.
+ * Args:
+ *    inbuf - Buffer containing the start of a PNG datastream.
+ *    inlen - Length of `inbuf`.
+ * Return:
+ *    `true` if the signature is present.
+ */
+bool_t png_signature_is_valid(uint8_t const *inbuf, size_t inlen);
+
+/*
+ * Function: png_signature_serialize
+ *  Writes the 8 byte PNG datastream signature.
+ * Args:
+ *    outbuf - Destination buffer.
+ *    outlen - As input, it represents the size of `outbuf`.  As
+ *             output, the value is the number of bytes written, or
+ *             needed if the buffer was too small.
+ * Return:
+ *    OK on success.  FAILURE if the buffer was too small.  NULL_ARG
+ *    if any of the input variables are null.
+ */
+status_t png_signature_serialize(uint8_t *outbuf, size_t *outlen);
+
 bool_t chunk_type_is_valid(uint32_t type);
 bool_t chunk_type_is_critical(uint32_t type);
 bool_t chunk_type_is_private(uint32_t type);
 bool_t chunk_type_is_reserved(uint32_t type);
 bool_t chunk_type_is_safe_to_copy(uint32_t type);
 
+/* Number of chunk types covered by one `chunk_type_masks_t`. */
+#define CHUNK_TYPE_MASK_BITS 64
+
+/*
+ * Classes of up to 64 chunk types.  Bit i of every mask is the result
+ * of the matching `chunk_type_is_*()` function for type i.
+ */
+typedef struct {
+    uint64_t is_valid;
+    uint64_t is_critical;
+    uint64_t is_private;
+    uint64_t is_reserved;
+    uint64_t is_safe_to_copy;
+} chunk_type_masks_t;
+
+/*
+ * Function: chunk_type_classify
+ *  Classifies an array of host-order chunk types in one pass, four
+ *  types at a time with SSE2 where it is available.
+ * Args:
+ *    types - Array of chunk types.
+ *    count - Number of types in `types`.
+ *    masks - Array of (count + 63) / 64 masks.  Masks[k] receives the
+ *            classes of types 64k to 64k + 63, with the bits past
+ *            `count` cleared.
+ * Return:
+ *    OK on success.
+ *    NULL_ARG if `masks` is NULL, or `types` is NULL while `count`
+ *      is not 0.
+ */
+status_t chunk_type_classify(
+    uint32_t const *types, size_t count, chunk_type_masks_t *masks);
+
 #endif /* _CHUNK_H_ */
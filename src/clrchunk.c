@@ -95,11 +95,6 @@ status_t palette_free(palette_t *palette)
         return STATUS_NULL_ARGUMENT;
     }
 
-    if (palette->colors && palette->size > 0)
-    {
-        memset(palette->colors, 0, sizeof(rgb_t) * palette->size);
-    }
-
     if (palette->colors)
     {
         free(palette->colors);
@@ -108,6 +103,20 @@ status_t palette_free(palette_t *palette)
     return palette_clear(palette);
 }
 
+status_t palette_release(chunk_memory_t const *memory, palette_t *palette)
+{
+    if (!palette)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (memory && memory->wipe_policy == CHUNK_WIPE_ALL)
+    {
+        engine_wipe(palette->colors, sizeof(rgb_t) * palette->size);
+    }
+    return palette_free(palette);
+}
+
 status_t palette_clear(palette_t *palette)
 {
     if (!palette)
@@ -288,3 +297,282 @@ status_t palette_get_color(
     color->blue = palette_color->blue;
     return STATUS_OK;
 }
+
+/* Expands the packed entries into the RGBX layout. */
+static void palette_table_expand(palette_table_t *table)
+{
+    uint32_t i;
+    uint8_t const *rgb;
+
+    rgb = table->rgb;
+    for (i = 0; i < PALETTE_MAX_ENTRIES; i++, rgb += kPaletteByteAlignment)
+    {
+        table->rgbx[i][0] = rgb[kRedIndex];
+        table->rgbx[i][1] = rgb[kGreenIndex];
+        table->rgbx[i][2] = rgb[kBlueIndex];
+        table->rgbx[i][3] = 0xff;
+    }
+}
+
+status_t palette_table_clear(palette_table_t *table)
+{
+    if (!table)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(table->rgb, 0, sizeof(table->rgb));
+    palette_table_expand(table);
+    table->size = 0;
+    return STATUS_OK;
+}
+
+status_t palette_table_deserialize(
+    uint8_t const *inbuf, uint32_t *inlen, palette_table_t *table)
+{
+    uint32_t length;
+
+    if (!inbuf || !inlen || !table)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    length = *inlen;
+    if (length % kPaletteByteAlignment != 0 ||
+        length > PALETTE_MAX_ENTRIES * kPaletteByteAlignment)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+
+    /* Unused entries stay black for branch-free lookups. */
+    memcpy(table->rgb, inbuf, length);
+    memset(table->rgb + length, 0, sizeof(table->rgb) - length);
+    palette_table_expand(table);
+    table->size = (uint16_t)(length / kPaletteByteAlignment);
+    return STATUS_OK;
+}
+
+status_t palette_table_serialize(
+    palette_table_t const *table, uint8_t *outbuf, uint32_t *outlen)
+{
+    uint32_t length;
+
+    if (!table || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    length = table->size * kPaletteByteAlignment;
+    if (*outlen < length)
+    {
+        *outlen = length;
+        return STATUS_FAILURE;
+    }
+    *outlen = length;
+
+    memcpy(outbuf, table->rgb, length);
+    return STATUS_OK;
+}
+
+status_t palette_table_from_chunk(
+    chunk_t const *chunk, palette_table_t *table)
+{
+    uint32_t length;
+
+    if (!chunk || !table)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->type != kPlteType || chunk->length == 0 ||
+        chunk->length % kPaletteByteAlignment != 0 ||
+        chunk->length > PALETTE_MAX_ENTRIES * kPaletteByteAlignment)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    length = chunk->length;
+    return palette_table_deserialize(chunk->data, &length, table);
+}
+
+status_t palette_table_from_palette(
+    palette_t const *palette, palette_table_t *table)
+{
+    uint32_t i;
+    uint8_t *rgb;
+
+    if (!palette || !table)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!palette_is_valid(palette))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(table->rgb, 0, sizeof(table->rgb));
+    rgb = table->rgb;
+    for (i = 0; i < palette->size; i++, rgb += kPaletteByteAlignment)
+    {
+        rgb[kRedIndex] = palette->colors[i].red;
+        rgb[kGreenIndex] = palette->colors[i].green;
+        rgb[kBlueIndex] = palette->colors[i].blue;
+    }
+    palette_table_expand(table);
+    table->size = palette->size;
+    return STATUS_OK;
+}
+
+status_t chunk_new_palette_table(
+    palette_table_t const *table, chunk_t *chunk)
+{
+    if (!table || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (table->size == 0 || table->size > PALETTE_MAX_ENTRIES)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    return chunk_new(
+        kPlteType, table->rgb, table->size * kPaletteByteAlignment, chunk);
+}
+
+/*
+ * tRNS, gAMA, cHRM and sRGB specific constants.  Defined in RFC2083
+ * Section 4.2 and the sRGB extension.
+ */
+
+static uint32_t const kGrayKeyLength = sizeof(uint16_t);
+static uint32_t const kRgbKeyLength = sizeof(uint16_t) * 3;
+static uint32_t const kGamaLength = sizeof(uint32_t);
+static uint32_t const kChrmLength = sizeof(uint32_t) * 8;
+static uint32_t const kSrgbLength = 1;
+
+static uint16_t read_uint16(uint8_t const *inbuf)
+{
+    uint16_t nvalue;
+    memcpy(&nvalue, inbuf, sizeof(uint16_t));
+    return ntohs(nvalue);
+}
+
+static uint32_t read_uint32(uint8_t const *inbuf)
+{
+    uint32_t nvalue;
+    memcpy(&nvalue, inbuf, sizeof(uint32_t));
+    return ntohl(nvalue);
+}
+
+status_t trns_from_chunk(
+    chunk_t const *chunk, uint8_t color_type, trns_t *trns)
+{
+    if (!chunk || !trns)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->type != TRNS_TYPE || (chunk->length > 0 && !chunk->data))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(trns, 0, sizeof(trns_t));
+    switch (color_type_from_code(color_type))
+    {
+        case COLOR_TYPE_PALETTE:
+            if (chunk->length == 0 || chunk->length > PALETTE_MAX_ENTRIES)
+            {
+                return STATUS_ILLEGAL_ARGUMENT;
+            }
+            memcpy(trns->alpha, chunk->data, chunk->length);
+            trns->alpha_count = (uint16_t)chunk->length;
+            return STATUS_OK;
+        case COLOR_TYPE_GRAYSCALE:
+            if (chunk->length != kGrayKeyLength)
+            {
+                return STATUS_ILLEGAL_ARGUMENT;
+            }
+            trns->gray = read_uint16(chunk->data);
+            return STATUS_OK;
+        case COLOR_TYPE_REALCOLOR:
+            if (chunk->length != kRgbKeyLength)
+            {
+                return STATUS_ILLEGAL_ARGUMENT;
+            }
+            trns->red = read_uint16(chunk->data);
+            trns->green = read_uint16(chunk->data + 2);
+            trns->blue = read_uint16(chunk->data + 4);
+            return STATUS_OK;
+        default:
+            /* Images with an alpha channel must not have a tRNS. */
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+status_t gama_from_chunk(chunk_t const *chunk, uint32_t *gamma)
+{
+    if (!chunk || !gamma)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->type != GAMA_TYPE || chunk->length != kGamaLength ||
+        !chunk->data)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    *gamma = read_uint32(chunk->data);
+    return *gamma != 0 ? STATUS_OK : STATUS_ILLEGAL_ARGUMENT;
+}
+
+status_t chrm_from_chunk(chunk_t const *chunk, chrm_t *chrm)
+{
+    uint8_t const *iptr;
+
+    if (!chunk || !chrm)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->type != CHRM_TYPE || chunk->length != kChrmLength ||
+        !chunk->data)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    iptr = chunk->data;
+    chrm->white_x = read_uint32(iptr);
+    chrm->white_y = read_uint32(iptr + 4);
+    chrm->red_x = read_uint32(iptr + 8);
+    chrm->red_y = read_uint32(iptr + 12);
+    chrm->green_x = read_uint32(iptr + 16);
+    chrm->green_y = read_uint32(iptr + 20);
+    chrm->blue_x = read_uint32(iptr + 24);
+    chrm->blue_y = read_uint32(iptr + 28);
+    if (chrm->white_y == 0 || chrm->red_y == 0 || chrm->green_y == 0 ||
+        chrm->blue_y == 0)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    return STATUS_OK;
+}
+
+status_t srgb_from_chunk(chunk_t const *chunk, uint8_t *intent)
+{
+    if (!chunk || !intent)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->type != SRGB_TYPE || chunk->length != kSrgbLength ||
+        !chunk->data || chunk->data[0] > SRGB_MAX_INTENT)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    *intent = chunk->data[0];
+    return STATUS_OK;
+}
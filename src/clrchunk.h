@@ -4,14 +4,26 @@
  *  Copyright (c) 2018 Alex Dale
  *  See LICENSE for details
  */
-#ifndef _IMGCHUNK_H_
-#define _IMGCHUNK_H_
+#ifndef _CLRCHUNK_H_
+#define _CLRCHUNK_H_
 
 #include "base.h"
 #include "chunk.h"
+#include "imgchunk.h"
 
 /* Numeric value of "PLTE" in ASCII. */
 #define PLTE_TYPE 0x504c5445u
+/* Numeric value of "tRNS" in ASCII. */
+#define TRNS_TYPE 0x74524e53u
+/* Numeric value of "gAMA" in ASCII. */
+#define GAMA_TYPE 0x67414d41u
+/* Numeric value of "cHRM" in ASCII. */
+#define CHRM_TYPE 0x6348524du
+/* Numeric value of "sRGB" in ASCII. */
+#define SRGB_TYPE 0x73524742u
+
+/* gAMA, cHRM and sRGB values are stored times 100000. */
+#define COLOR_FIXED_POINT 100000u
 
 /* This might get moved to a different file. */
 typedef struct {
@@ -28,6 +40,24 @@ typedef struct {
     rgb_t *colors;
 } palette_t;
 
+/* Largest number of entries allowed in a PLTE chunk. */
+#define PALETTE_MAX_ENTRIES 256
+
+/*
+ * Palette with inline storage for every possible entry, kept in two
+ * layouts.  `rgbx` holds each entry as 4 bytes (R, G, B, 0xff), ready
+ * to be used as an RGBA8 lookup table by word sized gathers and
+ * shuffles.  Entries at and above `size` are opaque black so that
+ * out of range indices need no branch.  `rgb` holds the packed 3 byte
+ * serialized form.
+ */
+typedef struct {
+    _Alignas(32) uint8_t rgbx[PALETTE_MAX_ENTRIES][4];
+    uint8_t rgb[PALETTE_MAX_ENTRIES * 3];
+    /* Number of palette entries. */
+    uint16_t size;
+} palette_table_t;
+
 
 /*
  * Function: chunk_is_palette
@@ -82,7 +112,8 @@ status_t palette_create(rgb_t *colors, uint8_t size, palette_t *palette);
 
 /*
  * Function: palette_free
- *  Frees the resouces of an initialized palette and clears it.
+ *  Frees the resouces of an initialized palette and clears it.  The
+ *  colors are not wiped, see `palette_release()`.
  * Args:
  *    palette - Palette to be freed.
  * Return:
@@ -91,6 +122,13 @@ status_t palette_create(rgb_t *colors, uint8_t size, palette_t *palette);
  */
 status_t palette_free(palette_t *palette);
 
+/*
+ * Function: palette_release
+ *  Same as `palette_free()`, but wipes the colors first when the
+ *  memory context wipes every chunk.
+ */
+status_t palette_release(chunk_memory_t const *memory, palette_t *palette);
+
 /*
  * Function: palette_clear
  *  Zeros the provided palette.  Intended to be used on a stack allocated
@@ -182,4 +220,154 @@ status_t palette_get_color(
     palette_t const *palette, uint8_t index, rgb_t *color);
 
 
-#endif /* _IMGCHUNK_H_ */
+/*
+ * Function: palette_table_clear
+ *  Empties a palette table.
+ */
+status_t palette_table_clear(palette_table_t *table);
+
+/*
+ * Function: palette_table_deserialize
+ *  Deserializes a PLTE payload into a palette table.  No memory is
+ *  allocated.
+ * Args:
+ *    inbuf - Buffer containing serialized data.
+ *    inlen - On input, it should point to the length of `inbuf`,
+ *            which must be a whole number of entries.  On output, it
+ *            will contain the number of bytes used.
+ *    table - Pointer to a palette table.
+ * Return:
+ *    OK if the palette was deserialized.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    INCOMPLETE_PACKET if `inlen` is not a valid PLTE length.
+ */
+status_t palette_table_deserialize(
+    uint8_t const *inbuf, uint32_t *inlen, palette_table_t *table);
+
+/*
+ * Function: palette_table_serialize
+ *  Serializes a palette table into its PLTE payload form.
+ * Args:
+ *    table - Pointer to a palette table.
+ *    outbuf - Buffer to serialize data to.
+ *    outlen - On input, it should point to the length of the `outbuf`.
+ *             On output, it will contain the number of bytes used
+ *             if serialization was successful or the number of bytes
+ *             expected if buffer was not large enough.
+ * Return:
+ *    OK if the palette was serialized.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    FAILURE if the data could not fit into the provided buffer.
+ */
+status_t palette_table_serialize(
+    palette_table_t const *table, uint8_t *outbuf, uint32_t *outlen);
+
+/*
+ * Function: palette_table_from_chunk
+ *  Initializes a palette table from a PLTE chunk of up to 256 entries.
+ * Return:
+ *    OK if the palette was deserialized from the chunk.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not a valid PLTE chunk.
+ */
+status_t palette_table_from_chunk(
+    chunk_t const *chunk, palette_table_t *table);
+
+/*
+ * Function: palette_table_from_palette
+ *  Initializes a palette table from the entries of a palette.
+ */
+status_t palette_table_from_palette(
+    palette_t const *palette, palette_table_t *table);
+
+/*
+ * Function: chunk_new_palette_table
+ *  Initializes a chunk struct containing the PLTE form of a palette
+ *  table as its data.
+ * Return:
+ *    OK if the palette was serialized into the chunk.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the palette is empty.
+ *    OUT_OF_MEM if the chunk data could not be allocated.
+ */
+status_t chunk_new_palette_table(
+    palette_table_t const *table, chunk_t *chunk);
+
+/*
+ *  tRNS, gAMA, cHRM and sRGB API.
+ */
+
+typedef struct {
+    /* Alpha of the leading palette entries, the others are opaque. */
+    uint8_t alpha[PALETTE_MAX_ENTRIES];
+    uint16_t alpha_count;
+    /* Samples of the single transparent color of gray and RGB images. */
+    uint16_t gray;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+} trns_t;
+
+/* Chromaticities of the white point and primaries, times 100000. */
+typedef struct {
+    uint32_t white_x;
+    uint32_t white_y;
+    uint32_t red_x;
+    uint32_t red_y;
+    uint32_t green_x;
+    uint32_t green_y;
+    uint32_t blue_x;
+    uint32_t blue_y;
+} chrm_t;
+
+/* Largest sRGB rendering intent, absolute colorimetric. */
+#define SRGB_MAX_INTENT 3
+
+/*
+ * Function: trns_from_chunk
+ *  Reads a tRNS chunk for an image of the given color type.
+ * Args:
+ *    chunk - Pointer to a tRNS chunk.
+ *    color_type - IHDR color type code of the image.
+ *    trns - Pointer to a tRNS struct.
+ * Return:
+ *    OK if the transparency was read.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not a tRNS chunk of a length valid for
+ *      the color type, or the color type has an alpha channel.
+ */
+status_t trns_from_chunk(
+    chunk_t const *chunk, uint8_t color_type, trns_t *trns);
+
+/*
+ * Function: gama_from_chunk
+ *  Reads the image gamma, times 100000, from a gAMA chunk.
+ * Return:
+ *    OK if the gamma was read.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not a gAMA chunk or the gamma is 0.
+ */
+status_t gama_from_chunk(chunk_t const *chunk, uint32_t *gamma);
+
+/*
+ * Function: chrm_from_chunk
+ *  Reads the chromaticities of a cHRM chunk.
+ * Return:
+ *    OK if the chromaticities were read.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not a cHRM chunk or any y is 0.
+ */
+status_t chrm_from_chunk(chunk_t const *chunk, chrm_t *chrm);
+
+/*
+ * Function: srgb_from_chunk
+ *  Reads the rendering intent of an sRGB chunk.
+ * Return:
+ *    OK if the intent was read.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not an sRGB chunk or the intent is
+ *      unknown.
+ */
+status_t srgb_from_chunk(chunk_t const *chunk, uint8_t *intent);
+
+#endif /* _CLRCHUNK_H_ */
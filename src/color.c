@@ -0,0 +1,761 @@
+/*
+ *  Image-Formats - Color Stage
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "engine.h"
+
+#include "color.h"
+
+typedef enum {
+    /* 8-bit samples to 8-bit output. */
+    COLOR_LUT_ENCODE8,
+    /* 16-bit samples, or linear values, to 8-bit output. */
+    COLOR_LUT_ENCODE16,
+    /* 8-bit samples to 16-bit linear values. */
+    COLOR_LUT_LINEAR8,
+    /* 16-bit samples to 16-bit linear values. */
+    COLOR_LUT_LINEAR16
+} color_lut_kind_t;
+
+/* Table raising its normalized index to `exponent` / 100000. */
+typedef struct {
+    color_lut_kind_t kind;
+    uint32_t exponent;
+    void *table;
+} color_lut_t;
+
+/*
+ * Tables shared by every stage of the process.  They are only added,
+ * so that a table handed out stays valid while stages use it.
+ */
+#define COLOR_LUT_CACHE_SLOTS 32
+static color_lut_t lut_cache[COLOR_LUT_CACHE_SLOTS];
+static uint32_t lut_cache_count = 0;
+static pthread_mutex_t lut_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double const kFixedPoint = COLOR_FIXED_POINT;
+/* Image gamma implied by an sRGB chunk. */
+static uint32_t const kSrgbGamma = 45455;
+/* Exponents closer to 1 than this leave samples unchanged (5%). */
+static uint32_t const kGammaThreshold = 5000;
+/* Matrices closer to the identity than this are not applied. */
+static double const kMatrixEpsilon = 0.001;
+/* Larger coefficients only come from nearly collinear primaries. */
+static double const kMatrixMax = 64.0;
+static uint32_t const kMatrixShift = 14;
+static uint16_t const kLinearMax = 0xffff;
+static uint8_t const kTransparent = 0;
+
+/* White point, red, green and blue chromaticities of sRGB. */
+static double const kSrgbChromaticities[8] = {
+    0.3127, 0.3290, 0.64, 0.33, 0.30, 0.60, 0.15, 0.06
+};
+
+status_t color_options_default(color_options_t *options)
+{
+    if (!options)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(options, 0, sizeof(color_options_t));
+    options->transparency = true;
+    return STATUS_OK;
+}
+
+status_t color_info_read(
+    color_info_t *info, uint8_t color_type, chunk_t const *chunk)
+{
+    status_t status;
+
+    if (!info || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    switch (chunk->type)
+    {
+        case TRNS_TYPE:
+            status = trns_from_chunk(chunk, color_type, &info->trns);
+            info->has_trns = status == STATUS_OK;
+            return status;
+        case GAMA_TYPE:
+            return gama_from_chunk(chunk, &info->gamma);
+        case CHRM_TYPE:
+            status = chrm_from_chunk(chunk, &info->chrm);
+            info->has_chrm = status == STATUS_OK;
+            return status;
+        case SRGB_TYPE:
+            status = srgb_from_chunk(chunk, &info->srgb_intent);
+            info->has_srgb = status == STATUS_OK;
+            return status;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+static void *lut_build(color_lut_kind_t kind, uint32_t exponent)
+{
+    uint8_t *encode;
+    uint16_t *linear;
+    size_t entries, i;
+    double e, scale;
+
+    entries = (kind == COLOR_LUT_ENCODE8 || kind == COLOR_LUT_LINEAR8) ?
+        256 : 65536;
+    e = exponent / kFixedPoint;
+    scale = 1.0 / (double)(entries - 1);
+    if (kind == COLOR_LUT_ENCODE8 || kind == COLOR_LUT_ENCODE16)
+    {
+        encode = (uint8_t *)engine_allocate(entries);
+        if (encode)
+        {
+            for (i = 0; i < entries; i++)
+            {
+                encode[i] = (uint8_t)(255.0 * pow(i * scale, e) + 0.5);
+            }
+        }
+        return encode;
+    }
+
+    linear = (uint16_t *)engine_allocate(entries * sizeof(uint16_t));
+    if (linear)
+    {
+        for (i = 0; i < entries; i++)
+        {
+            linear[i] = (uint16_t)(kLinearMax * pow(i * scale, e) + 0.5);
+        }
+    }
+    return linear;
+}
+
+/*
+ * Returns the cached table of a kind and exponent, building it on
+ * first use.  A table built while the cache is full belongs to the
+ * stage.
+ */
+static void const *lut_get(
+    color_stage_t *stage, color_lut_kind_t kind, uint32_t exponent)
+{
+    void *table;
+    uint32_t i;
+
+    pthread_mutex_lock(&lut_cache_lock);
+    for (i = 0; i < lut_cache_count; i++)
+    {
+        if (lut_cache[i].kind == kind && lut_cache[i].exponent == exponent)
+        {
+            table = lut_cache[i].table;
+            pthread_mutex_unlock(&lut_cache_lock);
+            return table;
+        }
+    }
+
+    table = lut_build(kind, exponent);
+    if (table)
+    {
+        if (lut_cache_count < COLOR_LUT_CACHE_SLOTS)
+        {
+            lut_cache[lut_cache_count].kind = kind;
+            lut_cache[lut_cache_count].exponent = exponent;
+            lut_cache[lut_cache_count].table = table;
+            lut_cache_count++;
+        }
+        else
+        {
+            /* A stage looks up at most COLOR_STAGE_TABLES tables. */
+            i = stage->owned[0] ? 1 : 0;
+            stage->owned[i] = table;
+        }
+    }
+    pthread_mutex_unlock(&lut_cache_lock);
+    return table;
+}
+
+/* Exponent times 100000 of 1 / (a * b), with a and b times 100000. */
+static uint32_t inverse_exponent(uint32_t a, uint32_t b)
+{
+    return (uint32_t)(kFixedPoint * kFixedPoint * kFixedPoint /
+                      ((double)a * (double)b) + 0.5);
+}
+
+static bool_t invert3(double const *m, double *out)
+{
+    double det;
+
+    det = m[0] * (m[4] * m[8] - m[5] * m[7]) -
+        m[1] * (m[3] * m[8] - m[5] * m[6]) +
+        m[2] * (m[3] * m[7] - m[4] * m[6]);
+    if (fabs(det) < 1e-12)
+    {
+        return false;
+    }
+    out[0] = (m[4] * m[8] - m[5] * m[7]) / det;
+    out[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+    out[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+    out[3] = (m[5] * m[6] - m[3] * m[8]) / det;
+    out[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+    out[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+    out[6] = (m[3] * m[7] - m[4] * m[6]) / det;
+    out[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+    out[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+    return true;
+}
+
+static void multiply3(double const *a, double const *b, double *out)
+{
+    uint32_t row, col;
+
+    for (row = 0; row < 3; row++)
+    {
+        for (col = 0; col < 3; col++)
+        {
+            out[row * 3 + col] = a[row * 3] * b[col] +
+                a[row * 3 + 1] * b[3 + col] +
+                a[row * 3 + 2] * b[6 + col];
+        }
+    }
+}
+
+/*
+ * Computes the RGB to XYZ matrix of a white point and primaries, given
+ * as in `kSrgbChromaticities`.
+ */
+static bool_t rgb_to_xyz(double const *xy, double *m)
+{
+    double primaries[9], inverse[9], white[3], scale[3];
+    uint32_t i;
+
+    for (i = 0; i < 3; i++)
+    {
+        primaries[i] = xy[2 + i * 2] / xy[3 + i * 2];
+        primaries[3 + i] = 1.0;
+        primaries[6 + i] =
+            (1.0 - xy[2 + i * 2] - xy[3 + i * 2]) / xy[3 + i * 2];
+    }
+    white[0] = xy[0] / xy[1];
+    white[1] = 1.0;
+    white[2] = (1.0 - xy[0] - xy[1]) / xy[1];
+    if (!invert3(primaries, inverse))
+    {
+        return false;
+    }
+    for (i = 0; i < 3; i++)
+    {
+        scale[i] = inverse[i * 3] * white[0] + inverse[i * 3 + 1] * white[1] +
+            inverse[i * 3 + 2] * white[2];
+    }
+    for (i = 0; i < 9; i++)
+    {
+        m[i] = primaries[i] * scale[i % 3];
+    }
+    return true;
+}
+
+/*
+ * Computes the matrix converting linear RGB of the cHRM primaries to
+ * linear sRGB.
+ * Return:
+ *    `false` if the chromaticities are degenerate or already sRGB.
+ */
+static bool_t chrm_matrix(chrm_t const *chrm, int32_t *matrix)
+{
+    double image[9], srgb[9], inverse[9], combined[9], xy[8];
+    bool_t identity;
+    uint32_t i;
+
+    xy[0] = chrm->white_x / kFixedPoint;
+    xy[1] = chrm->white_y / kFixedPoint;
+    xy[2] = chrm->red_x / kFixedPoint;
+    xy[3] = chrm->red_y / kFixedPoint;
+    xy[4] = chrm->green_x / kFixedPoint;
+    xy[5] = chrm->green_y / kFixedPoint;
+    xy[6] = chrm->blue_x / kFixedPoint;
+    xy[7] = chrm->blue_y / kFixedPoint;
+    if (!rgb_to_xyz(xy, image) || !rgb_to_xyz(kSrgbChromaticities, srgb) ||
+        !invert3(srgb, inverse))
+    {
+        return false;
+    }
+    multiply3(inverse, image, combined);
+
+    identity = true;
+    for (i = 0; i < 9; i++)
+    {
+        if (fabs(combined[i]) > kMatrixMax)
+        {
+            /* Degenerate primaries. */
+            return false;
+        }
+        if (fabs(combined[i] - (i % 4 == 0 ? 1.0 : 0.0)) > kMatrixEpsilon)
+        {
+            identity = false;
+        }
+        matrix[i] = (int32_t)lround(combined[i] * (1 << kMatrixShift));
+    }
+    return !identity;
+}
+
+/* Largest sample of a bit depth up to 8. */
+static uint16_t sample_max(uint8_t bit_depth)
+{
+    return (uint16_t)((1u << bit_depth) - 1);
+}
+
+static void stage_init_key(trns_t const *trns, color_stage_t *stage)
+{
+    uint16_t max;
+    uint32_t i, channels;
+
+    if (stage->color_type == COLOR_TYPE_GRAYSCALE)
+    {
+        stage->key[0] = trns->gray;
+        channels = 1;
+    }
+    else if (stage->color_type == COLOR_TYPE_REALCOLOR)
+    {
+        stage->key[0] = trns->red;
+        stage->key[1] = trns->green;
+        stage->key[2] = trns->blue;
+        channels = 3;
+    }
+    else
+    {
+        return;
+    }
+
+    if (stage->bit_depth < 16)
+    {
+        /* Scale the key like the samples are expanded. */
+        max = sample_max(stage->bit_depth);
+        for (i = 0; i < channels; i++)
+        {
+            if (stage->key[i] > max)
+            {
+                /* No sample can match. */
+                return;
+            }
+            stage->key[i] = (uint16_t)(stage->key[i] * (255 / max));
+        }
+    }
+    stage->has_key = true;
+}
+
+/* Converts the color of a pixel to the sRGB primaries. */
+static void convert_pixel(
+    color_stage_t const *stage, uint32_t r, uint32_t g, uint32_t b,
+    uint8_t *out)
+{
+    int32_t const *m;
+    int64_t value;
+    uint32_t i;
+
+    m = stage->matrix;
+    for (i = 0; i < 3; i++, m += 3)
+    {
+        value = ((int64_t)m[0] * r + (int64_t)m[1] * g + (int64_t)m[2] * b +
+                 (1 << (kMatrixShift - 1))) >> kMatrixShift;
+        if (value < 0)
+        {
+            value = 0;
+        }
+        else if (value > kLinearMax)
+        {
+            value = kLinearMax;
+        }
+        out[i] = stage->from_linear[value];
+    }
+}
+
+/* Applies the transparency and lookups to the palette entries once. */
+static void stage_init_palette(
+    color_stage_t *stage, trns_t const *trns,
+    palette_table_t const *palette)
+{
+    uint8_t *entry;
+    uint32_t i;
+
+    memcpy(&stage->palette, palette, sizeof(palette_table_t));
+    if (trns)
+    {
+        for (i = 0; i < trns->alpha_count; i++)
+        {
+            stage->palette.rgbx[i][3] = trns->alpha[i];
+        }
+    }
+    for (i = 0; i < PALETTE_MAX_ENTRIES; i++)
+    {
+        entry = stage->palette.rgbx[i];
+        if (stage->convert)
+        {
+            convert_pixel(
+                stage, stage->to_linear[entry[0]],
+                stage->to_linear[entry[1]], stage->to_linear[entry[2]],
+                entry);
+        }
+        else if (stage->gamma)
+        {
+            entry[0] = stage->gamma[entry[0]];
+            entry[1] = stage->gamma[entry[1]];
+            entry[2] = stage->gamma[entry[2]];
+        }
+    }
+    if (stage->premultiply)
+    {
+        color_premultiply(
+            stage->palette.rgbx[0], PALETTE_MAX_ENTRIES,
+            stage->palette.rgbx[0]);
+    }
+}
+
+status_t color_stage_init(
+    color_options_t const *options, color_info_t const *info,
+    ihdr_t const *ihdr, palette_table_t const *palette, color_stage_t *stage)
+{
+    uint32_t gamma, exponent;
+    bool_t wide, color;
+
+    if (!options || !info || !ihdr || !stage)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    if (!ihdr_is_valid(ihdr))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(stage, 0, sizeof(color_stage_t));
+    stage->color_type = color_type_from_code(ihdr->color_type);
+    stage->bit_depth = ihdr->bit_depth;
+    if (stage->color_type == COLOR_TYPE_PALETTE && !palette)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (options->transparency && info->has_trns)
+    {
+        stage_init_key(&info->trns, stage);
+    }
+
+    /* sRGB takes precedence over gAMA and cHRM. */
+    gamma = info->has_srgb ? kSrgbGamma : info->gamma;
+    wide = stage->bit_depth == 16;
+    color = ihdr_color_type_is_realcolor(ihdr->color_type);
+
+    if (options->chromaticities && info->has_chrm && !info->has_srgb &&
+        gamma != 0 && color && chrm_matrix(&info->chrm, stage->matrix))
+    {
+        exponent = inverse_exponent(gamma, COLOR_FIXED_POINT);
+        stage->to_linear = (uint16_t const *)lut_get(
+            stage, wide ? COLOR_LUT_LINEAR16 : COLOR_LUT_LINEAR8, exponent);
+        exponent = options->display_gamma != 0 ?
+            inverse_exponent(options->display_gamma, COLOR_FIXED_POINT) :
+            gamma;
+        stage->from_linear = (uint8_t const *)lut_get(
+            stage, COLOR_LUT_ENCODE16, exponent);
+        if (!stage->to_linear || !stage->from_linear)
+        {
+            color_stage_free(stage);
+            return STATUS_OUT_OF_MEMORY;
+        }
+        stage->convert = true;
+    }
+    else if (gamma != 0 && options->display_gamma != 0)
+    {
+        exponent = inverse_exponent(gamma, options->display_gamma);
+        if (exponent + kGammaThreshold < COLOR_FIXED_POINT ||
+            exponent > COLOR_FIXED_POINT + kGammaThreshold)
+        {
+            stage->gamma = (uint8_t const *)lut_get(
+                stage, wide ? COLOR_LUT_ENCODE16 : COLOR_LUT_ENCODE8,
+                exponent);
+            if (!stage->gamma)
+            {
+                color_stage_free(stage);
+                return STATUS_OUT_OF_MEMORY;
+            }
+        }
+    }
+
+    stage->premultiply = options->premultiply &&
+        (ihdr_color_type_is_alpha_channel(ihdr->color_type) || stage->has_key ||
+         (stage->color_type == COLOR_TYPE_PALETTE &&
+          options->transparency && info->has_trns));
+
+    if (stage->color_type == COLOR_TYPE_PALETTE)
+    {
+        stage_init_palette(
+            stage, options->transparency && info->has_trns ?
+                &info->trns : NULL,
+            palette);
+        return STATUS_OK;
+    }
+
+    stage->active = stage->has_key || stage->gamma || stage->convert ||
+        stage->premultiply;
+    return STATUS_OK;
+}
+
+/* Clears the alpha of 8-bit RGB pixels matching the key. */
+static void apply_rgb_key(
+    color_stage_t const *stage, uint32_t count, uint8_t *rgba)
+{
+    uint32_t i, key, pixel;
+
+    key = (uint32_t)stage->key[0] | ((uint32_t)stage->key[1] << 8) |
+        ((uint32_t)stage->key[2] << 16);
+    i = 0;
+#ifdef __SSE2__
+    {
+        __m128i keys, mask, alpha, pixels, match;
+
+        keys = _mm_set1_epi32((int32_t)key);
+        mask = _mm_set1_epi32(0x00ffffff);
+        alpha = _mm_set1_epi32((int32_t)0xff000000u);
+        for (; i + 4 <= count; i += 4)
+        {
+            pixels = _mm_loadu_si128((__m128i const *)(rgba + i * 4));
+            match = _mm_cmpeq_epi32(_mm_and_si128(pixels, mask), keys);
+            pixels = _mm_andnot_si128(_mm_and_si128(match, alpha), pixels);
+            _mm_storeu_si128((__m128i *)(rgba + i * 4), pixels);
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        pixel = (uint32_t)rgba[i * 4] | ((uint32_t)rgba[i * 4 + 1] << 8) |
+            ((uint32_t)rgba[i * 4 + 2] << 16);
+        if (pixel == key)
+        {
+            rgba[i * 4 + 3] = kTransparent;
+        }
+    }
+}
+
+/* Applies the stage to pixels expanded from samples of up to 8 bits. */
+static void apply_narrow(
+    color_stage_t const *stage, uint32_t count, uint8_t *rgba)
+{
+    uint8_t const *lut;
+    uint8_t *pixel;
+    uint32_t i;
+
+    if (stage->has_key)
+    {
+        if (stage->color_type == COLOR_TYPE_REALCOLOR)
+        {
+            apply_rgb_key(stage, count, rgba);
+        }
+        else
+        {
+            for (i = 0, pixel = rgba; i < count; i++, pixel += 4)
+            {
+                if (pixel[0] == stage->key[0])
+                {
+                    pixel[3] = kTransparent;
+                }
+            }
+        }
+    }
+
+    if (stage->convert)
+    {
+        for (i = 0, pixel = rgba; i < count; i++, pixel += 4)
+        {
+            convert_pixel(
+                stage, stage->to_linear[pixel[0]],
+                stage->to_linear[pixel[1]], stage->to_linear[pixel[2]],
+                pixel);
+        }
+    }
+    else if (stage->gamma)
+    {
+        lut = stage->gamma;
+        for (i = 0, pixel = rgba; i < count; i++, pixel += 4)
+        {
+            pixel[0] = lut[pixel[0]];
+            pixel[1] = lut[pixel[1]];
+            pixel[2] = lut[pixel[2]];
+        }
+    }
+}
+
+static uint16_t read_sample(uint8_t const *row)
+{
+    return (uint16_t)((row[0] << 8) | row[1]);
+}
+
+/*
+ * Applies the stage to pixels expanded from 16-bit samples, reading
+ * the full samples from the serialized scanline.
+ */
+static void apply_wide(
+    color_stage_t const *stage, uint8_t const *row, uint32_t count,
+    uint8_t *rgba)
+{
+    uint32_t i, stride;
+    uint16_t r, g, b;
+    bool_t gray;
+
+    gray = !ihdr_color_type_is_realcolor(
+        color_type_to_code(stage->color_type));
+    switch (stage->color_type)
+    {
+        case COLOR_TYPE_GRAYSCALE:
+            stride = 2;
+            break;
+        case COLOR_TYPE_GRAYSCALE_ALPHA:
+            stride = 4;
+            break;
+        case COLOR_TYPE_REALCOLOR:
+            stride = 6;
+            break;
+        default:
+            stride = 8;
+            break;
+    }
+
+    for (i = 0; i < count; i++, row += stride, rgba += 4)
+    {
+        r = read_sample(row);
+        g = gray ? r : read_sample(row + 2);
+        b = gray ? r : read_sample(row + 4);
+        if (stage->has_key && r == stage->key[0] &&
+            (gray || (g == stage->key[1] && b == stage->key[2])))
+        {
+            rgba[3] = kTransparent;
+        }
+        if (stage->convert)
+        {
+            convert_pixel(
+                stage, stage->to_linear[r], stage->to_linear[g],
+                stage->to_linear[b], rgba);
+        }
+        else if (stage->gamma)
+        {
+            rgba[0] = stage->gamma[r];
+            rgba[1] = stage->gamma[g];
+            rgba[2] = stage->gamma[b];
+        }
+    }
+}
+
+status_t color_stage_apply(
+    color_stage_t const *stage, uint8_t const *row, uint32_t count,
+    uint8_t *rgba)
+{
+    if (!stage || !row || !rgba)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!stage->active)
+    {
+        return STATUS_OK;
+    }
+    if (stage->bit_depth == 16)
+    {
+        apply_wide(stage, row, count, rgba);
+    }
+    else
+    {
+        apply_narrow(stage, count, rgba);
+    }
+    if (stage->premultiply)
+    {
+        color_premultiply(rgba, count, rgba);
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Divides a product of two 8-bit values by 255, rounded to nearest.
+ * Exact for every product up to 255 * 255.
+ */
+static uint8_t div255(uint32_t product)
+{
+    product += 0x80;
+    return (uint8_t)((product + (product >> 8)) >> 8);
+}
+
+#ifdef __SSE2__
+/* Premultiplies the two pixels held in the 16-bit lanes of `pixels`. */
+static __m128i premultiply_sse2(__m128i pixels, __m128i opaque)
+{
+    __m128i alpha, product;
+
+    /* Alpha in every lane, and 255 in the alpha lane itself. */
+    alpha = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_or_si128(alpha, opaque);
+    product = _mm_add_epi16(
+        _mm_mullo_epi16(pixels, alpha), _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(
+        _mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+}
+#endif
+
+status_t color_premultiply(uint8_t const *rgba, uint32_t count, uint8_t *out)
+{
+    uint32_t i;
+    uint8_t alpha;
+
+    if (!rgba || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    i = 0;
+#ifdef __SSE2__
+    {
+        __m128i zero, opaque, pixels, low, high;
+
+        zero = _mm_setzero_si128();
+        opaque = _mm_set_epi16(0xff, 0, 0, 0, 0xff, 0, 0, 0);
+        for (; i + 4 <= count; i += 4)
+        {
+            pixels = _mm_loadu_si128((__m128i const *)(rgba + i * 4));
+            low = premultiply_sse2(_mm_unpacklo_epi8(pixels, zero), opaque);
+            high = premultiply_sse2(_mm_unpackhi_epi8(pixels, zero), opaque);
+            _mm_storeu_si128(
+                (__m128i *)(out + i * 4), _mm_packus_epi16(low, high));
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        alpha = rgba[i * 4 + 3];
+        out[i * 4] = div255((uint32_t)rgba[i * 4] * alpha);
+        out[i * 4 + 1] = div255((uint32_t)rgba[i * 4 + 1] * alpha);
+        out[i * 4 + 2] = div255((uint32_t)rgba[i * 4 + 2] * alpha);
+        out[i * 4 + 3] = alpha;
+    }
+    return STATUS_OK;
+}
+
+status_t color_stage_free(color_stage_t *stage)
+{
+    uint32_t i;
+
+    if (!stage)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (i = 0; i < COLOR_STAGE_TABLES; i++)
+    {
+        free(stage->owned[i]);
+    }
+    memset(stage, 0, sizeof(color_stage_t));
+    return STATUS_OK;
+}
@@ -0,0 +1,163 @@
+/*
+ *  Image-Formats - Color Stage
+ *      Applies tRNS, gAMA, cHRM and sRGB to decoded RGBA8 pixels, and
+ *      premultiplies them by alpha.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _COLOR_H_
+#define _COLOR_H_
+
+#include "base.h"
+#include "chunk.h"
+#include "clrchunk.h"
+#include "imgchunk.h"
+
+/* Lookup tables a stage may hold outside of the shared cache. */
+#define COLOR_STAGE_TABLES 2
+
+typedef struct {
+    /* Turns the tRNS color or palette alphas into alpha. */
+    bool_t transparency;
+    /*
+     * Gamma of the display, times 100000 (220000 for 2.2).  Samples of
+     * images with a gAMA or sRGB chunk are corrected for it.  0 leaves
+     * the samples as encoded.
+     */
+    uint32_t display_gamma;
+    /*
+     * Converts color images with a cHRM chunk, and a gAMA to linearize
+     * them with, to the sRGB primaries.  The white point is not
+     * adapted.
+     */
+    bool_t chromaticities;
+    /*
+     * Multiplies the color samples by alpha, as compositors blending
+     * premultiplied RGBA8 expect.  Applied last, to the output values.
+     */
+    bool_t premultiply;
+} color_options_t;
+
+/* Colorimetry of an image, as read from its ancillary chunks. */
+typedef struct {
+    bool_t has_trns;
+    trns_t trns;
+    /* gAMA times 100000, 0 without one. */
+    uint32_t gamma;
+    bool_t has_chrm;
+    chrm_t chrm;
+    bool_t has_srgb;
+    uint8_t srgb_intent;
+} color_info_t;
+
+/*
+ * Precomputed form of the color options for one image.  The lookup
+ * tables are shared by every stage using the same gamma, across images
+ * and threads, and are never modified.
+ */
+typedef struct {
+    color_type_t color_type;
+    uint8_t bit_depth;
+    /* Whether `color_stage_apply()` changes anything. */
+    bool_t active;
+    /*
+     * Transparent color.  Up to 8 bits it is scaled like the expanded
+     * samples, 16-bit keys are compared with the serialized samples.
+     */
+    bool_t has_key;
+    uint16_t key[3];
+    /* Sample to output, with 2^bit_depth entries, or NULL. */
+    uint8_t const *gamma;
+    /*
+     * Conversion of the primaries: samples are linearized to 16 bits,
+     * multiplied by `matrix` (Q14) and encoded again.
+     */
+    bool_t convert;
+    uint16_t const *to_linear;
+    uint8_t const *from_linear;
+    int32_t matrix[9];
+    /* Set only for images that can have an alpha below 255. */
+    bool_t premultiply;
+    /* Palette with the transparency and lookups already applied. */
+    palette_table_t palette;
+    /* Tables built while the cache was full, freed with the stage. */
+    void *owned[COLOR_STAGE_TABLES];
+} color_stage_t;
+
+/*
+ * Function: color_options_default
+ *  Initializes color options to apply transparency only.
+ */
+status_t color_options_default(color_options_t *options);
+
+/*
+ * Function: color_info_read
+ *  Records a tRNS, gAMA, cHRM or sRGB chunk of an image.
+ * Args:
+ *    info - Pointer to the colorimetry of the image, zeroed before its
+ *           first chunk.
+ *    color_type - IHDR color type code of the image.
+ *    chunk - Chunk to record.
+ * Return:
+ *    OK if the chunk was recorded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is malformed or of another type.  It
+ *      should then be ignored, as any broken ancillary chunk.
+ */
+status_t color_info_read(
+    color_info_t *info, uint8_t color_type, chunk_t const *chunk);
+
+/*
+ * Function: color_stage_init
+ *  Prepares the color stage of an image, taking its lookup tables from
+ *  the process wide cache or computing them on first use.
+ * Args:
+ *    options - Color options.
+ *    info - Colorimetry of the image.
+ *    ihdr - Pointer to a valid IHDR struct.
+ *    palette - Palette of the image.  Can be NULL unless the color type
+ *              is palette.
+ *    stage - Pointer to an uninitialized stage.
+ * Return:
+ *    OK if the stage was initialized.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    ILLEGAL_ARG if the IHDR is not valid.
+ *    OUT_OF_MEM if a lookup table could not be allocated.
+ */
+status_t color_stage_init(
+    color_options_t const *options, color_info_t const *info,
+    ihdr_t const *ihdr, palette_table_t const *palette, color_stage_t *stage);
+
+/*
+ * Function: color_stage_apply
+ *  Applies the stage to pixels expanded to RGBA8.  Palette images are
+ *  handled by expanding them with `stage->palette` instead.
+ * Args:
+ *    stage - Pointer to an initialized stage.
+ *    row - Serialized scanline the pixels were expanded from.
+ *    count - Number of pixels.
+ *    rgba - Expanded pixels, changed in place.
+ */
+status_t color_stage_apply(
+    color_stage_t const *stage, uint8_t const *row, uint32_t count,
+    uint8_t *rgba);
+
+/*
+ * Function: color_premultiply
+ *  Multiplies the color samples of RGBA8 pixels by their alpha, divided
+ *  exactly by 255 with rounding.
+ * Args:
+ *    rgba - Pixels to premultiply.
+ *    count - Number of pixels.
+ *    out - Destination of `count` * 4 bytes.  Can be `rgba`.
+ */
+status_t color_premultiply(uint8_t const *rgba, uint32_t count, uint8_t *out);
+
+/*
+ * Function: color_stage_free
+ *  Frees the tables owned by an initialized stage and clears it.
+ */
+status_t color_stage_free(color_stage_t *stage);
+
+#endif /* _COLOR_H_ */
@@ -0,0 +1,382 @@
+/*
+ *  Image-Formats - Compression Backends
+ *      Adapts system compression libraries to the engine compressor
+ *      interface, and lists the backends that were built.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENGINE_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ENGINE_WITH_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "compress.h"
+#include "deflate.h"
+
+#ifndef ENGINE_DEFAULT_COMPRESSOR
+#define ENGINE_DEFAULT_COMPRESSOR "deflate"
+#endif
+
+#ifdef ENGINE_WITH_ZLIB
+
+static uint32_t const kZlibMaxLevel = 9;
+
+typedef struct {
+    z_stream stream;
+    engine_sink_t sink;
+    void *context;
+    uint8_t *output;
+    size_t output_size;
+} zlib_stream_t;
+
+/* Sinks full output buffers, or everything when finishing. */
+static status_t zlib_run(zlib_stream_t *zlib, int flush)
+{
+    status_t status;
+    int result;
+
+    do
+    {
+        result = deflate(&zlib->stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+            return STATUS_FAILURE;
+        }
+        if (zlib->stream.avail_out == 0 ||
+            (result == Z_STREAM_END && zlib->stream.next_out != zlib->output))
+        {
+            status = zlib->sink(
+                zlib->context, zlib->output,
+                (size_t)(zlib->stream.next_out - zlib->output));
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+            zlib->stream.next_out = zlib->output;
+            zlib->stream.avail_out = (uInt)zlib->output_size;
+        }
+    } while (flush == Z_FINISH ?
+             result != Z_STREAM_END : zlib->stream.avail_in > 0);
+    return STATUS_OK;
+}
+
+static status_t zlib_create(uint32_t level, size_t output_size, void **stream)
+{
+    zlib_stream_t *zlib;
+
+    if (level > kZlibMaxLevel || output_size < 2 || output_size > UINT32_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    zlib = (zlib_stream_t *)engine_allocate(sizeof(zlib_stream_t));
+    if (!zlib)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    memset(zlib, 0, sizeof(zlib_stream_t));
+    /* Bounded by the check above, as IDAT chunks are by the encoder. */
+    zlib->output = (uint8_t *)engine_allocate_large(output_size);
+    if (!zlib->output || deflateInit(&zlib->stream, (int)level) != Z_OK)
+    {
+        free(zlib->output);
+        free(zlib);
+        return STATUS_OUT_OF_MEMORY;
+    }
+    zlib->output_size = output_size;
+    *stream = zlib;
+    return STATUS_OK;
+}
+
+static status_t zlib_reset(void *stream, engine_sink_t sink, void *context)
+{
+    zlib_stream_t *zlib;
+
+    if (!sink)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    zlib = (zlib_stream_t *)stream;
+    if (deflateReset(&zlib->stream) != Z_OK)
+    {
+        return STATUS_FAILURE;
+    }
+    zlib->sink = sink;
+    zlib->context = context;
+    zlib->stream.next_out = zlib->output;
+    zlib->stream.avail_out = (uInt)zlib->output_size;
+    return STATUS_OK;
+}
+
+static status_t zlib_write(void *stream, uint8_t const *data, size_t length)
+{
+    zlib_stream_t *zlib;
+    uInt count;
+    status_t status;
+
+    zlib = (zlib_stream_t *)stream;
+    while (length > 0)
+    {
+        count = length > UINT32_MAX ? UINT32_MAX : (uInt)length;
+        zlib->stream.next_in = (Bytef *)data;
+        zlib->stream.avail_in = count;
+        status = zlib_run(zlib, Z_NO_FLUSH);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        data += count;
+        length -= count;
+    }
+    return STATUS_OK;
+}
+
+static status_t zlib_finish(void *stream)
+{
+    zlib_stream_t *zlib;
+
+    zlib = (zlib_stream_t *)stream;
+    zlib->stream.next_in = NULL;
+    zlib->stream.avail_in = 0;
+    return zlib_run(zlib, Z_FINISH);
+}
+
+static void zlib_destroy(void *stream)
+{
+    zlib_stream_t *zlib;
+
+    zlib = (zlib_stream_t *)stream;
+    deflateEnd(&zlib->stream);
+    free(zlib->output);
+    free(zlib);
+}
+
+engine_compressor_t const kZlibCompressor = {
+    "zlib", kZlibMaxLevel,
+    zlib_create, zlib_reset, zlib_write, zlib_finish, zlib_destroy
+};
+
+#endif /* ENGINE_WITH_ZLIB */
+
+#ifdef ENGINE_WITH_LIBDEFLATE
+
+static uint32_t const kLibdeflateMaxLevel = 12;
+static size_t const kLibdeflateMaxInput = (size_t)1 << 30;
+
+typedef struct {
+    struct libdeflate_compressor *compressor;
+    engine_sink_t sink;
+    void *context;
+    size_t output_size;
+    /* Input of the datastream, compressed at once when finishing. */
+    uint8_t *input;
+    size_t input_length;
+    size_t input_capacity;
+    uint8_t *output;
+    size_t output_capacity;
+} libdeflate_stream_t;
+
+static status_t libdeflate_create(
+    uint32_t level, size_t output_size, void **stream)
+{
+    libdeflate_stream_t *libdeflate;
+
+    if (level > kLibdeflateMaxLevel || output_size < 2)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    libdeflate = (libdeflate_stream_t *)engine_allocate(
+        sizeof(libdeflate_stream_t));
+    if (!libdeflate)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    memset(libdeflate, 0, sizeof(libdeflate_stream_t));
+    libdeflate->compressor = libdeflate_alloc_compressor((int)level);
+    if (!libdeflate->compressor)
+    {
+        free(libdeflate);
+        return STATUS_OUT_OF_MEMORY;
+    }
+    libdeflate->output_size = output_size;
+    *stream = libdeflate;
+    return STATUS_OK;
+}
+
+static status_t libdeflate_reset(
+    void *stream, engine_sink_t sink, void *context)
+{
+    libdeflate_stream_t *libdeflate;
+
+    if (!sink)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    libdeflate = (libdeflate_stream_t *)stream;
+    libdeflate->sink = sink;
+    libdeflate->context = context;
+    libdeflate->input_length = 0;
+    return STATUS_OK;
+}
+
+/*
+ * Grows a buffer to hold at least `size` bytes, keeping `length`.
+ * Sizes are bounded through kLibdeflateMaxInput.
+ */
+static status_t libdeflate_reserve(
+    uint8_t **buffer, size_t *capacity, size_t length, size_t size)
+{
+    uint8_t *grown;
+
+    if (*capacity >= size)
+    {
+        return STATUS_OK;
+    }
+    if (size < *capacity * 2)
+    {
+        size = *capacity * 2;
+    }
+    grown = (uint8_t *)engine_allocate_large(size);
+    if (!grown)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    if (length > 0)
+    {
+        memcpy(grown, *buffer, length);
+    }
+    free(*buffer);
+    *buffer = grown;
+    *capacity = size;
+    return STATUS_OK;
+}
+
+static status_t libdeflate_write(
+    void *stream, uint8_t const *data, size_t length)
+{
+    libdeflate_stream_t *libdeflate;
+    status_t status;
+
+    libdeflate = (libdeflate_stream_t *)stream;
+    if (length > kLibdeflateMaxInput - libdeflate->input_length)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    status = libdeflate_reserve(
+        &libdeflate->input, &libdeflate->input_capacity,
+        libdeflate->input_length, libdeflate->input_length + length);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    memcpy(libdeflate->input + libdeflate->input_length, data, length);
+    libdeflate->input_length += length;
+    return STATUS_OK;
+}
+
+static status_t libdeflate_finish(void *stream)
+{
+    libdeflate_stream_t *libdeflate;
+    size_t bound, length, offset, piece;
+    status_t status;
+
+    libdeflate = (libdeflate_stream_t *)stream;
+    bound = libdeflate_zlib_compress_bound(
+        libdeflate->compressor, libdeflate->input_length);
+    status = libdeflate_reserve(
+        &libdeflate->output, &libdeflate->output_capacity, 0, bound);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    length = libdeflate_zlib_compress(
+        libdeflate->compressor, libdeflate->input, libdeflate->input_length,
+        libdeflate->output, libdeflate->output_capacity);
+    if (length == 0)
+    {
+        return STATUS_FAILURE;
+    }
+
+    for (offset = 0; offset < length; offset += piece)
+    {
+        piece = length - offset;
+        if (piece > libdeflate->output_size)
+        {
+            piece = libdeflate->output_size;
+        }
+        status = libdeflate->sink(
+            libdeflate->context, libdeflate->output + offset, piece);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    libdeflate->input_length = 0;
+    return STATUS_OK;
+}
+
+static void libdeflate_destroy(void *stream)
+{
+    libdeflate_stream_t *libdeflate;
+
+    libdeflate = (libdeflate_stream_t *)stream;
+    libdeflate_free_compressor(libdeflate->compressor);
+    free(libdeflate->input);
+    free(libdeflate->output);
+    free(libdeflate);
+}
+
+engine_compressor_t const kLibdeflateCompressor = {
+    "libdeflate", kLibdeflateMaxLevel,
+    libdeflate_create, libdeflate_reset, libdeflate_write,
+    libdeflate_finish, libdeflate_destroy
+};
+
+#endif /* ENGINE_WITH_LIBDEFLATE */
+
+/* Backends that were built, the bundled one first. */
+static engine_compressor_t const *const kCompressors[] = {
+    &kDeflateCompressor,
+#ifdef ENGINE_WITH_ZLIB
+    &kZlibCompressor,
+#endif
+#ifdef ENGINE_WITH_LIBDEFLATE
+    &kLibdeflateCompressor,
+#endif
+};
+
+engine_compressor_t const *engine_get_compressor(char_t const *name)
+{
+    uint32_t i;
+
+    if (!name)
+    {
+        name = ENGINE_DEFAULT_COMPRESSOR;
+    }
+    for (i = 0; i < sizeof(kCompressors) / sizeof(kCompressors[0]); i++)
+    {
+        if (strcmp(kCompressors[i]->name, name) == 0)
+        {
+            return kCompressors[i];
+        }
+    }
+    return NULL;
+}
+
+engine_compressor_t const *engine_get_compressor_at(uint32_t index)
+{
+    if (index >= sizeof(kCompressors) / sizeof(kCompressors[0]))
+    {
+        return NULL;
+    }
+    return kCompressors[index];
+}
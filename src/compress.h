@@ -0,0 +1,52 @@
+/*
+ *  Image-Formats - Compression Backends
+ *      Adapts system compression libraries to the engine compressor
+ *      interface.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include "base.h"
+#include "engine.h"
+
+#ifdef ENGINE_WITH_ZLIB
+/* Backend named "zlib", streaming through the system zlib. */
+extern engine_compressor_t const kZlibCompressor;
+#endif
+
+#ifdef ENGINE_WITH_LIBDEFLATE
+/*
+ * Backend named "libdeflate".  The library only compresses whole
+ * buffers, so input is held until the datastream is finished; writing
+ * more than 1 GiB to one datastream fails with LIMIT_EXCEEDED.  Levels
+ * go up to 12, above those of the other backends.
+ */
+extern engine_compressor_t const kLibdeflateCompressor;
+#endif
+
+/* Largest number of backends a build can have. */
+#define ENGINE_MAX_COMPRESSORS 3
+
+/*
+ * Function: engine_get_compressor
+ *  Finds a compression backend by name: "deflate" for the bundled one,
+ *  and "zlib" or "libdeflate" when built with them.
+ * Args:
+ *    name - Name of the backend.  NULL for the default backend, chosen
+ *           when building with ENGINE_DEFAULT_COMPRESSOR.
+ * Return:
+ *    The backend, or NULL if it was not built.
+ */
+engine_compressor_t const *engine_get_compressor(char_t const *name);
+
+/*
+ * Function: engine_get_compressor_at
+ *  Returns the `index`th backend that was built, or NULL past the
+ *  last one.  The bundled backend is always first.
+ */
+engine_compressor_t const *engine_get_compressor_at(uint32_t index);
+
+#endif /* _COMPRESS_H_ */
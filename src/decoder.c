@@ -0,0 +1,2096 @@
+/*
+ *  Image-Formats - PNG Decoder
+ *      Streams the image data of a PNG datastream scanline by scanline.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "filter.h"
+#include "pixconv.h"
+#include "workers.h"
+
+#include "decoder.h"
+
+/* Length + Type + CRC fields surrounding the chunk data. */
+static size_t const kChunkOverhead = sizeof(uint32_t) * 3;
+
+static uint64_t const kDefaultMaxPixels = (uint64_t)1 << 28;
+static uint64_t const kDefaultMaxTextBytes = 1024 * 1024;
+/* First allocation for decompressed text, doubled as needed. */
+static size_t const kTextBlockSize = 4096;
+/* Inflated bytes allowed before the inflate ratio is checked. */
+static uint64_t const kInflateRatioSlack = 1024 * 1024;
+/* Inflated bytes between two checks of the CPU time. */
+static uint64_t const kCpuCheckBytes = 256 * 1024;
+
+/*
+ * Type: row_handler_t
+ *  Receives each unfiltered scanline of the image in datastream order.
+ *  `y` is the image row the scanline belongs to.
+ */
+typedef status_t (*row_handler_t)(
+    void *context, ihdr_pass_t const *pass, uint32_t y, uint8_t const *row);
+
+typedef struct {
+    region_t region;
+    uint32_t pixel_bits;
+    size_t row_size;
+    uint8_t *outbuf;
+} region_context_t;
+
+typedef struct {
+    pixconv_t conv;
+    uint32_t image_width;
+    uint32_t image_height;
+    uint32_t width;
+    uint32_t height;
+    /* Expanded RGBA8 scanline. */
+    uint8_t *scanline;
+    /* Thumbnail column of every image column. */
+    uint32_t *column_map;
+    /* Number of image columns averaged into every thumbnail column. */
+    uint32_t *column_count;
+    /*
+     * Channel sums of one thumbnail row, or of a band of rows starting
+     * at `first_row` if interlaced.
+     */
+    uint64_t *sums;
+    uint32_t first_row;
+    uint32_t sum_rows;
+    /* Thumbnail row accumulated in `sums` when it holds a single row. */
+    uint32_t current_row;
+    uint8_t *outbuf;
+} thumbnail_context_t;
+
+static uint32_t const kNoRow = 0xffffffffu;
+
+/* Planes of a YUV420 image. */
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint8_t *luma;
+    uint8_t *cb;
+    uint8_t *cr;
+} yuv_planes_t;
+
+typedef struct {
+    pixconv_t conv;
+    pixel_format_t format;
+    uint32_t width;
+    uint32_t height;
+    /* Bytes per pixel, of the Y plane for YUV420. */
+    uint32_t pixel_bytes;
+    /* Scanline of a reduced image, or RGBA8 scanline for YUV420. */
+    uint8_t *scanline;
+    uint8_t *outbuf;
+    yuv_planes_t planes;
+    /*
+     * Chroma sums of one chroma row, or of `sum_rows` chroma rows from
+     * `first_row` if interlaced.
+     */
+    uint16_t *sums;
+    uint32_t first_row;
+    uint32_t sum_rows;
+    bool_t interlaced;
+} pixels_context_t;
+
+/* Target size of a band of filtered scanlines. */
+static size_t const kBandBytes = 256 * 1024;
+static uint32_t const kNoBand = 0xffffffffu;
+/* Alignment of the parts of a shared scratch buffer. */
+static size_t const kBufferAlignment = 64;
+
+typedef struct {
+    pixconv_t conv;
+    pixel_format_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_bytes;
+    /* Bytes per pixel of the output, if packed. */
+    uint32_t out_bytes;
+    yuv_planes_t planes;
+    /* RGBA8 row and chroma sums of each worker, for YUV420. */
+    uint8_t *scratch;
+    size_t scratch_size;
+    size_t row_size;
+    uint32_t band_rows;
+    uint32_t band_count;
+    /* Ring of bands, each with `band_rows` filtered scanlines. */
+    uint32_t slot_count;
+    uint8_t **slots;
+    /* Band held by each slot, or kNoBand if the slot is free. */
+    uint32_t *slot_band;
+    /* Last unfiltered scanline of the most recently unfiltered band. */
+    uint8_t *carry;
+    /* Next band to be claimed by a worker. */
+    uint32_t next_band;
+    /* Number of leading bands that have been unfiltered. */
+    uint32_t unfiltered;
+    bool_t abort;
+    status_t status;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *outbuf;
+} band_context_t;
+
+/*
+ * Reads the chunk at `*offset` and advances past it.  The chunk data
+ * points into the datastream, so the chunk is only ever cleared.
+ */
+static status_t decoder_chunk_at(
+    decoder_t const *decoder, size_t *offset, chunk_crc_policy_t crc_policy,
+    chunk_t *chunk)
+{
+    size_t length;
+    status_t status;
+
+    if (decoder->inlen - *offset < kChunkOverhead)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+
+    length = decoder->inlen - *offset;
+    chunk_clear(chunk);
+    status = chunk_view(decoder->inbuf + *offset, &length, crc_policy, chunk);
+    if (status != STATUS_OK)
+    {
+        chunk_clear(chunk);
+        return status;
+    }
+    *offset += length;
+    return STATUS_OK;
+}
+
+/* Reads the next chunk of the datastream. */
+static status_t decoder_next_chunk(decoder_t *decoder, chunk_t *chunk)
+{
+    return decoder_chunk_at(
+        decoder, &decoder->offset, decoder->options.crc_policy, chunk);
+}
+
+/*
+ * Inflate source walking through consecutive IDAT chunks, or fdAT
+ * chunks without their sequence number for animation frames.
+ */
+static status_t idat_source(void *context, uint8_t const **data, size_t *length)
+{
+    decoder_t *decoder;
+    uint32_t skip;
+    status_t status;
+
+    decoder = (decoder_t *)context;
+    skip = (decoder->data_type == FDAT_TYPE) ? FDAT_SEQUENCE_SIZE : 0;
+    do
+    {
+        status = decoder_next_chunk(decoder, &decoder->chunk);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        if (decoder->chunk.type != decoder->data_type ||
+            decoder->chunk.length < skip)
+        {
+            /* Image data ended before the last scanline. */
+            return STATUS_BAD_PACKET;
+        }
+    } while (decoder->chunk.length == skip);
+
+    *data = decoder->chunk.data + skip;
+    *length = decoder->chunk.length - skip;
+    decoder->compressed_bytes += *length;
+    return STATUS_OK;
+}
+
+/* Wipes a scratch buffer if asked to, then returns it to the pool. */
+static void decoder_release(decoder_t *decoder, decoder_buffer_t which)
+{
+    chunk_memory_t const *memory;
+
+    memory = &decoder->options.memory;
+    if (memory->wipe_policy == CHUNK_WIPE_ALL)
+    {
+        engine_wipe(decoder->buffers[which], decoder->buffer_sizes[which]);
+    }
+    engine_pool_release(memory->pool, decoder->buffers[which]);
+    decoder->buffers[which] = NULL;
+    decoder->buffer_sizes[which] = 0;
+}
+
+/*
+ * Returns a scratch buffer of at least `size` bytes, reusing the one
+ * kept by the decoder when it is large enough.  The contents are not
+ * preserved when it grows.
+ */
+static void *decoder_reserve(
+    decoder_t *decoder, decoder_buffer_t which, size_t size)
+{
+    if (decoder->buffer_sizes[which] < size)
+    {
+        decoder_release(decoder, which);
+        decoder->buffers[which] = (uint8_t *)engine_pool_allocate(
+            decoder->options.memory.pool, size);
+        if (!decoder->buffers[which])
+        {
+            return NULL;
+        }
+        decoder->buffer_sizes[which] = size;
+    }
+    return decoder->buffers[which];
+}
+
+status_t decoder_options_default(decoder_options_t *options)
+{
+    if (!options)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(options, 0, sizeof(decoder_options_t));
+    options->crc_policy = CHUNK_CRC_CHECK_ALL;
+    options->limits.max_pixels = kDefaultMaxPixels;
+    options->limits.max_text_bytes = kDefaultMaxTextBytes;
+    color_options_default(&options->color);
+    return STATUS_OK;
+}
+
+status_t decoder_init(decoder_options_t const *options, decoder_t *decoder)
+{
+    if (!decoder)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(decoder, 0, sizeof(decoder_t));
+    if (options)
+    {
+        decoder->options = *options;
+    }
+    else
+    {
+        decoder_options_default(&decoder->options);
+    }
+    return STATUS_OK;
+}
+
+/* Size of the image data once inflated, with the filter type bytes. */
+static uint64_t image_data_size(ihdr_t const *ihdr)
+{
+    ihdr_pass_t pass;
+    uint32_t pass_count, pass_index;
+    uint64_t total;
+    size_t row_size;
+
+    total = 0;
+    pass_count = ihdr_get_pass_count(ihdr);
+    for (pass_index = 0; pass_index < pass_count; pass_index++)
+    {
+        ihdr_get_pass(ihdr, pass_index, &pass);
+        if (pass.width > 0 && pass.height > 0)
+        {
+            ihdr_get_row_size(ihdr, pass.width, &row_size);
+            total += ((uint64_t)row_size + 1) * pass.height;
+        }
+    }
+    return total;
+}
+
+/* Checks the size of the loaded image against the limits. */
+static status_t decoder_check_size(decoder_t const *decoder)
+{
+    decoder_limits_t const *limits;
+
+    limits = &decoder->options.limits;
+    if (limits->max_pixels > 0 &&
+        (uint64_t)decoder->ihdr.width * decoder->ihdr.height >
+            limits->max_pixels)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    if (limits->max_image_bytes > 0 &&
+        image_data_size(&decoder->ihdr) > limits->max_image_bytes)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Prepares the expansion of the image to RGBA8, with the color stage
+ * computed on first use after a load.
+ */
+static status_t decoder_init_conv(decoder_t *decoder, pixconv_t *conv)
+{
+    status_t status;
+
+    status = pixconv_init(&decoder->ihdr, &decoder->palette, conv);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (!decoder->stage_ready)
+    {
+        status = color_stage_init(
+            &decoder->options.color, &decoder->color, &decoder->ihdr,
+            &decoder->palette, &decoder->stage);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        decoder->stage_ready = true;
+    }
+    return pixconv_use_stage(conv, &decoder->stage);
+}
+
+/* Frees the decoded texts and forgets the text chunks. */
+static void decoder_free_texts(decoder_t *decoder)
+{
+    uint32_t i;
+    decoder_text_t *text;
+
+    for (i = 0; i < decoder->text_count; i++)
+    {
+        text = &decoder->texts[i];
+        if (!text->text)
+        {
+            continue;
+        }
+        if (decoder->options.memory.wipe_policy == CHUNK_WIPE_ALL)
+        {
+            engine_wipe((void *)text->text, text->size);
+        }
+        free((void *)text->text);
+    }
+    free(decoder->texts);
+    decoder->texts = NULL;
+    decoder->text_count = 0;
+    decoder->texts_indexed = false;
+    decoder->text_offset = 0;
+}
+
+/* Forgets the current image, keeping the options and buffers. */
+static void decoder_unload(decoder_t *decoder)
+{
+    decoder->inbuf = NULL;
+    decoder->inlen = 0;
+    decoder->offset = 0;
+    decoder->data_offset = 0;
+    decoder->data_type = IDAT_TYPE;
+    memset(&decoder->ihdr, 0, sizeof(ihdr_t));
+    decoder->palette.size = 0;
+    chunk_clear(&decoder->chunk);
+    decoder_free_texts(decoder);
+    memset(&decoder->color, 0, sizeof(color_info_t));
+    color_stage_free(&decoder->stage);
+    decoder->stage_ready = false;
+}
+
+/*
+ * Handles a chunk preceding the image data, found at `offset`.  Known
+ * chunks are found with a single switch on the type, the registry is
+ * only searched for the others, and unknown ancillary chunks are
+ * skipped without being copied.  Text chunks are left for
+ * `decoder_get_text()`, only the first one is remembered.  Critical
+ * chunks out of order or repeated fail the load, ancillary ones are
+ * ignored.
+ */
+static status_t decoder_dispatch(
+    decoder_t *decoder, chunk_sequence_t *sequence, chunk_t const *chunk,
+    size_t offset)
+{
+    chunk_kind_t kind;
+    bool_t handled;
+    status_t status;
+
+    kind = chunk_kind_of(chunk->type);
+    if (chunk_sequence_add(sequence, kind) != STATUS_OK)
+    {
+        return chunk_type_is_critical(chunk->type) ?
+            STATUS_BAD_PACKET : STATUS_OK;
+    }
+
+    switch (kind)
+    {
+        case CHUNK_KIND_IDAT:
+            return STATUS_OK;
+        case CHUNK_KIND_PLTE:
+            if (palette_table_from_chunk(chunk, &decoder->palette) !=
+                STATUS_OK)
+            {
+                return STATUS_BAD_PACKET;
+            }
+            return STATUS_OK;
+        case CHUNK_KIND_IEND:
+            /* The image data is missing. */
+            return STATUS_BAD_PACKET;
+        case CHUNK_KIND_TRNS:
+        case CHUNK_KIND_GAMA:
+        case CHUNK_KIND_CHRM:
+        case CHUNK_KIND_SRGB:
+            /* Broken ancillary chunks are ignored. */
+            color_info_read(&decoder->color, decoder->ihdr.color_type, chunk);
+            break;
+        case CHUNK_KIND_TEXT:
+        case CHUNK_KIND_ZTXT:
+        case CHUNK_KIND_ITXT:
+            if (decoder->text_offset == 0)
+            {
+                decoder->text_offset = offset;
+            }
+            break;
+        default:
+            break;
+    }
+
+    status = chunk_registry_dispatch(
+        decoder->options.registry, chunk, &handled);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (!handled && chunk_type_is_critical(chunk->type))
+    {
+        return STATUS_UNKNOWN_TYPE;
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Checks the order of the critical chunks following the first IDAT
+ * chunk, up to IEND.  Only the chunk headers are read, and a
+ * datastream cut short is left for the image data to fail.
+ */
+static status_t decoder_check_tail(
+    decoder_t const *decoder, chunk_sequence_t *sequence)
+{
+    chunk_t chunk;
+    chunk_kind_t kind;
+    size_t offset;
+
+    offset = decoder->offset;
+    while (decoder_chunk_at(
+               decoder, &offset, CHUNK_CRC_CHECK_NONE, &chunk) == STATUS_OK)
+    {
+        kind = chunk_kind_of(chunk.type);
+        if (chunk_sequence_add(sequence, kind) != STATUS_OK &&
+            chunk_type_is_critical(chunk.type))
+        {
+            return STATUS_BAD_PACKET;
+        }
+        if (kind == CHUNK_KIND_IEND)
+        {
+            break;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t decoder_load(uint8_t const *inbuf, size_t inlen, decoder_t *decoder)
+{
+    chunk_sequence_t sequence;
+    chunk_t chunk;
+    size_t chunk_offset;
+    status_t status;
+
+    if (!inbuf || !decoder)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    decoder_unload(decoder);
+    chunk_clear(&chunk);
+    chunk_sequence_init(&sequence);
+
+    if (!png_signature_is_valid(inbuf, inlen))
+    {
+        return STATUS_BAD_PACKET;
+    }
+    decoder->inbuf = inbuf;
+    decoder->inlen = inlen;
+    decoder->offset = PNG_SIGNATURE_SIZE;
+
+    /* IHDR must be the first chunk. */
+    status = decoder_next_chunk(decoder, &chunk);
+    if (status != STATUS_OK)
+    {
+        goto fail;
+    }
+    if (!chunk_is_ihdr(&chunk) ||
+        ihdr_from_chunk(&chunk, &decoder->ihdr) != STATUS_OK ||
+        !ihdr_is_valid(&decoder->ihdr))
+    {
+        status = STATUS_BAD_PACKET;
+        goto fail;
+    }
+    chunk_sequence_add(&sequence, CHUNK_KIND_IHDR);
+    status = decoder_check_size(decoder);
+    if (status != STATUS_OK)
+    {
+        goto fail;
+    }
+
+    /* Read chunks up to the start of the image data. */
+    for (;;)
+    {
+        chunk_offset = decoder->offset;
+        status = decoder_next_chunk(decoder, &chunk);
+        if (status != STATUS_OK)
+        {
+            goto fail;
+        }
+
+        status = decoder_dispatch(decoder, &sequence, &chunk, chunk_offset);
+        if (status != STATUS_OK)
+        {
+            goto fail;
+        }
+        if (chunk_is_idat(&chunk))
+        {
+            decoder->data_offset = chunk_offset;
+            break;
+        }
+    }
+
+    if (ihdr_color_type_is_palette(decoder->ihdr.color_type) &&
+        decoder->palette.size == 0)
+    {
+        status = STATUS_BAD_PACKET;
+        goto fail;
+    }
+    status = decoder_check_tail(decoder, &sequence);
+    if (status != STATUS_OK)
+    {
+        goto fail;
+    }
+
+    return STATUS_OK;
+
+fail:
+    decoder_unload(decoder);
+    return status;
+}
+
+status_t decoder_load_frame(
+    decoder_t const *image, fctl_t const *fctl, size_t data_offset,
+    uint32_t data_type, decoder_t *frame)
+{
+    if (!image || !fctl || !frame)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!image->inbuf || !fctl_is_valid(fctl, &image->ihdr) ||
+        (data_type != IDAT_TYPE && data_type != FDAT_TYPE) ||
+        data_offset < PNG_SIGNATURE_SIZE || data_offset >= image->inlen)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    decoder_unload(frame);
+    frame->inbuf = image->inbuf;
+    frame->inlen = image->inlen;
+    frame->offset = data_offset;
+    frame->data_offset = data_offset;
+    frame->data_type = data_type;
+    frame->ihdr = image->ihdr;
+    frame->ihdr.width = fctl->width;
+    frame->ihdr.height = fctl->height;
+    if (image->palette.size > 0)
+    {
+        frame->palette = image->palette;
+    }
+    frame->color = image->color;
+    return STATUS_OK;
+}
+
+status_t decoder_open(
+    uint8_t const *inbuf, size_t inlen, decoder_options_t const *options,
+    decoder_t *decoder)
+{
+    status_t status;
+
+    status = decoder_init(options, decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    status = decoder_load(inbuf, inlen, decoder);
+    if (status != STATUS_OK)
+    {
+        decoder_close(decoder);
+    }
+    return status;
+}
+
+status_t decoder_close(decoder_t *decoder)
+{
+    uint32_t i;
+
+    if (!decoder)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    decoder_free_texts(decoder);
+    color_stage_free(&decoder->stage);
+    inflater_free(&decoder->inflater);
+    for (i = 0; i < DECODER_BUFFER_COUNT; i++)
+    {
+        decoder_release(decoder, (decoder_buffer_t)i);
+    }
+    memset(decoder, 0, sizeof(decoder_t));
+    return STATUS_OK;
+}
+
+/*
+ * Restarts the image data stream at the first IDAT chunk, along with
+ * the measures of the streaming limits.
+ */
+static status_t decoder_rewind(decoder_t *decoder)
+{
+    chunk_clear(&decoder->chunk);
+    decoder->offset = decoder->data_offset;
+    decoder->compressed_bytes = 0;
+    decoder->inflated_bytes = 0;
+    decoder->cpu_check_bytes = kCpuCheckBytes;
+    if (decoder->options.limits.max_cpu_ms > 0)
+    {
+        decoder->cpu_start = engine_cpu_seconds();
+    }
+    return inflater_reset(idat_source, decoder, &decoder->inflater);
+}
+
+/*
+ * Inflates the next `outlen` bytes of image data, then checks the
+ * inflate ratio and, every `kCpuCheckBytes`, the CPU time.
+ */
+static status_t decoder_read(
+    decoder_t *decoder, uint8_t *outbuf, size_t outlen)
+{
+    decoder_limits_t const *limits;
+    status_t status;
+
+    status = inflater_read(&decoder->inflater, outbuf, outlen);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    limits = &decoder->options.limits;
+    decoder->inflated_bytes += outlen;
+    if (limits->max_inflate_ratio > 0 &&
+        decoder->inflated_bytes > kInflateRatioSlack &&
+        decoder->inflated_bytes >
+            decoder->compressed_bytes * limits->max_inflate_ratio)
+    {
+        return STATUS_LIMIT_EXCEEDED;
+    }
+    if (limits->max_cpu_ms > 0 &&
+        decoder->inflated_bytes >= decoder->cpu_check_bytes)
+    {
+        decoder->cpu_check_bytes = decoder->inflated_bytes + kCpuCheckBytes;
+        if ((engine_cpu_seconds() - decoder->cpu_start) * 1e3 >
+            (double)limits->max_cpu_ms)
+        {
+            return STATUS_LIMIT_EXCEEDED;
+        }
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Unfilters the scanlines of every pass and hands those of image rows
+ * before `y_end` to `handler`.  Scanlines are inflated only until the
+ * last one intersecting the rows before `y_end`.
+ */
+static status_t decoder_scan(
+    decoder_t *decoder, uint32_t y_end, row_handler_t handler, void *context)
+{
+    ihdr_pass_t pass;
+    uint32_t pass_count, pass_index, last_pass, pixel_bits, pixel_bytes;
+    uint32_t row_index, rows_needed;
+    size_t row_size, max_row_size;
+    uint8_t *rows, *current, *prior;
+    bool_t complete;
+    status_t status;
+
+    pass_count = ihdr_get_pass_count(&decoder->ihdr);
+    if ((status = ihdr_get_pixel_bits(&decoder->ihdr, &pixel_bits)) !=
+            STATUS_OK ||
+        (status = ihdr_get_row_size(
+            &decoder->ihdr, decoder->ihdr.width, &max_row_size)) !=
+            STATUS_OK)
+    {
+        return status;
+    }
+    pixel_bytes = pixel_bits < 8 ? 1 : pixel_bits / 8;
+
+    /* Find the last pass that contains a needed row. */
+    last_pass = 0;
+    for (pass_index = 0; pass_index < pass_count; pass_index++)
+    {
+        ihdr_get_pass(&decoder->ihdr, pass_index, &pass);
+        if (pass.width > 0 && pass.height > 0 && pass.y_offset < y_end)
+        {
+            last_pass = pass_index;
+        }
+    }
+
+    status = decoder_rewind(decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    /* Current and prior scanlines, each with its filter type byte. */
+    rows = (uint8_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_ROWS, (max_row_size + 1) * 2);
+    if (!rows)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    complete = true;
+    for (pass_index = 0;
+         pass_index < pass_count && status == STATUS_OK;
+         pass_index++)
+    {
+        ihdr_get_pass(&decoder->ihdr, pass_index, &pass);
+        if (pass.width == 0 || pass.height == 0)
+        {
+            continue;
+        }
+        ihdr_get_row_size(&decoder->ihdr, pass.width, &row_size);
+
+        rows_needed = 0;
+        if (pass.y_offset < y_end)
+        {
+            rows_needed = (y_end - pass.y_offset + pass.y_step - 1) /
+                pass.y_step;
+            if (rows_needed > pass.height)
+            {
+                rows_needed = pass.height;
+            }
+        }
+
+        current = rows;
+        prior = NULL;
+        for (row_index = 0; row_index < pass.height; row_index++)
+        {
+            if (pass_index >= last_pass && row_index >= rows_needed)
+            {
+                /* Nothing after this scanline is needed. */
+                complete = false;
+                break;
+            }
+
+            status = decoder_read(decoder, current, row_size + 1);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+            if (row_index >= rows_needed)
+            {
+                /* Skipped, but still needs inflating to reach next pass. */
+                continue;
+            }
+
+            status = filter_unfilter_row(
+                current[0], current + 1, prior, row_size, pixel_bytes);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+            status = handler(
+                context, &pass, pass.y_offset + row_index * pass.y_step,
+                current + 1);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+
+            prior = current + 1;
+            current = (current == rows) ? rows + max_row_size + 1 : rows;
+        }
+        if (!complete)
+        {
+            break;
+        }
+    }
+
+    if (status == STATUS_OK && complete)
+    {
+        status = inflater_finish(&decoder->inflater);
+    }
+    return status;
+}
+
+static uint32_t get_packed_pixel(
+    uint8_t const *row, size_t index, uint32_t pixel_bits)
+{
+    size_t bit;
+    bit = index * pixel_bits;
+    return (row[bit >> 3] >> (8 - pixel_bits - (bit & 7))) &
+        ((1u << pixel_bits) - 1);
+}
+
+static void set_packed_pixel(
+    uint8_t *row, size_t index, uint32_t pixel_bits, uint32_t value)
+{
+    size_t bit;
+    bit = index * pixel_bits;
+    row[bit >> 3] |= (uint8_t)(value << (8 - pixel_bits - (bit & 7)));
+}
+
+static status_t region_row_handler(
+    void *context, ihdr_pass_t const *pass, uint32_t y, uint8_t const *row)
+{
+    region_context_t *ctx;
+    region_t const *region;
+    uint32_t bits, pixel_bytes, index, x;
+    size_t count;
+    uint8_t *out;
+
+    ctx = (region_context_t *)context;
+    region = &ctx->region;
+    if (y < region->y || y - region->y >= region->height)
+    {
+        return STATUS_OK;
+    }
+
+    bits = ctx->pixel_bits;
+    pixel_bytes = bits / 8;
+    out = ctx->outbuf + (size_t)(y - region->y) * ctx->row_size;
+
+    if (pass->x_step == 1)
+    {
+        /* Whole scanline, copy the window directly. */
+        if (bits >= 8)
+        {
+            memcpy(out, row + (size_t)region->x * pixel_bytes,
+                   (size_t)region->width * pixel_bytes);
+        }
+        else
+        {
+            for (count = 0; count < region->width; count++)
+            {
+                set_packed_pixel(out, count, bits, get_packed_pixel(
+                    row, region->x + count, bits));
+            }
+        }
+        return STATUS_OK;
+    }
+
+    /* Reduced image, scatter the pixels that fall into the window. */
+    index = 0;
+    if (region->x > pass->x_offset)
+    {
+        index = (region->x - pass->x_offset + pass->x_step - 1) /
+            pass->x_step;
+    }
+    for (; index < pass->width; index++)
+    {
+        x = pass->x_offset + index * pass->x_step;
+        if (x - region->x >= region->width)
+        {
+            break;
+        }
+        if (bits >= 8)
+        {
+            memcpy(out + (size_t)(x - region->x) * pixel_bytes,
+                   row + (size_t)index * pixel_bytes, pixel_bytes);
+        }
+        else
+        {
+            set_packed_pixel(out, x - region->x, bits,
+                             get_packed_pixel(row, index, bits));
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t decoder_decode_region(
+    decoder_t *decoder, region_t const *region,
+    uint8_t *outbuf, size_t *outlen)
+{
+    region_context_t context;
+    uint64_t total;
+    status_t status;
+
+    if (!decoder || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (region)
+    {
+        context.region = *region;
+    }
+    else
+    {
+        context.region.x = 0;
+        context.region.y = 0;
+        context.region.width = decoder->ihdr.width;
+        context.region.height = decoder->ihdr.height;
+    }
+
+    if (context.region.width == 0 || context.region.height == 0 ||
+        context.region.x >= decoder->ihdr.width ||
+        context.region.y >= decoder->ihdr.height ||
+        decoder->ihdr.width - context.region.x < context.region.width ||
+        decoder->ihdr.height - context.region.y < context.region.height)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if ((status = ihdr_get_pixel_bits(
+            &decoder->ihdr, &context.pixel_bits)) != STATUS_OK ||
+        (status = ihdr_get_row_size(
+            &decoder->ihdr, context.region.width, &context.row_size)) !=
+            STATUS_OK)
+    {
+        return status;
+    }
+
+    total = (uint64_t)context.row_size * context.region.height;
+    if (total > SIZE_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    if (*outlen < total)
+    {
+        *outlen = (size_t)total;
+        return STATUS_FAILURE;
+    }
+    *outlen = (size_t)total;
+
+    /* Packed pixels are OR-ed into place. */
+    if (context.pixel_bits < 8)
+    {
+        memset(outbuf, 0, (size_t)total);
+    }
+    context.outbuf = outbuf;
+
+    return decoder_scan(
+        decoder, context.region.y + context.region.height,
+        region_row_handler, &context);
+}
+
+/* First image coordinate that falls into the scaled coordinate `index`. */
+static uint32_t scale_start(uint32_t index, uint32_t image, uint32_t scaled)
+{
+    return (uint32_t)(((uint64_t)index * image + scaled - 1) / scaled);
+}
+
+static void thumbnail_flush_row(
+    thumbnail_context_t *ctx, uint32_t row, uint64_t const *sums)
+{
+    uint64_t count;
+    uint32_t rows, col, channel;
+    uint8_t *out;
+
+    rows = scale_start(row + 1, ctx->image_height, ctx->height) -
+        scale_start(row, ctx->image_height, ctx->height);
+    out = ctx->outbuf + (size_t)row * ctx->width * 4;
+    for (col = 0; col < ctx->width; col++)
+    {
+        count = (uint64_t)ctx->column_count[col] * rows;
+        for (channel = 0; channel < 4; channel++)
+        {
+            *out++ = (uint8_t)((*sums++ + count / 2) / count);
+        }
+    }
+}
+
+static status_t thumbnail_row_handler(
+    void *context, ihdr_pass_t const *pass, uint32_t y, uint8_t const *row)
+{
+    thumbnail_context_t *ctx;
+    uint32_t thumb_row, index;
+    uint64_t *sums, *sum;
+    uint8_t const *pixel;
+    status_t status;
+
+    ctx = (thumbnail_context_t *)context;
+    thumb_row = (uint32_t)((uint64_t)y * ctx->height / ctx->image_height);
+
+    if (ctx->sum_rows == 1)
+    {
+        /* Rows arrive in order, finish the previous thumbnail row. */
+        if (thumb_row != ctx->current_row)
+        {
+            if (ctx->current_row != kNoRow)
+            {
+                thumbnail_flush_row(ctx, ctx->current_row, ctx->sums);
+            }
+            memset(ctx->sums, 0, sizeof(uint64_t) * ctx->width * 4);
+            ctx->current_row = thumb_row;
+        }
+        sums = ctx->sums;
+    }
+    else
+    {
+        if (thumb_row < ctx->first_row ||
+            thumb_row - ctx->first_row >= ctx->sum_rows)
+        {
+            /* Belongs to another band. */
+            return STATUS_OK;
+        }
+        sums = ctx->sums +
+            (size_t)(thumb_row - ctx->first_row) * ctx->width * 4;
+    }
+
+    status = pixconv_expand_rgba8(&ctx->conv, row, pass->width, ctx->scanline);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    pixel = ctx->scanline;
+    for (index = 0; index < pass->width; index++, pixel += 4)
+    {
+        sum = sums + (size_t)ctx->column_map[
+            pass->x_offset + index * pass->x_step] * 4;
+        sum[0] += pixel[0];
+        sum[1] += pixel[1];
+        sum[2] += pixel[2];
+        sum[3] += pixel[3];
+    }
+    return STATUS_OK;
+}
+
+status_t decoder_decode_thumbnail(
+    decoder_t *decoder, uint32_t width, uint32_t height,
+    uint8_t *outbuf, size_t *outlen)
+{
+    thumbnail_context_t context;
+    uint64_t total;
+    uint32_t x, col, row, rows;
+    size_t row_sums;
+    status_t status;
+
+    if (!decoder || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (width == 0 || height == 0 ||
+        width > decoder->ihdr.width || height > decoder->ihdr.height)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    total = (uint64_t)width * height * 4;
+    if (total > SIZE_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    if (*outlen < total)
+    {
+        *outlen = (size_t)total;
+        return STATUS_FAILURE;
+    }
+    *outlen = (size_t)total;
+
+    memset(&context, 0, sizeof(context));
+    status = decoder_init_conv(decoder, &context.conv);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    context.image_width = decoder->ihdr.width;
+    context.image_height = decoder->ihdr.height;
+    context.width = width;
+    context.height = height;
+    context.current_row = kNoRow;
+    context.outbuf = outbuf;
+    /*
+     * Interlaced rows arrive out of order, so the sums of as many rows
+     * as a scratch buffer holds are kept, scanning once per band.
+     */
+    row_sums = sizeof(uint64_t) * width * 4;
+    context.sum_rows = 1;
+    if (ihdr_get_pass_count(&decoder->ihdr) > 1)
+    {
+        context.sum_rows = row_sums < kMallocLimit ?
+            (uint32_t)(kMallocLimit / row_sums) : 1;
+        if (context.sum_rows > height)
+        {
+            context.sum_rows = height;
+        }
+    }
+
+    context.scanline = (uint8_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_SCANLINE, (size_t)context.image_width * 4);
+    context.column_map = (uint32_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_COLUMNS,
+        sizeof(uint32_t) * ((size_t)context.image_width + width));
+    context.sums = (uint64_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_SUMS, row_sums * context.sum_rows);
+    if (!context.scanline || !context.column_map || !context.sums)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    context.column_count = context.column_map + context.image_width;
+
+    for (col = 0; col < width; col++)
+    {
+        context.column_count[col] =
+            scale_start(col + 1, context.image_width, width) -
+            scale_start(col, context.image_width, width);
+    }
+    for (x = 0; x < context.image_width; x++)
+    {
+        context.column_map[x] =
+            (uint32_t)((uint64_t)x * width / context.image_width);
+    }
+
+    if (ihdr_get_pass_count(&decoder->ihdr) == 1)
+    {
+        memset(context.sums, 0, row_sums);
+        status = decoder_scan(
+            decoder, decoder->ihdr.height, thumbnail_row_handler, &context);
+        if (status == STATUS_OK)
+        {
+            thumbnail_flush_row(&context, context.current_row, context.sums);
+        }
+        return status;
+    }
+
+    for (row = 0; row < height; row += context.sum_rows)
+    {
+        rows = height - row < context.sum_rows ? height - row :
+            context.sum_rows;
+        context.first_row = row;
+        memset(context.sums, 0, row_sums * rows);
+        status = decoder_scan(
+            decoder, scale_start(row + rows, decoder->ihdr.height, height),
+            thumbnail_row_handler, &context);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        for (x = 0; x < rows; x++)
+        {
+            thumbnail_flush_row(
+                &context, row + x, context.sums + (size_t)x * width * 4);
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Splits an output buffer into the planes of a YUV420 image. */
+static void yuv_planes_init(
+    uint8_t *outbuf, uint32_t width, uint32_t height, yuv_planes_t *planes)
+{
+    size_t chroma_size;
+
+    chroma_size = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    planes->width = width;
+    planes->height = height;
+    planes->luma = outbuf;
+    planes->cb = outbuf + (size_t)width * height;
+    planes->cr = planes->cb + chroma_size;
+}
+
+/* Writes the Y samples of an image row and adds it to chroma sums. */
+static status_t yuv_add_row(
+    yuv_planes_t const *planes, uint32_t y, uint32_t x_offset,
+    uint32_t x_step, uint8_t const *rgba, uint32_t count, uint16_t *sums)
+{
+    status_t status;
+
+    status = pixconv_store_luma(
+        rgba, count, x_step,
+        planes->luma + (size_t)y * planes->width + x_offset);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    return pixconv_add_chroma(rgba, count, x_offset, x_step, sums);
+}
+
+/* Writes a chroma row once both of its image rows were added. */
+static status_t yuv_store_row(
+    yuv_planes_t const *planes, uint32_t chroma_row, uint16_t *sums)
+{
+    size_t columns;
+    uint32_t rows;
+
+    columns = (planes->width + 1) / 2;
+    rows = (chroma_row * 2 + 1 < planes->height) ? 2 : 1;
+    return pixconv_store_chroma(
+        sums, planes->width, rows, planes->cb + chroma_row * columns,
+        planes->cr + chroma_row * columns);
+}
+
+/* Writes the first `rows` chroma rows of an interlaced band. */
+static status_t yuv_store_rows(pixels_context_t *ctx, uint32_t rows)
+{
+    uint32_t i;
+    uint16_t *sums;
+    status_t status;
+
+    sums = ctx->sums;
+    for (i = 0; i < rows; i++)
+    {
+        status = yuv_store_row(&ctx->planes, ctx->first_row + i, sums);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        sums += (size_t)((ctx->width + 1) / 2) * 3;
+    }
+    return STATUS_OK;
+}
+
+static status_t yuv_row_handler(
+    pixels_context_t *ctx, ihdr_pass_t const *pass, uint32_t y,
+    uint8_t const *row)
+{
+    uint16_t *sums;
+    status_t status;
+
+    /* Interlaced rows arrive out of order, so a band of rows is kept. */
+    sums = ctx->sums;
+    if (ctx->interlaced)
+    {
+        if (y / 2 < ctx->first_row || y / 2 - ctx->first_row >= ctx->sum_rows)
+        {
+            return STATUS_OK;
+        }
+        sums += (size_t)(y / 2 - ctx->first_row) * ((ctx->width + 1) / 2) * 3;
+    }
+
+    status = pixconv_expand_rgba8(&ctx->conv, row, pass->width, ctx->scanline);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = yuv_add_row(
+        &ctx->planes, y, pass->x_offset, pass->x_step, ctx->scanline,
+        pass->width, sums);
+    if (status != STATUS_OK || ctx->interlaced)
+    {
+        return status;
+    }
+    if ((y & 1) || y + 1 == ctx->height)
+    {
+        status = yuv_store_row(&ctx->planes, y / 2, sums);
+    }
+    return status;
+}
+
+static status_t pixels_row_handler(
+    void *context, ihdr_pass_t const *pass, uint32_t y, uint8_t const *row)
+{
+    pixels_context_t *ctx;
+    uint32_t index;
+    uint8_t *out;
+    status_t status;
+
+    ctx = (pixels_context_t *)context;
+    if (ctx->format == PIXEL_FORMAT_YUV420)
+    {
+        return yuv_row_handler(ctx, pass, y, row);
+    }
+
+    out = ctx->outbuf + (size_t)y * ctx->width * ctx->pixel_bytes;
+    if (pass->x_step == 1)
+    {
+        return pixconv_expand(&ctx->conv, ctx->format, row, pass->width, out);
+    }
+
+    status = pixconv_expand(
+        &ctx->conv, ctx->format, row, pass->width, ctx->scanline);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    for (index = 0; index < pass->width; index++)
+    {
+        memcpy(out + (size_t)(pass->x_offset + index * pass->x_step) *
+                   ctx->pixel_bytes,
+               ctx->scanline + (size_t)index * ctx->pixel_bytes,
+               ctx->pixel_bytes);
+    }
+    return STATUS_OK;
+}
+
+static void band_fail(band_context_t *ctx, status_t status)
+{
+    pthread_mutex_lock(&ctx->lock);
+    if (!ctx->abort)
+    {
+        ctx->status = status;
+        ctx->abort = true;
+    }
+    pthread_cond_broadcast(&ctx->changed);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static uint32_t band_height(band_context_t const *ctx, uint32_t band)
+{
+    uint32_t first;
+    first = band * ctx->band_rows;
+    return (ctx->height - first < ctx->band_rows) ?
+        ctx->height - first : ctx->band_rows;
+}
+
+/*
+ * Expands the rows of a YUV420 band, which starts on an even row, with
+ * the scratch of a worker.
+ */
+static status_t band_expand_yuv(
+    band_context_t *ctx, uint32_t band, uint32_t worker)
+{
+    uint32_t rows, row, y;
+    uint8_t *current, *rgba;
+    uint16_t *sums;
+    status_t status;
+
+    rows = band_height(ctx, band);
+    current = ctx->slots[band % ctx->slot_count];
+    rgba = ctx->scratch + ctx->scratch_size * worker;
+    sums = (uint16_t *)(rgba + (size_t)ctx->width * 4);
+    for (row = 0; row < rows; row++, current += ctx->row_size + 1)
+    {
+        y = band * ctx->band_rows + row;
+        status = pixconv_expand_rgba8(
+            &ctx->conv, current + 1, ctx->width, rgba);
+        if (status == STATUS_OK)
+        {
+            status = yuv_add_row(
+                &ctx->planes, y, 0, 1, rgba, ctx->width, sums);
+        }
+        if (status == STATUS_OK && ((y & 1) || y + 1 == ctx->height))
+        {
+            status = yuv_store_row(&ctx->planes, y / 2, sums);
+        }
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Unfilters a band, hands its last scanline on and expands it. */
+static status_t band_process(
+    band_context_t *ctx, uint32_t band, uint32_t worker)
+{
+    uint32_t slot, rows, row;
+    size_t stride;
+    uint8_t *current, *prior, *out;
+    status_t status;
+
+    slot = band % ctx->slot_count;
+    rows = band_height(ctx, band);
+    stride = ctx->row_size + 1;
+
+    prior = (band == 0) ? NULL : ctx->carry;
+    current = ctx->slots[slot];
+    for (row = 0; row < rows; row++, current += stride)
+    {
+        status = filter_unfilter_row(
+            current[0], current + 1, prior, ctx->row_size, ctx->pixel_bytes);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        prior = current + 1;
+    }
+    memcpy(ctx->carry, prior, ctx->row_size);
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->unfiltered = band + 1;
+    pthread_cond_broadcast(&ctx->changed);
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (ctx->format == PIXEL_FORMAT_YUV420)
+    {
+        status = band_expand_yuv(ctx, band, worker);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    else
+    {
+        current = ctx->slots[slot];
+        out = ctx->outbuf +
+            (size_t)band * ctx->band_rows * ctx->width * ctx->out_bytes;
+        for (row = 0; row < rows; row++, current += stride)
+        {
+            status = pixconv_expand(
+                &ctx->conv, ctx->format, current + 1, ctx->width, out);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+            out += (size_t)ctx->width * ctx->out_bytes;
+        }
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->slot_band[slot] = kNoBand;
+    pthread_cond_broadcast(&ctx->changed);
+    pthread_mutex_unlock(&ctx->lock);
+    return STATUS_OK;
+}
+
+static void band_worker(void *context, uint32_t index)
+{
+    band_context_t *ctx;
+    uint32_t band, slot;
+    status_t status;
+
+    ctx = (band_context_t *)context;
+    for (;;)
+    {
+        pthread_mutex_lock(&ctx->lock);
+        if (ctx->abort || ctx->next_band >= ctx->band_count)
+        {
+            pthread_mutex_unlock(&ctx->lock);
+            return;
+        }
+        band = ctx->next_band++;
+        slot = band % ctx->slot_count;
+        /* Wait for the inflated band and the band before it. */
+        while (!ctx->abort &&
+               (ctx->slot_band[slot] != band || ctx->unfiltered != band))
+        {
+            pthread_cond_wait(&ctx->changed, &ctx->lock);
+        }
+        if (ctx->abort)
+        {
+            pthread_mutex_unlock(&ctx->lock);
+            return;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+
+        status = band_process(ctx, band, index);
+        if (status != STATUS_OK)
+        {
+            band_fail(ctx, status);
+            return;
+        }
+    }
+}
+
+/* Inflates every band into the ring, on the calling thread. */
+static status_t band_produce(decoder_t *decoder, band_context_t *ctx)
+{
+    uint32_t band, slot;
+    status_t status;
+
+    for (band = 0; band < ctx->band_count; band++)
+    {
+        slot = band % ctx->slot_count;
+        pthread_mutex_lock(&ctx->lock);
+        while (!ctx->abort && ctx->slot_band[slot] != kNoBand)
+        {
+            pthread_cond_wait(&ctx->changed, &ctx->lock);
+        }
+        status = ctx->abort ? ctx->status : STATUS_OK;
+        pthread_mutex_unlock(&ctx->lock);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+
+        status = decoder_read(
+            decoder, ctx->slots[slot],
+            band_height(ctx, band) * (ctx->row_size + 1));
+        if (status != STATUS_OK)
+        {
+            band_fail(ctx, status);
+            return status;
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->slot_band[slot] = band;
+        pthread_cond_broadcast(&ctx->changed);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Decodes a non-interlaced image with worker threads.  Sets `*started`
+ * to false, decoding nothing, if no worker thread could be started.
+ */
+static status_t decode_bands(
+    decoder_t *decoder, band_context_t *ctx, uint32_t threads,
+    bool_t *started)
+{
+    workers_t workers;
+    uint32_t slot, pixel_bits;
+    size_t table_size, carry_size, slot_size;
+    uint8_t *buffer;
+    status_t status;
+
+    *started = false;
+    ihdr_get_pixel_bits(&decoder->ihdr, &pixel_bits);
+    ihdr_get_row_size(&decoder->ihdr, ctx->width, &ctx->row_size);
+    ctx->pixel_bytes = pixel_bits < 8 ? 1 : pixel_bits / 8;
+    /* Every busy worker holds one slot, the producer fills another. */
+    ctx->slot_count = threads + 2;
+    ctx->band_rows = (uint32_t)(kBandBytes / (ctx->row_size + 1));
+    /* Many threads shrink the bands to keep all slots in one buffer. */
+    if ((size_t)ctx->band_rows * (ctx->row_size + 1) * ctx->slot_count >
+        kMallocLimit / 2)
+    {
+        ctx->band_rows = (uint32_t)(
+            kMallocLimit / 2 / ctx->slot_count / (ctx->row_size + 1));
+    }
+    /* YUV420 bands hold whole chroma rows. */
+    if (ctx->format == PIXEL_FORMAT_YUV420)
+    {
+        ctx->band_rows &= ~1u;
+        ctx->scratch_size = (size_t)ctx->width * 4 +
+            sizeof(uint16_t) * ((ctx->width + 1) / 2) * 3;
+        ctx->scratch_size = (ctx->scratch_size + kBufferAlignment - 1) &
+            ~(kBufferAlignment - 1);
+    }
+    if (ctx->band_rows == 0)
+    {
+        ctx->band_rows = ctx->format == PIXEL_FORMAT_YUV420 ? 2 : 1;
+    }
+    ctx->band_count = (ctx->height + ctx->band_rows - 1) / ctx->band_rows;
+
+    /* Slot table, carry row, slots and scratch share the rows buffer. */
+    table_size = sizeof(uint8_t *) * ctx->slot_count +
+        sizeof(uint32_t) * ctx->slot_count;
+    table_size = (table_size + kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+    carry_size = (ctx->row_size + kBufferAlignment - 1) &
+        ~(kBufferAlignment - 1);
+    slot_size = ((size_t)ctx->band_rows * (ctx->row_size + 1) +
+                 kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+    buffer = (uint8_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_ROWS,
+        table_size + carry_size + slot_size * ctx->slot_count +
+            ctx->scratch_size * threads);
+    if (!buffer)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    ctx->scratch = buffer + table_size + carry_size +
+        slot_size * ctx->slot_count;
+    memset(ctx->scratch, 0, ctx->scratch_size * threads);
+    ctx->slots = (uint8_t **)buffer;
+    ctx->slot_band = (uint32_t *)(ctx->slots + ctx->slot_count);
+    ctx->carry = buffer + table_size;
+    for (slot = 0; slot < ctx->slot_count; slot++)
+    {
+        ctx->slot_band[slot] = kNoBand;
+        ctx->slots[slot] = buffer + table_size + carry_size +
+            slot_size * slot;
+    }
+
+    status = decoder_rewind(decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    if (pthread_mutex_init(&ctx->lock, NULL) != 0)
+    {
+        return STATUS_FAILURE;
+    }
+    if (pthread_cond_init(&ctx->changed, NULL) != 0)
+    {
+        pthread_mutex_destroy(&ctx->lock);
+        return STATUS_FAILURE;
+    }
+
+    status = workers_start(threads, threads, band_worker, ctx, &workers);
+    if (status == STATUS_OK)
+    {
+        *started = workers.thread_count > 0;
+        if (*started)
+        {
+            status = band_produce(decoder, ctx);
+        }
+        else
+        {
+            /* Workers would only run once the producer is done. */
+            band_fail(ctx, STATUS_FAILURE);
+        }
+        workers_join(&workers);
+        if (status == STATUS_OK && *started && ctx->abort)
+        {
+            status = ctx->status;
+        }
+    }
+
+    pthread_cond_destroy(&ctx->changed);
+    pthread_mutex_destroy(&ctx->lock);
+
+    if (status == STATUS_OK && *started)
+    {
+        status = inflater_finish(&decoder->inflater);
+    }
+    return status;
+}
+
+status_t decoder_decode_pixels(
+    decoder_t *decoder, pixel_format_t format, uint32_t threads,
+    uint8_t *outbuf, size_t *outlen)
+{
+    pixels_context_t context;
+    band_context_t bands;
+    uint64_t total;
+    size_t scanline_size, row_sums;
+    uint32_t chroma_height, row, rows;
+    bool_t started;
+    status_t status;
+
+    if (!decoder || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = pixconv_format_size(
+        format, decoder->ihdr.width, decoder->ihdr.height, &total);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (total > SIZE_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    if (*outlen < total)
+    {
+        *outlen = (size_t)total;
+        return STATUS_FAILURE;
+    }
+    *outlen = (size_t)total;
+
+    if (threads > 1 && ihdr_get_pass_count(&decoder->ihdr) == 1)
+    {
+        memset(&bands, 0, sizeof(bands));
+        bands.format = format;
+        bands.width = decoder->ihdr.width;
+        bands.height = decoder->ihdr.height;
+        bands.outbuf = outbuf;
+        if (format == PIXEL_FORMAT_YUV420)
+        {
+            yuv_planes_init(outbuf, bands.width, bands.height, &bands.planes);
+        }
+        bands.out_bytes = pixconv_pixel_bytes(format);
+        status = decoder_init_conv(decoder, &bands.conv);
+        if (status == STATUS_OK)
+        {
+            status = decode_bands(decoder, &bands, threads, &started);
+        }
+        if (status != STATUS_OK || started)
+        {
+            return status;
+        }
+        /* No worker thread could start, decode on the calling thread. */
+    }
+
+    memset(&context, 0, sizeof(context));
+    status = decoder_init_conv(decoder, &context.conv);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    context.format = format;
+    context.width = decoder->ihdr.width;
+    context.height = decoder->ihdr.height;
+    context.outbuf = outbuf;
+    context.interlaced = ihdr_get_pass_count(&decoder->ihdr) > 1;
+    context.pixel_bytes = pixconv_pixel_bytes(format);
+    scanline_size = (size_t)context.width * context.pixel_bytes;
+    if (format == PIXEL_FORMAT_YUV420)
+    {
+        yuv_planes_init(outbuf, context.width, context.height, &context.planes);
+        /*
+         * Interlaced rows arrive out of order, so the sums of as many
+         * chroma rows as a scratch buffer holds are kept, scanning once
+         * per band.
+         */
+        row_sums = sizeof(uint16_t) * ((context.width + 1) / 2) * 3;
+        chroma_height = (context.height + 1) / 2;
+        context.sum_rows = 1;
+        if (context.interlaced)
+        {
+            context.sum_rows = row_sums < kMallocLimit ?
+                (uint32_t)(kMallocLimit / row_sums) : 1;
+            if (context.sum_rows > chroma_height)
+            {
+                context.sum_rows = chroma_height;
+            }
+        }
+        context.sums = (uint16_t *)decoder_reserve(
+            decoder, DECODER_BUFFER_SUMS, row_sums * context.sum_rows);
+        if (!context.sums)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        memset(context.sums, 0, row_sums * context.sum_rows);
+        scanline_size = (size_t)context.width * 4;
+    }
+    context.scanline = (uint8_t *)decoder_reserve(
+        decoder, DECODER_BUFFER_SCANLINE, scanline_size);
+    if (!context.scanline)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    if (format != PIXEL_FORMAT_YUV420 || !context.interlaced)
+    {
+        return decoder_scan(
+            decoder, decoder->ihdr.height, pixels_row_handler, &context);
+    }
+
+    for (row = 0; row < chroma_height; row += context.sum_rows)
+    {
+        rows = chroma_height - row < context.sum_rows ? chroma_height - row :
+            context.sum_rows;
+        context.first_row = row;
+        memset(context.sums, 0, row_sums * rows);
+        status = decoder_scan(
+            decoder, (row + rows) * 2 < context.height ?
+                (row + rows) * 2 : context.height,
+            pixels_row_handler, &context);
+        if (status == STATUS_OK)
+        {
+            status = yuv_store_rows(&context, rows);
+        }
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t decoder_decode_rgba8(
+    decoder_t *decoder, uint32_t threads, uint8_t *outbuf, size_t *outlen)
+{
+    return decoder_decode_pixels(
+        decoder, PIXEL_FORMAT_RGBA8, threads, outbuf, outlen);
+}
+
+/*
+ * Walks the chunks from the first text chunk, or the image data, to
+ * IEND and records the type, offset and keyword of every well formed
+ * text chunk.  Only text chunks have their CRC verified.
+ */
+static status_t decoder_index_texts(decoder_t *decoder)
+{
+    chunk_t chunk;
+    text_view_t view;
+    size_t start, offset, chunk_offset;
+    uint32_t count, capacity;
+    decoder_text_t *texts, *text;
+    status_t status;
+
+    start = decoder->text_offset != 0 ?
+        decoder->text_offset : decoder->data_offset;
+
+    /* The first walk counts the text chunks, the second records them. */
+    texts = NULL;
+    capacity = 0;
+    status = STATUS_OK;
+    for (;;)
+    {
+        offset = start;
+        count = 0;
+        for (;;)
+        {
+            chunk_offset = offset;
+            status = decoder_chunk_at(
+                decoder, &offset, CHUNK_CRC_CHECK_NONE, &chunk);
+            if (status == STATUS_INCOMPLETE_PACKET ||
+                (status == STATUS_OK && chunk.type == IEND_TYPE))
+            {
+                /* Texts of a truncated datastream are still usable. */
+                status = STATUS_OK;
+                break;
+            }
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+            if (!chunk_is_text(&chunk))
+            {
+                continue;
+            }
+
+            offset = chunk_offset;
+            status = decoder_chunk_at(
+                decoder, &offset, decoder->options.crc_policy, &chunk);
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+            if (text_view_from_chunk(&chunk, &view) != STATUS_OK)
+            {
+                /* Malformed ancillary chunks are ignored. */
+                continue;
+            }
+            if (count < capacity)
+            {
+                text = &texts[count];
+                text->type = chunk.type;
+                text->offset = chunk_offset;
+                memcpy(text->keyword, view.keyword, view.keyword_length);
+                text->keyword[view.keyword_length] = '\0';
+            }
+            count++;
+        }
+
+        if (status != STATUS_OK || capacity != 0 || count == 0)
+        {
+            break;
+        }
+        texts = (decoder_text_t *)engine_allocate(
+            sizeof(decoder_text_t) * count);
+        if (!texts)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        memset(texts, 0, sizeof(decoder_text_t) * count);
+        capacity = count;
+    }
+
+    if (status != STATUS_OK)
+    {
+        free(texts);
+        return status;
+    }
+    decoder->texts = texts;
+    decoder->text_count = count;
+    decoder->texts_indexed = true;
+    return STATUS_OK;
+}
+
+typedef struct {
+    uint8_t const *data;
+    size_t length;
+} text_source_t;
+
+/* Inflate source handing over the compressed text in one block. */
+static status_t text_source(void *context, uint8_t const **data, size_t *length)
+{
+    text_source_t *source;
+
+    source = (text_source_t *)context;
+    if (source->length == 0)
+    {
+        return STATUS_BAD_PACKET;
+    }
+    *data = source->data;
+    *length = source->length;
+    source->length = 0;
+    return STATUS_OK;
+}
+
+/*
+ * Inflates compressed text into a heap block of `*length` bytes, no
+ * larger than the text limit.
+ */
+static status_t decoder_inflate_text(
+    decoder_t *decoder, text_view_t const *view, uint8_t **outbuf,
+    size_t *length)
+{
+    text_source_t source;
+    uint64_t max_bytes;
+    uint8_t *buffer, *grown;
+    size_t capacity, produced;
+    status_t status;
+
+    source.data = view->text;
+    source.length = view->text_length;
+    status = inflater_reset(text_source, &source, &decoder->inflater);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    max_bytes = decoder->options.limits.max_text_bytes;
+    capacity = kTextBlockSize;
+    *length = 0;
+    buffer = NULL;
+    for (;;)
+    {
+        if (!buffer || *length == capacity)
+        {
+            if (buffer)
+            {
+                if (max_bytes > 0 && capacity >= max_bytes)
+                {
+                    status = STATUS_LIMIT_EXCEEDED;
+                    break;
+                }
+                capacity *= 2;
+            }
+            if (max_bytes > 0 && capacity > max_bytes)
+            {
+                /* One more byte tells a text at the limit from a larger one. */
+                capacity = (size_t)max_bytes + 1;
+            }
+            if (capacity > kMallocLimit)
+            {
+                status = STATUS_OUT_OF_MEMORY;
+                break;
+            }
+            grown = (uint8_t *)realloc(buffer, capacity);
+            if (!grown)
+            {
+                status = STATUS_OUT_OF_MEMORY;
+                break;
+            }
+            buffer = grown;
+        }
+
+        status = inflater_read_some(
+            &decoder->inflater, buffer + *length, capacity - *length,
+            &produced);
+        *length += produced;
+        if (status != STATUS_OK || *length < capacity)
+        {
+            break;
+        }
+    }
+
+    if (status == STATUS_OK && max_bytes > 0 && *length > max_bytes)
+    {
+        status = STATUS_LIMIT_EXCEEDED;
+    }
+    if (status == STATUS_OK)
+    {
+        status = inflater_finish(&decoder->inflater);
+    }
+    if (status != STATUS_OK)
+    {
+        free(buffer);
+        return status;
+    }
+    *outbuf = buffer;
+    return STATUS_OK;
+}
+
+/*
+ * Reads the text of an indexed chunk, decompressing it and converting
+ * it to UTF-8, into a block holding the text and language tag.
+ */
+static status_t decoder_decode_text(decoder_t *decoder, decoder_text_t *text)
+{
+    chunk_t chunk;
+    text_view_t view;
+    size_t offset, length, size;
+    uint8_t *inflated, *block;
+    uint8_t const *raw;
+    status_t status;
+
+    /* The CRC was verified while indexing. */
+    offset = text->offset;
+    status = decoder_chunk_at(decoder, &offset, CHUNK_CRC_CHECK_NONE, &chunk);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = text_view_from_chunk(&chunk, &view);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    inflated = NULL;
+    raw = view.text;
+    length = view.text_length;
+    if (view.compressed)
+    {
+        status = decoder_inflate_text(decoder, &view, &inflated, &length);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        raw = inflated;
+    }
+
+    size = (view.utf8 ? length : length * 2) + view.language_length + 2;
+    block = (uint8_t *)engine_allocate(size);
+    if (!block)
+    {
+        free(inflated);
+        return STATUS_OUT_OF_MEMORY;
+    }
+    if (view.utf8)
+    {
+        memcpy(block, raw, length);
+    }
+    else
+    {
+        length = text_latin1_to_utf8(raw, length, block);
+    }
+    block[length] = '\0';
+    if (view.language_length > 0)
+    {
+        memcpy(block + length + 1, view.language, view.language_length);
+    }
+    block[length + 1 + view.language_length] = '\0';
+    free(inflated);
+
+    text->text = (char_t const *)block;
+    text->length = length;
+    text->language = (char_t const *)(block + length + 1);
+    text->size = size;
+    return STATUS_OK;
+}
+
+status_t decoder_get_text(
+    decoder_t *decoder, char_t const *keyword, decoder_text_t const **text)
+{
+    decoder_text_t *entry;
+    uint32_t i;
+    status_t status;
+
+    if (!decoder || !keyword || !text)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    *text = NULL;
+    if (!decoder->inbuf)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if (!decoder->texts_indexed)
+    {
+        status = decoder_index_texts(decoder);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    for (i = 0; i < decoder->text_count; i++)
+    {
+        entry = &decoder->texts[i];
+        if (strcmp(entry->keyword, keyword) != 0)
+        {
+            continue;
+        }
+        if (!entry->text)
+        {
+            status = decoder_decode_text(decoder, entry);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+        }
+        *text = entry;
+        break;
+    }
+    return STATUS_OK;
+}
@@ -0,0 +1,386 @@
+/*
+ *  Image-Formats - PNG Decoder
+ *      Streams the image data of a PNG datastream scanline by scanline.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+#include "anichunk.h"
+#include "base.h"
+#include "chunk.h"
+#include "clrchunk.h"
+#include "color.h"
+#include "imgchunk.h"
+#include "inflate.h"
+#include "pixconv.h"
+#include "registry.h"
+#include "txtchunk.h"
+
+typedef struct {
+    /* Image coordinates of the top left pixel. */
+    uint32_t x;
+    uint32_t y;
+    /* Size of the region in pixels. */
+    uint32_t width;
+    uint32_t height;
+} region_t;
+
+/*
+ * Resources an image may claim before it is rejected with
+ * LIMIT_EXCEEDED.  A limit of 0 disables it.  The size limits are
+ * checked against the header, before anything is allocated.  The
+ * others are checked while inflating, so that a decompression bomb is
+ * cut off early.
+ */
+typedef struct {
+    /* Width times height, 2^28 by default. */
+    uint64_t max_pixels;
+    /*
+     * Size of the image data once inflated, filter type bytes
+     * included.  This bounds the size of every decoded form.
+     */
+    uint64_t max_image_bytes;
+    /*
+     * Ratio of inflated to compressed image data, checked once more
+     * than 1 MiB has been inflated.  Deflate itself cannot exceed
+     * about 1032.
+     */
+    uint32_t max_inflate_ratio;
+    /* CPU time of the inflating thread per decode, in milliseconds. */
+    uint32_t max_cpu_ms;
+    /* Size of a single text once decompressed, 1 MiB by default. */
+    uint64_t max_text_bytes;
+} decoder_limits_t;
+
+typedef struct {
+    /* Chunks whose CRC is verified, all of them by default. */
+    chunk_crc_policy_t crc_policy;
+    /*
+     * Scratch buffers come from and return to `memory.pool`.  They are
+     * wiped on release only with CHUNK_WIPE_ALL, which is not the
+     * default.
+     */
+    chunk_memory_t memory;
+    decoder_limits_t limits;
+    /*
+     * Handlers of the chunks preceding the image data, other than IHDR
+     * and PLTE, or NULL.  A critical chunk without a handler that the
+     * library does not know fails the load.  Not owned by the decoder.
+     */
+    chunk_registry_t const *registry;
+    /*
+     * Applied to RGBA8 output, transparency only by default.  Set
+     * `color.premultiply` for premultiplied output.
+     */
+    color_options_t color;
+} decoder_options_t;
+
+/*
+ * Text chunk of a datastream.  Only the keyword is read when the
+ * chunks are indexed, the rest once the text is first asked for.
+ */
+typedef struct {
+    uint32_t type;
+    /* Offset of the chunk in the datastream. */
+    size_t offset;
+    /* NUL terminated Latin-1 keyword. */
+    char_t keyword[TEXT_KEYWORD_MAX + 1];
+    /* NUL terminated UTF-8 text, or NULL until decoded. */
+    char_t const *text;
+    size_t length;
+    /* NUL terminated iTXt language tag, empty for other chunks. */
+    char_t const *language;
+    /* Size of the block holding `text` and `language`. */
+    size_t size;
+} decoder_text_t;
+
+/* Scratch buffers kept by a decoder across images. */
+typedef enum {
+    /* Filtered scanlines being inflated and unfiltered. */
+    DECODER_BUFFER_ROWS,
+    /* Expanded scanline. */
+    DECODER_BUFFER_SCANLINE,
+    /* Thumbnail column mapping. */
+    DECODER_BUFFER_COLUMNS,
+    /* Thumbnail or chroma channel sums. */
+    DECODER_BUFFER_SUMS,
+    DECODER_BUFFER_COUNT
+} decoder_buffer_t;
+
+typedef struct {
+    /* PNG datastream.  Not owned by the decoder. */
+    uint8_t const *inbuf;
+    size_t inlen;
+    /* Offset of the next unread chunk in `inbuf`. */
+    size_t offset;
+    /* Offset of the first IDAT (or fdAT) chunk in `inbuf`. */
+    size_t data_offset;
+    /* Type of the chunks carrying the image data, IDAT or fdAT. */
+    uint32_t data_type;
+    decoder_options_t options;
+    ihdr_t ihdr;
+    /* Only populated for images that have a PLTE chunk. */
+    palette_table_t palette;
+    /* tRNS, gAMA, cHRM and sRGB of the image. */
+    color_info_t color;
+    /* Color stage of RGBA8 output, computed on first use. */
+    color_stage_t stage;
+    bool_t stage_ready;
+    /* IDAT chunk currently being inflated, pointing into `inbuf`. */
+    chunk_t chunk;
+    inflater_t inflater;
+    /* Image data given to and read from the inflater since the rewind. */
+    uint64_t compressed_bytes;
+    uint64_t inflated_bytes;
+    /* Inflated bytes at which CPU time is checked next. */
+    uint64_t cpu_check_bytes;
+    /* CPU time of the inflating thread at the rewind, in seconds. */
+    double cpu_start;
+    /*
+     * Offset of the first text chunk before the image data, or 0.
+     * This is all loading records of the text chunks.
+     */
+    size_t text_offset;
+    /* Text chunks of the whole datastream, indexed on first use. */
+    decoder_text_t *texts;
+    uint32_t text_count;
+    bool_t texts_indexed;
+    /* Grown on demand and reused by every image loaded. */
+    uint8_t *buffers[DECODER_BUFFER_COUNT];
+    size_t buffer_sizes[DECODER_BUFFER_COUNT];
+} decoder_t;
+
+/*
+ * Function: decoder_options_default
+ *  Initializes decoder options to verify the CRC of every chunk,
+ *  without wiping or pooling scratch buffers, to limit images to 2^28
+ *  pixels and texts to 1 MiB only, and to apply tRNS but not gamma to
+ *  RGBA8 output.
+ */
+status_t decoder_options_default(decoder_options_t *options);
+
+/*
+ * Function: decoder_init
+ *  Initializes a long-lived decoder without an image.  Images are
+ *  read with `decoder_load()`, which reuses the scratch buffers and
+ *  inflate window of previous images, so that decoding images of
+ *  similar size does not allocate memory once warmed up.
+ * Args:
+ *    options - Decoding options, copied into the decoder.  NULL for
+ *              the defaults.
+ *    decoder - Pointer to an uninitialized decoder.
+ */
+status_t decoder_init(decoder_options_t const *options, decoder_t *decoder);
+
+/*
+ * Function: decoder_load
+ *  Reads the chunks preceding the image data of a PNG datastream into
+ *  an initialized decoder, replacing its previous image.  On failure
+ *  the decoder holds no image but can still be loaded again.
+ * Note:
+ *  The decoder does not copy `inbuf`, which must remain valid until
+ *  the next load or until the decoder is closed.
+ * Return:
+ *    As `decoder_open()`.
+ */
+status_t decoder_load(uint8_t const *inbuf, size_t inlen, decoder_t *decoder);
+
+/*
+ * Function: decoder_load_frame
+ *  Loads the image data of an animation frame into an initialized
+ *  decoder, replacing its previous image.  The frame is decoded as an
+ *  image of the size of the frame region, which shares the datastream,
+ *  header and palette of `image`.
+ * Note:
+ *  Nothing is read until the frame is decoded.  The datastream of
+ *  `image` must remain valid as for `decoder_load()`.
+ * Args:
+ *    image - Pointer to a decoder holding the image of the animation.
+ *    fctl - Frame control of the frame.
+ *    data_offset - Offset of the first data chunk of the frame.
+ *    data_type - IDAT_TYPE if the frame is the default image, otherwise
+ *                FDAT_TYPE.
+ *    frame - Pointer to an initialized decoder, other than `image`.
+ * Return:
+ *    OK if the frame was loaded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if `image` holds no image, or the frame does not fit
+ *      into it.
+ */
+status_t decoder_load_frame(
+    decoder_t const *image, fctl_t const *fctl, size_t data_offset,
+    uint32_t data_type, decoder_t *frame);
+
+/*
+ * Function: decoder_open
+ *  Initializes a decoder and reads the chunks preceding the image data
+ *  of a PNG datastream.
+ * Note:
+ *  The decoder does not copy `inbuf`, which must remain valid until
+ *  the decoder is closed.
+ * Args:
+ *    inbuf - Buffer containing a complete PNG datastream.
+ *    inlen - Length of `inbuf`.
+ *    options - Decoding options, copied into the decoder.  NULL for
+ *              the defaults.
+ *    decoder - Pointer to an uninitialized decoder.
+ * Return:
+ *    OK if the header chunks were read.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    BAD_PACKET if the datastream or its IHDR is malformed, or a
+ *      critical chunk is out of order or repeated.  Ancillary chunks
+ *      out of order or repeated are ignored.
+ *    BAD_CRC if a verified chunk is corrupted.
+ *    UNKNOWN_TYPE if an unknown critical chunk was found.
+ *    LIMIT_EXCEEDED if the image is larger than the limits allow.
+ *    Otherwise the status returned by a registered chunk handler.
+ */
+status_t decoder_open(
+    uint8_t const *inbuf, size_t inlen, decoder_options_t const *options,
+    decoder_t *decoder);
+
+/*
+ * Function: decoder_close
+ *  Frees the resources of an initialized decoder and clears it.
+ */
+status_t decoder_close(decoder_t *decoder);
+
+/*
+ * Function: decoder_decode_region
+ *  Decodes a rectangular region of the image into `outbuf`.  The
+ *  region is stored top to bottom in the serialized pixel format of
+ *  the image, each row starting on a byte boundary.  Only two
+ *  scanlines of the image are held in memory, and decoding stops
+ *  after the last scanline that intersects the region.
+ * Args:
+ *    decoder - Pointer to an opened decoder.
+ *    region - Region of the image to decode.  NULL for the whole image.
+ *    outbuf - Destination of the decoded pixels.
+ *    outlen - On input, it should point to the length of `outbuf`.
+ *             On output, it will contain the number of bytes used if
+ *             decoding was successful or the number of bytes expected
+ *             if the buffer was not large enough.
+ * Return:
+ *    OK if the region was decoded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the region is empty or exceeds the image.
+ *    FAILURE if the region could not fit into the provided buffer.
+ *    BAD_PACKET if the image data is malformed.
+ *    LIMIT_EXCEEDED if inflating exceeded the ratio or CPU limit.
+ */
+status_t decoder_decode_region(
+    decoder_t *decoder, region_t const *region,
+    uint8_t *outbuf, size_t *outlen);
+
+/*
+ * Function: decoder_decode_thumbnail
+ *  Decodes a downscaled copy of the image as 8-bit RGBA.  Each
+ *  scanline is unfiltered, expanded and averaged into the output
+ *  pixels it covers (box filter) in a single pass, so the full
+ *  resolution image is never held in memory.  Interlaced rows arrive
+ *  out of order: the sums of as many thumbnail rows as fit in 4 MiB
+ *  are kept, and the image data is scanned once per such band.
+ * Args:
+ *    decoder - Pointer to an opened decoder.
+ *    width - Width of the thumbnail, at most the image width.
+ *    height - Height of the thumbnail, at most the image height.
+ *    outbuf - Destination of `width` * `height` * 4 bytes.
+ *    outlen - On input, it should point to the length of `outbuf`.
+ *             On output, it will contain the number of bytes used if
+ *             decoding was successful or the number of bytes expected
+ *             if the buffer was not large enough.
+ * Return:
+ *    OK if the thumbnail was decoded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the thumbnail is empty or larger than the image.
+ *    FAILURE if the thumbnail could not fit into the provided buffer.
+ *    BAD_PACKET if the image data is malformed.
+ *    LIMIT_EXCEEDED if inflating exceeded the ratio or CPU limit.
+ *    OUT_OF_MEM if the sums of a thumbnail row, 32 bytes per pixel,
+ *      do not fit in 4 MiB.
+ */
+status_t decoder_decode_thumbnail(
+    decoder_t *decoder, uint32_t width, uint32_t height,
+    uint8_t *outbuf, size_t *outlen);
+
+/*
+ * Function: decoder_decode_pixels
+ *  Decodes the whole image in a pixel format.  Each scanline is
+ *  written in the format as soon as it is unfiltered, so no RGBA8 copy
+ *  of the image is made.  The color options apply to every format.
+ *
+ *  With more than one thread, the calling thread inflates the image
+ *  data into a ring of scanline bands while worker threads unfilter
+ *  and expand earlier bands.  Unfiltering a band only waits for the
+ *  last scanline of the band before it, so expansion of every band
+ *  and inflating overlap with the unfiltering chain.  If no worker
+ *  thread can be started, and for interlaced images, the image is
+ *  decoded on the calling thread.  Interlaced YUV420 chroma rows
+ *  arrive out of order: the sums of as many chroma rows as fit in
+ *  4 MiB are kept, and the image data is scanned once per band.
+ * Args:
+ *    decoder - Pointer to an opened decoder.
+ *    format - Layout of the decoded pixels.
+ *    threads - Number of worker threads.  0 or 1 decodes on the
+ *              calling thread only.
+ *    outbuf - Destination of the image, as sized by
+ *             `pixconv_format_size()`.
+ *    outlen - On input, it should point to the length of `outbuf`.
+ *             On output, it will contain the number of bytes used if
+ *             decoding was successful or the number of bytes expected
+ *             if the buffer was not large enough.
+ * Return:
+ *    OK if the image was decoded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the format is not known.
+ *    FAILURE if the image could not fit into the provided buffer.
+ *    BAD_PACKET if the image data is malformed.
+ *    LIMIT_EXCEEDED if inflating exceeded the ratio or CPU limit.
+ *    OUT_OF_MEM if the YUV420 chroma sums of a row, 3 bytes per pixel,
+ *      do not fit in 4 MiB.
+ */
+status_t decoder_decode_pixels(
+    decoder_t *decoder, pixel_format_t format, uint32_t threads,
+    uint8_t *outbuf, size_t *outlen);
+
+/*
+ * Function: decoder_decode_rgba8
+ *  Decodes the whole image as 8-bit RGBA, premultiplied by alpha if
+ *  the color options ask for it.  Same as `decoder_decode_pixels()`
+ *  with PIXEL_FORMAT_RGBA8.
+ */
+status_t decoder_decode_rgba8(
+    decoder_t *decoder, uint32_t threads, uint8_t *outbuf, size_t *outlen);
+
+/*
+ * Function: decoder_get_text
+ *  Finds the first tEXt, zTXt or iTXt chunk with the given keyword,
+ *  anywhere in the datastream.  Text chunks are neither read nor
+ *  decompressed while decoding.  The first call indexes their
+ *  keywords, and the text of a keyword is decompressed and converted
+ *  to UTF-8 the first time it is asked for, then kept by the decoder
+ *  until the next load.
+ * Note:
+ *  Shares the inflater with the image data, so must not be called
+ *  while the image is being decoded.
+ * Args:
+ *    decoder - Pointer to an opened decoder.
+ *    keyword - NUL terminated keyword.
+ *    text - Will point to the text, or NULL if no chunk has the
+ *           keyword.  Valid until the next load or close.
+ * Return:
+ *    OK if the text was found or there is none.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the decoder holds no image.
+ *    BAD_PACKET if the chunk or its compressed text is malformed.
+ *    BAD_CRC if a verified chunk is corrupted.
+ *    OUT_OF_MEM if the text could not be allocated.
+ *    LIMIT_EXCEEDED if the text is larger than the limits allow.
+ */
+status_t decoder_get_text(
+    decoder_t *decoder, char_t const *keyword, decoder_text_t const **text);
+
+#endif /* _DECODER_H_ */
@@ -0,0 +1,1380 @@
+/*
+ *  Image-Formats - Deflate
+ *      Compresses zlib datastreams (RFC1950, RFC1951).
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "inflate.h"
+
+#include "deflate.h"
+
+/* Back references may reach up to 32 KiB into the input. */
+static uint32_t const kWindowSize = 32768;
+static uint32_t const kWindowMask = 32767;
+
+static uint32_t const kMinMatch = 3;
+static uint32_t const kMaxMatch = 258;
+/* Input kept ahead of the current position, so any match fits. */
+static uint32_t const kMinLookahead = 258 + 3 + 1;
+static uint32_t const kMaxDistance = 32768 - (258 + 3 + 1);
+/* Matches of the minimum length are not worth a long distance. */
+static uint32_t const kTooFar = 4096;
+
+static uint32_t const kHashSize = 1u << 15;
+static uint32_t const kNil = 0;
+
+/* Symbols buffered before a block is emitted. */
+static uint32_t const kMaxSymbols = 16384;
+static uint32_t const kMaxStoredLength = 65535;
+
+/* zlib header fields.  Defined in RFC1950 Section 2.2. */
+static uint8_t const kZlibMethod = 0x78;
+static uint32_t const kHeaderCheckBase = 31;
+
+/* Block types.  Defined in RFC1951 Section 3.2.3. */
+static uint32_t const kBlockStored = 0;
+static uint32_t const kBlockFixed = 1;
+static uint32_t const kBlockDynamic = 2;
+
+#define LITERAL_CODES 286
+#define DISTANCE_CODES 30
+#define CODE_LENGTH_CODES 19
+#define FIXED_LITERAL_CODES 288
+
+static uint32_t const kEndOfBlock = 256;
+static uint32_t const kMaxCodeBits = 15;
+static uint32_t const kMaxCodeLengthBits = 7;
+
+/* Base values and extra bits of length and distance codes. */
+static uint16_t const kLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static uint8_t const kLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static uint16_t const kDistanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static uint8_t const kDistanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* Transmission order of the code length code lengths. */
+static uint8_t const kCodeLengthOrder[CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Matching parameters of every level, as in zlib. */
+typedef struct {
+    uint16_t good_length;
+    uint16_t lazy_length;
+    uint16_t nice_length;
+    uint16_t max_chain;
+} level_config_t;
+
+static level_config_t const kLevels[DEFLATE_MAX_LEVEL + 1] = {
+    {0, 0, 0, 0},
+    {4, 4, 8, 4},
+    {4, 5, 16, 8},
+    {4, 6, 32, 32},
+    {4, 4, 16, 16},
+    {8, 16, 32, 32},
+    {8, 16, 128, 128},
+    {8, 32, 128, 256},
+    {32, 128, 258, 1024},
+    {32, 258, 258, 4096}
+};
+/* Levels up to this one insert short matches greedily. */
+static uint32_t const kGreedyLevel = 3;
+
+typedef struct {
+    uint32_t frequency;
+    uint16_t symbol;
+} symbol_frequency_t;
+
+/* Huffman code of a block alphabet. */
+typedef struct {
+    uint8_t lengths[FIXED_LITERAL_CODES];
+    uint16_t codes[FIXED_LITERAL_CODES];
+} huffman_code_t;
+
+/* Run-length encoded code lengths of a dynamic block header. */
+typedef struct {
+    uint8_t symbols[LITERAL_CODES + DISTANCE_CODES];
+    uint8_t extra[LITERAL_CODES + DISTANCE_CODES];
+    uint32_t count;
+} code_length_runs_t;
+
+/*
+ *  Output
+ */
+
+static void put_byte(deflater_t *deflater, uint8_t byte)
+{
+    status_t status;
+
+    deflater->output[deflater->output_length++] = byte;
+    if (deflater->output_length == deflater->output_size)
+    {
+        if (deflater->status == STATUS_OK)
+        {
+            status = deflater->sink(
+                deflater->sink_context, deflater->output,
+                deflater->output_length);
+            deflater->status = status;
+        }
+        deflater->output_length = 0;
+    }
+}
+
+/* Appends `count` bits of `value`, least significant bit first. */
+static void put_bits(deflater_t *deflater, uint32_t value, uint32_t count)
+{
+    deflater->bit_buffer |= (uint64_t)value << deflater->bit_count;
+    deflater->bit_count += count;
+    if (deflater->bit_count >= 32)
+    {
+        put_byte(deflater, (uint8_t)deflater->bit_buffer);
+        put_byte(deflater, (uint8_t)(deflater->bit_buffer >> 8));
+        put_byte(deflater, (uint8_t)(deflater->bit_buffer >> 16));
+        put_byte(deflater, (uint8_t)(deflater->bit_buffer >> 24));
+        deflater->bit_buffer >>= 32;
+        deflater->bit_count -= 32;
+    }
+}
+
+/* Pads the output to a byte boundary and flushes the bit buffer. */
+static void align_bits(deflater_t *deflater)
+{
+    if (deflater->bit_count & 7)
+    {
+        put_bits(deflater, 0, 8 - (deflater->bit_count & 7));
+    }
+    while (deflater->bit_count > 0)
+    {
+        put_byte(deflater, (uint8_t)deflater->bit_buffer);
+        deflater->bit_buffer >>= 8;
+        deflater->bit_count -= 8;
+    }
+}
+
+/* Appends bytes, the output must be byte aligned. */
+static void put_bytes(deflater_t *deflater, uint8_t const *data, size_t length)
+{
+    size_t count;
+
+    while (length > 0)
+    {
+        count = deflater->output_size - deflater->output_length - 1;
+        if (count > length - 1)
+        {
+            count = length - 1;
+        }
+        memcpy(deflater->output + deflater->output_length, data, count);
+        deflater->output_length += count;
+        /* The last byte goes through put_byte() to reach the sink. */
+        put_byte(deflater, data[count]);
+        data += count + 1;
+        length -= count + 1;
+    }
+}
+
+/*
+ *  Huffman codes
+ */
+
+static int compare_frequency(void const *a, void const *b)
+{
+    symbol_frequency_t const *fa, *fb;
+    fa = (symbol_frequency_t const *)a;
+    fb = (symbol_frequency_t const *)b;
+    if (fa->frequency != fb->frequency)
+    {
+        return fa->frequency < fb->frequency ? -1 : 1;
+    }
+    return fa->symbol < fb->symbol ? -1 : (fa->symbol > fb->symbol);
+}
+
+/*
+ * Replaces the frequencies of symbols sorted by increasing frequency
+ * with their optimal code lengths.  In-place algorithm of Moffat and
+ * Katajainen.
+ */
+static void minimum_redundancy(symbol_frequency_t *items, int32_t count)
+{
+    int32_t root, leaf, next, available, used, depth;
+
+    if (count == 1)
+    {
+        items[0].frequency = 1;
+        return;
+    }
+
+    items[0].frequency += items[1].frequency;
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < count - 1; next++)
+    {
+        if (leaf >= count || items[root].frequency < items[leaf].frequency)
+        {
+            items[next].frequency = items[root].frequency;
+            items[root++].frequency = (uint32_t)next;
+        }
+        else
+        {
+            items[next].frequency = items[leaf++].frequency;
+        }
+
+        if (leaf >= count ||
+            (root < next && items[root].frequency < items[leaf].frequency))
+        {
+            items[next].frequency += items[root].frequency;
+            items[root++].frequency = (uint32_t)next;
+        }
+        else
+        {
+            items[next].frequency += items[leaf++].frequency;
+        }
+    }
+
+    items[count - 2].frequency = 0;
+    for (next = count - 3; next >= 0; next--)
+    {
+        items[next].frequency = items[items[next].frequency].frequency + 1;
+    }
+
+    available = 1;
+    used = 0;
+    depth = 0;
+    root = count - 2;
+    next = count - 1;
+    while (available > 0)
+    {
+        while (root >= 0 && (int32_t)items[root].frequency == depth)
+        {
+            used++;
+            root--;
+        }
+        while (available > used)
+        {
+            items[next--].frequency = (uint32_t)depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/* Assigns canonical codes, bit reversed for output, to code lengths. */
+static void assign_codes(huffman_code_t *code, uint32_t count)
+{
+    uint16_t length_count[16], next_code[16];
+    uint32_t i, bits, value, reversed;
+
+    memset(length_count, 0, sizeof(length_count));
+    for (i = 0; i < count; i++)
+    {
+        length_count[code->lengths[i]]++;
+    }
+    length_count[0] = 0;
+
+    value = 0;
+    for (bits = 1; bits <= kMaxCodeBits; bits++)
+    {
+        value = (value + length_count[bits - 1]) << 1;
+        next_code[bits] = (uint16_t)value;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        bits = code->lengths[i];
+        if (bits == 0)
+        {
+            code->codes[i] = 0;
+            continue;
+        }
+        value = next_code[bits]++;
+        reversed = 0;
+        while (bits-- > 0)
+        {
+            reversed = (reversed << 1) | (value & 1);
+            value >>= 1;
+        }
+        code->codes[i] = (uint16_t)reversed;
+    }
+}
+
+/*
+ * Builds a length limited Huffman code for `count` symbols.  At least
+ * two symbols get a code so that the code is always complete.
+ */
+static void build_code(
+    uint32_t const *frequencies, uint32_t count, uint32_t max_bits,
+    huffman_code_t *code)
+{
+    symbol_frequency_t items[FIXED_LITERAL_CODES];
+    uint32_t length_count[16];
+    uint32_t used, i, bits, total;
+
+    memset(code->lengths, 0, sizeof(code->lengths));
+    used = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (frequencies[i] > 0)
+        {
+            items[used].frequency = frequencies[i];
+            items[used].symbol = (uint16_t)i;
+            used++;
+        }
+    }
+    for (i = 0; used < 2; i++)
+    {
+        if (frequencies[i] == 0)
+        {
+            items[used].frequency = 1;
+            items[used].symbol = (uint16_t)i;
+            used++;
+        }
+    }
+
+    qsort(items, used, sizeof(symbol_frequency_t), compare_frequency);
+    minimum_redundancy(items, (int32_t)used);
+
+    /* Move codes longer than the limit up, keeping the code complete. */
+    memset(length_count, 0, sizeof(length_count));
+    for (i = 0; i < used; i++)
+    {
+        bits = items[i].frequency;
+        length_count[bits > max_bits ? max_bits : bits]++;
+    }
+    total = 0;
+    for (bits = 1; bits <= max_bits; bits++)
+    {
+        total += length_count[bits] << (max_bits - bits);
+    }
+    while (total > (1u << max_bits))
+    {
+        length_count[max_bits]--;
+        for (bits = max_bits - 1; bits > 0; bits--)
+        {
+            if (length_count[bits] > 0)
+            {
+                length_count[bits]--;
+                length_count[bits + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    /* The least frequent symbols get the longest codes. */
+    i = 0;
+    for (bits = max_bits; bits > 0; bits--)
+    {
+        while (length_count[bits]-- > 0)
+        {
+            code->lengths[items[i++].symbol] = (uint8_t)bits;
+        }
+    }
+    assign_codes(code, count);
+}
+
+static void build_fixed_codes(
+    huffman_code_t *literals, huffman_code_t *distances)
+{
+    uint32_t i;
+
+    for (i = 0; i < FIXED_LITERAL_CODES; i++)
+    {
+        literals->lengths[i] =
+            (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    }
+    assign_codes(literals, FIXED_LITERAL_CODES);
+    for (i = 0; i < DISTANCE_CODES; i++)
+    {
+        distances->lengths[i] = 5;
+    }
+    assign_codes(distances, DISTANCE_CODES);
+}
+
+/* Run-length encodes the code lengths of a dynamic block. */
+static void encode_code_lengths(
+    uint8_t const *lengths, uint32_t count, code_length_runs_t *runs,
+    uint32_t *frequencies)
+{
+    uint32_t i, run, step;
+    uint8_t value;
+
+    runs->count = 0;
+    for (i = 0; i < count; i += run)
+    {
+        value = lengths[i];
+        run = 1;
+        while (i + run < count && lengths[i + run] == value)
+        {
+            run++;
+        }
+
+        step = run;
+        if (value == 0)
+        {
+            while (step >= 11)
+            {
+                uint32_t n = step > 138 ? 138 : step;
+                runs->symbols[runs->count] = 18;
+                runs->extra[runs->count++] = (uint8_t)(n - 11);
+                step -= n;
+            }
+            if (step >= 3)
+            {
+                runs->symbols[runs->count] = 17;
+                runs->extra[runs->count++] = (uint8_t)(step - 3);
+                step = 0;
+            }
+        }
+        else
+        {
+            runs->symbols[runs->count] = value;
+            runs->extra[runs->count++] = 0;
+            step--;
+            while (step >= 3)
+            {
+                uint32_t n = step > 6 ? 6 : step;
+                runs->symbols[runs->count] = 16;
+                runs->extra[runs->count++] = (uint8_t)(n - 3);
+                step -= n;
+            }
+        }
+        while (step-- > 0)
+        {
+            runs->symbols[runs->count] = value;
+            runs->extra[runs->count++] = 0;
+        }
+    }
+
+    for (i = 0; i < runs->count; i++)
+    {
+        frequencies[runs->symbols[i]]++;
+    }
+}
+
+/*
+ *  Blocks
+ */
+
+static uint32_t distance_code(deflater_t const *deflater, uint32_t distance)
+{
+    distance--;
+    return (distance < 256) ? deflater->distance_codes[distance] :
+        deflater->distance_codes[256 + (distance >> 7)];
+}
+
+/* Number of bits used by the symbols of a block under a code. */
+static uint64_t block_data_bits(
+    uint32_t const *literal_frequencies, uint32_t const *distance_frequencies,
+    huffman_code_t const *literals, huffman_code_t const *distances)
+{
+    uint64_t bits;
+    uint32_t i;
+
+    bits = 0;
+    for (i = 0; i < LITERAL_CODES; i++)
+    {
+        bits += (uint64_t)literal_frequencies[i] * literals->lengths[i];
+        if (i > kEndOfBlock)
+        {
+            bits += (uint64_t)literal_frequencies[i] *
+                kLengthExtra[i - kEndOfBlock - 1];
+        }
+    }
+    for (i = 0; i < DISTANCE_CODES; i++)
+    {
+        bits += (uint64_t)distance_frequencies[i] *
+            (distances->lengths[i] + kDistanceExtra[i]);
+    }
+    return bits;
+}
+
+static void put_symbols(
+    deflater_t *deflater, huffman_code_t const *literals,
+    huffman_code_t const *distances)
+{
+    uint32_t i, symbol, value, distance, code;
+
+    for (i = 0; i < deflater->symbol_count; i++)
+    {
+        symbol = deflater->symbols[i];
+        value = symbol & 0xffff;
+        distance = symbol >> 16;
+        if (distance == 0)
+        {
+            put_bits(deflater, literals->codes[value],
+                     literals->lengths[value]);
+            continue;
+        }
+
+        code = deflater->length_codes[value];
+        put_bits(deflater, literals->codes[kEndOfBlock + 1 + code],
+                 literals->lengths[kEndOfBlock + 1 + code]);
+        put_bits(deflater, value - kLengthBase[code], kLengthExtra[code]);
+
+        code = distance_code(deflater, distance);
+        put_bits(deflater, distances->codes[code], distances->lengths[code]);
+        put_bits(deflater, distance - kDistanceBase[code],
+                 kDistanceExtra[code]);
+    }
+    put_bits(deflater, literals->codes[kEndOfBlock],
+             literals->lengths[kEndOfBlock]);
+}
+
+static void put_stored(
+    deflater_t *deflater, uint8_t const *data, uint32_t length, bool_t final)
+{
+    uint32_t count;
+
+    do
+    {
+        count = length > kMaxStoredLength ? kMaxStoredLength : length;
+        put_bits(deflater, (final && count == length) ? 1 : 0, 1);
+        put_bits(deflater, kBlockStored, 2);
+        align_bits(deflater);
+        put_byte(deflater, (uint8_t)count);
+        put_byte(deflater, (uint8_t)(count >> 8));
+        put_byte(deflater, (uint8_t)~count);
+        put_byte(deflater, (uint8_t)(~count >> 8));
+        put_bytes(deflater, data, count);
+        data += count;
+        length -= count;
+    } while (length > 0);
+}
+
+/*
+ * Emits the symbols of the current block as a stored, fixed or dynamic
+ * block, whichever is the smallest.
+ */
+static void emit_block(deflater_t *deflater, bool_t final)
+{
+    uint32_t literal_frequencies[LITERAL_CODES];
+    uint32_t distance_frequencies[DISTANCE_CODES];
+    uint32_t length_frequencies[CODE_LENGTH_CODES];
+    uint8_t lengths[LITERAL_CODES + DISTANCE_CODES];
+    huffman_code_t literals, distances, code_lengths;
+    huffman_code_t fixed_literals, fixed_distances;
+    code_length_runs_t runs;
+    uint32_t i, symbol, literal_count, distance_count, length_count;
+    uint64_t dynamic_bits, fixed_bits, stored_bits;
+
+    memset(literal_frequencies, 0, sizeof(literal_frequencies));
+    memset(distance_frequencies, 0, sizeof(distance_frequencies));
+    memset(length_frequencies, 0, sizeof(length_frequencies));
+    for (i = 0; i < deflater->symbol_count; i++)
+    {
+        symbol = deflater->symbols[i];
+        if ((symbol >> 16) == 0)
+        {
+            literal_frequencies[symbol & 0xff]++;
+        }
+        else
+        {
+            literal_frequencies[kEndOfBlock + 1 +
+                deflater->length_codes[symbol & 0xffff]]++;
+            distance_frequencies[distance_code(deflater, symbol >> 16)]++;
+        }
+    }
+    literal_frequencies[kEndOfBlock] = 1;
+
+    build_code(literal_frequencies, LITERAL_CODES, kMaxCodeBits, &literals);
+    build_code(distance_frequencies, DISTANCE_CODES, kMaxCodeBits, &distances);
+
+    literal_count = LITERAL_CODES;
+    while (literal_count > kEndOfBlock + 1 &&
+           literals.lengths[literal_count - 1] == 0)
+    {
+        literal_count--;
+    }
+    distance_count = DISTANCE_CODES;
+    while (distance_count > 1 && distances.lengths[distance_count - 1] == 0)
+    {
+        distance_count--;
+    }
+    memcpy(lengths, literals.lengths, literal_count);
+    memcpy(lengths + literal_count, distances.lengths, distance_count);
+    encode_code_lengths(
+        lengths, literal_count + distance_count, &runs, length_frequencies);
+    build_code(length_frequencies, CODE_LENGTH_CODES, kMaxCodeLengthBits,
+               &code_lengths);
+    length_count = CODE_LENGTH_CODES;
+    while (length_count > 4 &&
+           code_lengths.lengths[kCodeLengthOrder[length_count - 1]] == 0)
+    {
+        length_count--;
+    }
+
+    /* Header sizes, then the size of the data in every block type. */
+    dynamic_bits = 3 + 5 + 5 + 4 + 3 * (uint64_t)length_count;
+    for (i = 0; i < CODE_LENGTH_CODES; i++)
+    {
+        dynamic_bits += (uint64_t)length_frequencies[i] *
+            code_lengths.lengths[i];
+    }
+    dynamic_bits += 2 * (uint64_t)length_frequencies[16] +
+        3 * (uint64_t)length_frequencies[17] +
+        7 * (uint64_t)length_frequencies[18];
+    dynamic_bits += block_data_bits(
+        literal_frequencies, distance_frequencies, &literals, &distances);
+
+    build_fixed_codes(&fixed_literals, &fixed_distances);
+    fixed_bits = 3 + block_data_bits(
+        literal_frequencies, distance_frequencies,
+        &fixed_literals, &fixed_distances);
+
+    stored_bits = (uint64_t)deflater->block_bytes * 8 +
+        (uint64_t)(deflater->block_bytes / kMaxStoredLength + 1) * (3 + 7 + 32);
+
+    if (stored_bits < fixed_bits && stored_bits < dynamic_bits)
+    {
+        put_stored(deflater, deflater->window + deflater->block_start,
+                   deflater->block_bytes, final);
+    }
+    else if (fixed_bits <= dynamic_bits)
+    {
+        put_bits(deflater, final ? 1 : 0, 1);
+        put_bits(deflater, kBlockFixed, 2);
+        put_symbols(deflater, &fixed_literals, &fixed_distances);
+    }
+    else
+    {
+        put_bits(deflater, final ? 1 : 0, 1);
+        put_bits(deflater, kBlockDynamic, 2);
+        put_bits(deflater, literal_count - 257, 5);
+        put_bits(deflater, distance_count - 1, 5);
+        put_bits(deflater, length_count - 4, 4);
+        for (i = 0; i < length_count; i++)
+        {
+            put_bits(deflater, code_lengths.lengths[kCodeLengthOrder[i]], 3);
+        }
+        for (i = 0; i < runs.count; i++)
+        {
+            symbol = runs.symbols[i];
+            put_bits(deflater, code_lengths.codes[symbol],
+                     code_lengths.lengths[symbol]);
+            if (symbol >= 16)
+            {
+                put_bits(deflater, runs.extra[i],
+                         symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+            }
+        }
+        put_symbols(deflater, &literals, &distances);
+    }
+
+    deflater->block_start += deflater->block_bytes;
+    deflater->block_bytes = 0;
+    deflater->symbol_count = 0;
+}
+
+/*
+ *  Matching
+ */
+
+static void record_literal(deflater_t *deflater, uint8_t literal)
+{
+    deflater->symbols[deflater->symbol_count++] = literal;
+    deflater->block_bytes++;
+}
+
+static void record_match(
+    deflater_t *deflater, uint32_t distance, uint32_t length)
+{
+    deflater->symbols[deflater->symbol_count++] = (distance << 16) | length;
+    deflater->block_bytes += length;
+}
+
+/* Inserts the string at `position` and returns the previous head. */
+static uint32_t insert_string(deflater_t *deflater, uint32_t position)
+{
+    uint8_t const *data;
+    uint32_t hash, head;
+
+    data = deflater->window + position;
+    hash = (((uint32_t)data[0] << 10) ^ ((uint32_t)data[1] << 5) ^ data[2]) &
+        (kHashSize - 1);
+    head = deflater->head[hash];
+    deflater->prev[position & kWindowMask] = (uint16_t)head;
+    deflater->head[hash] = (uint16_t)position;
+    return head;
+}
+
+/* Length of the longest match found in the chain starting at `match`. */
+static uint32_t longest_match(deflater_t *deflater, uint32_t match)
+{
+    uint8_t const *scan, *candidate;
+    uint32_t chain, best, length, max_length, nice, limit;
+
+    scan = deflater->window + deflater->strstart;
+    best = deflater->prev_length;
+    max_length = deflater->lookahead < kMaxMatch ?
+        deflater->lookahead : kMaxMatch;
+    if (best >= max_length)
+    {
+        return best;
+    }
+    nice = deflater->nice_length < max_length ?
+        deflater->nice_length : max_length;
+    chain = deflater->max_chain;
+    if (best >= deflater->good_length)
+    {
+        chain >>= 2;
+    }
+    limit = deflater->strstart > kMaxDistance ?
+        deflater->strstart - kMaxDistance : kNil;
+
+    do
+    {
+        candidate = deflater->window + match;
+        if (candidate[best] != scan[best] || candidate[0] != scan[0] ||
+            candidate[1] != scan[1])
+        {
+            continue;
+        }
+        length = 2;
+        while (length < max_length && candidate[length] == scan[length])
+        {
+            length++;
+        }
+        if (length > best)
+        {
+            deflater->match_start = match;
+            best = length;
+            if (length >= nice)
+            {
+                break;
+            }
+        }
+    } while ((match = deflater->prev[match & kWindowMask]) > limit &&
+             --chain != 0);
+
+    return best;
+}
+
+/* Finds a match at every position and takes it, for fast levels. */
+static void deflate_greedy(deflater_t *deflater, bool_t flush)
+{
+    uint32_t head, length;
+
+    for (;;)
+    {
+        if (deflater->lookahead < kMinLookahead && !flush)
+        {
+            return;
+        }
+        if (deflater->lookahead == 0)
+        {
+            return;
+        }
+
+        head = kNil;
+        if (deflater->lookahead >= kMinMatch)
+        {
+            head = insert_string(deflater, deflater->strstart);
+        }
+        length = 0;
+        if (head != kNil && deflater->strstart - head <= kMaxDistance)
+        {
+            deflater->prev_length = kMinMatch - 1;
+            length = longest_match(deflater, head);
+        }
+
+        if (length >= kMinMatch)
+        {
+            record_match(
+                deflater, deflater->strstart - deflater->match_start, length);
+            deflater->lookahead -= length;
+            if (length <= deflater->lazy_length &&
+                deflater->lookahead >= kMinMatch)
+            {
+                /* The first string of the match is already inserted. */
+                while (--length > 0)
+                {
+                    deflater->strstart++;
+                    insert_string(deflater, deflater->strstart);
+                }
+                deflater->strstart++;
+            }
+            else
+            {
+                deflater->strstart += length;
+            }
+        }
+        else
+        {
+            record_literal(deflater, deflater->window[deflater->strstart]);
+            deflater->lookahead--;
+            deflater->strstart++;
+        }
+
+        if (deflater->symbol_count == kMaxSymbols)
+        {
+            emit_block(deflater, false);
+        }
+    }
+}
+
+/*
+ * Only takes a match if the next position has no longer one,
+ * otherwise emits a literal, for better levels.
+ */
+static void deflate_lazy(deflater_t *deflater, bool_t flush)
+{
+    uint32_t head, prev_match, max_insert;
+
+    for (;;)
+    {
+        if (deflater->lookahead < kMinLookahead && !flush)
+        {
+            return;
+        }
+        if (deflater->lookahead == 0)
+        {
+            break;
+        }
+
+        head = kNil;
+        if (deflater->lookahead >= kMinMatch)
+        {
+            head = insert_string(deflater, deflater->strstart);
+        }
+
+        deflater->prev_length = deflater->match_length;
+        prev_match = deflater->match_start;
+        deflater->match_length = kMinMatch - 1;
+        if (head != kNil && deflater->prev_length < deflater->lazy_length &&
+            deflater->strstart - head <= kMaxDistance)
+        {
+            deflater->match_length = longest_match(deflater, head);
+            if (deflater->match_length == kMinMatch &&
+                deflater->strstart - deflater->match_start > kTooFar)
+            {
+                deflater->match_length = kMinMatch - 1;
+            }
+        }
+
+        if (deflater->prev_length >= kMinMatch &&
+            deflater->match_length <= deflater->prev_length)
+        {
+            max_insert = deflater->strstart + deflater->lookahead - kMinMatch;
+            record_match(deflater, deflater->strstart - 1 - prev_match,
+                         deflater->prev_length);
+            /* The first two strings of the match are already inserted. */
+            deflater->lookahead -= deflater->prev_length - 1;
+            deflater->prev_length -= 2;
+            do
+            {
+                if (++deflater->strstart <= max_insert)
+                {
+                    insert_string(deflater, deflater->strstart);
+                }
+            } while (--deflater->prev_length != 0);
+            deflater->match_available = false;
+            deflater->match_length = kMinMatch - 1;
+            deflater->strstart++;
+        }
+        else if (deflater->match_available)
+        {
+            record_literal(deflater, deflater->window[deflater->strstart - 1]);
+            deflater->strstart++;
+            deflater->lookahead--;
+        }
+        else
+        {
+            deflater->match_available = true;
+            deflater->strstart++;
+            deflater->lookahead--;
+        }
+
+        if (deflater->symbol_count >= kMaxSymbols - 1)
+        {
+            emit_block(deflater, false);
+        }
+    }
+
+    if (deflater->match_available)
+    {
+        record_literal(deflater, deflater->window[deflater->strstart - 1]);
+        deflater->match_available = false;
+    }
+}
+
+/* Stores the input as is, for level 0. */
+static void deflate_stored(deflater_t *deflater, bool_t flush)
+{
+    deflater->block_bytes += deflater->lookahead;
+    deflater->strstart += deflater->lookahead;
+    deflater->lookahead = 0;
+    if (!flush && deflater->block_bytes >= kWindowSize)
+    {
+        put_stored(deflater, deflater->window + deflater->block_start,
+                   deflater->block_bytes, false);
+        deflater->block_start += deflater->block_bytes;
+        deflater->block_bytes = 0;
+    }
+}
+
+static void deflate_run(deflater_t *deflater, bool_t flush)
+{
+    if (deflater->level == 0)
+    {
+        deflate_stored(deflater, flush);
+    }
+    else if (deflater->level <= kGreedyLevel)
+    {
+        deflate_greedy(deflater, flush);
+    }
+    else
+    {
+        deflate_lazy(deflater, flush);
+    }
+}
+
+/* Moves the upper window down to make room for more input. */
+static void slide_window(deflater_t *deflater)
+{
+    uint32_t i;
+
+    /* The current block must not lose the input it covers. */
+    if (deflater->block_start < kWindowSize)
+    {
+        if (deflater->level == 0)
+        {
+            put_stored(deflater, deflater->window + deflater->block_start,
+                       deflater->block_bytes, false);
+            deflater->block_start += deflater->block_bytes;
+            deflater->block_bytes = 0;
+        }
+        else
+        {
+            emit_block(deflater, false);
+        }
+    }
+
+    memmove(deflater->window, deflater->window + kWindowSize, kWindowSize);
+    deflater->strstart -= kWindowSize;
+    deflater->block_start -= kWindowSize;
+    deflater->match_start = deflater->match_start >= kWindowSize ?
+        deflater->match_start - kWindowSize : kNil;
+    for (i = 0; i < kHashSize; i++)
+    {
+        deflater->head[i] = deflater->head[i] >= kWindowSize ?
+            (uint16_t)(deflater->head[i] - kWindowSize) : (uint16_t)kNil;
+    }
+    for (i = 0; i < kWindowSize; i++)
+    {
+        deflater->prev[i] = deflater->prev[i] >= kWindowSize ?
+            (uint16_t)(deflater->prev[i] - kWindowSize) : (uint16_t)kNil;
+    }
+}
+
+/* Second byte of the zlib header, after the method. */
+static uint32_t zlib_header_flags(uint32_t level)
+{
+    uint32_t flags;
+
+    /* Compression level hint, from fastest to maximum. */
+    flags = (level <= 1) ? 0 : (level <= 5) ? 1 : (level == 6) ? 2 : 3;
+    flags <<= 6;
+    flags += kHeaderCheckBase -
+        (((uint32_t)kZlibMethod << 8) + flags) % kHeaderCheckBase;
+    return flags;
+}
+
+static void put_zlib_header(deflater_t *deflater)
+{
+    put_byte(deflater, kZlibMethod);
+    put_byte(deflater, (uint8_t)zlib_header_flags(deflater->level));
+    deflater->started = true;
+}
+
+/* Compresses the remaining input into a last block before a flush. */
+static void end_block(deflater_t *deflater, bool_t final)
+{
+    deflate_run(deflater, true);
+    if (deflater->level == 0)
+    {
+        put_stored(deflater, deflater->window + deflater->block_start,
+                   deflater->block_bytes, final);
+        deflater->block_start += deflater->block_bytes;
+        deflater->block_bytes = 0;
+    }
+    else
+    {
+        emit_block(deflater, final);
+    }
+}
+
+/* Hands the output buffered so far to the sink. */
+static void flush_output(deflater_t *deflater)
+{
+    if (deflater->output_length > 0 && deflater->status == STATUS_OK)
+    {
+        deflater->status = deflater->sink(
+            deflater->sink_context, deflater->output, deflater->output_length);
+    }
+    deflater->output_length = 0;
+}
+
+/*
+ *  Interface
+ */
+
+static void build_symbol_codes(deflater_t *deflater)
+{
+    uint32_t code, value, first, last;
+
+    for (code = 0; code < 28; code++)
+    {
+        first = kLengthBase[code];
+        last = first + (1u << kLengthExtra[code]);
+        for (value = first; value < last && value <= kMaxMatch; value++)
+        {
+            deflater->length_codes[value] = (uint8_t)code;
+        }
+    }
+    deflater->length_codes[kMaxMatch] = 28;
+
+    for (code = 0; code < DISTANCE_CODES; code++)
+    {
+        first = kDistanceBase[code] - 1u;
+        last = first + (1u << kDistanceExtra[code]);
+        for (value = first; value < last; value++)
+        {
+            if (value < 256)
+            {
+                deflater->distance_codes[value] = (uint8_t)code;
+            }
+            else
+            {
+                deflater->distance_codes[256 + (value >> 7)] = (uint8_t)code;
+            }
+        }
+    }
+}
+
+status_t deflater_init(
+    uint32_t level, size_t output_size, deflate_sink_t sink, void *context,
+    deflater_t *deflater)
+{
+    if (!sink || !deflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (level > DEFLATE_MAX_LEVEL || output_size < 2 ||
+        output_size > UINT32_MAX)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(deflater, 0, sizeof(deflater_t));
+    deflater->window = (uint8_t *)engine_allocate(kWindowSize * 2);
+    deflater->head = (uint16_t *)engine_allocate(sizeof(uint16_t) * kHashSize);
+    deflater->prev = (uint16_t *)engine_allocate(
+        sizeof(uint16_t) * kWindowSize);
+    deflater->symbols = (uint32_t *)engine_allocate(
+        sizeof(uint32_t) * kMaxSymbols);
+    /* Bounded by the check above, as IDAT chunks are by the encoder. */
+    deflater->output = (uint8_t *)engine_allocate_large(output_size);
+    if (!deflater->window || !deflater->head || !deflater->prev ||
+        !deflater->symbols || !deflater->output)
+    {
+        deflater_free(deflater);
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    deflater->level = level;
+    deflater->good_length = kLevels[level].good_length;
+    deflater->lazy_length = kLevels[level].lazy_length;
+    deflater->nice_length = kLevels[level].nice_length;
+    deflater->max_chain = kLevels[level].max_chain;
+    deflater->output_size = output_size;
+    build_symbol_codes(deflater);
+    return deflater_reset(sink, context, deflater);
+}
+
+status_t deflater_reset(
+    deflate_sink_t sink, void *context, deflater_t *deflater)
+{
+    if (!sink || !deflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!deflater->window)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    deflater->sink = sink;
+    deflater->sink_context = context;
+    memset(deflater->head, 0, sizeof(uint16_t) * kHashSize);
+    memset(deflater->prev, 0, sizeof(uint16_t) * kWindowSize);
+    deflater->strstart = 0;
+    deflater->lookahead = 0;
+    deflater->block_start = 0;
+    deflater->block_bytes = 0;
+    deflater->match_length = kMinMatch - 1;
+    deflater->match_start = 0;
+    deflater->prev_length = kMinMatch - 1;
+    deflater->match_available = false;
+    deflater->symbol_count = 0;
+    deflater->output_length = 0;
+    deflater->bit_buffer = 0;
+    deflater->bit_count = 0;
+    deflater->adler = 1;
+    deflater->raw = false;
+    deflater->started = false;
+    deflater->finished = false;
+    deflater->status = STATUS_OK;
+    return STATUS_OK;
+}
+
+status_t deflater_write(
+    deflater_t *deflater, uint8_t const *data, size_t length)
+{
+    uint32_t end, count;
+
+    if (!deflater || (!data && length != 0))
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (deflater->finished)
+    {
+        return STATUS_FAILURE;
+    }
+
+    if (!deflater->started)
+    {
+        put_zlib_header(deflater);
+    }
+    if (!deflater->raw)
+    {
+        deflater->adler = adler32_update(deflater->adler, data, length);
+    }
+
+    while (length > 0 && deflater->status == STATUS_OK)
+    {
+        end = deflater->strstart + deflater->lookahead;
+        if (end == kWindowSize * 2)
+        {
+            slide_window(deflater);
+            end -= kWindowSize;
+        }
+
+        count = kWindowSize * 2 - end;
+        if (count > length)
+        {
+            count = (uint32_t)length;
+        }
+        memcpy(deflater->window + end, data, count);
+        deflater->lookahead += count;
+        data += count;
+        length -= count;
+
+        if (deflater->lookahead >= kMinLookahead)
+        {
+            deflate_run(deflater, false);
+        }
+    }
+    return deflater->status;
+}
+
+status_t deflater_finish(deflater_t *deflater)
+{
+    uint32_t i;
+
+    if (!deflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (deflater->finished)
+    {
+        return STATUS_FAILURE;
+    }
+
+    if (!deflater->started)
+    {
+        put_zlib_header(deflater);
+    }
+
+    end_block(deflater, true);
+    align_bits(deflater);
+
+    /* Adler-32 checksum, most significant byte first. */
+    for (i = 0; i < sizeof(uint32_t) && !deflater->raw; i++)
+    {
+        put_byte(deflater, (uint8_t)(deflater->adler >> (24 - 8 * i)));
+    }
+    flush_output(deflater);
+    deflater->finished = true;
+    return deflater->status;
+}
+
+status_t deflater_reset_segment(
+    deflate_sink_t sink, void *context, uint8_t const *dictionary,
+    size_t length, deflater_t *deflater)
+{
+    uint32_t i;
+    status_t status;
+
+    if (!dictionary && length != 0)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = deflater_reset(sink, context, deflater);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    /* The header and checksum belong to the whole datastream. */
+    deflater->raw = true;
+    deflater->started = true;
+    if (length > kWindowSize)
+    {
+        dictionary += length - kWindowSize;
+        length = kWindowSize;
+    }
+    if (length > 0)
+    {
+        memcpy(deflater->window, dictionary, length);
+    }
+    for (i = 0; i + kMinMatch <= length; i++)
+    {
+        insert_string(deflater, i);
+    }
+    deflater->strstart = (uint32_t)length;
+    deflater->block_start = (uint32_t)length;
+    return STATUS_OK;
+}
+
+status_t deflater_flush(deflater_t *deflater)
+{
+    if (!deflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (deflater->finished)
+    {
+        return STATUS_FAILURE;
+    }
+
+    if (!deflater->started)
+    {
+        put_zlib_header(deflater);
+    }
+
+    /* An empty stored block leaves the output byte aligned. */
+    end_block(deflater, false);
+    put_stored(deflater, deflater->window, 0, false);
+    flush_output(deflater);
+    return deflater->status;
+}
+
+status_t deflater_get_header(deflater_t const *deflater, uint8_t *header)
+{
+    if (!deflater || !header)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    header[0] = kZlibMethod;
+    header[1] = (uint8_t)zlib_header_flags(deflater->level);
+    return STATUS_OK;
+}
+
+status_t deflater_free(deflater_t *deflater)
+{
+    if (!deflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    free(deflater->window);
+    free(deflater->head);
+    free(deflater->prev);
+    free(deflater->symbols);
+    free(deflater->output);
+    memset(deflater, 0, sizeof(deflater_t));
+    return STATUS_OK;
+}
+
+/* Sink of a backend stream before its first datastream is started. */
+static status_t unset_sink(void *context, uint8_t const *data, size_t length)
+{
+    (void)context;
+    (void)data;
+    (void)length;
+    return STATUS_FAILURE;
+}
+
+static status_t backend_create(
+    uint32_t level, size_t output_size, void **stream)
+{
+    deflater_t *deflater;
+    status_t status;
+
+    deflater = (deflater_t *)engine_allocate(sizeof(deflater_t));
+    if (!deflater)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    status = deflater_init(level, output_size, unset_sink, NULL, deflater);
+    if (status != STATUS_OK)
+    {
+        free(deflater);
+        return status;
+    }
+    *stream = deflater;
+    return STATUS_OK;
+}
+
+static status_t backend_reset(
+    void *stream, deflate_sink_t sink, void *context)
+{
+    return deflater_reset(sink, context, (deflater_t *)stream);
+}
+
+static status_t backend_write(
+    void *stream, uint8_t const *data, size_t length)
+{
+    return deflater_write((deflater_t *)stream, data, length);
+}
+
+static status_t backend_finish(void *stream)
+{
+    return deflater_finish((deflater_t *)stream);
+}
+
+static void backend_destroy(void *stream)
+{
+    deflater_free((deflater_t *)stream);
+    free(stream);
+}
+
+engine_compressor_t const kDeflateCompressor = {
+    "deflate", DEFLATE_MAX_LEVEL,
+    backend_create, backend_reset, backend_write, backend_finish,
+    backend_destroy
+};
@@ -0,0 +1,166 @@
+/*
+ *  Image-Formats - Deflate
+ *      Compresses zlib datastreams (RFC1950, RFC1951).
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _DEFLATE_H_
+#define _DEFLATE_H_
+
+#include "base.h"
+#include "engine.h"
+
+/* Highest compression level, 0 stores the data uncompressed. */
+#define DEFLATE_MAX_LEVEL 9
+
+/*
+ * Type: deflate_sink_t
+ *  Receives compressed data.  Every call but the last of a datastream
+ *  carries exactly the output size of the deflater.  Anything other
+ *  than OK aborts compression and is returned to the caller.
+ */
+typedef engine_sink_t deflate_sink_t;
+
+typedef struct {
+    deflate_sink_t sink;
+    void *sink_context;
+    /* Matching parameters of the compression level. */
+    uint32_t level;
+    uint32_t good_length;
+    uint32_t lazy_length;
+    uint32_t nice_length;
+    uint32_t max_chain;
+    /* Two windows of input, older strings are found by hash chains. */
+    uint8_t *window;
+    uint16_t *head;
+    uint16_t *prev;
+    uint32_t strstart;
+    uint32_t lookahead;
+    /* Input covered by the symbols of the current block. */
+    uint32_t block_start;
+    uint32_t block_bytes;
+    /* Matching state carried between calls. */
+    uint32_t match_length;
+    uint32_t match_start;
+    uint32_t prev_length;
+    bool_t match_available;
+    /* Symbols of the current block, distance << 16 | literal or length. */
+    uint32_t *symbols;
+    uint32_t symbol_count;
+    /* Length and distance codes, indexed by length and by distance - 1. */
+    uint8_t length_codes[259];
+    uint8_t distance_codes[512];
+    /* Compressed data waiting for the sink. */
+    uint8_t *output;
+    size_t output_length;
+    size_t output_size;
+    uint64_t bit_buffer;
+    uint32_t bit_count;
+    uint32_t adler;
+    /* Segment of a datastream, without header and checksum. */
+    bool_t raw;
+    bool_t started;
+    bool_t finished;
+    /* First error returned by the sink. */
+    status_t status;
+} deflater_t;
+
+/*
+ * Function: deflater_init
+ *  Initializes a deflater.  Its buffers are reused by every datastream
+ *  started with `deflater_reset()`.
+ * Args:
+ *    level - Compression level, from 0 to DEFLATE_MAX_LEVEL.
+ *    output_size - Number of bytes handed to the sink at once, up to
+ *                  UINT32_MAX.
+ *    sink - Callback receiving compressed data.
+ *    context - Opaque pointer handed to `sink`.
+ *    deflater - Pointer to an uninitialized deflater.
+ * Return:
+ *    OK if the deflater was initialized.
+ *    NULL_ARG if `sink` or `deflater` are NULL.
+ *    ILLEGAL_ARG if the level or output size is out of range.
+ *    OUT_OF_MEM if the buffers could not be allocated.
+ */
+status_t deflater_init(
+    uint32_t level, size_t output_size, deflate_sink_t sink, void *context,
+    deflater_t *deflater);
+
+/*
+ * Function: deflater_reset
+ *  Starts a new datastream on an initialized deflater, without
+ *  allocating memory.
+ */
+status_t deflater_reset(
+    deflate_sink_t sink, void *context, deflater_t *deflater);
+
+/*
+ * Function: deflater_write
+ *  Compresses `length` bytes of input.  Compressed data reaches the
+ *  sink as the output buffer fills.
+ * Return:
+ *    OK if the input was consumed.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    FAILURE if the datastream was already finished.
+ *    Otherwise the status returned by the sink.
+ */
+status_t deflater_write(
+    deflater_t *deflater, uint8_t const *data, size_t length);
+
+/*
+ * Function: deflater_finish
+ *  Compresses the remaining input, ends the datastream with its
+ *  Adler-32 checksum and hands all remaining output to the sink.
+ */
+status_t deflater_finish(deflater_t *deflater);
+
+/*
+ * Function: deflater_reset_segment
+ *  Starts a segment of a datastream split for parallel compression.
+ *  The segment is raw deflate data, without the zlib header and
+ *  Adler-32 checksum of the datastream, and its matches can reach
+ *  back into the input preceding it.  Segments ended with
+ *  `deflater_flush()`, and the last one with `deflater_finish()`,
+ *  concatenate into the deflate data of the whole input.
+ * Args:
+ *    sink - Callback receiving compressed data.
+ *    context - Opaque pointer handed to `sink`.
+ *    dictionary - Input preceding the segment, of which only the last
+ *                 32 KiB are used.  NULL if `length` is 0.
+ *    length - Length of the dictionary.
+ *    deflater - Pointer to an initialized deflater.
+ * Return:
+ *    OK if the segment was started.
+ *    NULL_ARG if `sink`, `deflater` or the dictionary are NULL.
+ *    ILLEGAL_ARG if the deflater is not initialized.
+ */
+status_t deflater_reset_segment(
+    deflate_sink_t sink, void *context, uint8_t const *dictionary,
+    size_t length, deflater_t *deflater);
+
+/*
+ * Function: deflater_flush
+ *  Compresses the remaining input and ends the block with an empty
+ *  stored block, so that the output ends on a byte boundary, then
+ *  hands all of it to the sink.  The datastream can go on.
+ */
+status_t deflater_flush(deflater_t *deflater);
+
+/*
+ * Function: deflater_get_header
+ *  Stores the two bytes of the zlib header the deflater writes at the
+ *  start of a datastream.
+ */
+status_t deflater_get_header(deflater_t const *deflater, uint8_t *header);
+
+/*
+ * Function: deflater_free
+ *  Frees the resources of an initialized deflater and clears it.
+ */
+status_t deflater_free(deflater_t *deflater);
+
+/* Bundled backend, named "deflate", wrapping a deflater. */
+extern engine_compressor_t const kDeflateCompressor;
+
+#endif /* _DEFLATE_H_ */
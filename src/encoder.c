@@ -0,0 +1,885 @@
+/*
+ *  Image-Formats - PNG Encoder
+ *      Filters, compresses and writes PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "engine.h"
+
+#include "encoder.h"
+#include "inflate.h"
+#include "pixconv.h"
+#include "workers.h"
+
+static uint32_t const kDefaultLevel = 6;
+static uint32_t const kDefaultIdatSize = 64 * 1024;
+static uint32_t const kIhdrSize = 13;
+static uint32_t const kSampleMax = 0xffff;
+/* Input a segment can match against, the deflate window. */
+static size_t const kDictionarySize = 32 * 1024;
+static size_t const kSegmentOutputSize = 16 * 1024;
+
+status_t encoder_options_default(encoder_options_t *options)
+{
+    if (!options)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(options, 0, sizeof(encoder_options_t));
+    options->compressor = engine_get_compressor(NULL);
+    options->level = kDefaultLevel;
+    options->adaptive_filter = true;
+    options->filter = FILTER_TYPE_NONE;
+    options->idat_size = kDefaultIdatSize;
+    options->threads = 1;
+    return STATUS_OK;
+}
+
+/* Writes every full output buffer of the deflater as an IDAT chunk. */
+static status_t idat_sink(void *context, uint8_t const *data, size_t length)
+{
+    encoder_t *encoder;
+
+    encoder = (encoder_t *)context;
+    return writer_write_data(
+        encoder->writer, IDAT_TYPE, data, (uint32_t)length);
+}
+
+/* Appends the output of a segment deflater to the segment. */
+static status_t segment_sink(void *context, uint8_t const *data, size_t length)
+{
+    encoder_segment_t *segment;
+    uint8_t *output;
+    size_t capacity;
+
+    segment = (encoder_segment_t *)context;
+    if (segment->output_capacity - segment->output_length < length)
+    {
+        capacity = segment->output_capacity * 2;
+        while (capacity - segment->output_length < length)
+        {
+            capacity *= 2;
+        }
+        output = (uint8_t *)engine_allocate(capacity);
+        if (!output)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        memcpy(output, segment->output, segment->output_length);
+        free(segment->output);
+        segment->output = output;
+        segment->output_capacity = capacity;
+    }
+    memcpy(segment->output + segment->output_length, data, length);
+    segment->output_length += length;
+    return STATUS_OK;
+}
+
+/* Allocates a batch of segments, one per thread. */
+static status_t encoder_create_segments(encoder_t *encoder)
+{
+    encoder_segment_t *segment;
+    uint32_t i, count;
+    status_t status;
+
+    count = encoder->options.threads;
+    count = count < 1 ? 1 : count > WORKERS_MAX_THREADS ?
+        WORKERS_MAX_THREADS : count;
+    encoder->segments = (encoder_segment_t *)engine_allocate(
+        sizeof(encoder_segment_t) * count);
+    if (!encoder->segments)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    memset(encoder->segments, 0, sizeof(encoder_segment_t) * count);
+    encoder->segment_count = count;
+
+    for (i = 0; i < count; i++)
+    {
+        segment = &encoder->segments[i];
+        status = deflater_init(
+            encoder->options.level, kSegmentOutputSize, segment_sink,
+            segment, &segment->deflater);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        segment->input = (uint8_t *)engine_allocate(
+            kDictionarySize + encoder->options.segment_size);
+        segment->output_capacity = kSegmentOutputSize;
+        segment->output = (uint8_t *)engine_allocate(
+            segment->output_capacity);
+        if (!segment->input || !segment->output)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t encoder_init(encoder_options_t const *options, encoder_t *encoder)
+{
+    status_t status;
+
+    if (!encoder)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(encoder, 0, sizeof(encoder_t));
+    if (options)
+    {
+        encoder->options = *options;
+    }
+    else
+    {
+        encoder_options_default(&encoder->options);
+    }
+
+    if (!encoder->options.compressor)
+    {
+        encoder->options.compressor = engine_get_compressor(NULL);
+    }
+
+    if (encoder->options.level > encoder->options.compressor->max_level ||
+        encoder->options.idat_size < 2 ||
+        encoder->options.idat_size > kSigned32Max ||
+        (!encoder->options.adaptive_filter &&
+         encoder->options.filter > FILTER_TYPE_PAETH) ||
+        encoder->options.segment_size > ENCODER_MAX_SEGMENT_SIZE ||
+        (encoder->options.segment_size > 0 &&
+         encoder->options.compressor != &kDeflateCompressor))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if (encoder->options.segment_size > 0)
+    {
+        status = encoder_create_segments(encoder);
+        if (status != STATUS_OK)
+        {
+            encoder_free(encoder);
+        }
+        return status;
+    }
+
+    return encoder->options.compressor->create(
+        encoder->options.level, encoder->options.idat_size,
+        &encoder->stream);
+}
+
+/*
+ * Returns a scratch buffer of at least `size` bytes, reusing the one
+ * kept by the encoder when it is large enough.
+ */
+static uint8_t *encoder_reserve(
+    encoder_t *encoder, encoder_buffer_t which, size_t size)
+{
+    if (encoder->buffer_sizes[which] < size)
+    {
+        free(encoder->buffers[which]);
+        encoder->buffer_sizes[which] = 0;
+        encoder->buffers[which] = (uint8_t *)engine_allocate(size);
+        if (!encoder->buffers[which])
+        {
+            return NULL;
+        }
+        encoder->buffer_sizes[which] = size;
+    }
+    return encoder->buffers[which];
+}
+
+/* Copies the pixels of an image row that belong to an interlace pass. */
+static void extract_pass_row(
+    uint8_t const *row, ihdr_pass_t const *pass, uint32_t pixel_bits,
+    size_t row_size, uint8_t *out)
+{
+    uint32_t i, x, bytes, value;
+    size_t bit;
+
+    if (pixel_bits >= 8)
+    {
+        bytes = pixel_bits / 8;
+        for (i = 0, x = pass->x_offset; i < pass->width; i++, x += pass->x_step)
+        {
+            memcpy(out + (size_t)i * bytes, row + (size_t)x * bytes, bytes);
+        }
+        return;
+    }
+
+    memset(out, 0, row_size);
+    for (i = 0, x = pass->x_offset; i < pass->width; i++, x += pass->x_step)
+    {
+        bit = (size_t)x * pixel_bits;
+        value = (row[bit >> 3] >> (8 - pixel_bits - (bit & 7))) &
+            ((1u << pixel_bits) - 1);
+        bit = (size_t)i * pixel_bits;
+        out[bit >> 3] |= (uint8_t)(value << (8 - pixel_bits - (bit & 7)));
+    }
+}
+
+/* Bytes per pixel of a source format, 0 for serialized rows. */
+static uint32_t source_pixel_bytes(source_format_t format)
+{
+    switch (format)
+    {
+        case SOURCE_FORMAT_RGBA8:
+        case SOURCE_FORMAT_BGRA8:
+            return 4;
+        case SOURCE_FORMAT_RGBA16:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/* Whether source rows are already scanlines of the image. */
+static bool_t source_is_serialized(
+    encoder_source_t const *source, ihdr_t const *ihdr)
+{
+    return source->format == SOURCE_FORMAT_SERIALIZED ||
+        (source->format == SOURCE_FORMAT_RGBA8 && ihdr->bit_depth == 8 &&
+         color_type_from_code(ihdr->color_type) ==
+             COLOR_TYPE_REALCOLOR_ALPHA);
+}
+
+/* Reads a source pixel as 16-bit RGBA. */
+static void read_source_pixel(
+    source_format_t format, uint8_t const *pixel, uint16_t *rgba)
+{
+    switch (format)
+    {
+        case SOURCE_FORMAT_RGBA8:
+            rgba[0] = (uint16_t)(pixel[0] * 257);
+            rgba[1] = (uint16_t)(pixel[1] * 257);
+            rgba[2] = (uint16_t)(pixel[2] * 257);
+            rgba[3] = (uint16_t)(pixel[3] * 257);
+            break;
+        case SOURCE_FORMAT_BGRA8:
+            rgba[0] = (uint16_t)(pixel[2] * 257);
+            rgba[1] = (uint16_t)(pixel[1] * 257);
+            rgba[2] = (uint16_t)(pixel[0] * 257);
+            rgba[3] = (uint16_t)(pixel[3] * 257);
+            break;
+        default:
+            memcpy(rgba, pixel, sizeof(uint16_t) * 4);
+            break;
+    }
+}
+
+/* Packs 8-bit source pixels as 8-bit RGB or RGBA. */
+static void pack_source_rgb8(
+    source_format_t format, uint8_t const *row, uint32_t count,
+    bool_t alpha, uint8_t *out)
+{
+    uint32_t i, red, blue;
+
+    if (alpha)
+    {
+        if (format == SOURCE_FORMAT_BGRA8)
+        {
+            pixconv_swap_red_blue(row, count, out);
+        }
+        else
+        {
+            memcpy(out, row, (size_t)count * 4);
+        }
+        return;
+    }
+
+    red = (format == SOURCE_FORMAT_BGRA8) ? 2 : 0;
+    blue = 2 - red;
+    for (i = 0; i < count; i++, row += 4, out += 3)
+    {
+        out[0] = row[red];
+        out[1] = row[1];
+        out[2] = row[blue];
+    }
+}
+
+/*
+ * Packs the pixels of a source row that belong to an interlace pass
+ * into the serialized pixel format of the image.
+ */
+static void pack_source_row(
+    encoder_source_t const *source, ihdr_t const *ihdr, uint8_t const *row,
+    ihdr_pass_t const *pass, size_t row_size, uint8_t *out)
+{
+    static uint8_t const kChannels[][4] = {
+        {0}, {0, 1, 2}, {0}, {0, 3}, {0, 1, 2, 3}};
+    static uint8_t const kChannelCounts[] = {1, 3, 1, 2, 4};
+    color_type_t color_type;
+    uint32_t i, x, channel, pixel_bytes, max, value, bits;
+    uint16_t rgba[4];
+    size_t bit;
+
+    color_type = color_type_from_code(ihdr->color_type);
+    pixel_bytes = source_pixel_bytes(source->format);
+    if (source->format != SOURCE_FORMAT_RGBA16 && ihdr->bit_depth == 8 &&
+        pass->x_step == 1 &&
+        (color_type == COLOR_TYPE_REALCOLOR ||
+         color_type == COLOR_TYPE_REALCOLOR_ALPHA))
+    {
+        pack_source_rgb8(
+            source->format, row + (size_t)pass->x_offset * pixel_bytes,
+            pass->width, color_type == COLOR_TYPE_REALCOLOR_ALPHA, out);
+        return;
+    }
+
+    bits = ihdr->bit_depth;
+    max = (1u << bits) - 1;
+    if (bits < 8)
+    {
+        memset(out, 0, row_size);
+    }
+    bit = 0;
+    for (i = 0, x = pass->x_offset; i < pass->width; i++, x += pass->x_step)
+    {
+        read_source_pixel(
+            source->format, row + (size_t)x * pixel_bytes, rgba);
+        for (channel = 0; channel < kChannelCounts[color_type]; channel++)
+        {
+            /* Scaled to the bit depth, rounding to nearest. */
+            value = rgba[kChannels[color_type][channel]];
+            value = (value * max + kSampleMax / 2) / kSampleMax;
+            if (bits == 16)
+            {
+                *out++ = (uint8_t)(value >> 8);
+                *out++ = (uint8_t)value;
+            }
+            else if (bits == 8)
+            {
+                *out++ = (uint8_t)value;
+            }
+            else
+            {
+                out[bit >> 3] |= (uint8_t)(value << (8 - bits - (bit & 7)));
+                bit += bits;
+            }
+        }
+    }
+}
+
+/* Hands segmented datastream bytes to the sink in IDAT size pieces. */
+static status_t encoder_put(
+    encoder_t *encoder, uint8_t const *data, size_t length)
+{
+    uint8_t *idat;
+    size_t count;
+    status_t status;
+
+    idat = encoder->buffers[ENCODER_BUFFER_IDAT];
+    while (length > 0)
+    {
+        count = encoder->options.idat_size - encoder->idat_length;
+        if (count > length)
+        {
+            count = length;
+        }
+        memcpy(idat + encoder->idat_length, data, count);
+        encoder->idat_length += count;
+        data += count;
+        length -= count;
+        if (encoder->idat_length == encoder->options.idat_size)
+        {
+            status = encoder->sink(
+                encoder->sink_context, idat, encoder->idat_length);
+            encoder->idat_length = 0;
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Compresses a segment, after the data preceding it. */
+static void segment_task(void *context, uint32_t index)
+{
+    encoder_segment_t *segment;
+    status_t status;
+
+    segment = &((encoder_t *)context)->segments[index];
+    segment->output_length = 0;
+    status = deflater_reset_segment(
+        segment_sink, segment, segment->input, segment->dictionary_length,
+        &segment->deflater);
+    if (status == STATUS_OK)
+    {
+        status = deflater_write(
+            &segment->deflater, segment->input + segment->dictionary_length,
+            segment->input_length);
+    }
+    if (status == STATUS_OK)
+    {
+        status = segment->final ?
+            deflater_finish(&segment->deflater) :
+            deflater_flush(&segment->deflater);
+    }
+    segment->status = status;
+}
+
+/* Compresses the first `count` segments and writes them in order. */
+static status_t encoder_flush_segments(encoder_t *encoder, uint32_t count)
+{
+    uint32_t i;
+    status_t status;
+
+    status = workers_run(
+        encoder->options.threads, count, segment_task, encoder);
+    for (i = 0; i < count && status == STATUS_OK; i++)
+    {
+        status = encoder->segments[i].status;
+        if (status == STATUS_OK)
+        {
+            status = encoder_put(
+                encoder, encoder->segments[i].output,
+                encoder->segments[i].output_length);
+        }
+    }
+    return status;
+}
+
+/*
+ * Moves on to the next segment, compressing the batch once every
+ * segment is filled.  The new segment starts with the tail of the
+ * data preceding it.
+ */
+static status_t encoder_next_segment(encoder_t *encoder)
+{
+    encoder_segment_t *previous, *segment;
+    size_t end, length;
+    status_t status;
+
+    previous = &encoder->segments[encoder->segment_index];
+    encoder->segment_index++;
+    if (encoder->segment_index == encoder->segment_count)
+    {
+        status = encoder_flush_segments(encoder, encoder->segment_count);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        encoder->segment_index = 0;
+    }
+
+    segment = &encoder->segments[encoder->segment_index];
+    end = previous->dictionary_length + previous->input_length;
+    length = end < kDictionarySize ? end : kDictionarySize;
+    memmove(segment->input, previous->input + end - length, length);
+    segment->dictionary_length = length;
+    segment->input_length = 0;
+    return STATUS_OK;
+}
+
+/* Compresses filtered scanlines, as one stream or in segments. */
+static status_t encoder_write_data(
+    encoder_t *encoder, uint8_t const *data, size_t length)
+{
+    encoder_segment_t *segment;
+    size_t count;
+    status_t status;
+
+    if (!encoder->segments)
+    {
+        return encoder->options.compressor->write(
+            encoder->stream, data, length);
+    }
+
+    encoder->adler = adler32_update(encoder->adler, data, length);
+    while (length > 0)
+    {
+        segment = &encoder->segments[encoder->segment_index];
+        if (segment->input_length == encoder->options.segment_size)
+        {
+            status = encoder_next_segment(encoder);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+            continue;
+        }
+        count = encoder->options.segment_size - segment->input_length;
+        if (count > length)
+        {
+            count = length;
+        }
+        memcpy(segment->input + segment->dictionary_length +
+               segment->input_length, data, count);
+        segment->input_length += count;
+        data += count;
+        length -= count;
+    }
+    return STATUS_OK;
+}
+
+/* Ends the datastream with the last segment and the checksum. */
+static status_t encoder_finish_data(encoder_t *encoder)
+{
+    uint8_t trailer[4];
+    uint32_t i;
+    status_t status;
+
+    if (!encoder->segments)
+    {
+        return encoder->options.compressor->finish(encoder->stream);
+    }
+
+    encoder->segments[encoder->segment_index].final = true;
+    status = encoder_flush_segments(encoder, encoder->segment_index + 1);
+    encoder->segments[encoder->segment_index].final = false;
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    for (i = 0; i < sizeof(trailer); i++)
+    {
+        trailer[i] = (uint8_t)(encoder->adler >> (24 - 8 * i));
+    }
+    status = encoder_put(encoder, trailer, sizeof(trailer));
+    if (status == STATUS_OK && encoder->idat_length > 0)
+    {
+        status = encoder->sink(
+            encoder->sink_context, encoder->buffers[ENCODER_BUFFER_IDAT],
+            encoder->idat_length);
+    }
+    return status;
+}
+
+/* Starts a segmented datastream with the zlib header. */
+static status_t encoder_start_segments(
+    encoder_t *encoder, deflate_sink_t sink, void *context)
+{
+    uint8_t header[2];
+
+    if (!encoder_reserve(
+            encoder, ENCODER_BUFFER_IDAT, encoder->options.idat_size))
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    encoder->sink = sink;
+    encoder->sink_context = context;
+    encoder->idat_length = 0;
+    encoder->adler = 1;
+    encoder->segment_index = 0;
+    encoder->segments[0].dictionary_length = 0;
+    encoder->segments[0].input_length = 0;
+    deflater_get_header(&encoder->segments[0].deflater, header);
+    return encoder_put(encoder, header, sizeof(header));
+}
+
+/* Filters and compresses the scanlines of every pass. */
+static status_t encoder_write_passes(
+    encoder_t *encoder, ihdr_t const *ihdr, encoder_source_t const *source)
+{
+    ihdr_pass_t pass;
+    uint32_t pass_count, pass_index, row_index, pixel_bits, pixel_bytes;
+    size_t image_row_size, row_size, stride;
+    uint8_t *rows, *filtered, *current, *prior;
+    uint8_t const *row, *prior_row;
+    bool_t adaptive, in_place;
+    status_t status;
+
+    ihdr_get_pixel_bits(ihdr, &pixel_bits);
+    ihdr_get_row_size(ihdr, ihdr->width, &image_row_size);
+    pixel_bytes = pixel_bits < 8 ? 1 : pixel_bits / 8;
+    pass_count = ihdr_get_pass_count(ihdr);
+    in_place = pass_count == 1 && source_is_serialized(source, ihdr);
+    stride = source->stride;
+    if (stride == 0)
+    {
+        stride = source->format == SOURCE_FORMAT_SERIALIZED ?
+            image_row_size :
+            (size_t)ihdr->width * source_pixel_bytes(source->format);
+    }
+
+    /* Filtered scanline with its type byte, then a filter candidate. */
+    filtered = encoder_reserve(
+        encoder, ENCODER_BUFFER_FILTERED, image_row_size * 2 + 1);
+    rows = NULL;
+    if (!in_place)
+    {
+        rows = encoder_reserve(
+            encoder, ENCODER_BUFFER_ROWS, image_row_size * 2);
+    }
+    if (!filtered || (!in_place && !rows))
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+
+    /* Filters do not pay off for palette and sub-byte images. */
+    adaptive = encoder->options.adaptive_filter &&
+        !ihdr_color_type_is_palette(ihdr->color_type) && ihdr->bit_depth >= 8;
+
+    status = STATUS_OK;
+    for (pass_index = 0;
+         pass_index < pass_count && status == STATUS_OK;
+         pass_index++)
+    {
+        ihdr_get_pass(ihdr, pass_index, &pass);
+        if (pass.width == 0 || pass.height == 0)
+        {
+            continue;
+        }
+        ihdr_get_row_size(ihdr, pass.width, &row_size);
+
+        current = rows;
+        prior_row = NULL;
+        for (row_index = 0; row_index < pass.height; row_index++)
+        {
+            row = source->pixels +
+                (size_t)(pass.y_offset + row_index * pass.y_step) * stride;
+            if (in_place)
+            {
+                prior = (uint8_t *)row;
+            }
+            else
+            {
+                if (source->format == SOURCE_FORMAT_SERIALIZED)
+                {
+                    extract_pass_row(
+                        row, &pass, pixel_bits, row_size, current);
+                }
+                else
+                {
+                    pack_source_row(
+                        source, ihdr, row, &pass, row_size, current);
+                }
+                row = current;
+                prior = current;
+                current = (current == rows) ? rows + image_row_size : rows;
+            }
+
+            if (adaptive)
+            {
+                status = filter_choose_row(
+                    row, prior_row, row_size, pixel_bytes,
+                    filtered + row_size + 1, filtered);
+            }
+            else if (!encoder->options.adaptive_filter)
+            {
+                filtered[0] = (uint8_t)encoder->options.filter;
+                status = filter_filter_row(
+                    encoder->options.filter, row, prior_row, row_size,
+                    pixel_bytes, filtered + 1);
+            }
+            else
+            {
+                filtered[0] = FILTER_TYPE_NONE;
+                status = filter_filter_row(
+                    FILTER_TYPE_NONE, row, prior_row, row_size,
+                    pixel_bytes, filtered + 1);
+            }
+            if (status == STATUS_OK)
+            {
+                status = encoder_write_data(
+                    encoder, filtered, row_size + 1);
+            }
+            if (status != STATUS_OK)
+            {
+                break;
+            }
+            prior_row = prior;
+        }
+    }
+
+    if (status == STATUS_OK)
+    {
+        status = encoder_finish_data(encoder);
+    }
+    return status;
+}
+
+/* Checks that a source can be encoded as described by a valid IHDR. */
+static bool_t source_is_valid(
+    encoder_source_t const *source, ihdr_t const *ihdr)
+{
+    size_t row_size;
+
+    if (source->format >= SOURCE_FORMAT_COUNT)
+    {
+        return false;
+    }
+    if (source->format == SOURCE_FORMAT_SERIALIZED)
+    {
+        ihdr_get_row_size(ihdr, ihdr->width, &row_size);
+    }
+    else
+    {
+        if (ihdr_color_type_is_palette(ihdr->color_type))
+        {
+            return false;
+        }
+        row_size = (size_t)ihdr->width * source_pixel_bytes(source->format);
+    }
+    return source->stride == 0 || source->stride >= row_size;
+}
+
+status_t encoder_encode(
+    encoder_t *encoder, ihdr_t const *ihdr, palette_table_t const *palette,
+    uint8_t const *pixels, writer_t *writer)
+{
+    encoder_source_t source;
+
+    source.pixels = pixels;
+    source.stride = 0;
+    source.format = SOURCE_FORMAT_SERIALIZED;
+    return encoder_encode_source(encoder, ihdr, palette, &source, writer);
+}
+
+status_t encoder_encode_source(
+    encoder_t *encoder, ihdr_t const *ihdr, palette_table_t const *palette,
+    encoder_source_t const *source, writer_t *writer)
+{
+    uint8_t buffer[PALETTE_MAX_ENTRIES * 3];
+    uint32_t length;
+    status_t status;
+
+    if (!encoder || !ihdr || !source || !source->pixels || !writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!ihdr_is_valid(ihdr) || !source_is_valid(source, ihdr))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if (ihdr_color_type_is_palette(ihdr->color_type))
+    {
+        if (!palette)
+        {
+            return STATUS_NULL_ARGUMENT;
+        }
+        if (palette->size == 0 ||
+            palette->size > (1u << ihdr->bit_depth))
+        {
+            return STATUS_ILLEGAL_ARGUMENT;
+        }
+    }
+    else if (palette && !ihdr_color_type_is_realcolor(ihdr->color_type))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    encoder->writer = writer;
+    status = writer_write_signature(writer);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    length = kIhdrSize;
+    status = ihdr_serialize(ihdr, buffer, &length);
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, IHDR_TYPE, buffer, length);
+    }
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    if (palette && palette->size > 0)
+    {
+        length = sizeof(buffer);
+        status = palette_table_serialize(palette, buffer, &length);
+        if (status == STATUS_OK)
+        {
+            status = writer_write_data(writer, PLTE_TYPE, buffer, length);
+        }
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    status = encoder_compress_source(
+        encoder, ihdr, source, idat_sink, encoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    return writer_write_data(writer, IEND_TYPE, NULL, 0);
+}
+
+status_t encoder_compress(
+    encoder_t *encoder, ihdr_t const *ihdr, uint8_t const *pixels,
+    deflate_sink_t sink, void *context)
+{
+    encoder_source_t source;
+
+    source.pixels = pixels;
+    source.stride = 0;
+    source.format = SOURCE_FORMAT_SERIALIZED;
+    return encoder_compress_source(encoder, ihdr, &source, sink, context);
+}
+
+status_t encoder_compress_source(
+    encoder_t *encoder, ihdr_t const *ihdr, encoder_source_t const *source,
+    deflate_sink_t sink, void *context)
+{
+    status_t status;
+
+    if (!encoder || !ihdr || !source || !source->pixels || !sink)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!ihdr_is_valid(ihdr) || !source_is_valid(source, ihdr))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if (encoder->segments)
+    {
+        status = encoder_start_segments(encoder, sink, context);
+    }
+    else
+    {
+        status = encoder->options.compressor->reset(
+            encoder->stream, sink, context);
+    }
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    return encoder_write_passes(encoder, ihdr, source);
+}
+
+status_t encoder_free(encoder_t *encoder)
+{
+    uint32_t i;
+
+    if (!encoder)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (encoder->stream)
+    {
+        encoder->options.compressor->destroy(encoder->stream);
+    }
+    for (i = 0; i < ENCODER_BUFFER_COUNT; i++)
+    {
+        free(encoder->buffers[i]);
+    }
+    for (i = 0; i < encoder->segment_count; i++)
+    {
+        deflater_free(&encoder->segments[i].deflater);
+        free(encoder->segments[i].input);
+        free(encoder->segments[i].output);
+    }
+    free(encoder->segments);
+    memset(encoder, 0, sizeof(encoder_t));
+    return STATUS_OK;
+}
@@ -0,0 +1,229 @@
+/*
+ *  Image-Formats - PNG Encoder
+ *      Filters, compresses and writes PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+#include "base.h"
+#include "clrchunk.h"
+#include "deflate.h"
+#include "filter.h"
+#include "imgchunk.h"
+#include "writer.h"
+
+typedef struct {
+    /* Compression backend.  NULL for `engine_get_compressor(NULL)`. */
+    engine_compressor_t const *compressor;
+    /* Compression level, from 0 to the maximum of the backend. */
+    uint32_t level;
+    /* Choose the filter of every scanline, otherwise apply `filter`. */
+    bool_t adaptive_filter;
+    filter_type_t filter;
+    /* Largest data length of an IDAT chunk. */
+    uint32_t idat_size;
+    /*
+     * Bytes of filtered image data compressed on their own, up to
+     * ENCODER_MAX_SEGMENT_SIZE, or 0 for a single deflate stream.
+     * Segments are compressed in batches on `threads` threads.  Their
+     * boundaries fall every `segment_size` bytes whatever the thread
+     * count, so the datastream only depends on the image and on the
+     * other options.  Needs the bundled "deflate" backend.
+     */
+    uint32_t segment_size;
+    uint32_t threads;
+} encoder_options_t;
+
+/* Largest segment size of the encoder options. */
+#define ENCODER_MAX_SEGMENT_SIZE (1024 * 1024)
+
+/* Layouts of the pixels an image can be encoded from. */
+typedef enum {
+    /* Rows in the serialized pixel format described by the IHDR. */
+    SOURCE_FORMAT_SERIALIZED,
+    SOURCE_FORMAT_RGBA8,
+    SOURCE_FORMAT_BGRA8,
+    /* 16-bit samples in host byte order. */
+    SOURCE_FORMAT_RGBA16,
+    SOURCE_FORMAT_COUNT
+} source_format_t;
+
+/*
+ * Pixels of an image to encode, top row first.  Rows other than
+ * serialized ones are packed into the format of the IHDR as they are
+ * filtered:
+ *  - BGRA8 is swizzled.
+ *  - Alpha is dropped for color types without it.
+ *  - Gray color types take the red samples.
+ *  - Samples are scaled to the bit depth, rounding to nearest.
+ * Palette images can only be encoded from serialized rows.
+ */
+typedef struct {
+    uint8_t const *pixels;
+    /*
+     * Bytes from the start of a row to the next, at least the size of
+     * a row.  0 for rows that follow each other without padding.
+     */
+    size_t stride;
+    source_format_t format;
+} encoder_source_t;
+
+/* Scratch buffers kept by an encoder across images. */
+typedef enum {
+    /* Current and prior scanlines of an interlace pass, or packed. */
+    ENCODER_BUFFER_ROWS,
+    /* Filtered scanline and filter candidate. */
+    ENCODER_BUFFER_FILTERED,
+    /* Compressed segments waiting to fill an IDAT chunk. */
+    ENCODER_BUFFER_IDAT,
+    ENCODER_BUFFER_COUNT
+} encoder_buffer_t;
+
+/* Segment of the image data and its compressed data. */
+typedef struct {
+    deflater_t deflater;
+    /* The data preceding the segment, up to a window, then the segment. */
+    uint8_t *input;
+    size_t dictionary_length;
+    size_t input_length;
+    /* Whether the segment ends the image data. */
+    bool_t final;
+    /* Raw deflate data, grown on demand. */
+    uint8_t *output;
+    size_t output_length;
+    size_t output_capacity;
+    status_t status;
+} encoder_segment_t;
+
+typedef struct {
+    encoder_options_t options;
+    /* Compression stream of the backend in the options. */
+    void *stream;
+    /* Grown on demand and reused by every image encoded. */
+    uint8_t *buffers[ENCODER_BUFFER_COUNT];
+    size_t buffer_sizes[ENCODER_BUFFER_COUNT];
+    /* Destination of the image being encoded. */
+    writer_t *writer;
+    /* Batch of segments, when the options ask for segments. */
+    encoder_segment_t *segments;
+    uint32_t segment_count;
+    /* Segment being filled with filtered scanlines. */
+    uint32_t segment_index;
+    /* Checksum and destination of the segmented datastream. */
+    uint32_t adler;
+    deflate_sink_t sink;
+    void *sink_context;
+    size_t idat_length;
+} encoder_t;
+
+/*
+ * Function: encoder_options_default
+ *  Initializes encoder options to the default backend at level 6,
+ *  adaptive filtering, IDAT chunks of up to 64 KiB and a single
+ *  deflate stream.
+ */
+status_t encoder_options_default(encoder_options_t *options);
+
+/*
+ * Function: encoder_init
+ *  Initializes a long-lived encoder.  Its compression state and
+ *  scanline buffers are reused by every image, so that encoding
+ *  images of similar size does not allocate memory once warmed up.
+ * Args:
+ *    options - Encoding options, copied into the encoder.  NULL for
+ *              the defaults.
+ *    encoder - Pointer to an uninitialized encoder.
+ * Return:
+ *    OK if the encoder was initialized.
+ *    NULL_ARG if `encoder` is NULL.
+ *    ILLEGAL_ARG if the options are out of range, or ask for segments
+ *      of another backend than "deflate".
+ *    OUT_OF_MEM if the compression state could not be allocated.
+ */
+status_t encoder_init(encoder_options_t const *options, encoder_t *encoder);
+
+/*
+ * Function: encoder_encode
+ *  Writes a complete PNG datastream, from the signature to IEND.
+ * Args:
+ *    encoder - Pointer to an initialized encoder.
+ *    ihdr - Header of the image, which must be valid.
+ *    palette - Palette of the image.  Required by palette images,
+ *              written as a suggested palette for truecolor images
+ *              and NULL otherwise.
+ *    pixels - Image rows in the serialized pixel format described by
+ *             `ihdr`, stored top to bottom, each starting on a byte
+ *             boundary.  Interlaced images are given non-interlaced.
+ *    writer - Destination of the datastream.  It is not flushed.
+ * Return:
+ *    OK if the image was encoded.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    ILLEGAL_ARG if the header or palette are not valid.
+ *    OUT_OF_MEM if the scanline buffers could not be allocated.
+ *    Otherwise the status returned by the writer.
+ */
+status_t encoder_encode(
+    encoder_t *encoder, ihdr_t const *ihdr, palette_table_t const *palette,
+    uint8_t const *pixels, writer_t *writer);
+
+/*
+ * Function: encoder_encode_source
+ *  Writes a complete PNG datastream from pixels in any source format.
+ *  Each source row is packed into a scanline buffer right before it is
+ *  filtered, so no packed copy of the image is made.  Rows of a
+ *  non-interlaced image already in its format, serialized or RGBA8,
+ *  are filtered in place.
+ * Args:
+ *    encoder - As `encoder_encode()`.
+ *    ihdr - As `encoder_encode()`.
+ *    palette - As `encoder_encode()`.
+ *    source - Pixels of the image.
+ *    writer - As `encoder_encode()`.
+ * Return:
+ *    As `encoder_encode()`, and ILLEGAL_ARG if the source cannot be
+ *    encoded as described by `ihdr`.
+ */
+status_t encoder_encode_source(
+    encoder_t *encoder, ihdr_t const *ihdr, palette_table_t const *palette,
+    encoder_source_t const *source, writer_t *writer);
+
+/*
+ * Function: encoder_compress
+ *  Filters and compresses the image data of an image, without any of
+ *  the surrounding chunks.  The zlib datastream is handed to `sink` in
+ *  pieces of the IDAT size of the encoder.
+ * Args:
+ *    encoder - Pointer to an initialized encoder.
+ *    ihdr - Header of the image, which must be valid.
+ *    pixels - Image rows, as `encoder_encode()`.
+ *    sink - Callback receiving the compressed data.
+ *    context - Opaque pointer handed to `sink`.
+ * Return:
+ *    OK if the image data was compressed.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the header is not valid.
+ *    OUT_OF_MEM if the scanline buffers could not be allocated.
+ *    Otherwise the status returned by the sink.
+ */
+status_t encoder_compress(
+    encoder_t *encoder, ihdr_t const *ihdr, uint8_t const *pixels,
+    deflate_sink_t sink, void *context);
+
+/*
+ * Function: encoder_compress_source
+ *  Same as `encoder_compress()`, from pixels in any source format.
+ */
+status_t encoder_compress_source(
+    encoder_t *encoder, ihdr_t const *ihdr, encoder_source_t const *source,
+    deflate_sink_t sink, void *context);
+
+/*
+ * Function: encoder_free
+ *  Frees the resources of an initialized encoder and clears it.
+ */
+status_t encoder_free(encoder_t *encoder);
+
+#endif /* _ENCODER_H_ */
@@ -4,8 +4,12 @@
  *  Copyright (c) 2018 Alex Dale
  *  See LICENSE for details
  */
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "engine.h"
 
@@ -23,3 +27,154 @@ void *engine_allocate(size_t bytes)
     }
     return malloc(bytes);
 }
+
+void *engine_allocate_large(size_t bytes)
+{
+    return malloc(bytes);
+}
+
+double engine_cpu_seconds(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    {
+        /* CPU time of the whole process, where threads have no clock. */
+        return (double)clock() / CLOCKS_PER_SEC;
+    }
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Stored in front of every pool buffer, so that its capacity is known
+ * whatever size it was last handed out for.  Keeps the buffer aligned.
+ */
+typedef union {
+    size_t capacity;
+    max_align_t align;
+} pool_header_t;
+
+/* Calls through a volatile pointer cannot be elided as dead stores. */
+static void *(*const volatile wipe_memset)(void *, int, size_t) = memset;
+
+void engine_wipe(void *buffer, size_t bytes)
+{
+    if (buffer && bytes > 0)
+    {
+        wipe_memset(buffer, 0, bytes);
+    }
+}
+
+status_t engine_pool_init(size_t max_bytes, engine_pool_t *pool)
+{
+    if (!pool)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(pool, 0, sizeof(engine_pool_t));
+    if (pthread_mutex_init(&pool->lock, NULL) != 0)
+    {
+        return STATUS_FAILURE;
+    }
+    pool->max_bytes = max_bytes;
+    return STATUS_OK;
+}
+
+/* Allocates a buffer with room for its header. */
+static void *pool_buffer_new(size_t bytes)
+{
+    pool_header_t *header;
+
+    /* Same limit as `engine_allocate()`, on the buffer alone. */
+    if (bytes > kMallocLimit)
+    {
+        return NULL;
+    }
+    header = (pool_header_t *)malloc(sizeof(pool_header_t) + bytes);
+    if (!header)
+    {
+        return NULL;
+    }
+    header->capacity = bytes;
+    return header + 1;
+}
+
+void *engine_pool_allocate(engine_pool_t *pool, size_t bytes)
+{
+    void *buffer;
+    uint32_t i, best;
+
+    if (!pool)
+    {
+        return pool_buffer_new(bytes);
+    }
+
+    buffer = NULL;
+    pthread_mutex_lock(&pool->lock);
+    best = pool->count;
+    for (i = 0; i < pool->count; i++)
+    {
+        if (pool->sizes[i] >= bytes &&
+            (best == pool->count || pool->sizes[i] < pool->sizes[best]))
+        {
+            best = i;
+        }
+    }
+    if (best < pool->count)
+    {
+        buffer = pool->buffers[best];
+        pool->bytes -= pool->sizes[best];
+        pool->count--;
+        pool->buffers[best] = pool->buffers[pool->count];
+        pool->sizes[best] = pool->sizes[pool->count];
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return buffer ? buffer : pool_buffer_new(bytes);
+}
+
+void engine_pool_release(engine_pool_t *pool, void *buffer)
+{
+    pool_header_t *header;
+
+    if (!buffer)
+    {
+        return;
+    }
+
+    header = (pool_header_t *)buffer - 1;
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count < ENGINE_POOL_SLOTS &&
+            header->capacity <= pool->max_bytes - pool->bytes)
+        {
+            pool->buffers[pool->count] = buffer;
+            pool->sizes[pool->count] = header->capacity;
+            pool->count++;
+            pool->bytes += header->capacity;
+            header = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(header);
+}
+
+status_t engine_pool_free(engine_pool_t *pool)
+{
+    uint32_t i;
+
+    if (!pool)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (i = 0; i < pool->count; i++)
+    {
+        free((pool_header_t *)pool->buffers[i] - 1);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    memset(pool, 0, sizeof(engine_pool_t));
+    return STATUS_OK;
+}
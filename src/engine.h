@@ -8,10 +8,105 @@
 #ifndef _ENGINE_H_
 #define _ENGINE_H_
 
+#include <pthread.h>
+
 #include "base.h"
 
+/* Number of buffers an engine pool can hold on to. */
+#define ENGINE_POOL_SLOTS 16
+
+/*
+ * Pool of released buffers that can be handed out again instead of
+ * going through the heap.  Safe to share between threads.
+ */
+typedef struct {
+    void *buffers[ENGINE_POOL_SLOTS];
+    /* Capacity of every buffer, at least the size it was asked for. */
+    size_t sizes[ENGINE_POOL_SLOTS];
+    uint32_t count;
+    /* Upper limit on the bytes held by the pool. */
+    size_t max_bytes;
+    size_t bytes;
+    pthread_mutex_t lock;
+} engine_pool_t;
+
+/*
+ * Type: engine_sink_t
+ *  Receives output of a compression stream.  Anything other than OK
+ *  aborts compression and is returned to the caller.
+ */
+typedef status_t (*engine_sink_t)(
+    void *context, uint8_t const *data, size_t length);
+
+/*
+ * Compression backend producing zlib datastreams (RFC1950).  A stream
+ * is created for a level and an output size, and reused by every
+ * datastream started with `reset`.  Every call of the sink but the
+ * last of a datastream carries exactly the output size.
+ */
+typedef struct {
+    char_t const *name;
+    /* Compression levels go from 0 (stored) to `max_level`. */
+    uint32_t max_level;
+    status_t (*create)(uint32_t level, size_t output_size, void **stream);
+    status_t (*reset)(void *stream, engine_sink_t sink, void *context);
+    status_t (*write)(void *stream, uint8_t const *data, size_t length);
+    /* Hands all remaining output to the sink. */
+    status_t (*finish)(void *stream);
+    void (*destroy)(void *stream);
+} engine_compressor_t;
+
 void engine_die(char_t const * msg);
 
 void *engine_allocate(size_t bytes);
 
+/*
+ * Function: engine_allocate_large
+ *  Allocates a buffer that grows with the image, such as a whole frame
+ *  or canvas, without the kMallocLimit cap of `engine_allocate()`.
+ *  Callers bound `bytes` by an explicit limit of their options first.
+ */
+void *engine_allocate_large(size_t bytes);
+
+/*
+ * Function: engine_cpu_seconds
+ *  Returns the CPU time used so far by the calling thread, in seconds.
+ */
+double engine_cpu_seconds(void);
+
+/*
+ * Function: engine_wipe
+ *  Zeros a buffer in a way the compiler cannot optimize away.
+ */
+void engine_wipe(void *buffer, size_t bytes);
+
+/*
+ * Function: engine_pool_init
+ *  Initializes an empty pool holding at most `max_bytes` bytes.
+ */
+status_t engine_pool_init(size_t max_bytes, engine_pool_t *pool);
+
+/*
+ * Function: engine_pool_allocate
+ *  Hands out the smallest pooled buffer of at least `bytes` bytes, or
+ *  allocates a new one as `engine_allocate()`.  A NULL pool always
+ *  allocates.  The buffer keeps its capacity in a header in front of
+ *  it, so it must only be freed by `engine_pool_release()`.
+ */
+void *engine_pool_allocate(engine_pool_t *pool, size_t bytes);
+
+/*
+ * Function: engine_pool_release
+ *  Returns a buffer from `engine_pool_allocate()` to the pool, which
+ *  counts it at its full capacity.  The buffer is freed if the pool is
+ *  NULL or full.
+ */
+void engine_pool_release(engine_pool_t *pool, void *buffer);
+
+/*
+ * Function: engine_pool_free
+ *  Frees every pooled buffer and the pool itself.
+ */
+status_t engine_pool_free(engine_pool_t *pool);
+
 #endif /* _ENGINE_H_ */
@@ -0,0 +1,242 @@
+/*
+ *  Image-Formats - PNG Scanline Filters
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+filter_type_t filter_type_from_code(uint8_t filter_type_code)
+{
+    switch (filter_type_code)
+    {
+        case 0:
+            return FILTER_TYPE_NONE;
+        case 1:
+            return FILTER_TYPE_SUB;
+        case 2:
+            return FILTER_TYPE_UP;
+        case 3:
+            return FILTER_TYPE_AVERAGE;
+        case 4:
+            return FILTER_TYPE_PAETH;
+        default:
+            return FILTER_TYPE_UNKNOWN;
+    }
+}
+
+static uint8_t paeth_predictor(uint8_t a, uint8_t b, uint8_t c)
+{
+    int32_t p, pa, pb, pc;
+    p = (int32_t)a + b - c;
+    pa = abs(p - a);
+    pb = abs(p - b);
+    pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+    {
+        return a;
+    }
+    if (pb <= pc)
+    {
+        return b;
+    }
+    return c;
+}
+
+status_t filter_unfilter_row(
+    uint8_t filter_type_code, uint8_t *row, uint8_t const *prior,
+    size_t length, uint32_t pixel_bytes)
+{
+    size_t i;
+
+    if (!row)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (pixel_bytes == 0)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    /* Pixels left of the row and the row above the first are zero. */
+    switch (filter_type_from_code(filter_type_code))
+    {
+        case FILTER_TYPE_NONE:
+            break;
+        case FILTER_TYPE_SUB:
+            for (i = pixel_bytes; i < length; i++)
+            {
+                row[i] += row[i - pixel_bytes];
+            }
+            break;
+        case FILTER_TYPE_UP:
+            if (!prior)
+            {
+                break;
+            }
+            for (i = 0; i < length; i++)
+            {
+                row[i] += prior[i];
+            }
+            break;
+        case FILTER_TYPE_AVERAGE:
+            for (i = 0; i < length && i < pixel_bytes; i++)
+            {
+                row[i] += (prior ? prior[i] : 0) >> 1;
+            }
+            for (; i < length; i++)
+            {
+                row[i] += ((uint32_t)row[i - pixel_bytes] +
+                           (prior ? prior[i] : 0)) >> 1;
+            }
+            break;
+        case FILTER_TYPE_PAETH:
+            if (!prior)
+            {
+                /* With a zero prior row Paeth reduces to Sub. */
+                for (i = pixel_bytes; i < length; i++)
+                {
+                    row[i] += row[i - pixel_bytes];
+                }
+                break;
+            }
+            for (i = 0; i < length && i < pixel_bytes; i++)
+            {
+                row[i] += prior[i];
+            }
+            for (; i < length; i++)
+            {
+                row[i] += paeth_predictor(
+                    row[i - pixel_bytes], prior[i], prior[i - pixel_bytes]);
+            }
+            break;
+        default:
+            return STATUS_BAD_PACKET;
+    }
+
+    return STATUS_OK;
+}
+
+status_t filter_filter_row(
+    filter_type_t filter_type, uint8_t const *row, uint8_t const *prior,
+    size_t length, uint32_t pixel_bytes, uint8_t *out)
+{
+    size_t i;
+    uint8_t left, up, corner;
+
+    if (!row || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (pixel_bytes == 0)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    /* Pixels left of the row and the row above the first are zero. */
+    switch (filter_type)
+    {
+        case FILTER_TYPE_NONE:
+            memcpy(out, row, length);
+            break;
+        case FILTER_TYPE_SUB:
+            for (i = 0; i < length && i < pixel_bytes; i++)
+            {
+                out[i] = row[i];
+            }
+            for (; i < length; i++)
+            {
+                out[i] = row[i] - row[i - pixel_bytes];
+            }
+            break;
+        case FILTER_TYPE_UP:
+            if (!prior)
+            {
+                memcpy(out, row, length);
+                break;
+            }
+            for (i = 0; i < length; i++)
+            {
+                out[i] = row[i] - prior[i];
+            }
+            break;
+        case FILTER_TYPE_AVERAGE:
+            for (i = 0; i < length; i++)
+            {
+                left = (i >= pixel_bytes) ? row[i - pixel_bytes] : 0;
+                up = prior ? prior[i] : 0;
+                out[i] = row[i] - (uint8_t)(((uint32_t)left + up) >> 1);
+            }
+            break;
+        case FILTER_TYPE_PAETH:
+            for (i = 0; i < length; i++)
+            {
+                left = (i >= pixel_bytes) ? row[i - pixel_bytes] : 0;
+                up = prior ? prior[i] : 0;
+                corner = (prior && i >= pixel_bytes) ?
+                    prior[i - pixel_bytes] : 0;
+                out[i] = row[i] - paeth_predictor(left, up, corner);
+            }
+            break;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    return STATUS_OK;
+}
+
+/* Sum of the filtered bytes taken as signed magnitudes. */
+static uint64_t filter_cost(uint8_t const *data, size_t length)
+{
+    uint64_t sum;
+    size_t i;
+
+    sum = 0;
+    for (i = 0; i < length; i++)
+    {
+        sum += (data[i] < 128) ? data[i] : 256 - data[i];
+    }
+    return sum;
+}
+
+status_t filter_choose_row(
+    uint8_t const *row, uint8_t const *prior, size_t length,
+    uint32_t pixel_bytes, uint8_t *scratch, uint8_t *out)
+{
+    uint64_t cost, best_cost;
+    uint32_t type;
+    status_t status;
+
+    if (!row || !scratch || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    out[0] = FILTER_TYPE_NONE;
+    status = filter_filter_row(
+        FILTER_TYPE_NONE, row, prior, length, pixel_bytes, out + 1);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    best_cost = filter_cost(out + 1, length);
+
+    for (type = FILTER_TYPE_SUB; type <= FILTER_TYPE_PAETH; type++)
+    {
+        filter_filter_row(
+            (filter_type_t)type, row, prior, length, pixel_bytes, scratch);
+        cost = filter_cost(scratch, length);
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            out[0] = (uint8_t)type;
+            memcpy(out + 1, scratch, length);
+        }
+    }
+    return STATUS_OK;
+}
@@ -0,0 +1,90 @@
+/*
+ *  Image-Formats - PNG Scanline Filters
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include "base.h"
+
+/*
+ *  Filter types of filter method 0.  Defined in RFC2083 Section 6.
+ */
+
+typedef enum {
+    FILTER_TYPE_NONE,
+    FILTER_TYPE_SUB,
+    FILTER_TYPE_UP,
+    FILTER_TYPE_AVERAGE,
+    FILTER_TYPE_PAETH,
+    /* Larger than posible filter type codes. */
+    FILTER_TYPE_UNKNOWN = 256
+} filter_type_t;
+
+filter_type_t filter_type_from_code(uint8_t filter_type_code);
+
+/*
+ * Function: filter_unfilter_row
+ *  Reverses the filter applied to a single scanline, in place.
+ * Args:
+ *    filter_type_code - Filter type byte that preceded the scanline.
+ *    row - Scanline data, without the filter type byte.
+ *    prior - The previous unfiltered scanline of the same pass.  Can
+ *            be NULL for the first scanline of a pass.
+ *    length - Length of `row` (and `prior`) in bytes.
+ *    pixel_bytes - Number of bytes per complete pixel, rounded up
+ *                  to 1.
+ * Return:
+ *    OK if the scanline was unfiltered.
+ *    NULL_ARG if `row` is NULL.
+ *    BAD_PACKET if the filter type is unknown.
+ */
+status_t filter_unfilter_row(
+    uint8_t filter_type_code, uint8_t *row, uint8_t const *prior,
+    size_t length, uint32_t pixel_bytes);
+
+/*
+ * Function: filter_filter_row
+ *  Applies a filter to a single scanline.
+ * Args:
+ *    filter_type - Filter to apply.
+ *    row - Unfiltered scanline data.
+ *    prior - The previous unfiltered scanline of the same pass.  Can
+ *            be NULL for the first scanline of a pass.
+ *    length - Length of `row` (and `prior`) in bytes.
+ *    pixel_bytes - Number of bytes per complete pixel, rounded up
+ *                  to 1.
+ *    out - Destination of the `length` filtered bytes.
+ * Return:
+ *    OK if the scanline was filtered.
+ *    NULL_ARG if `row` or `out` are NULL.
+ *    ILLEGAL_ARG if the filter type is unknown.
+ */
+status_t filter_filter_row(
+    filter_type_t filter_type, uint8_t const *row, uint8_t const *prior,
+    size_t length, uint32_t pixel_bytes, uint8_t *out);
+
+/*
+ * Function: filter_choose_row
+ *  Filters a scanline with the filter type that gives the smallest
+ *  sum of absolute values, taken as signed bytes.  This is the
+ *  heuristic suggested by RFC2083 Section 9.6.
+ * Args:
+ *    row - Unfiltered scanline data.
+ *    prior - As `filter_filter_row()`.
+ *    length - Length of `row` (and `prior`) in bytes.
+ *    pixel_bytes - As `filter_filter_row()`.
+ *    scratch - Scratch space of `length` bytes.
+ *    out - Destination of the filter type byte followed by the
+ *          `length` filtered bytes.
+ * Return:
+ *    OK if the scanline was filtered.
+ *    NULL_ARG if any of the buffers are NULL.
+ */
+status_t filter_choose_row(
+    uint8_t const *row, uint8_t const *prior, size_t length,
+    uint32_t pixel_bytes, uint8_t *scratch, uint8_t *out);
+
+#endif /* _FILTER_H_ */
@@ -74,6 +74,12 @@ static uint8_t const kValidInterlaceMethods[] = {
     kAdam7Interlace
 };
 
+/* Adam7 pass layout.  Defined in RFC2083 Section 2.6. */
+static uint32_t const kAdam7XOffset[ADAM7_PASS_COUNT] = {0, 4, 0, 2, 0, 1, 0};
+static uint32_t const kAdam7YOffset[ADAM7_PASS_COUNT] = {0, 0, 4, 0, 2, 0, 1};
+static uint32_t const kAdam7XStep[ADAM7_PASS_COUNT] = {8, 8, 4, 4, 2, 2, 1};
+static uint32_t const kAdam7YStep[ADAM7_PASS_COUNT] = {8, 8, 8, 4, 4, 2, 2};
+
 /*
  * IDAT specific constants.  Defined in RFC2083 Section 4.1.3.
  */
@@ -406,6 +412,121 @@ status_t ihdr_get_sample_depth(ihdr_t const *ihdr, uint32_t *sample_depth)
     return STATUS_OK;
 }
 
+status_t ihdr_get_channel_count(ihdr_t const *ihdr, uint32_t *channels)
+{
+    if (!ihdr || !channels)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    switch (color_type_from_code(ihdr->color_type))
+    {
+        case COLOR_TYPE_GRAYSCALE:
+        case COLOR_TYPE_PALETTE:
+            *channels = 1;
+            return STATUS_OK;
+        case COLOR_TYPE_GRAYSCALE_ALPHA:
+            *channels = 2;
+            return STATUS_OK;
+        case COLOR_TYPE_REALCOLOR:
+            *channels = 3;
+            return STATUS_OK;
+        case COLOR_TYPE_REALCOLOR_ALPHA:
+            *channels = 4;
+            return STATUS_OK;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+status_t ihdr_get_pixel_bits(ihdr_t const *ihdr, uint32_t *pixel_bits)
+{
+    uint32_t channels;
+    status_t status;
+
+    if (!ihdr || !pixel_bits)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = ihdr_get_channel_count(ihdr, &channels);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    *pixel_bits = channels * ihdr->bit_depth;
+    return STATUS_OK;
+}
+
+status_t ihdr_get_row_size(
+    ihdr_t const *ihdr, uint32_t width, size_t *row_size)
+{
+    uint32_t pixel_bits;
+    status_t status;
+
+    if (!ihdr || !row_size)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = ihdr_get_pixel_bits(ihdr, &pixel_bits);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    /* Scanlines are padded to a whole number of bytes. */
+    *row_size = (size_t)(((uint64_t)width * pixel_bits + 7) / 8);
+    return STATUS_OK;
+}
+
+uint32_t ihdr_get_pass_count(ihdr_t const *ihdr)
+{
+    if (ihdr && ihdr->interlace_method == kAdam7Interlace)
+    {
+        return ADAM7_PASS_COUNT;
+    }
+    return 1;
+}
+
+status_t ihdr_get_pass(
+    ihdr_t const *ihdr, uint32_t pass, ihdr_pass_t *geometry)
+{
+    if (!ihdr || !geometry)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (pass >= ihdr_get_pass_count(ihdr))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    if (ihdr->interlace_method != kAdam7Interlace)
+    {
+        geometry->x_offset = 0;
+        geometry->y_offset = 0;
+        geometry->x_step = 1;
+        geometry->y_step = 1;
+        geometry->width = ihdr->width;
+        geometry->height = ihdr->height;
+        return STATUS_OK;
+    }
+
+    geometry->x_offset = kAdam7XOffset[pass];
+    geometry->y_offset = kAdam7YOffset[pass];
+    geometry->x_step = kAdam7XStep[pass];
+    geometry->y_step = kAdam7YStep[pass];
+    geometry->width = (ihdr->width > geometry->x_offset) ?
+        (ihdr->width - geometry->x_offset + geometry->x_step - 1) /
+            geometry->x_step : 0;
+    geometry->height = (ihdr->height > geometry->y_offset) ?
+        (ihdr->height - geometry->y_offset + geometry->y_step - 1) /
+            geometry->y_step : 0;
+    return STATUS_OK;
+}
+
 bool_t ihdr_color_type_is_greyscale(uint8_t color_type)
 {
     return (color_type == 0);
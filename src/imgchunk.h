@@ -182,6 +182,95 @@ status_t ihdr_from_chunk(chunk_t const *chunk, ihdr_t *ihdr);
  */
 status_t ihdr_get_sample_depth(ihdr_t const *ihdr, uint32_t *sample_depth);
 
+/*
+ * Function: ihdr_get_channel_count
+ *  Determines the number of samples that make up a single pixel.
+ * Args:
+ *    ihdr - Pointer to an initialized IHDR struct.
+ *    channels - Will store the number of channels.
+ * Return:
+ *    OK if channel count was found.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the color type is unknown.
+ */
+status_t ihdr_get_channel_count(ihdr_t const *ihdr, uint32_t *channels);
+
+/*
+ * Function: ihdr_get_pixel_bits
+ *  Determines the number of bits used by a single pixel in the
+ *  serialized image data.
+ * Args:
+ *    ihdr - Pointer to an initialized IHDR struct.
+ *    pixel_bits - Will store the number of bits per pixel.
+ * Return:
+ *    OK if the pixel size was found.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the color type is unknown.
+ */
+status_t ihdr_get_pixel_bits(ihdr_t const *ihdr, uint32_t *pixel_bits);
+
+/*
+ * Function: ihdr_get_row_size
+ *  Determines the number of bytes used by a scanline of `width`
+ *  pixels, not including the leading filter type byte.
+ * Args:
+ *    ihdr - Pointer to an initialized IHDR struct.
+ *    width - Number of pixels in the scanline.
+ *    row_size - Will store the size of the scanline in bytes.
+ * Return:
+ *    OK if the row size was found.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the color type is unknown.
+ */
+status_t ihdr_get_row_size(
+    ihdr_t const *ihdr, uint32_t width, size_t *row_size);
+
+/*
+ *  Interlace passes.
+ */
+
+/* Number of passes used by the Adam7 interlace method. */
+#define ADAM7_PASS_COUNT 7
+
+typedef struct {
+    /* Image coordinates of the first pixel of the pass. */
+    uint32_t x_offset;
+    uint32_t y_offset;
+    /* Image distance between neighbouring pixels of the pass. */
+    uint32_t x_step;
+    uint32_t y_step;
+    /* Size of the reduced image in pixels.  Either can be 0. */
+    uint32_t width;
+    uint32_t height;
+} ihdr_pass_t;
+
+/*
+ * Function: ihdr_get_pass_count
+ *  Determines the number of reduced images stored in the image data.
+ * Args:
+ *    ihdr - Pointer to an initialized IHDR struct.
+ * Return:
+ *    7 for Adam7 interlaced images, otherwise 1.
+ */
+uint32_t ihdr_get_pass_count(ihdr_t const *ihdr);
+
+/*
+ * Function: ihdr_get_pass
+ *  Determines the geometry of a single pass of the image data.  A
+ *  non-interlaced image consists of a single pass covering the whole
+ *  image.
+ * Args:
+ *    ihdr - Pointer to an initialized IHDR struct.
+ *    pass - Index of the pass, less than `ihdr_get_pass_count()`.
+ *    geometry - Will store the pass geometry.
+ * Return:
+ *    OK if the pass exists.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the pass index is out of range.
+ */
+status_t ihdr_get_pass(
+    ihdr_t const *ihdr, uint32_t pass, ihdr_pass_t *geometry);
+
 /* Color type */
 bool_t ihdr_color_type_is_greyscale(uint8_t color_type);
 bool_t ihdr_color_type_is_palette(uint8_t color_type);
@@ -0,0 +1,1308 @@
+/*
+ *  Image-Formats - Inflate
+ *      Streaming decompression of zlib datastreams (RFC1950 / RFC1951).
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#include "inflate.h"
+
+/* Back references may reach up to 32 KiB into the output. */
+static uint32_t const kWindowSize = 32768;
+static uint32_t const kWindowMask = 32767;
+
+/* zlib header fields.  Defined in RFC1950 Section 2.2. */
+static uint32_t const kDeflateMethod = 8;
+static uint32_t const kMaxWindowInfo = 7;
+static uint32_t const kPresetDictBitMask = 0x20;
+static uint32_t const kHeaderCheckBase = 31;
+
+static uint32_t const kAdlerBase = 65521;
+/* Largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits. */
+static size_t const kAdlerMaxRun = 5552;
+
+/* Block types.  Defined in RFC1951 Section 3.2.3. */
+static uint32_t const kBlockStored = 0;
+static uint32_t const kBlockFixed = 1;
+static uint32_t const kBlockDynamic = 2;
+
+static uint32_t const kEndOfBlock = 256;
+static uint32_t const kFixedLiteralCodes = 288;
+static uint32_t const kFixedDistanceCodes = 30;
+static uint32_t const kMaxLiteralCodes = 286;
+static uint32_t const kMaxDistanceCodes = 30;
+static uint32_t const kCodeLengthCodes = 19;
+
+/* Base values and extra bits of length and distance codes. */
+static uint16_t const kLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static uint8_t const kLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static uint16_t const kDistanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static uint8_t const kDistanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* Transmission order of the code length code lengths. */
+static uint8_t const kCodeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Longest code of the code length alphabet. */
+static uint32_t const kPrecodeBits = 7;
+
+/*
+ * Output space needed by the fast loop for one more symbol: the longest
+ * match, plus the overshoot of copying it 8 bytes at a time.
+ */
+static size_t const kFastOutput = 258 + 8;
+/* Input bytes read at once to refill the bit buffer. */
+static size_t const kFastInput = 8;
+
+typedef enum {
+    INFLATE_STATE_ZLIB_HEADER,
+    INFLATE_STATE_BLOCK_HEADER,
+    INFLATE_STATE_STORED,
+    INFLATE_STATE_CODES,
+    INFLATE_STATE_TRAILER,
+    INFLATE_STATE_DONE
+} inflate_state_t;
+
+/*
+ * Decoding table entries hold, from the least significant bit:
+ *  5 bits - Number of bits of input consumed by the entry.
+ *  3 bits - Kind of entry.
+ *  4 bits - Extra bits following a length or distance code, the index
+ *           bits of a subtable, or the code length of the first of two
+ *           literals.
+ *  16 bits (from bit 16) - Literal, two literals (first in the low
+ *           byte), base length or distance, or subtable offset.
+ */
+typedef enum {
+    ENTRY_LITERAL,
+    ENTRY_DOUBLE_LITERAL,
+    ENTRY_BASE,
+    ENTRY_END_OF_BLOCK,
+    ENTRY_SUBTABLE,
+    ENTRY_INVALID
+} entry_kind_t;
+
+typedef enum {
+    TABLE_PRECODE,
+    TABLE_LITLEN,
+    TABLE_DISTANCE
+} table_kind_t;
+
+static uint32_t make_entry(
+    uint32_t value, uint32_t extra, entry_kind_t kind, uint32_t length)
+{
+    return (value << 16) | (extra << 8) | ((uint32_t)kind << 5) | length;
+}
+
+static uint32_t entry_length(uint32_t entry)
+{
+    return entry & 0x1f;
+}
+
+static entry_kind_t entry_kind(uint32_t entry)
+{
+    return (entry_kind_t)((entry >> 5) & 0x7);
+}
+
+static uint32_t entry_extra(uint32_t entry)
+{
+    return (entry >> 8) & 0xf;
+}
+
+static uint32_t entry_value(uint32_t entry)
+{
+    return entry >> 16;
+}
+
+uint32_t adler32_update(uint32_t adler, uint8_t const *buf, size_t len)
+{
+    uint32_t a, b;
+    size_t run;
+
+    a = adler & 0xffffu;
+    b = adler >> 16;
+    while (len > 0)
+    {
+        run = len < kAdlerMaxRun ? len : kAdlerMaxRun;
+        len -= run;
+        for (; run >= 8; run -= 8, buf += 8)
+        {
+            a += buf[0]; b += a;
+            a += buf[1]; b += a;
+            a += buf[2]; b += a;
+            a += buf[3]; b += a;
+            a += buf[4]; b += a;
+            a += buf[5]; b += a;
+            a += buf[6]; b += a;
+            a += buf[7]; b += a;
+        }
+        while (run--)
+        {
+            a += *buf++;
+            b += a;
+        }
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+    }
+    return (b << 16) | a;
+}
+
+/* Moves on to the next block of compressed data. */
+static status_t next_input(inflater_t *inflater)
+{
+    status_t status;
+
+    status = inflater->source(
+        inflater->source_context, &inflater->input, &inflater->input_length);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (!inflater->input || inflater->input_length == 0)
+    {
+        return STATUS_BAD_PACKET;
+    }
+    return STATUS_OK;
+}
+
+/* Adds one byte of input to the bit buffer, which must have room. */
+static status_t pull_byte(inflater_t *inflater)
+{
+    status_t status;
+
+    if (inflater->input_length == 0)
+    {
+        status = next_input(inflater);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    inflater->bit_buffer |=
+        (uint64_t)*inflater->input++ << inflater->bit_count;
+    inflater->input_length--;
+    inflater->bit_count += 8;
+    return STATUS_OK;
+}
+
+static status_t get_bits(inflater_t *inflater, uint32_t need, uint32_t *value)
+{
+    status_t status;
+
+    while (inflater->bit_count < need)
+    {
+        status = pull_byte(inflater);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    *value = (uint32_t)(inflater->bit_buffer & ((1u << need) - 1));
+    inflater->bit_buffer >>= need;
+    inflater->bit_count -= need;
+    return STATUS_OK;
+}
+
+/* Drops the bits up to the next byte boundary. */
+static void align_bits(inflater_t *inflater)
+{
+    inflater->bit_buffer >>= inflater->bit_count & 7;
+    inflater->bit_count -= inflater->bit_count & 7;
+}
+
+static uint64_t load_le64(uint8_t const *p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+        ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+        ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+        ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t reverse_bits(uint32_t code, uint32_t length)
+{
+    uint32_t reversed;
+
+    reversed = 0;
+    while (length--)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+/* Decoding table entry of a symbol, without its code length. */
+static uint32_t symbol_entry(table_kind_t kind, uint32_t sym)
+{
+    if (kind == TABLE_PRECODE)
+    {
+        return make_entry(sym, 0, ENTRY_LITERAL, 0);
+    }
+    if (kind == TABLE_DISTANCE)
+    {
+        if (sym >= sizeof(kDistanceBase) / sizeof(kDistanceBase[0]))
+        {
+            return make_entry(0, 0, ENTRY_INVALID, 0);
+        }
+        return make_entry(
+            kDistanceBase[sym], kDistanceExtra[sym], ENTRY_BASE, 0);
+    }
+
+    if (sym < kEndOfBlock)
+    {
+        return make_entry(sym, 0, ENTRY_LITERAL, 0);
+    }
+    if (sym == kEndOfBlock)
+    {
+        return make_entry(0, 0, ENTRY_END_OF_BLOCK, 0);
+    }
+    sym -= kEndOfBlock + 1;
+    if (sym >= sizeof(kLengthBase) / sizeof(kLengthBase[0]))
+    {
+        return make_entry(0, 0, ENTRY_INVALID, 0);
+    }
+    return make_entry(kLengthBase[sym], kLengthExtra[sym], ENTRY_BASE, 0);
+}
+
+/*
+ * Builds the decoding table of a canonical Huffman code from its code
+ * lengths.  Entries of the primary table are indexed by the next `bits`
+ * bits of input, least significant first as codes are packed.  `left`
+ * will store the number of unused codes, which is non-zero for
+ * incomplete codes whose missing entries decode as invalid.
+ */
+static status_t table_build(
+    uint32_t *table, uint32_t size, uint32_t bits, table_kind_t kind,
+    uint8_t const *lengths, uint32_t count, int32_t *left)
+{
+    uint16_t counts[INFLATE_MAX_BITS + 1];
+    uint16_t offsets[INFLATE_MAX_BITS + 1];
+    uint16_t sorted[INFLATE_MAX_SYMBOLS];
+    uint16_t sub_offset[1 << INFLATE_LITLEN_TABLE_BITS];
+    uint8_t sub_bits[1 << INFLATE_LITLEN_TABLE_BITS];
+    uint32_t len, sym, code, reversed, index, next, prefix, i, n, entry;
+    uint32_t mask;
+    int32_t unused;
+
+    memset(counts, 0, sizeof(counts));
+    for (sym = 0; sym < count; sym++)
+    {
+        counts[lengths[sym]]++;
+    }
+
+    unused = 1;
+    for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        unused <<= 1;
+        unused -= counts[len];
+        if (unused < 0)
+        {
+            /* Over-subscribed code. */
+            return STATUS_BAD_PACKET;
+        }
+    }
+    *left = unused;
+
+    offsets[1] = 0;
+    for (len = 1; len < INFLATE_MAX_BITS; len++)
+    {
+        offsets[len + 1] = offsets[len] + counts[len];
+    }
+    for (sym = 0; sym < count; sym++)
+    {
+        if (lengths[sym] != 0)
+        {
+            sorted[offsets[lengths[sym]]++] = (uint16_t)sym;
+        }
+    }
+
+    /* Codes are handed out in order, so each prefix ends on its longest. */
+    mask = (1u << bits) - 1;
+    memset(sub_bits, 0, (size_t)1 << bits);
+    code = 0;
+    i = 0;
+    for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        for (n = 0; n < counts[len]; n++, i++, code++)
+        {
+            if (len > bits)
+            {
+                sub_bits[reverse_bits(code, len) & mask] =
+                    (uint8_t)(len - bits);
+            }
+        }
+        code <<= 1;
+    }
+
+    entry = make_entry(0, 0, ENTRY_INVALID, INFLATE_MAX_BITS);
+    for (index = 0; index <= mask; index++)
+    {
+        table[index] = entry;
+    }
+    next = mask + 1;
+    for (prefix = 0; prefix <= mask; prefix++)
+    {
+        if (sub_bits[prefix] == 0)
+        {
+            continue;
+        }
+        if (next + (1u << sub_bits[prefix]) > size)
+        {
+            return STATUS_BAD_PACKET;
+        }
+        sub_offset[prefix] = (uint16_t)next;
+        table[prefix] = make_entry(
+            next, sub_bits[prefix], ENTRY_SUBTABLE, bits);
+        for (index = 0; index < (1u << sub_bits[prefix]); index++)
+        {
+            table[next + index] = entry;
+        }
+        next += 1u << sub_bits[prefix];
+    }
+
+    code = 0;
+    i = 0;
+    for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        for (n = 0; n < counts[len]; n++, i++, code++)
+        {
+            entry = symbol_entry(kind, sorted[i]) | len;
+            reversed = reverse_bits(code, len);
+            if (len <= bits)
+            {
+                for (index = reversed; index <= mask; index += 1u << len)
+                {
+                    table[index] = entry;
+                }
+                continue;
+            }
+            prefix = reversed & mask;
+            for (index = reversed >> bits;
+                 index < (1u << sub_bits[prefix]);
+                 index += 1u << (len - bits))
+            {
+                table[sub_offset[prefix] + index] = entry;
+            }
+        }
+        code <<= 1;
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Merges pairs of short literal codes into single entries of the
+ * primary table, so that both are decoded by one lookup.
+ */
+static void table_pair_literals(uint32_t *table, uint32_t bits)
+{
+    uint32_t index, first, second, first_length, second_length;
+
+    /* The second code is found at a lower index, still unmerged. */
+    for (index = 1u << bits; index-- > 0;)
+    {
+        first = table[index];
+        first_length = entry_length(first);
+        if (entry_kind(first) != ENTRY_LITERAL || first_length >= bits)
+        {
+            continue;
+        }
+        second = table[index >> first_length];
+        second_length = entry_length(second);
+        if (entry_kind(second) != ENTRY_LITERAL ||
+            first_length + second_length > bits)
+        {
+            continue;
+        }
+        table[index] = make_entry(
+            entry_value(first) | (entry_value(second) << 8), first_length,
+            ENTRY_DOUBLE_LITERAL, first_length + second_length);
+    }
+}
+
+/* Incomplete codes are only allowed for a single code of one bit. */
+static bool_t is_single_code(uint8_t const *lengths, uint32_t count)
+{
+    uint32_t sym;
+
+    for (sym = 0; sym < count; sym++)
+    {
+        if (lengths[sym] > 1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Decodes the next symbol, pulling input one byte at a time as needed,
+ * without consuming its bits.  Two literals are only decoded at once
+ * if `pair` is set and both codes are available.
+ */
+static status_t peek_symbol(
+    inflater_t *inflater, uint32_t const *table, uint32_t bits, bool_t pair,
+    uint32_t *symbol)
+{
+    uint32_t entry;
+    status_t status;
+
+    for (;;)
+    {
+        entry = table[inflater->bit_buffer & ((1u << bits) - 1)];
+        if (entry_kind(entry) == ENTRY_SUBTABLE)
+        {
+            entry = table[entry_value(entry) +
+                ((inflater->bit_buffer >> bits) &
+                 ((1u << entry_extra(entry)) - 1))];
+        }
+        if (entry_kind(entry) == ENTRY_DOUBLE_LITERAL &&
+            (!pair || entry_length(entry) > inflater->bit_count))
+        {
+            entry = make_entry(
+                entry_value(entry) & 0xff, 0, ENTRY_LITERAL,
+                entry_extra(entry));
+        }
+        if (entry_length(entry) <= inflater->bit_count)
+        {
+            *symbol = entry;
+            return STATUS_OK;
+        }
+        status = pull_byte(inflater);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+}
+
+static status_t decode_symbol(
+    inflater_t *inflater, uint32_t const *table, uint32_t bits, bool_t pair,
+    uint32_t *entry)
+{
+    status_t status;
+
+    status = peek_symbol(inflater, table, bits, pair, entry);
+    if (status == STATUS_OK)
+    {
+        inflater->bit_buffer >>= entry_length(*entry);
+        inflater->bit_count -= entry_length(*entry);
+    }
+    return status;
+}
+
+static status_t build_fixed_tables(inflater_t *inflater)
+{
+    uint8_t lengths[INFLATE_MAX_SYMBOLS];
+    uint32_t sym;
+    int32_t left;
+    status_t status;
+
+    if (inflater->fixed_tables)
+    {
+        return STATUS_OK;
+    }
+
+    for (sym = 0; sym < 144; sym++) lengths[sym] = 8;
+    for (; sym < 256; sym++) lengths[sym] = 9;
+    for (; sym < 280; sym++) lengths[sym] = 7;
+    for (; sym < kFixedLiteralCodes; sym++) lengths[sym] = 8;
+    status = table_build(
+        inflater->litlen_table, INFLATE_LITLEN_TABLE_SIZE,
+        INFLATE_LITLEN_TABLE_BITS, TABLE_LITLEN, lengths,
+        kFixedLiteralCodes, &left);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    table_pair_literals(inflater->litlen_table, INFLATE_LITLEN_TABLE_BITS);
+
+    for (sym = 0; sym < kFixedDistanceCodes; sym++) lengths[sym] = 5;
+    status = table_build(
+        inflater->distance_table, INFLATE_DISTANCE_TABLE_SIZE,
+        INFLATE_DISTANCE_TABLE_BITS, TABLE_DISTANCE, lengths,
+        kFixedDistanceCodes, &left);
+    inflater->fixed_tables = (status == STATUS_OK);
+    return status;
+}
+
+static status_t build_dynamic_tables(inflater_t *inflater)
+{
+    uint8_t lengths[kMaxLiteralCodes + kMaxDistanceCodes];
+    uint32_t nlen, ndist, ncode, index, sym, len, repeat, entry;
+    int32_t left;
+    status_t status;
+
+    if ((status = get_bits(inflater, 5, &nlen)) != STATUS_OK ||
+        (status = get_bits(inflater, 5, &ndist)) != STATUS_OK ||
+        (status = get_bits(inflater, 4, &ncode)) != STATUS_OK)
+    {
+        return status;
+    }
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlen > kMaxLiteralCodes || ndist > kMaxDistanceCodes)
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    /* Code length code, which must be complete.  Borrows the literal
+       table, which is rebuilt below. */
+    inflater->fixed_tables = false;
+    memset(lengths, 0, kCodeLengthCodes);
+    for (index = 0; index < ncode; index++)
+    {
+        status = get_bits(inflater, 3, &len);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        lengths[kCodeLengthOrder[index]] = (uint8_t)len;
+    }
+    status = table_build(
+        inflater->litlen_table, INFLATE_LITLEN_TABLE_SIZE, kPrecodeBits,
+        TABLE_PRECODE, lengths, kCodeLengthCodes, &left);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (left != 0)
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    /* Literal/length and distance code lengths. */
+    index = 0;
+    while (index < nlen + ndist)
+    {
+        status = decode_symbol(
+            inflater, inflater->litlen_table, kPrecodeBits, false, &entry);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        sym = entry_value(entry);
+        if (sym < 16)
+        {
+            lengths[index++] = (uint8_t)sym;
+            continue;
+        }
+
+        len = 0;
+        if (sym == 16)
+        {
+            if (index == 0)
+            {
+                return STATUS_BAD_PACKET;
+            }
+            len = lengths[index - 1];
+            status = get_bits(inflater, 2, &repeat);
+            repeat += 3;
+        }
+        else if (sym == 17)
+        {
+            status = get_bits(inflater, 3, &repeat);
+            repeat += 3;
+        }
+        else
+        {
+            status = get_bits(inflater, 7, &repeat);
+            repeat += 11;
+        }
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        if (index + repeat > nlen + ndist)
+        {
+            return STATUS_BAD_PACKET;
+        }
+        while (repeat--)
+        {
+            lengths[index++] = (uint8_t)len;
+        }
+    }
+
+    /* A block without an end code can never terminate. */
+    if (lengths[kEndOfBlock] == 0)
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    status = table_build(
+        inflater->litlen_table, INFLATE_LITLEN_TABLE_SIZE,
+        INFLATE_LITLEN_TABLE_BITS, TABLE_LITLEN, lengths, nlen, &left);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (left > 0 && !is_single_code(lengths, nlen))
+    {
+        return STATUS_BAD_PACKET;
+    }
+    table_pair_literals(inflater->litlen_table, INFLATE_LITLEN_TABLE_BITS);
+
+    status = table_build(
+        inflater->distance_table, INFLATE_DISTANCE_TABLE_SIZE,
+        INFLATE_DISTANCE_TABLE_BITS, TABLE_DISTANCE, lengths + nlen, ndist,
+        &left);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (left > 0 && !is_single_code(lengths + nlen, ndist))
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t read_zlib_header(inflater_t *inflater)
+{
+    uint32_t cmf, flg;
+    status_t status;
+
+    if ((status = get_bits(inflater, 8, &cmf)) != STATUS_OK ||
+        (status = get_bits(inflater, 8, &flg)) != STATUS_OK)
+    {
+        return status;
+    }
+
+    if ((cmf & 0x0f) != kDeflateMethod || (cmf >> 4) > kMaxWindowInfo ||
+        ((cmf << 8) | flg) % kHeaderCheckBase != 0 ||
+        (flg & kPresetDictBitMask) != 0)
+    {
+        return STATUS_BAD_PACKET;
+    }
+    return STATUS_OK;
+}
+
+static status_t read_block_header(inflater_t *inflater)
+{
+    uint32_t last, type, len, nlen;
+    status_t status;
+
+    if ((status = get_bits(inflater, 1, &last)) != STATUS_OK ||
+        (status = get_bits(inflater, 2, &type)) != STATUS_OK)
+    {
+        return status;
+    }
+    inflater->last_block = (last != 0);
+
+    if (type == kBlockStored)
+    {
+        /* Stored blocks start on a byte boundary. */
+        align_bits(inflater);
+        if ((status = get_bits(inflater, 16, &len)) != STATUS_OK ||
+            (status = get_bits(inflater, 16, &nlen)) != STATUS_OK)
+        {
+            return status;
+        }
+        if (len != (~nlen & 0xffffu))
+        {
+            return STATUS_BAD_PACKET;
+        }
+        inflater->stored_remaining = len;
+        inflater->state = INFLATE_STATE_STORED;
+        return STATUS_OK;
+    }
+
+    if (type == kBlockFixed)
+    {
+        status = build_fixed_tables(inflater);
+    }
+    else if (type == kBlockDynamic)
+    {
+        status = build_dynamic_tables(inflater);
+    }
+    else
+    {
+        status = STATUS_BAD_PACKET;
+    }
+
+    if (status == STATUS_OK)
+    {
+        inflater->state = INFLATE_STATE_CODES;
+    }
+    return status;
+}
+
+/*
+ * Copies a back reference to `outbuf + count`, where `count` bytes
+ * were already produced by this call.  The start of the reference may
+ * lie in the window, before `outbuf`.
+ */
+static void copy_match(
+    inflater_t const *inflater, uint8_t *outbuf, size_t count,
+    uint32_t distance, uint32_t length)
+{
+    uint8_t *out;
+    uint8_t const *src;
+    uint32_t start, run, first;
+
+    out = outbuf + count;
+    if (distance > count)
+    {
+        start = (uint32_t)((inflater->total_out + count - distance) &
+                           kWindowMask);
+        run = distance - (uint32_t)count;
+        if (run > length)
+        {
+            run = length;
+        }
+        first = kWindowSize - start;
+        if (first > run)
+        {
+            first = run;
+        }
+        memcpy(out, inflater->window + start, first);
+        memcpy(out + first, inflater->window, run - first);
+        out += run;
+        length -= run;
+    }
+
+    src = out - distance;
+    while (length--)
+    {
+        *out++ = *src++;
+    }
+}
+
+/*
+ * Copies a back reference within the output, 8 bytes at a time.  Up
+ * to 7 bytes past the end of the reference are overwritten.
+ */
+static void copy_match_wide(uint8_t *out, uint32_t distance, uint32_t length)
+{
+    uint8_t const *src;
+    uint8_t *end;
+    uint32_t period;
+
+    end = out + length;
+    src = out - distance;
+    if (distance == 1)
+    {
+        memset(out, *src, length);
+        return;
+    }
+    if (distance < 8)
+    {
+        /* Repeat the pattern until its period is at least 8 bytes. */
+        period = distance * ((8 + distance - 1) / distance);
+        while (out < end && out < src + period)
+        {
+            *out++ = *src++;
+        }
+        src = out - period;
+    }
+    while (out < end)
+    {
+        memcpy(out, src, 8);
+        out += 8;
+        src += 8;
+    }
+}
+
+/*
+ * Decodes symbols of a compressed block while the input holds enough
+ * bits for the longest length and distance pair, and the output has
+ * room for the longest match.  The bit buffer is refilled 8 bytes at
+ * a time.
+ */
+static status_t inflate_fast(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *count)
+{
+    uint32_t const *litlen, *distances;
+    uint8_t const *in;
+    uint8_t *out, *out_end;
+    uint64_t bit_buffer;
+    uint32_t bit_count, entry, extra, length, distance;
+    size_t in_length, position;
+    status_t status;
+
+    litlen = inflater->litlen_table;
+    distances = inflater->distance_table;
+    in = inflater->input;
+    in_length = inflater->input_length;
+    bit_buffer = inflater->bit_buffer;
+    bit_count = inflater->bit_count;
+    out = outbuf + *count;
+    out_end = outbuf + outlen;
+    status = STATUS_OK;
+
+    while (in_length >= kFastInput && (size_t)(out_end - out) >= kFastOutput)
+    {
+        bit_buffer |= load_le64(in) << bit_count;
+        in += (63 - bit_count) >> 3;
+        in_length -= (63 - bit_count) >> 3;
+        bit_count |= 56;
+
+        entry = litlen[bit_buffer & ((1u << INFLATE_LITLEN_TABLE_BITS) - 1)];
+        if (entry_kind(entry) == ENTRY_SUBTABLE)
+        {
+            entry = litlen[entry_value(entry) +
+                ((bit_buffer >> INFLATE_LITLEN_TABLE_BITS) &
+                 ((1u << entry_extra(entry)) - 1))];
+        }
+        bit_buffer >>= entry_length(entry);
+        bit_count -= entry_length(entry);
+
+        if (entry_kind(entry) == ENTRY_LITERAL)
+        {
+            *out++ = (uint8_t)entry_value(entry);
+            continue;
+        }
+        if (entry_kind(entry) == ENTRY_DOUBLE_LITERAL)
+        {
+            out[0] = (uint8_t)entry_value(entry);
+            out[1] = (uint8_t)(entry_value(entry) >> 8);
+            out += 2;
+            continue;
+        }
+        if (entry_kind(entry) == ENTRY_END_OF_BLOCK)
+        {
+            inflater->state = INFLATE_STATE_BLOCK_HEADER;
+            break;
+        }
+        if (entry_kind(entry) != ENTRY_BASE)
+        {
+            status = STATUS_BAD_PACKET;
+            break;
+        }
+
+        extra = entry_extra(entry);
+        length = entry_value(entry) +
+            (uint32_t)(bit_buffer & ((1u << extra) - 1));
+        bit_buffer >>= extra;
+        bit_count -= extra;
+
+        entry = distances[
+            bit_buffer & ((1u << INFLATE_DISTANCE_TABLE_BITS) - 1)];
+        if (entry_kind(entry) == ENTRY_SUBTABLE)
+        {
+            entry = distances[entry_value(entry) +
+                ((bit_buffer >> INFLATE_DISTANCE_TABLE_BITS) &
+                 ((1u << entry_extra(entry)) - 1))];
+        }
+        bit_buffer >>= entry_length(entry);
+        bit_count -= entry_length(entry);
+        if (entry_kind(entry) != ENTRY_BASE)
+        {
+            status = STATUS_BAD_PACKET;
+            break;
+        }
+        extra = entry_extra(entry);
+        distance = entry_value(entry) +
+            (uint32_t)(bit_buffer & ((1u << extra) - 1));
+        bit_buffer >>= extra;
+        bit_count -= extra;
+
+        position = (size_t)(out - outbuf);
+        if (distance > inflater->total_out + position)
+        {
+            /* Reference to data before the start of the stream. */
+            status = STATUS_BAD_PACKET;
+            break;
+        }
+        if (distance > position)
+        {
+            copy_match(inflater, outbuf, position, distance, length);
+        }
+        else
+        {
+            copy_match_wide(out, distance, length);
+        }
+        out += length;
+    }
+
+    inflater->input = in;
+    inflater->input_length = in_length;
+    inflater->bit_buffer = bit_buffer;
+    inflater->bit_count = bit_count;
+    *count = (size_t)(out - outbuf);
+    return status;
+}
+
+/* Decodes a compressed block until the output is full or it ends. */
+static status_t inflate_codes(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *count)
+{
+    uint32_t entry, extra, run;
+    status_t status;
+
+    /* Finish a back reference interrupted by a full output. */
+    if (inflater->match_length > 0)
+    {
+        run = inflater->match_length;
+        if (run > outlen - *count)
+        {
+            run = (uint32_t)(outlen - *count);
+        }
+        copy_match(inflater, outbuf, *count, inflater->match_distance, run);
+        *count += run;
+        inflater->match_length -= run;
+        if (inflater->match_length > 0)
+        {
+            return STATUS_OK;
+        }
+    }
+
+    status = inflate_fast(inflater, outbuf, outlen, count);
+    if (status != STATUS_OK || inflater->state != INFLATE_STATE_CODES ||
+        *count == outlen)
+    {
+        return status;
+    }
+
+    /* One symbol at a time near the end of the input or output. */
+    status = decode_symbol(
+        inflater, inflater->litlen_table, INFLATE_LITLEN_TABLE_BITS,
+        outlen - *count >= 2, &entry);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    switch (entry_kind(entry))
+    {
+        case ENTRY_LITERAL:
+            outbuf[(*count)++] = (uint8_t)entry_value(entry);
+            return STATUS_OK;
+
+        case ENTRY_DOUBLE_LITERAL:
+            outbuf[(*count)++] = (uint8_t)entry_value(entry);
+            outbuf[(*count)++] = (uint8_t)(entry_value(entry) >> 8);
+            return STATUS_OK;
+
+        case ENTRY_END_OF_BLOCK:
+            inflater->state = INFLATE_STATE_BLOCK_HEADER;
+            return STATUS_OK;
+
+        case ENTRY_BASE:
+            break;
+
+        default:
+            return STATUS_BAD_PACKET;
+    }
+
+    status = get_bits(inflater, entry_extra(entry), &extra);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    inflater->match_length = entry_value(entry) + extra;
+
+    status = decode_symbol(
+        inflater, inflater->distance_table, INFLATE_DISTANCE_TABLE_BITS,
+        false, &entry);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (entry_kind(entry) != ENTRY_BASE)
+    {
+        return STATUS_BAD_PACKET;
+    }
+    status = get_bits(inflater, entry_extra(entry), &extra);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    inflater->match_distance = entry_value(entry) + extra;
+    if (inflater->match_distance > inflater->total_out + *count)
+    {
+        /* Reference to data before the start of the stream. */
+        return STATUS_BAD_PACKET;
+    }
+    return STATUS_OK;
+}
+
+/* Copies a stored block until the output is full or it ends. */
+static status_t inflate_stored(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *count)
+{
+    size_t run;
+    status_t status;
+
+    /* Whole bytes left in the bit buffer come first. */
+    while (inflater->stored_remaining > 0 && *count < outlen &&
+           inflater->bit_count >= 8)
+    {
+        outbuf[(*count)++] = (uint8_t)inflater->bit_buffer;
+        inflater->bit_buffer >>= 8;
+        inflater->bit_count -= 8;
+        inflater->stored_remaining--;
+    }
+    if (inflater->bit_count == 0)
+    {
+        /* Input is copied directly, past any bits loaded ahead. */
+        inflater->bit_buffer = 0;
+    }
+
+    while (inflater->stored_remaining > 0 && *count < outlen)
+    {
+        if (inflater->input_length == 0)
+        {
+            status = next_input(inflater);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+        }
+        run = inflater->input_length;
+        if (run > inflater->stored_remaining)
+        {
+            run = inflater->stored_remaining;
+        }
+        if (run > outlen - *count)
+        {
+            run = outlen - *count;
+        }
+        memcpy(outbuf + *count, inflater->input, run);
+        inflater->input += run;
+        inflater->input_length -= run;
+        inflater->stored_remaining -= (uint32_t)run;
+        *count += run;
+    }
+
+    if (inflater->stored_remaining == 0)
+    {
+        inflater->state = INFLATE_STATE_BLOCK_HEADER;
+    }
+    return STATUS_OK;
+}
+
+/* Keeps the last 32 KiB of output in the window. */
+static void window_append(
+    inflater_t *inflater, uint8_t const *data, size_t length)
+{
+    uint32_t start, first;
+    size_t skip;
+
+    skip = length > kWindowSize ? length - kWindowSize : 0;
+    inflater->total_out += skip;
+    data += skip;
+    length -= skip;
+
+    start = (uint32_t)(inflater->total_out & kWindowMask);
+    first = kWindowSize - start;
+    if (first > length)
+    {
+        first = (uint32_t)length;
+    }
+    memcpy(inflater->window + start, data, first);
+    memcpy(inflater->window, data + first, length - first);
+    inflater->total_out += length;
+}
+
+/*
+ * Decodes until either `outlen` bytes were produced or the final block
+ * of the datastream ended.
+ */
+static status_t inflate_run(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *produced)
+{
+    size_t count;
+    status_t status;
+
+    count = 0;
+    status = STATUS_OK;
+    while (count < outlen && status == STATUS_OK &&
+           inflater->state < INFLATE_STATE_TRAILER)
+    {
+        switch (inflater->state)
+        {
+            case INFLATE_STATE_ZLIB_HEADER:
+                status = read_zlib_header(inflater);
+                if (status == STATUS_OK)
+                {
+                    inflater->state = INFLATE_STATE_BLOCK_HEADER;
+                }
+                break;
+
+            case INFLATE_STATE_BLOCK_HEADER:
+                if (inflater->last_block)
+                {
+                    inflater->state = INFLATE_STATE_TRAILER;
+                    break;
+                }
+                status = read_block_header(inflater);
+                break;
+
+            case INFLATE_STATE_STORED:
+                status = inflate_stored(inflater, outbuf, outlen, &count);
+                break;
+
+            default:
+                status = inflate_codes(inflater, outbuf, outlen, &count);
+                break;
+        }
+    }
+
+    window_append(inflater, outbuf, count);
+    *produced = count;
+    return status;
+}
+
+status_t inflater_init(
+    inflate_source_t source, void *context, inflater_t *inflater)
+{
+    if (!source || !inflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(inflater, 0, sizeof(inflater_t));
+    inflater->window = (uint8_t *)engine_allocate(kWindowSize);
+    if (!inflater->window)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    inflater->source = source;
+    inflater->source_context = context;
+    inflater->adler = 1;
+    inflater->state = INFLATE_STATE_ZLIB_HEADER;
+    return STATUS_OK;
+}
+
+status_t inflater_reset(
+    inflate_source_t source, void *context, inflater_t *inflater)
+{
+    uint8_t *window;
+
+    if (!source || !inflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!inflater->window)
+    {
+        return inflater_init(source, context, inflater);
+    }
+
+    window = inflater->window;
+    memset(inflater, 0, sizeof(inflater_t));
+    inflater->window = window;
+    inflater->source = source;
+    inflater->source_context = context;
+    inflater->adler = 1;
+    inflater->state = INFLATE_STATE_ZLIB_HEADER;
+    return STATUS_OK;
+}
+
+status_t inflater_read(inflater_t *inflater, uint8_t *outbuf, size_t outlen)
+{
+    size_t produced;
+    status_t status;
+
+    if (!inflater || (!outbuf && outlen != 0))
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = inflate_run(inflater, outbuf, outlen, &produced);
+    inflater->adler = adler32_update(inflater->adler, outbuf, produced);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (produced < outlen)
+    {
+        /* Datastream ended before the expected amount of data. */
+        return STATUS_BAD_PACKET;
+    }
+    return STATUS_OK;
+}
+
+status_t inflater_read_some(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *produced)
+{
+    status_t status;
+
+    if (!inflater || !produced || (!outbuf && outlen != 0))
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = inflate_run(inflater, outbuf, outlen, produced);
+    inflater->adler = adler32_update(inflater->adler, outbuf, *produced);
+    return status;
+}
+
+status_t inflater_finish(inflater_t *inflater)
+{
+    uint8_t discard[256];
+    uint32_t byte, checksum, i;
+    size_t produced;
+    status_t status;
+
+    if (!inflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    while (inflater->state < INFLATE_STATE_TRAILER)
+    {
+        status = inflate_run(inflater, discard, sizeof(discard), &produced);
+        inflater->adler = adler32_update(inflater->adler, discard, produced);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    if (inflater->state == INFLATE_STATE_DONE)
+    {
+        return STATUS_OK;
+    }
+
+    /* Adler-32 checksum, most significant byte first. */
+    align_bits(inflater);
+    checksum = 0;
+    for (i = 0; i < sizeof(uint32_t); i++)
+    {
+        status = get_bits(inflater, 8, &byte);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        checksum = (checksum << 8) | byte;
+    }
+    inflater->state = INFLATE_STATE_DONE;
+
+    return checksum == inflater->adler ? STATUS_OK : STATUS_BAD_CRC;
+}
+
+status_t inflater_free(inflater_t *inflater)
+{
+    if (!inflater)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (inflater->window)
+    {
+        free(inflater->window);
+    }
+    memset(inflater, 0, sizeof(inflater_t));
+    return STATUS_OK;
+}
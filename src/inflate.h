@@ -0,0 +1,145 @@
+/*
+ *  Image-Formats - Inflate
+ *      Streaming decompression of zlib datastreams (RFC1950 / RFC1951).
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+
+#include "base.h"
+
+/* Maximum number of symbols in a deflate Huffman alphabet. */
+#define INFLATE_MAX_SYMBOLS 288
+/* Maximum bit length of a deflate Huffman code. */
+#define INFLATE_MAX_BITS 15
+
+/*
+ * Decoding tables are indexed by the next bits of input.  Codes longer
+ * than the table bits continue in subtables stored after the primary
+ * table.  The sizes are the worst cases over every valid code.
+ */
+#define INFLATE_LITLEN_TABLE_BITS 11
+#define INFLATE_LITLEN_TABLE_SIZE 2342
+#define INFLATE_DISTANCE_TABLE_BITS 8
+#define INFLATE_DISTANCE_TABLE_SIZE 402
+
+/*
+ * Type: inflate_source_t
+ *  Callback used by the inflater to pull the next block of compressed
+ *  data.  The returned block must remain valid until the next call.
+ * Args:
+ *    context - Opaque pointer given to `inflater_init()`.
+ *    data - Will point to the next block of compressed data.
+ *    length - Will store the length of the block.  Must not be 0 if
+ *             OK is returned.
+ * Return:
+ *    OK if a block is available.  Any other status stops the
+ *    inflater and is returned to its caller.
+ */
+typedef status_t (*inflate_source_t)(
+    void *context, uint8_t const **data, size_t *length);
+
+typedef struct {
+    inflate_source_t source;
+    void *source_context;
+    /* Unread remains of the current compressed block. */
+    uint8_t const *input;
+    size_t input_length;
+    /* Bits above `bit_count` are the next unconsumed bits of `input`. */
+    uint64_t bit_buffer;
+    uint32_t bit_count;
+    /* Ring of the last 32 KiB of output, for back references. */
+    uint8_t *window;
+    uint64_t total_out;
+    uint32_t adler;
+    /* Decoder state. */
+    uint32_t state;
+    bool_t last_block;
+    uint32_t stored_remaining;
+    uint32_t match_length;
+    uint32_t match_distance;
+    /* Whether the tables hold the fixed codes of RFC1951 3.2.6. */
+    bool_t fixed_tables;
+    uint32_t litlen_table[INFLATE_LITLEN_TABLE_SIZE];
+    uint32_t distance_table[INFLATE_DISTANCE_TABLE_SIZE];
+} inflater_t;
+
+/*
+ * Function: inflater_init
+ *  Initializes an inflater that pulls its input from `source`.
+ * Args:
+ *    source - Callback providing compressed data.
+ *    context - Opaque pointer handed to `source`.
+ *    inflater - Pointer to an uninitialized inflater.
+ * Return:
+ *    OK if the inflater was initialized.
+ *    NULL_ARG if `source` or `inflater` are NULL.
+ *    OUT_OF_MEM if the window could not be allocated.
+ */
+status_t inflater_init(
+    inflate_source_t source, void *context, inflater_t *inflater);
+
+/*
+ * Function: inflater_reset
+ *  Restarts an initialized inflater on a new datastream, keeping its
+ *  window so that no memory is allocated.
+ */
+status_t inflater_reset(
+    inflate_source_t source, void *context, inflater_t *inflater);
+
+/*
+ * Function: inflater_read
+ *  Decompresses exactly `outlen` bytes into `outbuf`.  Decoding can be
+ *  resumed by the next call at any byte boundary.
+ * Args:
+ *    inflater - Pointer to an initialized inflater.
+ *    outbuf - Destination of the decompressed data.
+ *    outlen - Number of bytes to decompress.
+ * Return:
+ *    OK if `outlen` bytes were decompressed.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    BAD_PACKET if the datastream is malformed or ended early.
+ *    Otherwise the status returned by the source.
+ */
+status_t inflater_read(inflater_t *inflater, uint8_t *outbuf, size_t outlen);
+
+/*
+ * Function: inflater_read_some
+ *  Same as `inflater_read()`, but stops early at the end of the
+ *  datastream, for data whose size is not known in advance.
+ * Args:
+ *    produced - Will store the number of bytes decompressed, which is
+ *               less than `outlen` only at the end of the datastream.
+ */
+status_t inflater_read_some(
+    inflater_t *inflater, uint8_t *outbuf, size_t outlen, size_t *produced);
+
+/*
+ * Function: inflater_finish
+ *  Decodes the remainder of the datastream and verifies its Adler-32
+ *  checksum.  Any left over decompressed data is discarded.
+ * Args:
+ *    inflater - Pointer to an initialized inflater.
+ * Return:
+ *    OK if the datastream is complete and its checksum matches.
+ *    BAD_CRC if the checksum does not match.
+ *    Otherwise as `inflater_read()`.
+ */
+status_t inflater_finish(inflater_t *inflater);
+
+/*
+ * Function: inflater_free
+ *  Frees the resources of an initialized inflater and clears it.
+ */
+status_t inflater_free(inflater_t *inflater);
+
+/*
+ * Function: adler32_update
+ *  Updates a running Adler-32 checksum (RFC1950 Section 9).  The
+ *  initial value of the checksum is 1.
+ */
+uint32_t adler32_update(uint32_t adler, uint8_t const *buf, size_t len);
+
+#endif /* _INFLATE_H_ */
@@ -0,0 +1,808 @@
+/*
+ *  Image-Formats - PNG Optimizer
+ *      Losslessly recompresses PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "anichunk.h"
+#include "compress.h"
+#include "engine.h"
+#include "registry.h"
+#include "workers.h"
+
+#include "optimize.h"
+
+static uint32_t const kDefaultLevel = 9;
+static uint32_t const kDefaultIdatSize = 64 * 1024;
+static uint64_t const kDefaultMaxPixels = (uint64_t)1 << 28;
+/* Length + Type + CRC fields surrounding the chunk data. */
+static size_t const kChunkOverhead = sizeof(uint32_t) * 3;
+
+/* Filter strategies, then one deflate trial per backend at most. */
+#define OPTIMIZE_TRIAL_COUNT (OPTIMIZE_STRATEGY_COUNT + ENGINE_MAX_COMPRESSORS)
+
+/* Open addressing table used to count the colors of an image. */
+#define OPTIMIZE_COLOR_SLOTS 1024
+static uint32_t const kNoColor = 0xffffffffu;
+
+/* Position of an ancillary chunk relative to the critical chunks. */
+typedef enum {
+    OPTIMIZE_GROUP_BEFORE_PLTE,
+    OPTIMIZE_GROUP_BEFORE_IDAT,
+    OPTIMIZE_GROUP_AFTER_IDAT
+} optimize_group_t;
+
+typedef struct {
+    encoder_options_t options;
+    /* Compressed image data. */
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+    status_t status;
+} optimize_trial_t;
+
+typedef struct {
+    ihdr_t const *ihdr;
+    uint8_t const *pixels;
+    optimize_trial_t *trials;
+} optimize_context_t;
+
+status_t optimize_options_default(optimize_options_t *options)
+{
+    if (!options)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(options, 0, sizeof(optimize_options_t));
+    options->compressor = engine_get_compressor(NULL);
+    options->level = kDefaultLevel;
+    options->deflate_trials = true;
+    options->strip = true;
+    options->threads = 1;
+    options->idat_size = kDefaultIdatSize;
+    options->max_pixels = kDefaultMaxPixels;
+    return STATUS_OK;
+}
+
+/* Replaces 16-bit samples by 8-bit ones if they are all multiples of 257. */
+static bool_t reduce_depth(ihdr_t *ihdr, uint8_t *pixels, size_t size)
+{
+    size_t i;
+
+    if (ihdr->bit_depth != 16)
+    {
+        return false;
+    }
+    for (i = 0; i < size; i += 2)
+    {
+        if (pixels[i] != pixels[i + 1])
+        {
+            return false;
+        }
+    }
+    for (i = 0; i < size / 2; i++)
+    {
+        pixels[i] = pixels[i * 2];
+    }
+    ihdr->bit_depth = 8;
+    return true;
+}
+
+/* Drops an alpha channel that is opaque everywhere. */
+static bool_t reduce_alpha(
+    ihdr_t *ihdr, uint8_t *pixels, uint64_t pixel_count)
+{
+    uint32_t channels, sample_bytes, pixel_bytes, color_bytes, i;
+    uint64_t pixel;
+    uint8_t const *alpha;
+
+    if (!ihdr_color_type_is_alpha_channel(ihdr->color_type))
+    {
+        return false;
+    }
+    ihdr_get_channel_count(ihdr, &channels);
+    sample_bytes = ihdr->bit_depth / 8;
+    pixel_bytes = channels * sample_bytes;
+    color_bytes = pixel_bytes - sample_bytes;
+
+    for (pixel = 0; pixel < pixel_count; pixel++)
+    {
+        alpha = pixels + pixel * pixel_bytes + color_bytes;
+        for (i = 0; i < sample_bytes; i++)
+        {
+            if (alpha[i] != 0xff)
+            {
+                return false;
+            }
+        }
+    }
+    for (pixel = 0; pixel < pixel_count; pixel++)
+    {
+        memmove(pixels + pixel * color_bytes, pixels + pixel * pixel_bytes,
+                color_bytes);
+    }
+    ihdr->color_type = color_type_to_code(
+        ihdr_color_type_is_realcolor(ihdr->color_type) ?
+            COLOR_TYPE_REALCOLOR : COLOR_TYPE_GRAYSCALE);
+    return true;
+}
+
+/* Replaces truecolor samples by greyscale ones if all channels match. */
+static bool_t reduce_greyscale(
+    ihdr_t *ihdr, uint8_t *pixels, uint64_t pixel_count)
+{
+    uint32_t channels, sample_bytes, pixel_bytes, out_bytes;
+    uint64_t pixel;
+    uint8_t const *ptr;
+
+    if (ihdr_color_type_is_palette(ihdr->color_type) ||
+        !ihdr_color_type_is_realcolor(ihdr->color_type))
+    {
+        return false;
+    }
+    ihdr_get_channel_count(ihdr, &channels);
+    sample_bytes = ihdr->bit_depth / 8;
+    pixel_bytes = channels * sample_bytes;
+    /* Grey sample, followed by the alpha sample if any. */
+    out_bytes = pixel_bytes - sample_bytes * 2;
+
+    for (pixel = 0; pixel < pixel_count; pixel++)
+    {
+        ptr = pixels + pixel * pixel_bytes;
+        if (memcmp(ptr, ptr + sample_bytes, sample_bytes) != 0 ||
+            memcmp(ptr, ptr + sample_bytes * 2, sample_bytes) != 0)
+        {
+            return false;
+        }
+    }
+    for (pixel = 0; pixel < pixel_count; pixel++)
+    {
+        ptr = pixels + pixel * pixel_bytes;
+        memmove(pixels + pixel * out_bytes, ptr, sample_bytes);
+        memmove(pixels + pixel * out_bytes + sample_bytes,
+                ptr + sample_bytes * 3, out_bytes - sample_bytes);
+    }
+    ihdr->color_type = color_type_to_code(
+        ihdr_color_type_is_alpha_channel(ihdr->color_type) ?
+            COLOR_TYPE_GRAYSCALE_ALPHA : COLOR_TYPE_GRAYSCALE);
+    return true;
+}
+
+/*
+ * Replaces 8-bit RGB pixels by palette indices if there are at most 256
+ * colors.  Entries are ordered by first use and indices are packed at
+ * the smallest bit depth holding them.
+ */
+static bool_t reduce_palette(
+    ihdr_t *ihdr, uint8_t *pixels, palette_table_t *palette)
+{
+    uint32_t keys[OPTIMIZE_COLOR_SLOTS];
+    uint8_t values[OPTIMIZE_COLOR_SLOTS];
+    uint8_t entries[PALETTE_MAX_ENTRIES * 3];
+    uint32_t count, key, slot, depth, x, y, bits, length;
+    size_t row_size;
+    uint8_t const *in;
+    uint8_t *out;
+    uint8_t packed;
+
+    if (ihdr->color_type != color_type_to_code(COLOR_TYPE_REALCOLOR) ||
+        ihdr->bit_depth != 8)
+    {
+        return false;
+    }
+
+    for (slot = 0; slot < OPTIMIZE_COLOR_SLOTS; slot++)
+    {
+        keys[slot] = kNoColor;
+    }
+    count = 0;
+    in = pixels;
+    for (y = 0; y < ihdr->height; y++)
+    {
+        for (x = 0; x < ihdr->width; x++, in += 3)
+        {
+            key = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+            slot = (key * 2654435761u) >> 22;
+            while (keys[slot] != kNoColor && keys[slot] != key)
+            {
+                slot = (slot + 1) & (OPTIMIZE_COLOR_SLOTS - 1);
+            }
+            if (keys[slot] == kNoColor)
+            {
+                if (count == PALETTE_MAX_ENTRIES)
+                {
+                    return false;
+                }
+                keys[slot] = key;
+                values[slot] = (uint8_t)count;
+                memcpy(entries + count * 3, in, 3);
+                count++;
+            }
+        }
+    }
+
+    depth = count <= 2 ? 1 : count <= 4 ? 2 : count <= 16 ? 4 : 8;
+    ihdr->color_type = color_type_to_code(COLOR_TYPE_PALETTE);
+    ihdr->bit_depth = (uint8_t)depth;
+    ihdr_get_row_size(ihdr, ihdr->width, &row_size);
+
+    /* Rows shrink, so they are packed in place from the front. */
+    in = pixels;
+    for (y = 0; y < ihdr->height; y++)
+    {
+        out = pixels + (size_t)y * row_size;
+        packed = 0;
+        bits = 0;
+        for (x = 0; x < ihdr->width; x++, in += 3)
+        {
+            key = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+            slot = (key * 2654435761u) >> 22;
+            while (keys[slot] != key)
+            {
+                slot = (slot + 1) & (OPTIMIZE_COLOR_SLOTS - 1);
+            }
+            packed = (uint8_t)((packed << depth) | values[slot]);
+            bits += depth;
+            if (bits == 8)
+            {
+                *out++ = packed;
+                packed = 0;
+                bits = 0;
+            }
+        }
+        if (bits > 0)
+        {
+            *out = (uint8_t)(packed << (8 - bits));
+        }
+    }
+
+    length = count * 3;
+    palette_table_deserialize(entries, &length, palette);
+    return true;
+}
+
+/* Determines if an ancillary chunk is still valid in the output. */
+static bool_t optimize_keep_chunk(
+    uint32_t type, ihdr_t const *input, ihdr_t const *output, bool_t strip)
+{
+    if (chunk_type_is_critical(type))
+    {
+        return false;
+    }
+
+    switch (chunk_kind_of(type))
+    {
+        case CHUNK_KIND_GAMA:
+        case CHUNK_KIND_CHRM:
+        case CHUNK_KIND_SRGB:
+            return true;
+        case CHUNK_KIND_ICCP:
+            /* Profiles are either for greyscale or for color images. */
+            return ihdr_color_type_is_realcolor(input->color_type) ==
+                ihdr_color_type_is_realcolor(output->color_type);
+        case CHUNK_KIND_TIME:
+            return !strip;
+        case CHUNK_KIND_TRNS:
+        case CHUNK_KIND_BKGD:
+        case CHUNK_KIND_SBIT:
+        case CHUNK_KIND_HIST:
+            return input->color_type == output->color_type &&
+                input->bit_depth == output->bit_depth;
+        default:
+            /* Unknown chunks may depend on the image data. */
+            return chunk_type_is_safe_to_copy(type) && !strip;
+    }
+}
+
+/* Reads the chunk at `*offset` and advances past it. */
+static status_t optimize_next_chunk(
+    uint8_t const *inbuf, size_t inlen, chunk_crc_policy_t crc_policy,
+    size_t *offset, chunk_t *chunk)
+{
+    size_t length;
+    status_t status;
+
+    if (inlen - *offset < kChunkOverhead)
+    {
+        return STATUS_INCOMPLETE_PACKET;
+    }
+
+    length = inlen - *offset;
+    chunk_clear(chunk);
+    status = chunk_view(inbuf + *offset, &length, crc_policy, chunk);
+    if (status != STATUS_OK)
+    {
+        chunk_clear(chunk);
+        return status;
+    }
+    *offset += length;
+    return STATUS_OK;
+}
+
+/*
+ * Walks the ancillary chunks of the input that are kept in a group.
+ * With a writer they are written, otherwise their size is added to
+ * `*size`.
+ */
+static status_t optimize_walk(
+    uint8_t const *inbuf, size_t inlen, chunk_crc_policy_t crc_policy,
+    ihdr_t const *input, ihdr_t const *output, bool_t strip,
+    optimize_group_t group, writer_t *writer, size_t *size)
+{
+    chunk_t chunk;
+    optimize_group_t current;
+    size_t offset;
+    status_t status;
+
+    offset = PNG_SIGNATURE_SIZE;
+    current = OPTIMIZE_GROUP_BEFORE_PLTE;
+    for (;;)
+    {
+        status = optimize_next_chunk(
+            inbuf, inlen, crc_policy, &offset, &chunk);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+
+        if (chunk.type == IEND_TYPE)
+        {
+            return STATUS_OK;
+        }
+        if (chunk.type == PLTE_TYPE && current == OPTIMIZE_GROUP_BEFORE_PLTE)
+        {
+            current = OPTIMIZE_GROUP_BEFORE_IDAT;
+        }
+        else if (chunk.type == IDAT_TYPE)
+        {
+            current = OPTIMIZE_GROUP_AFTER_IDAT;
+        }
+
+        if (current != group ||
+            !optimize_keep_chunk(chunk.type, input, output, strip))
+        {
+            continue;
+        }
+        if (writer)
+        {
+            status = writer_write_chunk(writer, &chunk);
+            if (status != STATUS_OK)
+            {
+                return status;
+            }
+        }
+        else
+        {
+            *size += chunk.length + kChunkOverhead;
+        }
+    }
+}
+
+/*
+ * Verifies every chunk of the input, rejecting animations, and looks
+ * for a tRNS chunk.
+ */
+static status_t optimize_scan(
+    uint8_t const *inbuf, size_t inlen, bool_t *has_trns)
+{
+    chunk_t chunk;
+    size_t offset;
+    status_t status;
+
+    offset = PNG_SIGNATURE_SIZE;
+    do
+    {
+        status = optimize_next_chunk(
+            inbuf, inlen, CHUNK_CRC_CHECK_ALL, &offset, &chunk);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        if (chunk.type == ACTL_TYPE)
+        {
+            return STATUS_ILLEGAL_ARGUMENT;
+        }
+        if (chunk.type == TRNS_TYPE)
+        {
+            *has_trns = true;
+        }
+    } while (chunk.type != IEND_TYPE);
+    return STATUS_OK;
+}
+
+/* Writes every chunk of the input unchanged. */
+static status_t optimize_copy(
+    uint8_t const *inbuf, size_t inlen, writer_t *writer)
+{
+    chunk_t chunk;
+    size_t offset;
+    status_t status;
+
+    status = writer_write_signature(writer);
+    offset = PNG_SIGNATURE_SIZE;
+    while (status == STATUS_OK)
+    {
+        status = optimize_next_chunk(
+            inbuf, inlen, CHUNK_CRC_CHECK_NONE, &offset, &chunk);
+        if (status == STATUS_OK)
+        {
+            status = writer_write_chunk(writer, &chunk);
+        }
+        if (status == STATUS_OK && chunk.type == IEND_TYPE)
+        {
+            break;
+        }
+    }
+    return status;
+}
+
+/* Appends compressed data to a trial. */
+static status_t optimize_sink(
+    void *context, uint8_t const *data, size_t length)
+{
+    optimize_trial_t *trial;
+    uint8_t *grown;
+    size_t capacity;
+
+    trial = (optimize_trial_t *)context;
+    if (trial->capacity - trial->length < length)
+    {
+        capacity = trial->capacity * 2;
+        if (capacity < trial->length + length)
+        {
+            capacity = trial->length + length;
+        }
+        grown = (uint8_t *)engine_allocate_large(capacity);
+        if (!grown)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        if (trial->length > 0)
+        {
+            memcpy(grown, trial->data, trial->length);
+        }
+        free(trial->data);
+        trial->data = grown;
+        trial->capacity = capacity;
+    }
+    memcpy(trial->data + trial->length, data, length);
+    trial->length += length;
+    return STATUS_OK;
+}
+
+/* Compresses the image data with the strategy of one trial. */
+static void optimize_task(void *context, uint32_t index)
+{
+    optimize_context_t *ctx;
+    optimize_trial_t *trial;
+    encoder_t encoder;
+
+    ctx = (optimize_context_t *)context;
+    trial = &ctx->trials[index];
+    trial->status = encoder_init(&trial->options, &encoder);
+    if (trial->status == STATUS_OK)
+    {
+        trial->status = encoder_compress(
+            &encoder, ctx->ihdr, ctx->pixels, optimize_sink, trial);
+    }
+    encoder_free(&encoder);
+}
+
+/*
+ * Sets up the deflate trials after the filter strategies: the filter of
+ * `best` at the maximum level of each backend, unless `best` already
+ * used it.
+ * Return:
+ *    The number of filter strategies and deflate trials.
+ */
+static uint32_t optimize_deflate_trials(
+    optimize_trial_t const *best, optimize_trial_t *trials)
+{
+    engine_compressor_t const *compressor;
+    uint32_t index, count;
+
+    count = OPTIMIZE_STRATEGY_COUNT;
+    for (index = 0; index < ENGINE_MAX_COMPRESSORS; index++)
+    {
+        compressor = engine_get_compressor_at(index);
+        if (!compressor)
+        {
+            break;
+        }
+        if (compressor == best->options.compressor &&
+            compressor->max_level == best->options.level)
+        {
+            continue;
+        }
+        trials[count].options = best->options;
+        trials[count].options.compressor = compressor;
+        trials[count].options.level = compressor->max_level;
+        count++;
+    }
+    return count;
+}
+
+/* Writes the optimized datastream around the chosen image data. */
+static status_t optimize_write(
+    uint8_t const *inbuf, size_t inlen, optimize_options_t const *options,
+    ihdr_t const *input, ihdr_t const *output, palette_table_t const *palette,
+    optimize_trial_t const *trial, writer_t *writer)
+{
+    uint8_t buffer[PALETTE_MAX_ENTRIES * 3];
+    uint32_t length;
+    size_t offset, piece;
+    chunk_t chunk;
+    status_t status;
+
+    status = writer_write_signature(writer);
+    if (status == STATUS_OK)
+    {
+        status = chunk_new_ihdr(output, &chunk);
+        if (status == STATUS_OK)
+        {
+            status = writer_write_chunk(writer, &chunk);
+            chunk_free(&chunk);
+        }
+    }
+    if (status == STATUS_OK)
+    {
+        status = optimize_walk(
+            inbuf, inlen, CHUNK_CRC_CHECK_NONE, input, output,
+            options->strip, OPTIMIZE_GROUP_BEFORE_PLTE, writer, NULL);
+    }
+    if (status == STATUS_OK && palette)
+    {
+        length = sizeof(buffer);
+        status = palette_table_serialize(palette, buffer, &length);
+        if (status == STATUS_OK)
+        {
+            status = writer_write_data(writer, PLTE_TYPE, buffer, length);
+        }
+    }
+    if (status == STATUS_OK)
+    {
+        status = optimize_walk(
+            inbuf, inlen, CHUNK_CRC_CHECK_NONE, input, output,
+            options->strip, OPTIMIZE_GROUP_BEFORE_IDAT, writer, NULL);
+    }
+    for (offset = 0;
+         offset < trial->length && status == STATUS_OK;
+         offset += piece)
+    {
+        piece = trial->length - offset;
+        if (piece > options->idat_size)
+        {
+            piece = options->idat_size;
+        }
+        status = writer_write_data(
+            writer, IDAT_TYPE, trial->data + offset, (uint32_t)piece);
+    }
+    if (status == STATUS_OK)
+    {
+        status = optimize_walk(
+            inbuf, inlen, CHUNK_CRC_CHECK_NONE, input, output,
+            options->strip, OPTIMIZE_GROUP_AFTER_IDAT, writer, NULL);
+    }
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, IEND_TYPE, NULL, 0);
+    }
+    return status;
+}
+
+/* Size of the optimized datastream, without writing it. */
+static status_t optimize_measure(
+    uint8_t const *inbuf, size_t inlen, optimize_options_t const *options,
+    ihdr_t const *input, ihdr_t const *output, palette_table_t const *palette,
+    optimize_trial_t const *trial, size_t *size)
+{
+    optimize_group_t group;
+    size_t pieces;
+    status_t status;
+
+    /* Signature, IHDR and IEND. */
+    *size = PNG_SIGNATURE_SIZE + (kChunkOverhead + 13) + kChunkOverhead;
+    if (palette)
+    {
+        *size += kChunkOverhead + (size_t)palette->size * 3;
+    }
+    pieces = (trial->length + options->idat_size - 1) / options->idat_size;
+    *size += trial->length + (pieces > 0 ? pieces : 1) * kChunkOverhead;
+
+    for (group = OPTIMIZE_GROUP_BEFORE_PLTE;
+         group <= OPTIMIZE_GROUP_AFTER_IDAT;
+         group++)
+    {
+        status = optimize_walk(
+            inbuf, inlen, CHUNK_CRC_CHECK_NONE, input, output,
+            options->strip, group, NULL, size);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t optimize_png(
+    uint8_t const *inbuf, size_t inlen, optimize_options_t const *options,
+    writer_t *writer, optimize_result_t *result)
+{
+    optimize_options_t defaults;
+    decoder_options_t decoder_options;
+    engine_compressor_t const *compressor;
+    optimize_trial_t trials[OPTIMIZE_TRIAL_COUNT];
+    optimize_context_t context;
+    decoder_t decoder;
+    ihdr_t input, output;
+    palette_table_t palette;
+    palette_table_t const *out_palette;
+    uint8_t *pixels;
+    size_t row_size, size, best_size;
+    uint64_t total, pixel_count;
+    uint32_t i, best, count;
+    bool_t has_trns;
+    status_t status;
+
+    if (!inbuf || !writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    if (!options)
+    {
+        optimize_options_default(&defaults);
+        options = &defaults;
+    }
+    compressor = options->compressor ?
+        options->compressor : engine_get_compressor(NULL);
+    if (options->level > compressor->max_level || options->idat_size < 2 ||
+        options->idat_size > kSigned32Max)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    /* The decoder rejects images over the limit before allocating. */
+    decoder_options_default(&decoder_options);
+    decoder_options.limits.max_pixels = options->max_pixels;
+    status = decoder_open(inbuf, inlen, &decoder_options, &decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    input = decoder.ihdr;
+    ihdr_get_row_size(&input, input.width, &row_size);
+    total = (uint64_t)row_size * input.height;
+    pixels = total <= SIZE_MAX ?
+        (uint8_t *)engine_allocate_large((size_t)total) : NULL;
+    if (!pixels)
+    {
+        decoder_close(&decoder);
+        return STATUS_OUT_OF_MEMORY;
+    }
+    size = (size_t)total;
+    status = decoder_decode_region(&decoder, NULL, pixels, &size);
+    palette = decoder.palette;
+    decoder_close(&decoder);
+
+    has_trns = false;
+    if (status == STATUS_OK)
+    {
+        status = optimize_scan(inbuf, inlen, &has_trns);
+    }
+
+    output = input;
+    output.interlace_method = 0;
+    out_palette = palette.size > 0 ? &palette : NULL;
+    pixel_count = (uint64_t)input.width * input.height;
+    if (status == STATUS_OK && !has_trns &&
+        !ihdr_color_type_is_palette(input.color_type))
+    {
+        reduce_depth(&output, pixels, size);
+        reduce_alpha(&output, pixels, pixel_count);
+        reduce_greyscale(&output, pixels, pixel_count);
+        if (reduce_palette(&output, pixels, &palette))
+        {
+            out_palette = &palette;
+        }
+        else if (output.color_type != input.color_type ||
+                 !ihdr_color_type_is_realcolor(output.color_type))
+        {
+            /* Suggested palettes only apply to the original format. */
+            out_palette = NULL;
+        }
+    }
+
+    memset(trials, 0, sizeof(trials));
+    for (i = 0; i < OPTIMIZE_STRATEGY_COUNT; i++)
+    {
+        encoder_options_default(&trials[i].options);
+        trials[i].options.compressor = compressor;
+        trials[i].options.level = options->level;
+        trials[i].options.idat_size = options->idat_size;
+        trials[i].options.adaptive_filter = (i == 0);
+        trials[i].options.filter = i == 0 ?
+            FILTER_TYPE_NONE : (filter_type_t)(i - 1);
+    }
+    if (status == STATUS_OK)
+    {
+        context.ihdr = &output;
+        context.pixels = pixels;
+        context.trials = trials;
+        status = workers_run(
+            options->threads, OPTIMIZE_STRATEGY_COUNT, optimize_task,
+            &context);
+    }
+
+    best = 0;
+    for (i = 0; i < OPTIMIZE_STRATEGY_COUNT && status == STATUS_OK; i++)
+    {
+        status = trials[i].status;
+        if (trials[i].length < trials[best].length)
+        {
+            best = i;
+        }
+    }
+
+    count = OPTIMIZE_STRATEGY_COUNT;
+    if (status == STATUS_OK && options->deflate_trials)
+    {
+        count = optimize_deflate_trials(&trials[best], trials);
+        context.trials = trials + OPTIMIZE_STRATEGY_COUNT;
+        status = workers_run(
+            options->threads, count - OPTIMIZE_STRATEGY_COUNT,
+            optimize_task, &context);
+    }
+    for (i = OPTIMIZE_STRATEGY_COUNT; i < count && status == STATUS_OK; i++)
+    {
+        status = trials[i].status;
+        if (trials[i].length < trials[best].length)
+        {
+            best = i;
+        }
+    }
+    best_size = 0;
+    if (status == STATUS_OK)
+    {
+        status = optimize_measure(
+            inbuf, inlen, options, &input, &output, out_palette,
+            &trials[best], &best_size);
+    }
+
+    if (status == STATUS_OK)
+    {
+        if (best_size < inlen)
+        {
+            status = optimize_write(
+                inbuf, inlen, options, &input, &output, out_palette,
+                &trials[best], writer);
+        }
+        else
+        {
+            status = optimize_copy(inbuf, inlen, writer);
+        }
+    }
+
+    if (status == STATUS_OK && result)
+    {
+        memset(result, 0, sizeof(optimize_result_t));
+        result->input_size = inlen;
+        result->kept_input = best_size >= inlen;
+        result->output_size = result->kept_input ? inlen : best_size;
+        result->ihdr = result->kept_input ? input : output;
+        result->adaptive_filter = trials[best].options.adaptive_filter;
+        result->filter = trials[best].options.filter;
+        result->compressor = trials[best].options.compressor;
+        result->level = trials[best].options.level;
+    }
+
+    for (i = 0; i < OPTIMIZE_TRIAL_COUNT; i++)
+    {
+        free(trials[i].data);
+    }
+    free(pixels);
+    return status;
+}
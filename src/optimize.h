@@ -0,0 +1,111 @@
+/*
+ *  Image-Formats - PNG Optimizer
+ *      Losslessly recompresses PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include "base.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "writer.h"
+
+/* Number of filter strategies tried by the optimizer. */
+#define OPTIMIZE_STRATEGY_COUNT 6
+
+typedef struct {
+    /* Compression backend.  NULL for `engine_get_compressor(NULL)`. */
+    engine_compressor_t const *compressor;
+    /* Compression level of every filter strategy. */
+    uint32_t level;
+    /*
+     * Also compress the best filter strategy at the maximum level of
+     * every backend that was built.
+     */
+    bool_t deflate_trials;
+    /* Drop metadata chunks that do not affect how the image looks. */
+    bool_t strip;
+    /* Number of strategies compressed at once. */
+    uint32_t threads;
+    /* Largest data length of an IDAT chunk. */
+    uint32_t idat_size;
+    /*
+     * Width times height of the input, 2^28 by default, 0 for no
+     * limit.  The image and its compressed data are bounded by it.
+     */
+    uint64_t max_pixels;
+} optimize_options_t;
+
+typedef struct {
+    size_t input_size;
+    size_t output_size;
+    /* Header of the output image. */
+    ihdr_t ihdr;
+    /* Whether the input was written unchanged, being smaller. */
+    bool_t kept_input;
+    /* Filter strategy of the output, unless the input was kept. */
+    bool_t adaptive_filter;
+    filter_type_t filter;
+    /* Backend and level of the output, unless the input was kept. */
+    engine_compressor_t const *compressor;
+    uint32_t level;
+} optimize_result_t;
+
+/*
+ * Function: optimize_options_default
+ *  Initializes optimizer options to the default backend at level 9,
+ *  deflate trials, metadata stripping, a single thread, IDAT chunks of
+ *  up to 64 KiB and images of up to 2^28 pixels.
+ */
+status_t optimize_options_default(optimize_options_t *options);
+
+/*
+ * Function: optimize_png
+ *  Rewrites a PNG datastream as the smallest equivalent one found.
+ *
+ *  The image is first reduced where that is lossless: 16-bit samples
+ *  that are all multiples of 257 become 8-bit, an alpha channel that
+ *  is fully opaque is dropped, truecolor with equal channels becomes
+ *  greyscale, and opaque 8-bit truecolor with at most 256 colors
+ *  becomes palette based with the smallest bit depth.  Images with a
+ *  tRNS chunk are not reduced.
+ *
+ *  Critical chunks are regenerated.  Ancillary chunks are kept or
+ *  dropped according to their safe-to-copy bit: safe-to-copy chunks
+ *  do not depend on the image data and are kept unless stripping.
+ *  Unsafe-to-copy chunks are kept only when known to stay valid:
+ *  gAMA, cHRM, sRGB and iCCP always, and chunks tied to the pixel
+ *  format (tRNS, bKGD, sBIT, hIST) when the format is unchanged.
+ *
+ *  Every filter strategy (adaptive and each fixed filter) compresses
+ *  the image data on `threads` threads.  With deflate trials, the
+ *  smallest one is then compressed again at the maximum level of each
+ *  backend, skipping the backend and level already tried.  The
+ *  smallest datastream is written.  If it is not smaller than the
+ *  input, the input chunks are written unchanged instead.  Segmented
+ *  streams are not tried, as they are never smaller than one stream.
+ * Args:
+ *    inbuf - Buffer containing a complete PNG datastream.
+ *    inlen - Length of `inbuf`.
+ *    options - Optimizer options.  NULL for the defaults.
+ *    writer - Destination of the datastream.  It is not flushed.
+ *    result - Receives a summary of the output.  Can be NULL.
+ * Return:
+ *    OK if the datastream was written.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    ILLEGAL_ARG if the options are out of range, or the input is an
+ *      animation.
+ *    LIMIT_EXCEEDED if width times height exceeds `max_pixels`.
+ *    OUT_OF_MEM if the image or compressed data could not be held in
+ *      memory.
+ *    Otherwise as `decoder_open()`, `decoder_decode_region()` or the
+ *    writer.
+ */
+status_t optimize_png(
+    uint8_t const *inbuf, size_t inlen, optimize_options_t const *options,
+    writer_t *writer, optimize_result_t *result);
+
+#endif /* _OPTIMIZE_H_ */
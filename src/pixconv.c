@@ -0,0 +1,597 @@
+/*
+ *  Image-Formats - Pixel Conversion
+ *      Expands serialized PNG pixels into common in-memory formats.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <pthread.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pixconv.h"
+
+static uint8_t const kOpaque = 0xff;
+/* 1.0 as a half float. */
+static uint16_t const kHalfOne = 0x3c00;
+
+/* BT.601 limited range coefficients, in units of 1/256. */
+static int32_t const kLumaRed = 66;
+static int32_t const kLumaGreen = 129;
+static int32_t const kLumaBlue = 25;
+static int32_t const kLumaOffset = 16 * 256 + 128;
+static int32_t const kCbRed = -38;
+static int32_t const kCbGreen = -74;
+static int32_t const kCbBlue = 112;
+static int32_t const kCrRed = 112;
+static int32_t const kCrGreen = -94;
+static int32_t const kCrBlue = -18;
+static int32_t const kChromaOffset = 128 * 256 + 128;
+
+/* Half floats of the 8-bit samples, computed on first use. */
+static uint16_t half_table[256];
+static pthread_once_t half_table_once = PTHREAD_ONCE_INIT;
+
+/* Multiplier that scales a sample of a given bit depth to 8 bits. */
+static uint8_t gray_scale_factor(uint8_t bit_depth)
+{
+    switch (bit_depth)
+    {
+        case 1:
+            return 0xff;
+        case 2:
+            return 0x55;
+        case 4:
+            return 0x11;
+        default:
+            return 1;
+    }
+}
+
+status_t pixconv_init(
+    ihdr_t const *ihdr, palette_table_t const *palette, pixconv_t *conv)
+{
+    if (!ihdr || !conv)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!ihdr_is_valid(ihdr))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(conv, 0, sizeof(pixconv_t));
+    conv->color_type = color_type_from_code(ihdr->color_type);
+    conv->bit_depth = ihdr->bit_depth;
+
+    if (conv->color_type == COLOR_TYPE_PALETTE && !palette)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    conv->palette = palette;
+    return STATUS_OK;
+}
+
+status_t pixconv_use_stage(pixconv_t *conv, color_stage_t const *stage)
+{
+    if (!conv || !stage)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (stage->color_type != conv->color_type ||
+        stage->bit_depth != conv->bit_depth)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    conv->stage = stage;
+    if (conv->color_type == COLOR_TYPE_PALETTE)
+    {
+        conv->palette = &stage->palette;
+    }
+    return STATUS_OK;
+}
+
+/* Expands packed samples of less than 8 bits. */
+static void expand_packed(
+    pixconv_t const *conv, uint8_t const *row, uint32_t count, uint8_t *out)
+{
+    uint32_t i, bits, mask, shift, value;
+    uint8_t factor;
+
+    bits = conv->bit_depth;
+    mask = (1u << bits) - 1;
+    factor = gray_scale_factor(conv->bit_depth);
+    for (i = 0; i < count; i++)
+    {
+        shift = 8 - bits - ((i * bits) & 7);
+        value = (row[(i * bits) >> 3] >> shift) & mask;
+        if (conv->color_type == COLOR_TYPE_PALETTE)
+        {
+            memcpy(out, conv->palette->rgbx[value], 4);
+        }
+        else
+        {
+            out[0] = out[1] = out[2] = (uint8_t)(value * factor);
+            out[3] = kOpaque;
+        }
+        out += 4;
+    }
+}
+
+status_t pixconv_expand_rgba8(
+    pixconv_t const *conv, uint8_t const *row, uint32_t count, uint8_t *out)
+{
+    uint8_t const *start;
+    uint8_t *start_out;
+    uint32_t i;
+
+    if (!conv || !row || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (conv->bit_depth < 8)
+    {
+        expand_packed(conv, row, count, out);
+        return conv->stage ?
+            color_stage_apply(conv->stage, row, count, out) : STATUS_OK;
+    }
+
+    start = row;
+    start_out = out;
+    /* 16-bit samples are big endian, so the high byte comes first. */
+    switch (conv->color_type)
+    {
+        case COLOR_TYPE_GRAYSCALE:
+            if (conv->bit_depth == 16)
+            {
+                for (i = 0; i < count; i++, row += 2, out += 4)
+                {
+                    out[0] = out[1] = out[2] = row[0];
+                    out[3] = kOpaque;
+                }
+            }
+            else
+            {
+                for (i = 0; i < count; i++, row += 1, out += 4)
+                {
+                    out[0] = out[1] = out[2] = row[0];
+                    out[3] = kOpaque;
+                }
+            }
+            break;
+        case COLOR_TYPE_REALCOLOR:
+            if (conv->bit_depth == 16)
+            {
+                for (i = 0; i < count; i++, row += 6, out += 4)
+                {
+                    out[0] = row[0];
+                    out[1] = row[2];
+                    out[2] = row[4];
+                    out[3] = kOpaque;
+                }
+            }
+            else
+            {
+                for (i = 0; i < count; i++, row += 3, out += 4)
+                {
+                    out[0] = row[0];
+                    out[1] = row[1];
+                    out[2] = row[2];
+                    out[3] = kOpaque;
+                }
+            }
+            break;
+        case COLOR_TYPE_PALETTE:
+            for (i = 0; i < count; i++, row += 1, out += 4)
+            {
+                memcpy(out, conv->palette->rgbx[row[0]], 4);
+            }
+            break;
+        case COLOR_TYPE_GRAYSCALE_ALPHA:
+            if (conv->bit_depth == 16)
+            {
+                for (i = 0; i < count; i++, row += 4, out += 4)
+                {
+                    out[0] = out[1] = out[2] = row[0];
+                    out[3] = row[2];
+                }
+            }
+            else
+            {
+                for (i = 0; i < count; i++, row += 2, out += 4)
+                {
+                    out[0] = out[1] = out[2] = row[0];
+                    out[3] = row[1];
+                }
+            }
+            break;
+        case COLOR_TYPE_REALCOLOR_ALPHA:
+            if (conv->bit_depth == 16)
+            {
+                for (i = 0; i < count; i++, row += 8, out += 4)
+                {
+                    out[0] = row[0];
+                    out[1] = row[2];
+                    out[2] = row[4];
+                    out[3] = row[6];
+                }
+            }
+            else if (conv->stage && conv->stage->premultiply &&
+                     !conv->stage->gamma && !conv->stage->convert)
+            {
+                /* Premultiply while copying, leaving nothing to apply. */
+                return color_premultiply(row, count, out);
+            }
+            else
+            {
+                memcpy(out, row, (size_t)count * 4);
+            }
+            break;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+    return conv->stage ?
+        color_stage_apply(conv->stage, start, count, start_out) : STATUS_OK;
+}
+
+status_t pixconv_format_size(
+    pixel_format_t format, uint32_t width, uint32_t height, uint64_t *size)
+{
+    uint64_t pixels;
+
+    if (!size)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    pixels = (uint64_t)width * height;
+    switch (format)
+    {
+        case PIXEL_FORMAT_RGBA8:
+        case PIXEL_FORMAT_BGRA8:
+            *size = pixels * 4;
+            return STATUS_OK;
+        case PIXEL_FORMAT_RGBA16F:
+            *size = pixels * 8;
+            return STATUS_OK;
+        case PIXEL_FORMAT_YUV420:
+            *size = pixels +
+                (uint64_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+            return STATUS_OK;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+uint32_t pixconv_pixel_bytes(pixel_format_t format)
+{
+    switch (format)
+    {
+        case PIXEL_FORMAT_RGBA8:
+        case PIXEL_FORMAT_BGRA8:
+            return 4;
+        case PIXEL_FORMAT_RGBA16F:
+            return 8;
+        case PIXEL_FORMAT_YUV420:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Rounds `value` / `max`, from 0 to 1, to the nearest half float. */
+static uint16_t half_from_unorm(uint32_t value, uint32_t max)
+{
+    double unit;
+    uint64_t bits, mantissa, rest, halfway;
+    uint32_t exponent, shift, half;
+
+    /* A double holds the quotient closely enough to round it once. */
+    unit = (double)value / (double)max;
+    memcpy(&bits, &unit, sizeof(bits));
+    exponent = (uint32_t)(bits >> 52) & 0x7ff;
+    mantissa = bits & (((uint64_t)1 << 52) - 1);
+    if (exponent < 998)
+    {
+        /* Below half the smallest subnormal half float. */
+        return 0;
+    }
+    if (exponent <= 1008)
+    {
+        /* Subnormal half float. */
+        mantissa |= (uint64_t)1 << 52;
+        shift = 1051 - exponent;
+        half = (uint32_t)(mantissa >> shift);
+        rest = mantissa & (((uint64_t)1 << shift) - 1);
+        halfway = (uint64_t)1 << (shift - 1);
+    }
+    else
+    {
+        half = ((exponent - 1008) << 10) | (uint32_t)(mantissa >> 42);
+        rest = mantissa & (((uint64_t)1 << 42) - 1);
+        halfway = (uint64_t)1 << 41;
+    }
+    /* Ties to even.  A carry into the exponent is still correct. */
+    if (rest > halfway || (rest == halfway && (half & 1)))
+    {
+        half++;
+    }
+    return (uint16_t)half;
+}
+
+static void init_half_table(void)
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++)
+    {
+        half_table[i] = half_from_unorm(i, 0xff);
+    }
+}
+
+/*
+ * Defines `name(rgba, count, out)`, which writes expanded RGBA8 pixels
+ * in a packed format of `size` bytes per pixel with `STORE(in, out)`.
+ * `out` may be the input itself, or start before it as long as it
+ * never runs ahead of the pixel being read.
+ */
+#define DEFINE_RGBA8_WRITER(name, size, STORE) \
+    static void name(uint8_t const *rgba, uint32_t count, uint8_t *out) \
+    { \
+        uint32_t i; \
+        for (i = 0; i < count; i++, rgba += 4, out += (size)) \
+        { \
+            STORE(rgba, out); \
+        } \
+    }
+
+#define STORE_BGRA8(in, out) \
+    do \
+    { \
+        uint8_t red = (in)[0]; \
+        (out)[0] = (in)[2]; \
+        (out)[1] = (in)[1]; \
+        (out)[2] = red; \
+        (out)[3] = (in)[3]; \
+    } while (0)
+
+#define STORE_RGBA16F(in, out) \
+    do \
+    { \
+        uint16_t half[4]; \
+        half[0] = half_table[(in)[0]]; \
+        half[1] = half_table[(in)[1]]; \
+        half[2] = half_table[(in)[2]]; \
+        half[3] = half_table[(in)[3]]; \
+        memcpy((out), half, sizeof(half)); \
+    } while (0)
+
+DEFINE_RGBA8_WRITER(write_bgra8, 4, STORE_BGRA8)
+DEFINE_RGBA8_WRITER(write_rgba16f, 8, STORE_RGBA16F)
+
+status_t pixconv_swap_red_blue(
+    uint8_t const *rgba, uint32_t count, uint8_t *out)
+{
+    uint32_t i;
+
+    if (!rgba || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    i = 0;
+#ifdef __SSE2__
+    {
+        __m128i keep, low, pixels;
+
+        keep = _mm_set1_epi32((int32_t)0xff00ff00u);
+        low = _mm_set1_epi32(0xff);
+        for (; i + 4 <= count; i += 4)
+        {
+            pixels = _mm_loadu_si128((__m128i const *)(rgba + i * 4));
+            pixels = _mm_or_si128(
+                _mm_and_si128(pixels, keep),
+                _mm_or_si128(
+                    _mm_and_si128(_mm_srli_epi32(pixels, 16), low),
+                    _mm_slli_epi32(_mm_and_si128(pixels, low), 16)));
+            _mm_storeu_si128((__m128i *)(out + i * 4), pixels);
+        }
+    }
+#endif
+    write_bgra8(rgba + (size_t)i * 4, count - i, out + (size_t)i * 4);
+    return STATUS_OK;
+}
+
+/* Writes 16-bit samples as RGBA16F without going through 8 bits. */
+static void expand_wide_half(
+    pixconv_t const *conv, uint8_t const *row, uint32_t count, uint8_t *out)
+{
+    uint32_t i, channels, channel;
+    uint16_t half[4], sample;
+
+    switch (conv->color_type)
+    {
+        case COLOR_TYPE_GRAYSCALE:
+            channels = 1;
+            break;
+        case COLOR_TYPE_GRAYSCALE_ALPHA:
+            channels = 2;
+            break;
+        case COLOR_TYPE_REALCOLOR:
+            channels = 3;
+            break;
+        default:
+            channels = 4;
+            break;
+    }
+
+    half[3] = kHalfOne;
+    for (i = 0; i < count; i++, out += sizeof(half))
+    {
+        for (channel = 0; channel < channels; channel++, row += 2)
+        {
+            sample = (uint16_t)((row[0] << 8) | row[1]);
+            half[channel] = half_from_unorm(sample, 0xffff);
+        }
+        if (channels <= 2)
+        {
+            /* Gray, then alpha if any. */
+            half[3] = channels == 2 ? half[1] : kHalfOne;
+            half[1] = half[2] = half[0];
+        }
+        memcpy(out, half, sizeof(half));
+    }
+}
+
+status_t pixconv_expand(
+    pixconv_t const *conv, pixel_format_t format, uint8_t const *row,
+    uint32_t count, uint8_t *out)
+{
+    status_t status;
+
+    if (!conv || !row || !out)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    switch (format)
+    {
+        case PIXEL_FORMAT_RGBA8:
+            return pixconv_expand_rgba8(conv, row, count, out);
+        case PIXEL_FORMAT_BGRA8:
+            status = pixconv_expand_rgba8(conv, row, count, out);
+            if (status == STATUS_OK)
+            {
+                status = pixconv_swap_red_blue(out, count, out);
+            }
+            return status;
+        case PIXEL_FORMAT_RGBA16F:
+            if (conv->bit_depth == 16 && (!conv->stage || !conv->stage->active))
+            {
+                expand_wide_half(conv, row, count, out);
+                return STATUS_OK;
+            }
+            /* Expand into the back half of the row, then widen it. */
+            pthread_once(&half_table_once, init_half_table);
+            status = pixconv_expand_rgba8(
+                conv, row, count, out + (size_t)count * 4);
+            if (status == STATUS_OK)
+            {
+                write_rgba16f(out + (size_t)count * 4, count, out);
+            }
+            return status;
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+status_t pixconv_store_luma(
+    uint8_t const *rgba, uint32_t count, uint32_t step, uint8_t *luma)
+{
+    uint32_t i;
+    int32_t value;
+
+    if (!rgba || !luma)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    i = 0;
+#ifdef __SSE2__
+    if (step == 1)
+    {
+        __m128i zero, coefficients, offset, pixels, low, high, sums;
+        int32_t packed;
+
+        zero = _mm_setzero_si128();
+        coefficients = _mm_setr_epi16(
+            (int16_t)kLumaRed, (int16_t)kLumaGreen, (int16_t)kLumaBlue, 0,
+            (int16_t)kLumaRed, (int16_t)kLumaGreen, (int16_t)kLumaBlue, 0);
+        offset = _mm_set1_epi32(kLumaOffset);
+        for (; i + 4 <= count; i += 4)
+        {
+            pixels = _mm_loadu_si128((__m128i const *)(rgba + i * 4));
+            /* Red and green, then blue, of each pixel. */
+            low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+            high = _mm_madd_epi16(
+                _mm_unpackhi_epi8(pixels, zero), coefficients);
+            low = _mm_add_epi32(
+                low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+            high = _mm_add_epi32(
+                high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+            sums = _mm_unpacklo_epi64(
+                _mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+                _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+            sums = _mm_srli_epi32(_mm_add_epi32(sums, offset), 8);
+            sums = _mm_packs_epi32(sums, sums);
+            packed = _mm_cvtsi128_si32(_mm_packus_epi16(sums, sums));
+            memcpy(luma + i, &packed, sizeof(packed));
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        value = kLumaRed * rgba[i * 4] + kLumaGreen * rgba[i * 4 + 1] +
+            kLumaBlue * rgba[i * 4 + 2] + kLumaOffset;
+        luma[(size_t)i * step] = (uint8_t)(value >> 8);
+    }
+    return STATUS_OK;
+}
+
+status_t pixconv_add_chroma(
+    uint8_t const *rgba, uint32_t count, uint32_t x_offset, uint32_t x_step,
+    uint16_t *sums)
+{
+    uint32_t i;
+    uint16_t *sum;
+
+    if (!rgba || !sums)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    for (i = 0; i < count; i++, rgba += 4)
+    {
+        sum = sums + (size_t)((x_offset + i * x_step) >> 1) * 3;
+        sum[0] = (uint16_t)(sum[0] + rgba[0]);
+        sum[1] = (uint16_t)(sum[1] + rgba[1]);
+        sum[2] = (uint16_t)(sum[2] + rgba[2]);
+    }
+    return STATUS_OK;
+}
+
+status_t pixconv_store_chroma(
+    uint16_t *sums, uint32_t width, uint32_t rows, uint8_t *cb, uint8_t *cr)
+{
+    uint32_t column, columns, pixels;
+    int32_t red, green, blue;
+
+    if (!sums || !cb || !cr)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    columns = (width + 1) / 2;
+    for (column = 0; column < columns; column++, sums += 3)
+    {
+        /* The last column of an odd width only has one pixel per row. */
+        pixels = rows * ((column * 2 + 1 < width) ? 2 : 1);
+        red = (int32_t)((sums[0] + pixels / 2) / pixels);
+        green = (int32_t)((sums[1] + pixels / 2) / pixels);
+        blue = (int32_t)((sums[2] + pixels / 2) / pixels);
+        cb[column] = (uint8_t)(
+            (kCbRed * red + kCbGreen * green + kCbBlue * blue +
+             kChromaOffset) >> 8);
+        cr[column] = (uint8_t)(
+            (kCrRed * red + kCrGreen * green + kCrBlue * blue +
+             kChromaOffset) >> 8);
+        sums[0] = sums[1] = sums[2] = 0;
+    }
+    return STATUS_OK;
+}
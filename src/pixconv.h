@@ -0,0 +1,175 @@
+/*
+ *  Image-Formats - Pixel Conversion
+ *      Expands serialized PNG pixels into common in-memory formats.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _PIXCONV_H_
+#define _PIXCONV_H_
+
+#include "base.h"
+#include "clrchunk.h"
+#include "color.h"
+#include "imgchunk.h"
+
+/* In-memory layouts decoded pixels can be written in. */
+typedef enum {
+    PIXEL_FORMAT_RGBA8,
+    PIXEL_FORMAT_BGRA8,
+    /* IEEE 754 half floats from 0 to 1, in host byte order. */
+    PIXEL_FORMAT_RGBA16F,
+    /*
+     * Planar 8-bit BT.601 YCbCr, limited range.  The Y plane is
+     * followed by the Cb and Cr planes, each (width + 1) / 2 by
+     * (height + 1) / 2, averaging blocks of 2x2 pixels.  Alpha is
+     * dropped.
+     */
+    PIXEL_FORMAT_YUV420,
+    PIXEL_FORMAT_COUNT
+} pixel_format_t;
+
+typedef struct {
+    color_type_t color_type;
+    uint8_t bit_depth;
+    /* Palette of the image, RGBX entries are used as RGBA8. */
+    palette_table_t const *palette;
+    /* Color stage applied after expanding, or NULL. */
+    color_stage_t const *stage;
+} pixconv_t;
+
+/*
+ * Function: pixconv_init
+ *  Prepares the conversion of pixels described by an IHDR.
+ * Args:
+ *    ihdr - Pointer to a valid IHDR struct.
+ *    palette - Palette of the image, which must outlive the converter.
+ *              Can be NULL unless the color type is palette.
+ *    conv - Pointer to an uninitialized converter.
+ * Return:
+ *    OK if the converter was initialized.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    ILLEGAL_ARG if the IHDR is not valid.
+ */
+status_t pixconv_init(
+    ihdr_t const *ihdr, palette_table_t const *palette, pixconv_t *conv);
+
+/*
+ * Function: pixconv_use_stage
+ *  Makes a converter apply a color stage to the pixels it expands, and
+ *  take palette entries from the stage.
+ * Args:
+ *    conv - Pointer to an initialized converter.
+ *    stage - Initialized stage of the same image, which must outlive
+ *            the converter.
+ */
+status_t pixconv_use_stage(pixconv_t *conv, color_stage_t const *stage);
+
+/*
+ * Function: pixconv_expand_rgba8
+ *  Expands the first `count` pixels of a serialized scanline into
+ *  8-bit RGBA.  Samples of lower bit depths are scaled up to the full
+ *  range and 16-bit samples are truncated to their high byte.  The
+ *  color stage, premultiplication included, is applied to each row
+ *  while it is still in cache.
+ * Args:
+ *    conv - Pointer to an initialized converter.
+ *    row - Unfiltered scanline, without the filter type byte.
+ *    count - Number of pixels to expand.
+ *    out - Destination of `count` * 4 bytes.
+ * Return:
+ *    OK if the pixels were expanded.
+ *    NULL_ARG if any of the arguments are NULL.
+ */
+status_t pixconv_expand_rgba8(
+    pixconv_t const *conv, uint8_t const *row, uint32_t count, uint8_t *out);
+
+/*
+ * Function: pixconv_format_size
+ *  Computes the size of an image in a pixel format.
+ * Args:
+ *    format - Pixel format.
+ *    width - Width of the image.
+ *    height - Height of the image.
+ *    size - Set to the number of bytes of the image.
+ * Return:
+ *    OK if the size was computed.
+ *    NULL_ARG if `size` is NULL.
+ *    ILLEGAL_ARG if the format is not known.
+ */
+status_t pixconv_format_size(
+    pixel_format_t format, uint32_t width, uint32_t height, uint64_t *size);
+
+/*
+ * Function: pixconv_pixel_bytes
+ *  Returns the bytes per pixel of a packed format, or of the Y plane
+ *  for YUV420.  0 if the format is not known.
+ */
+uint32_t pixconv_pixel_bytes(pixel_format_t format);
+
+/*
+ * Function: pixconv_expand
+ *  Expands the first `count` pixels of a serialized scanline into a
+ *  packed pixel format, in one pass over the output row.  16-bit
+ *  samples keep their full precision as RGBA16F when the color stage
+ *  leaves them unchanged.  Other pixels are expanded to RGBA8 first,
+ *  as with `pixconv_expand_rgba8()`.
+ * Args:
+ *    conv - Pointer to an initialized converter.
+ *    format - Any format but YUV420.
+ *    row - Unfiltered scanline, without the filter type byte.
+ *    count - Number of pixels to expand.
+ *    out - Destination of `count` pixels of the format.
+ * Return:
+ *    OK if the pixels were expanded.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the format is not a packed one.
+ */
+status_t pixconv_expand(
+    pixconv_t const *conv, pixel_format_t format, uint8_t const *row,
+    uint32_t count, uint8_t *out);
+
+/*
+ * Function: pixconv_swap_red_blue
+ *  Converts RGBA8 pixels to BGRA8 or back.  `out` can be `rgba`.
+ */
+status_t pixconv_swap_red_blue(
+    uint8_t const *rgba, uint32_t count, uint8_t *out);
+
+/*
+ * Function: pixconv_store_luma
+ *  Writes the Y samples of RGBA8 pixels, `step` bytes apart.
+ */
+status_t pixconv_store_luma(
+    uint8_t const *rgba, uint32_t count, uint32_t step, uint8_t *luma);
+
+/*
+ * Function: pixconv_add_chroma
+ *  Adds RGBA8 pixels of an image row to the channel sums of the chroma
+ *  row they belong to.
+ * Args:
+ *    rgba - Pixels to add.
+ *    count - Number of pixels.
+ *    x_offset - Image column of the first pixel.
+ *    x_step - Image columns from one pixel to the next.
+ *    sums - Red, green and blue sums of each chroma column.
+ */
+status_t pixconv_add_chroma(
+    uint8_t const *rgba, uint32_t count, uint32_t x_offset, uint32_t x_step,
+    uint16_t *sums);
+
+/*
+ * Function: pixconv_store_chroma
+ *  Writes the Cb and Cr samples of a chroma row from its channel sums,
+ *  and clears the sums for the next row.
+ * Args:
+ *    sums - Sums of the chroma row, added by `pixconv_add_chroma()`.
+ *    width - Width of the image.
+ *    rows - Image rows added to the sums, 1 or 2.
+ *    cb - Destination of (width + 1) / 2 Cb samples.
+ *    cr - Destination of (width + 1) / 2 Cr samples.
+ */
+status_t pixconv_store_chroma(
+    uint16_t *sums, uint32_t width, uint32_t rows, uint8_t *cb, uint8_t *cr);
+
+#endif /* _PIXCONV_H_ */
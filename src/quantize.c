@@ -0,0 +1,616 @@
+/*
+ *  Image-Formats - Color Quantization
+ *      Reduces truecolor images to palette images.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "workers.h"
+
+#include "quantize.h"
+
+/* Histogram of 5 bits per channel, indexed as 0bRRRRRGGGGGBBBBB. */
+#define HISTOGRAM_BITS 5
+#define HISTOGRAM_SIDE (1u << HISTOGRAM_BITS)
+#define HISTOGRAM_SIZE (HISTOGRAM_SIDE * HISTOGRAM_SIDE * HISTOGRAM_SIDE)
+static uint32_t const kSampleShift = 8 - HISTOGRAM_BITS;
+
+/* Pixels whose bins are computed in one batch before counting. */
+#define BIN_BATCH 1024
+
+/* Exact color table, more than twice the largest palette. */
+#define EXACT_TABLE_SIZE 512
+static uint32_t const kExactTableMask = EXACT_TABLE_SIZE - 1;
+static uint32_t const kExactEmpty = 0xffffffffu;
+
+static int16_t const kNotMapped = -1;
+
+typedef struct {
+    uint64_t red;
+    uint64_t green;
+    uint64_t blue;
+    uint64_t count;
+} bin_t;
+
+typedef struct {
+    /* Inclusive bin bounds of the box, per channel. */
+    uint8_t lo[3];
+    uint8_t hi[3];
+    uint64_t count;
+} box_t;
+
+typedef struct {
+    uint8_t const *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t stripes;
+    /* One histogram per stripe of rows. */
+    bin_t **histograms;
+    /* Palette index of every bin, or kNotMapped. */
+    int16_t *bin_map;
+    /* Exact colors, used instead of `bin_map` when set. */
+    uint32_t const *exact_colors;
+    uint8_t const *exact_index;
+    uint8_t *indices;
+} quantize_context_t;
+
+status_t quantize_options_default(quantize_options_t *options)
+{
+    if (!options)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    options->max_colors = QUANTIZE_MAX_COLORS;
+    options->dither = false;
+    options->threads = 1;
+    return STATUS_OK;
+}
+
+static uint32_t bin_of(uint8_t const *pixel)
+{
+    return ((uint32_t)(pixel[0] >> kSampleShift) << (2 * HISTOGRAM_BITS)) |
+           ((uint32_t)(pixel[1] >> kSampleShift) << HISTOGRAM_BITS) |
+           (uint32_t)(pixel[2] >> kSampleShift);
+}
+
+static uint32_t pack_rgb(uint8_t const *pixel)
+{
+    return ((uint32_t)pixel[0] << 16) | ((uint32_t)pixel[1] << 8) | pixel[2];
+}
+
+static void stripe_rows(
+    quantize_context_t const *ctx, uint32_t stripe,
+    uint32_t *first, uint32_t *last)
+{
+    *first = (uint32_t)((uint64_t)ctx->height * stripe / ctx->stripes);
+    *last = (uint32_t)((uint64_t)ctx->height * (stripe + 1) / ctx->stripes);
+}
+
+/* Counts the pixels of one stripe of rows into its histogram. */
+static void histogram_task(void *context, uint32_t stripe)
+{
+    quantize_context_t *ctx;
+    uint16_t bins[BIN_BATCH];
+    uint8_t const *pixel;
+    bin_t *histogram, *bin;
+    size_t remaining, batch, i;
+    uint32_t first, last;
+
+    ctx = (quantize_context_t *)context;
+    histogram = ctx->histograms[stripe];
+    stripe_rows(ctx, stripe, &first, &last);
+
+    pixel = ctx->pixels + (size_t)first * ctx->width * ctx->channels;
+    remaining = (size_t)(last - first) * ctx->width;
+    while (remaining > 0)
+    {
+        batch = remaining < BIN_BATCH ? remaining : BIN_BATCH;
+        /* Independent per pixel, so this loop vectorizes. */
+        for (i = 0; i < batch; i++)
+        {
+            bins[i] = (uint16_t)bin_of(pixel + i * ctx->channels);
+        }
+        for (i = 0; i < batch; i++, pixel += ctx->channels)
+        {
+            bin = &histogram[bins[i]];
+            bin->red += pixel[0];
+            bin->green += pixel[1];
+            bin->blue += pixel[2];
+            bin->count++;
+        }
+        remaining -= batch;
+    }
+}
+
+static void box_shrink(box_t *box, bin_t const *histogram)
+{
+    uint32_t r, g, b;
+    uint8_t lo[3], hi[3];
+    uint64_t count;
+    bin_t const *bin;
+
+    lo[0] = lo[1] = lo[2] = HISTOGRAM_SIDE - 1;
+    hi[0] = hi[1] = hi[2] = 0;
+    count = 0;
+    for (r = box->lo[0]; r <= box->hi[0]; r++)
+    for (g = box->lo[1]; g <= box->hi[1]; g++)
+    for (b = box->lo[2]; b <= box->hi[2]; b++)
+    {
+        bin = &histogram[
+            (r << (2 * HISTOGRAM_BITS)) | (g << HISTOGRAM_BITS) | b];
+        if (bin->count == 0)
+        {
+            continue;
+        }
+        count += bin->count;
+        if (r < lo[0]) lo[0] = (uint8_t)r;
+        if (r > hi[0]) hi[0] = (uint8_t)r;
+        if (g < lo[1]) lo[1] = (uint8_t)g;
+        if (g > hi[1]) hi[1] = (uint8_t)g;
+        if (b < lo[2]) lo[2] = (uint8_t)b;
+        if (b > hi[2]) hi[2] = (uint8_t)b;
+    }
+    memcpy(box->lo, lo, sizeof(lo));
+    memcpy(box->hi, hi, sizeof(hi));
+    box->count = count;
+}
+
+static uint32_t box_longest_axis(box_t const *box)
+{
+    uint32_t axis, longest;
+    longest = 0;
+    for (axis = 1; axis < 3; axis++)
+    {
+        if (box->hi[axis] - box->lo[axis] > box->hi[longest] - box->lo[longest])
+        {
+            longest = axis;
+        }
+    }
+    return longest;
+}
+
+/* Splits `box` at the median of its longest axis into `box` and `other`. */
+static void box_split(box_t *box, box_t *other, bin_t const *histogram)
+{
+    uint64_t planes[HISTOGRAM_SIDE], half, seen;
+    uint32_t axis, c[3], split;
+
+    axis = box_longest_axis(box);
+    memset(planes, 0, sizeof(planes));
+    for (c[0] = box->lo[0]; c[0] <= box->hi[0]; c[0]++)
+    for (c[1] = box->lo[1]; c[1] <= box->hi[1]; c[1]++)
+    for (c[2] = box->lo[2]; c[2] <= box->hi[2]; c[2]++)
+    {
+        planes[c[axis]] += histogram[
+            (c[0] << (2 * HISTOGRAM_BITS)) | (c[1] << HISTOGRAM_BITS) |
+            c[2]].count;
+    }
+
+    /* Both halves keep at least one plane. */
+    half = box->count / 2;
+    seen = 0;
+    for (split = box->lo[axis]; split < box->hi[axis] - 1u; split++)
+    {
+        seen += planes[split];
+        if (seen >= half)
+        {
+            break;
+        }
+    }
+
+    *other = *box;
+    box->hi[axis] = (uint8_t)split;
+    other->lo[axis] = (uint8_t)(split + 1);
+    box_shrink(box, histogram);
+    box_shrink(other, histogram);
+}
+
+static void box_mean(box_t const *box, bin_t const *histogram, rgb_t *color)
+{
+    uint64_t red, green, blue;
+    uint32_t r, g, b;
+    bin_t const *bin;
+
+    red = green = blue = 0;
+    for (r = box->lo[0]; r <= box->hi[0]; r++)
+    for (g = box->lo[1]; g <= box->hi[1]; g++)
+    for (b = box->lo[2]; b <= box->hi[2]; b++)
+    {
+        bin = &histogram[
+            (r << (2 * HISTOGRAM_BITS)) | (g << HISTOGRAM_BITS) | b];
+        red += bin->red;
+        green += bin->green;
+        blue += bin->blue;
+    }
+    memset(color, 0, sizeof(rgb_t));
+    color->red = (uint8_t)((red + box->count / 2) / box->count);
+    color->green = (uint8_t)((green + box->count / 2) / box->count);
+    color->blue = (uint8_t)((blue + box->count / 2) / box->count);
+}
+
+static uint32_t median_cut(
+    bin_t const *histogram, uint32_t max_colors, rgb_t *colors)
+{
+    box_t boxes[QUANTIZE_MAX_COLORS];
+    uint64_t score, best_score;
+    uint32_t count, i, best, axis;
+
+    memset(&boxes[0], 0, sizeof(box_t));
+    boxes[0].hi[0] = boxes[0].hi[1] = boxes[0].hi[2] = HISTOGRAM_SIDE - 1;
+    box_shrink(&boxes[0], histogram);
+
+    count = 1;
+    while (count < max_colors)
+    {
+        /* Split the most populous box relative to its extent. */
+        best = count;
+        best_score = 0;
+        for (i = 0; i < count; i++)
+        {
+            axis = box_longest_axis(&boxes[i]);
+            score = boxes[i].count *
+                (uint64_t)(boxes[i].hi[axis] - boxes[i].lo[axis]);
+            if (score > best_score)
+            {
+                best_score = score;
+                best = i;
+            }
+        }
+        if (best == count)
+        {
+            /* Every box is a single bin. */
+            break;
+        }
+        box_split(&boxes[best], &boxes[count], histogram);
+        count++;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        box_mean(&boxes[i], histogram, &colors[i]);
+    }
+    return count;
+}
+
+static uint32_t nearest_color(
+    rgb_t const *colors, uint32_t count, int32_t red, int32_t green,
+    int32_t blue)
+{
+    int32_t dr, dg, db, distance, best_distance;
+    uint32_t i, best;
+
+    best = 0;
+    best_distance = 0x7fffffff;
+    for (i = 0; i < count; i++)
+    {
+        dr = red - colors[i].red;
+        dg = green - colors[i].green;
+        db = blue - colors[i].blue;
+        distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static uint32_t exact_slot(uint32_t const *table, uint32_t color)
+{
+    uint32_t slot;
+    slot = (color * 2654435761u) >> 23;
+    while (table[slot & kExactTableMask] != kExactEmpty &&
+           table[slot & kExactTableMask] != color)
+    {
+        slot++;
+    }
+    return slot & kExactTableMask;
+}
+
+/*
+ * Collects the distinct colors of the image into `table`.  Returns the
+ * number of colors, or `max_colors` + 1 if there are more.
+ */
+static uint32_t collect_exact_colors(
+    quantize_context_t const *ctx, uint32_t max_colors,
+    uint32_t *table, uint8_t *table_index, rgb_t *colors)
+{
+    uint8_t const *pixel, *end;
+    uint32_t color, slot, count;
+
+    for (slot = 0; slot < EXACT_TABLE_SIZE; slot++)
+    {
+        table[slot] = kExactEmpty;
+    }
+
+    count = 0;
+    pixel = ctx->pixels;
+    end = pixel + (size_t)ctx->width * ctx->height * ctx->channels;
+    for (; pixel < end; pixel += ctx->channels)
+    {
+        color = pack_rgb(pixel);
+        slot = exact_slot(table, color);
+        if (table[slot] == color)
+        {
+            continue;
+        }
+        if (count == max_colors)
+        {
+            return max_colors + 1;
+        }
+        table[slot] = color;
+        table_index[slot] = (uint8_t)count;
+        memset(&colors[count], 0, sizeof(rgb_t));
+        colors[count].red = pixel[0];
+        colors[count].green = pixel[1];
+        colors[count].blue = pixel[2];
+        count++;
+    }
+    return count;
+}
+
+/* Maps the pixels of one stripe of rows without dithering. */
+static void map_task(void *context, uint32_t stripe)
+{
+    quantize_context_t *ctx;
+    uint8_t const *pixel;
+    uint8_t *index;
+    size_t count, i;
+    uint32_t first, last;
+
+    ctx = (quantize_context_t *)context;
+    stripe_rows(ctx, stripe, &first, &last);
+    pixel = ctx->pixels + (size_t)first * ctx->width * ctx->channels;
+    index = ctx->indices + (size_t)first * ctx->width;
+    count = (size_t)(last - first) * ctx->width;
+
+    if (ctx->exact_colors)
+    {
+        for (i = 0; i < count; i++, pixel += ctx->channels)
+        {
+            index[i] = ctx->exact_index[
+                exact_slot(ctx->exact_colors, pack_rgb(pixel))];
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++, pixel += ctx->channels)
+    {
+        index[i] = (uint8_t)ctx->bin_map[bin_of(pixel)];
+    }
+}
+
+/* Whether every pixel of an RGBA image is fully opaque. */
+static bool_t is_opaque(
+    uint8_t const *pixels, uint32_t width, uint32_t height)
+{
+    uint8_t const *pixel, *end;
+    uint8_t alpha;
+
+    alpha = 0xff;
+    end = pixels + (size_t)width * height * 4;
+    /* Branch free, so this loop vectorizes. */
+    for (pixel = pixels; pixel < end; pixel += 4)
+    {
+        alpha &= pixel[3];
+    }
+    return alpha == 0xff;
+}
+
+static int32_t clamp_sample(int32_t value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Maps every pixel with Floyd-Steinberg error diffusion. */
+static status_t map_dithered(
+    quantize_context_t *ctx, rgb_t const *colors, uint32_t count)
+{
+    int32_t *errors, *current, *next, *swap, value[3], error;
+    uint8_t const *pixel;
+    uint8_t clamped[3];
+    uint32_t x, y, channel, bin, index;
+    size_t row_errors;
+
+    /* One guard pixel on each side of the error rows. */
+    row_errors = ((size_t)ctx->width + 2) * 3;
+    errors = (int32_t *)engine_allocate(sizeof(int32_t) * row_errors * 2);
+    if (!errors)
+    {
+        return STATUS_OUT_OF_MEMORY;
+    }
+    memset(errors, 0, sizeof(int32_t) * row_errors * 2);
+    current = errors;
+    next = errors + row_errors;
+
+    pixel = ctx->pixels;
+    for (y = 0; y < ctx->height; y++)
+    {
+        memset(next, 0, sizeof(int32_t) * row_errors);
+        for (x = 0; x < ctx->width; x++, pixel += ctx->channels)
+        {
+            for (channel = 0; channel < 3; channel++)
+            {
+                /* Errors are kept in 1/16 units. */
+                value[channel] = clamp_sample(
+                    pixel[channel] + current[(x + 1) * 3 + channel] / 16);
+                clamped[channel] = (uint8_t)value[channel];
+            }
+
+            bin = bin_of(clamped);
+            if (ctx->bin_map[bin] == kNotMapped)
+            {
+                ctx->bin_map[bin] = (int16_t)nearest_color(
+                    colors, count, value[0], value[1], value[2]);
+            }
+            index = (uint32_t)ctx->bin_map[bin];
+            ctx->indices[(size_t)y * ctx->width + x] = (uint8_t)index;
+
+            for (channel = 0; channel < 3; channel++)
+            {
+                error = value[channel] - (channel == 0 ? colors[index].red :
+                    channel == 1 ? colors[index].green : colors[index].blue);
+                current[(x + 2) * 3 + channel] += error * 7;
+                next[x * 3 + channel] += error * 3;
+                next[(x + 1) * 3 + channel] += error * 5;
+                next[(x + 2) * 3 + channel] += error;
+            }
+        }
+        swap = current;
+        current = next;
+        next = swap;
+    }
+
+    free(errors);
+    return STATUS_OK;
+}
+
+status_t quantize_image(
+    uint8_t const *pixels, uint32_t width, uint32_t height, uint32_t channels,
+    quantize_options_t const *options, uint8_t *indices, palette_t *palette)
+{
+    quantize_options_t defaults;
+    quantize_context_t ctx;
+    rgb_t colors[QUANTIZE_MAX_COLORS];
+    uint32_t exact_table[EXACT_TABLE_SIZE];
+    uint8_t exact_index[EXACT_TABLE_SIZE];
+    bin_t *histogram;
+    uint32_t count, stripe, bin;
+    status_t status;
+
+    if (!pixels || !indices || !palette)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (!options)
+    {
+        quantize_options_default(&defaults);
+        options = &defaults;
+    }
+
+    if (width == 0 || height == 0 || (channels != 3 && channels != 4) ||
+        options->max_colors == 0 || options->max_colors > QUANTIZE_MAX_COLORS)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    /* The palette has no alpha, so transparency would be lost. */
+    if (channels == 4 && !is_opaque(pixels, width, height))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.pixels = pixels;
+    ctx.width = width;
+    ctx.height = height;
+    ctx.channels = channels;
+    ctx.indices = indices;
+    ctx.stripes = options->threads > 1 ? options->threads : 1;
+    if (ctx.stripes > height)
+    {
+        ctx.stripes = height;
+    }
+
+    /* Few enough colors to be kept exactly. */
+    count = collect_exact_colors(
+        &ctx, options->max_colors, exact_table, exact_index, colors);
+    if (count <= options->max_colors)
+    {
+        ctx.exact_colors = exact_table;
+        ctx.exact_index = exact_index;
+        status = workers_run(options->threads, ctx.stripes, map_task, &ctx);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+        return palette_new(colors, (uint8_t)count, palette);
+    }
+
+    ctx.histograms = (bin_t **)engine_allocate(sizeof(bin_t *) * ctx.stripes);
+    ctx.bin_map = (int16_t *)engine_allocate(sizeof(int16_t) * HISTOGRAM_SIZE);
+    if (!ctx.histograms || !ctx.bin_map)
+    {
+        status = STATUS_OUT_OF_MEMORY;
+        goto done;
+    }
+    memset(ctx.histograms, 0, sizeof(bin_t *) * ctx.stripes);
+    for (stripe = 0; stripe < ctx.stripes; stripe++)
+    {
+        ctx.histograms[stripe] =
+            (bin_t *)engine_allocate(sizeof(bin_t) * HISTOGRAM_SIZE);
+        if (!ctx.histograms[stripe])
+        {
+            status = STATUS_OUT_OF_MEMORY;
+            goto done;
+        }
+        memset(ctx.histograms[stripe], 0, sizeof(bin_t) * HISTOGRAM_SIZE);
+    }
+
+    status = workers_run(options->threads, ctx.stripes, histogram_task, &ctx);
+    if (status != STATUS_OK)
+    {
+        goto done;
+    }
+
+    /* Merge the stripe histograms into the first one. */
+    histogram = ctx.histograms[0];
+    for (stripe = 1; stripe < ctx.stripes; stripe++)
+    {
+        for (bin = 0; bin < HISTOGRAM_SIZE; bin++)
+        {
+            histogram[bin].red += ctx.histograms[stripe][bin].red;
+            histogram[bin].green += ctx.histograms[stripe][bin].green;
+            histogram[bin].blue += ctx.histograms[stripe][bin].blue;
+            histogram[bin].count += ctx.histograms[stripe][bin].count;
+        }
+    }
+
+    count = median_cut(histogram, options->max_colors, colors);
+
+    /* Map every populated bin by the mean color of its pixels. */
+    for (bin = 0; bin < HISTOGRAM_SIZE; bin++)
+    {
+        ctx.bin_map[bin] = kNotMapped;
+        if (histogram[bin].count > 0 && !options->dither)
+        {
+            ctx.bin_map[bin] = (int16_t)nearest_color(
+                colors, count,
+                (int32_t)(histogram[bin].red / histogram[bin].count),
+                (int32_t)(histogram[bin].green / histogram[bin].count),
+                (int32_t)(histogram[bin].blue / histogram[bin].count));
+        }
+    }
+
+    if (options->dither)
+    {
+        status = map_dithered(&ctx, colors, count);
+    }
+    else
+    {
+        status = workers_run(options->threads, ctx.stripes, map_task, &ctx);
+    }
+    if (status == STATUS_OK)
+    {
+        status = palette_new(colors, (uint8_t)count, palette);
+    }
+
+done:
+    if (ctx.histograms)
+    {
+        for (stripe = 0; stripe < ctx.stripes; stripe++)
+        {
+            free(ctx.histograms[stripe]);
+        }
+    }
+    free(ctx.histograms);
+    free(ctx.bin_map);
+    return status;
+}
@@ -0,0 +1,60 @@
+/*
+ *  Image-Formats - Color Quantization
+ *      Reduces truecolor images to palette images.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _QUANTIZE_H_
+#define _QUANTIZE_H_
+
+#include "base.h"
+#include "clrchunk.h"
+
+/* Largest number of palette entries the quantizer builds. */
+#define QUANTIZE_MAX_COLORS 255
+
+typedef struct {
+    /* Largest number of palette entries, from 1 to QUANTIZE_MAX_COLORS. */
+    uint32_t max_colors;
+    /* Diffuse the quantization error using Floyd-Steinberg. */
+    bool_t dither;
+    /* Number of threads used to build the histogram and map pixels. */
+    uint32_t threads;
+} quantize_options_t;
+
+/*
+ * Function: quantize_options_default
+ *  Initializes quantization options to 255 colors, no dithering and
+ *  a single thread.
+ */
+status_t quantize_options_default(quantize_options_t *options);
+
+/*
+ * Function: quantize_image
+ *  Builds a palette for an 8-bit RGB or RGBA image and maps every
+ *  pixel to its palette index.  Images with no more distinct colors
+ *  than `max_colors` are mapped exactly.  Otherwise the palette is
+ *  chosen with median cut on a 15-bit RGB histogram.  The palette has
+ *  no alpha, so RGBA images must be fully opaque.
+ * Args:
+ *    pixels - Interleaved RGB or RGBA samples, rows stored contiguously.
+ *    width - Image width in pixels.
+ *    height - Image height in pixels.
+ *    channels - 3 for RGB or 4 for RGBA.
+ *    options - Quantization options.  NULL for the defaults.
+ *    indices - Destination of `width` * `height` palette indices.
+ *    palette - Pointer to an uninitialized palette, which will own a
+ *              heap allocated list of colors.
+ * Return:
+ *    OK if the image was quantized.
+ *    NULL_ARG if any of the required arguments are NULL.
+ *    ILLEGAL_ARG if the image is empty, `channels` is unsupported,
+ *      `max_colors` is out of range or an RGBA pixel is not opaque.
+ *    OUT_OF_MEM if the histogram could not be allocated.
+ */
+status_t quantize_image(
+    uint8_t const *pixels, uint32_t width, uint32_t height, uint32_t channels,
+    quantize_options_t const *options, uint8_t *indices, palette_t *palette);
+
+#endif /* _QUANTIZE_H_ */
@@ -0,0 +1,271 @@
+/*
+ *  Image-Formats - PNG Chunk Registry
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <string.h>
+
+#include "registry.h"
+
+/* Indexed by chunk_kind_t, which has no more kinds than a mask has bits. */
+static chunk_descriptor_t const kDescriptors[CHUNK_KIND_COUNT] = {
+    { 0, "unknown", CHUNK_ORDER_ANY, true },
+    { IHDR_TYPE, "IHDR", CHUNK_ORDER_FIRST, false },
+    { PLTE_TYPE, "PLTE", CHUNK_ORDER_BEFORE_IDAT, false },
+    { IDAT_TYPE, "IDAT", CHUNK_ORDER_ANY, true },
+    { IEND_TYPE, "IEND", CHUNK_ORDER_LAST, false },
+    { TRNS_TYPE, "tRNS", CHUNK_ORDER_AFTER_PLTE, false },
+    { CHRM_TYPE, "cHRM", CHUNK_ORDER_BEFORE_PLTE, false },
+    { GAMA_TYPE, "gAMA", CHUNK_ORDER_BEFORE_PLTE, false },
+    { ICCP_TYPE, "iCCP", CHUNK_ORDER_BEFORE_PLTE, false },
+    { SBIT_TYPE, "sBIT", CHUNK_ORDER_BEFORE_PLTE, false },
+    { SRGB_TYPE, "sRGB", CHUNK_ORDER_BEFORE_PLTE, false },
+    { TEXT_TYPE, "tEXt", CHUNK_ORDER_ANY, true },
+    { ZTXT_TYPE, "zTXt", CHUNK_ORDER_ANY, true },
+    { ITXT_TYPE, "iTXt", CHUNK_ORDER_ANY, true },
+    { BKGD_TYPE, "bKGD", CHUNK_ORDER_AFTER_PLTE, false },
+    { HIST_TYPE, "hIST", CHUNK_ORDER_AFTER_PLTE, false },
+    { PHYS_TYPE, "pHYs", CHUNK_ORDER_BEFORE_IDAT, false },
+    { SPLT_TYPE, "sPLT", CHUNK_ORDER_BEFORE_IDAT, true },
+    { TIME_TYPE, "tIME", CHUNK_ORDER_ANY, false },
+    { ACTL_TYPE, "acTL", CHUNK_ORDER_BEFORE_IDAT, false },
+    { FCTL_TYPE, "fcTL", CHUNK_ORDER_ANY, true },
+    { FDAT_TYPE, "fdAT", CHUNK_ORDER_AFTER_IDAT, true }
+};
+
+/* Fibonacci hashing of a type into the slots of a registry. */
+static uint32_t const kHashMultiplier = 0x9e3779b1u;
+static uint32_t const kSlotBits = 6;
+
+chunk_kind_t chunk_kind_of(uint32_t type)
+{
+    switch (type)
+    {
+        case IHDR_TYPE:
+            return CHUNK_KIND_IHDR;
+        case PLTE_TYPE:
+            return CHUNK_KIND_PLTE;
+        case IDAT_TYPE:
+            return CHUNK_KIND_IDAT;
+        case IEND_TYPE:
+            return CHUNK_KIND_IEND;
+        case TRNS_TYPE:
+            return CHUNK_KIND_TRNS;
+        case CHRM_TYPE:
+            return CHUNK_KIND_CHRM;
+        case GAMA_TYPE:
+            return CHUNK_KIND_GAMA;
+        case ICCP_TYPE:
+            return CHUNK_KIND_ICCP;
+        case SBIT_TYPE:
+            return CHUNK_KIND_SBIT;
+        case SRGB_TYPE:
+            return CHUNK_KIND_SRGB;
+        case TEXT_TYPE:
+            return CHUNK_KIND_TEXT;
+        case ZTXT_TYPE:
+            return CHUNK_KIND_ZTXT;
+        case ITXT_TYPE:
+            return CHUNK_KIND_ITXT;
+        case BKGD_TYPE:
+            return CHUNK_KIND_BKGD;
+        case HIST_TYPE:
+            return CHUNK_KIND_HIST;
+        case PHYS_TYPE:
+            return CHUNK_KIND_PHYS;
+        case SPLT_TYPE:
+            return CHUNK_KIND_SPLT;
+        case TIME_TYPE:
+            return CHUNK_KIND_TIME;
+        case ACTL_TYPE:
+            return CHUNK_KIND_ACTL;
+        case FCTL_TYPE:
+            return CHUNK_KIND_FCTL;
+        case FDAT_TYPE:
+            return CHUNK_KIND_FDAT;
+        default:
+            return CHUNK_KIND_UNKNOWN;
+    }
+}
+
+chunk_descriptor_t const *chunk_descriptor_of(chunk_kind_t kind)
+{
+    if (kind <= CHUNK_KIND_UNKNOWN || kind >= CHUNK_KIND_COUNT)
+    {
+        return NULL;
+    }
+    return &kDescriptors[kind];
+}
+
+#define CHUNK_KIND_BIT(kind) ((uint32_t)1 << (kind))
+
+status_t chunk_sequence_init(chunk_sequence_t *sequence)
+{
+    if (!sequence)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    sequence->seen = 0;
+    return STATUS_OK;
+}
+
+status_t chunk_sequence_add(chunk_sequence_t *sequence, chunk_kind_t kind)
+{
+    chunk_descriptor_t const *descriptor;
+    uint32_t seen, after_plte, i;
+
+    if (!sequence)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    seen = sequence->seen;
+    descriptor = chunk_descriptor_of(kind);
+    if (seen & CHUNK_KIND_BIT(CHUNK_KIND_IEND))
+    {
+        return STATUS_BAD_PACKET;
+    }
+    if (!descriptor)
+    {
+        return (seen & CHUNK_KIND_BIT(CHUNK_KIND_IHDR)) ?
+            STATUS_OK : STATUS_BAD_PACKET;
+    }
+    if (!descriptor->multiple && (seen & CHUNK_KIND_BIT(kind)))
+    {
+        return STATUS_BAD_PACKET;
+    }
+    if (descriptor->order == CHUNK_ORDER_FIRST ?
+        seen != 0 : !(seen & CHUNK_KIND_BIT(CHUNK_KIND_IHDR)))
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    switch (descriptor->order)
+    {
+        case CHUNK_ORDER_BEFORE_PLTE:
+            if (seen & (CHUNK_KIND_BIT(CHUNK_KIND_PLTE) |
+                        CHUNK_KIND_BIT(CHUNK_KIND_IDAT)))
+            {
+                return STATUS_BAD_PACKET;
+            }
+            break;
+        case CHUNK_ORDER_AFTER_PLTE:
+        case CHUNK_ORDER_BEFORE_IDAT:
+            if (seen & CHUNK_KIND_BIT(CHUNK_KIND_IDAT))
+            {
+                return STATUS_BAD_PACKET;
+            }
+            break;
+        case CHUNK_ORDER_AFTER_IDAT:
+            if (!(seen & CHUNK_KIND_BIT(CHUNK_KIND_IDAT)))
+            {
+                return STATUS_BAD_PACKET;
+            }
+            break;
+        default:
+            break;
+    }
+
+    /* Chunks that must follow PLTE, if any, cannot have come first. */
+    if (kind == CHUNK_KIND_PLTE)
+    {
+        after_plte = 0;
+        for (i = 0; i < CHUNK_KIND_COUNT; i++)
+        {
+            if (kDescriptors[i].order == CHUNK_ORDER_AFTER_PLTE)
+            {
+                after_plte |= CHUNK_KIND_BIT(i);
+            }
+        }
+        if (seen & after_plte)
+        {
+            return STATUS_BAD_PACKET;
+        }
+    }
+
+    sequence->seen = seen | CHUNK_KIND_BIT(kind);
+    return STATUS_OK;
+}
+
+status_t chunk_registry_init(chunk_registry_t *registry)
+{
+    if (!registry)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(registry, 0, sizeof(chunk_registry_t));
+    return STATUS_OK;
+}
+
+/*
+ * Finds the slot holding `type`, or the empty slot where it would be
+ * added.  The registry is never more than half full, so there always
+ * is one.
+ */
+static uint32_t registry_find(chunk_registry_t const *registry, uint32_t type)
+{
+    uint32_t slot;
+
+    slot = (type * kHashMultiplier) >> (32 - kSlotBits);
+    while (registry->types[slot] != 0 && registry->types[slot] != type)
+    {
+        slot = (slot + 1) & (CHUNK_REGISTRY_SLOTS - 1);
+    }
+    return slot;
+}
+
+status_t chunk_registry_add(
+    chunk_registry_t *registry, uint32_t type, chunk_handler_t handler,
+    void *context)
+{
+    uint32_t slot;
+
+    if (!registry || !handler)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    if (!chunk_type_is_valid(type))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    slot = registry_find(registry, type);
+    if (registry->types[slot] == 0)
+    {
+        if (registry->count >= CHUNK_REGISTRY_SLOTS / 2)
+        {
+            return STATUS_FAILURE;
+        }
+        registry->types[slot] = type;
+        registry->count++;
+    }
+    registry->handlers[slot] = handler;
+    registry->contexts[slot] = context;
+    return STATUS_OK;
+}
+
+status_t chunk_registry_dispatch(
+    chunk_registry_t const *registry, chunk_t const *chunk,
+    bool_t *handled)
+{
+    uint32_t slot;
+
+    if (!chunk || !handled)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    *handled = false;
+    if (!registry || registry->count == 0 || chunk->type == 0)
+    {
+        return STATUS_OK;
+    }
+    slot = registry_find(registry, chunk->type);
+    if (registry->types[slot] == 0)
+    {
+        return STATUS_OK;
+    }
+    *handled = true;
+    return registry->handlers[slot](registry->contexts[slot], chunk);
+}
@@ -0,0 +1,184 @@
+/*
+ *  Image-Formats - PNG Chunk Registry
+ *      Maps chunk types to the chunks known to the library, and to
+ *      handlers registered for other chunks.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include "anichunk.h"
+#include "base.h"
+#include "chunk.h"
+#include "clrchunk.h"
+#include "imgchunk.h"
+#include "txtchunk.h"
+
+/* Other ancillary chunk types of RFC2083. */
+#define ICCP_TYPE 0x69434350u
+#define SBIT_TYPE 0x73424954u
+#define BKGD_TYPE 0x624b4744u
+#define HIST_TYPE 0x68495354u
+#define PHYS_TYPE 0x70485973u
+#define SPLT_TYPE 0x73504c54u
+#define TIME_TYPE 0x74494d45u
+
+/* Chunks known to the library. */
+typedef enum {
+    CHUNK_KIND_UNKNOWN,
+    CHUNK_KIND_IHDR,
+    CHUNK_KIND_PLTE,
+    CHUNK_KIND_IDAT,
+    CHUNK_KIND_IEND,
+    CHUNK_KIND_TRNS,
+    CHUNK_KIND_CHRM,
+    CHUNK_KIND_GAMA,
+    CHUNK_KIND_ICCP,
+    CHUNK_KIND_SBIT,
+    CHUNK_KIND_SRGB,
+    CHUNK_KIND_TEXT,
+    CHUNK_KIND_ZTXT,
+    CHUNK_KIND_ITXT,
+    CHUNK_KIND_BKGD,
+    CHUNK_KIND_HIST,
+    CHUNK_KIND_PHYS,
+    CHUNK_KIND_SPLT,
+    CHUNK_KIND_TIME,
+    CHUNK_KIND_ACTL,
+    CHUNK_KIND_FCTL,
+    CHUNK_KIND_FDAT,
+    CHUNK_KIND_COUNT
+} chunk_kind_t;
+
+/* Part of the datastream a chunk must appear in (RFC2083 4.3). */
+typedef enum {
+    CHUNK_ORDER_ANY,
+    CHUNK_ORDER_FIRST,
+    /* Before PLTE and IDAT. */
+    CHUNK_ORDER_BEFORE_PLTE,
+    /* After PLTE, if any, and before IDAT. */
+    CHUNK_ORDER_AFTER_PLTE,
+    CHUNK_ORDER_BEFORE_IDAT,
+    CHUNK_ORDER_AFTER_IDAT,
+    CHUNK_ORDER_LAST
+} chunk_order_t;
+
+typedef struct {
+    uint32_t type;
+    char_t const *name;
+    chunk_order_t order;
+    /* May appear more than once in a datastream. */
+    bool_t multiple;
+} chunk_descriptor_t;
+
+/*
+ * Function: chunk_kind_of
+ *  Determines which known chunk a type is, with a single switch on the
+ *  type.
+ * Return:
+ *    The kind of the chunk, or CHUNK_KIND_UNKNOWN.
+ */
+chunk_kind_t chunk_kind_of(uint32_t type);
+
+/*
+ * Function: chunk_descriptor_of
+ *  Returns the descriptor of a known chunk, or NULL for
+ *  CHUNK_KIND_UNKNOWN and out of range kinds.
+ */
+chunk_descriptor_t const *chunk_descriptor_of(chunk_kind_t kind);
+
+/* Known chunks seen so far in a datastream. */
+typedef struct {
+    /* Bit `1 << kind` is set once a chunk of that kind was seen. */
+    uint32_t seen;
+} chunk_sequence_t;
+
+/*
+ * Function: chunk_sequence_init
+ *  Initializes a sequence without any chunk, before IHDR.
+ */
+status_t chunk_sequence_init(chunk_sequence_t *sequence);
+
+/*
+ * Function: chunk_sequence_add
+ *  Checks the next chunk of a datastream against the order and
+ *  multiplicity of its descriptor, then records it.  Unknown chunks
+ *  may appear anywhere between IHDR and IEND.
+ * Args:
+ *    sequence - Pointer to the sequence of the chunks before it.
+ *    kind - Kind of the chunk.
+ * Return:
+ *    OK if the chunk may appear at this point.
+ *    NULL_ARG if `sequence` is NULL.
+ *    BAD_PACKET if it is out of order or one too many, in which case
+ *      it is not recorded.
+ */
+status_t chunk_sequence_add(chunk_sequence_t *sequence, chunk_kind_t kind);
+
+/*
+ * Type: chunk_handler_t
+ *  Receives a chunk of a registered type.  The chunk data is only
+ *  valid during the call.  Any status other than OK stops the reader
+ *  with that status.
+ */
+typedef status_t (*chunk_handler_t)(void *context, chunk_t const *chunk);
+
+/* Number of slots of a registry, which holds at most half as many. */
+#define CHUNK_REGISTRY_SLOTS 64
+
+/*
+ * Handlers of chunk types, such as private chunks, in an open
+ * addressing hash table.  A type of 0, which is never valid, marks an
+ * empty slot.
+ */
+typedef struct {
+    uint32_t types[CHUNK_REGISTRY_SLOTS];
+    chunk_handler_t handlers[CHUNK_REGISTRY_SLOTS];
+    void *contexts[CHUNK_REGISTRY_SLOTS];
+    uint32_t count;
+} chunk_registry_t;
+
+/*
+ * Function: chunk_registry_init
+ *  Initializes an empty registry.  No memory is allocated.
+ */
+status_t chunk_registry_init(chunk_registry_t *registry);
+
+/*
+ * Function: chunk_registry_add
+ *  Registers the handler of a chunk type, replacing any previous one.
+ * Args:
+ *    registry - Pointer to an initialized registry.
+ *    type - Host-order chunk type.
+ *    handler - Function receiving the chunks of `type`.
+ *    context - Passed to `handler` as is.
+ * Return:
+ *    OK if the handler was registered.
+ *    NULL_ARG if `registry` or `handler` is NULL.
+ *    ILLEGAL_ARG if `type` is not a valid chunk type.
+ *    FAILURE if the registry is full.
+ */
+status_t chunk_registry_add(
+    chunk_registry_t *registry, uint32_t type, chunk_handler_t handler,
+    void *context);
+
+/*
+ * Function: chunk_registry_dispatch
+ *  Hands a chunk to the handler registered for its type.
+ * Args:
+ *    registry - Pointer to an initialized registry.  NULL is treated
+ *               as an empty registry.
+ *    chunk - Chunk to dispatch.
+ *    handled - Set to `true` if a handler received the chunk.
+ * Return:
+ *    OK if there was no handler or the handler returned OK.
+ *    NULL_ARG if `chunk` or `handled` is NULL.
+ *    Otherwise the status returned by the handler.
+ */
+status_t chunk_registry_dispatch(
+    chunk_registry_t const *registry, chunk_t const *chunk,
+    bool_t *handled);
+
+#endif /* _REGISTRY_H_ */
@@ -0,0 +1,133 @@
+/*
+ *  Image-Formats - PNG Text Chunks
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <string.h>
+
+#include "txtchunk.h"
+
+/* Only compression method of zTXt and iTXt, zlib deflate. */
+static uint8_t const kCompressionDeflate = 0;
+
+bool_t chunk_is_text(chunk_t const *chunk)
+{
+    return chunk &&
+        (chunk->type == TEXT_TYPE || chunk->type == ZTXT_TYPE ||
+         chunk->type == ITXT_TYPE);
+}
+
+/*
+ * Reads a NUL terminated field starting at `*offset`, advancing past
+ * its terminator.
+ */
+static bool_t read_field(
+    uint8_t const *data, uint32_t length, uint32_t *offset,
+    char_t const **field, uint32_t *field_length)
+{
+    uint8_t const *end;
+
+    end = (uint8_t const *)memchr(data + *offset, 0, length - *offset);
+    if (!end)
+    {
+        return false;
+    }
+    *field = (char_t const *)(data + *offset);
+    *field_length = (uint32_t)(end - (data + *offset));
+    *offset += *field_length + 1;
+    return true;
+}
+
+status_t text_view_from_chunk(chunk_t const *chunk, text_view_t *view)
+{
+    uint8_t const *data;
+    uint32_t length, offset;
+
+    if (!chunk || !view)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    if (!chunk_is_text(chunk))
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    memset(view, 0, sizeof(text_view_t));
+    view->type = chunk->type;
+    data = chunk->data;
+    length = chunk->length;
+    offset = 0;
+    if (length == 0 || !data ||
+        !read_field(data, length, &offset, &view->keyword,
+                    &view->keyword_length) ||
+        view->keyword_length == 0 ||
+        view->keyword_length > TEXT_KEYWORD_MAX)
+    {
+        return STATUS_BAD_PACKET;
+    }
+
+    if (chunk->type == ZTXT_TYPE)
+    {
+        if (offset >= length || data[offset] != kCompressionDeflate)
+        {
+            return STATUS_BAD_PACKET;
+        }
+        view->compressed = true;
+        offset++;
+    }
+    else if (chunk->type == ITXT_TYPE)
+    {
+        /* Compression flag and method. */
+        if (length - offset < 2 || data[offset] > 1 ||
+            data[offset + 1] != kCompressionDeflate)
+        {
+            return STATUS_BAD_PACKET;
+        }
+        view->compressed = data[offset] == 1;
+        view->utf8 = true;
+        offset += 2;
+        if (!read_field(data, length, &offset, &view->language,
+                        &view->language_length) ||
+            !read_field(data, length, &offset, &view->translated,
+                        &view->translated_length))
+        {
+            return STATUS_BAD_PACKET;
+        }
+    }
+
+    view->text = data + offset;
+    view->text_length = length - offset;
+    return STATUS_OK;
+}
+
+bool_t text_keyword_equals(text_view_t const *view, char_t const *keyword)
+{
+    if (!view || !keyword)
+    {
+        return false;
+    }
+    return strlen(keyword) == view->keyword_length &&
+        memcmp(view->keyword, keyword, view->keyword_length) == 0;
+}
+
+size_t text_latin1_to_utf8(
+    uint8_t const *inbuf, size_t inlen, uint8_t *outbuf)
+{
+    size_t i, count;
+
+    count = 0;
+    for (i = 0; i < inlen; i++)
+    {
+        if (inbuf[i] < 0x80)
+        {
+            outbuf[count++] = inbuf[i];
+        }
+        else
+        {
+            outbuf[count++] = (uint8_t)(0xc0 | (inbuf[i] >> 6));
+            outbuf[count++] = (uint8_t)(0x80 | (inbuf[i] & 0x3f));
+        }
+    }
+    return count;
+}
@@ -0,0 +1,85 @@
+/*
+ *  Image-Formats - PNG Text Chunks
+ *      tEXt, zTXt and iTXt chunks.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _TXTCHUNK_H_
+#define _TXTCHUNK_H_
+
+#include "base.h"
+#include "chunk.h"
+
+/* Numeric value of "tEXt" in ASCII. */
+#define TEXT_TYPE 0x74455874u
+/* Numeric value of "zTXt" in ASCII. */
+#define ZTXT_TYPE 0x7a545874u
+/* Numeric value of "iTXt" in ASCII. */
+#define ITXT_TYPE 0x69545874u
+
+/* Longest keyword allowed, without its terminator. */
+#define TEXT_KEYWORD_MAX 79
+
+/*
+ * Fields of a text chunk, pointing into the chunk data.  None of the
+ * strings are NUL terminated.
+ */
+typedef struct {
+    uint32_t type;
+    /* Latin-1 keyword of 1 to TEXT_KEYWORD_MAX bytes. */
+    char_t const *keyword;
+    uint32_t keyword_length;
+    /* iTXt language tag and translated keyword, empty otherwise. */
+    char_t const *language;
+    uint32_t language_length;
+    char_t const *translated;
+    uint32_t translated_length;
+    /* Whether `text` is a zlib datastream. */
+    bool_t compressed;
+    /* Whether the text is UTF-8 (iTXt) rather than Latin-1. */
+    bool_t utf8;
+    uint8_t const *text;
+    uint32_t text_length;
+} text_view_t;
+
+/*
+ * Function: chunk_is_text
+ *  Determines if the provided chunk is a tEXt, zTXt or iTXt chunk.
+ */
+bool_t chunk_is_text(chunk_t const *chunk);
+
+/*
+ * Function: text_view_from_chunk
+ *  Splits the data of a text chunk into its fields without copying or
+ *  decompressing anything.
+ * Args:
+ *    chunk - Pointer to a text chunk.
+ *    view - Pointer to a view, valid as long as the chunk data.
+ * Return:
+ *    OK if the chunk is well formed.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is not a text chunk.
+ *    BAD_PACKET if a field is missing, the keyword is too short or
+ *      too long, or the compression method is unknown.
+ */
+status_t text_view_from_chunk(chunk_t const *chunk, text_view_t *view);
+
+/*
+ * Function: text_keyword_equals
+ *  Determines if the keyword of a view is the NUL terminated
+ *  `keyword`.
+ */
+bool_t text_keyword_equals(text_view_t const *view, char_t const *keyword);
+
+/*
+ * Function: text_latin1_to_utf8
+ *  Converts Latin-1 text to UTF-8.  `outbuf` must hold `2 * inlen`
+ *  bytes, the worst case.
+ * Return:
+ *    Number of bytes written to `outbuf`.
+ */
+size_t text_latin1_to_utf8(
+    uint8_t const *inbuf, size_t inlen, uint8_t *outbuf);
+
+#endif /* _TXTCHUNK_H_ */
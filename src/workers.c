@@ -0,0 +1,112 @@
+/*
+ *  Image-Formats - Workers
+ *      Runs independent tasks on a set of threads.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <string.h>
+
+#include "workers.h"
+
+static bool_t claim_task(workers_t *workers, uint32_t *index)
+{
+    bool_t claimed;
+
+    pthread_mutex_lock(&workers->lock);
+    claimed = workers->next_task < workers->task_count;
+    if (claimed)
+    {
+        *index = workers->next_task++;
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return claimed;
+}
+
+static void *worker_main(void *arg)
+{
+    workers_t *workers;
+    uint32_t index;
+
+    workers = (workers_t *)arg;
+    while (claim_task(workers, &index))
+    {
+        workers->task(workers->context, index);
+    }
+    return NULL;
+}
+
+status_t workers_start(
+    uint32_t threads, uint32_t tasks, worker_task_t task, void *context,
+    workers_t *workers)
+{
+    uint32_t i;
+
+    if (!task || !workers)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    memset(workers, 0, sizeof(workers_t));
+    workers->task = task;
+    workers->context = context;
+    workers->task_count = tasks;
+    if (pthread_mutex_init(&workers->lock, NULL) != 0)
+    {
+        return STATUS_FAILURE;
+    }
+
+    if (threads > WORKERS_MAX_THREADS)
+    {
+        threads = WORKERS_MAX_THREADS;
+    }
+    for (i = 0; i < threads; i++)
+    {
+        if (pthread_create(
+                &workers->threads[i], NULL, worker_main, workers) != 0)
+        {
+            /* Fewer threads, or the caller when joining, take over. */
+            break;
+        }
+        workers->thread_count++;
+    }
+    return STATUS_OK;
+}
+
+status_t workers_join(workers_t *workers)
+{
+    uint32_t i;
+
+    if (!workers)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (workers->thread_count == 0)
+    {
+        /* No threads, run what is left on the calling thread. */
+        worker_main(workers);
+    }
+    for (i = 0; i < workers->thread_count; i++)
+    {
+        pthread_join(workers->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&workers->lock);
+    workers->thread_count = 0;
+    return STATUS_OK;
+}
+
+status_t workers_run(
+    uint32_t threads, uint32_t tasks, worker_task_t task, void *context)
+{
+    workers_t workers;
+    status_t status;
+
+    status = workers_start(
+        threads > 1 ? threads : 0, tasks, task, context, &workers);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    return workers_join(&workers);
+}
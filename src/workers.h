@@ -0,0 +1,72 @@
+/*
+ *  Image-Formats - Workers
+ *      Runs independent tasks on a set of threads.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _WORKERS_H_
+#define _WORKERS_H_
+
+#include <pthread.h>
+
+#include "base.h"
+
+/* Upper limit on the number of threads started at once. */
+#define WORKERS_MAX_THREADS 64
+
+/*
+ * Type: worker_task_t
+ *  A task to be run by a worker thread.  `index` identifies the task
+ *  and ranges from 0 to the task count - 1.
+ */
+typedef void (*worker_task_t)(void *context, uint32_t index);
+
+typedef struct {
+    pthread_t threads[WORKERS_MAX_THREADS];
+    uint32_t thread_count;
+    worker_task_t task;
+    void *context;
+    uint32_t task_count;
+    /* Index of the next task to be claimed, protected by `lock`. */
+    uint32_t next_task;
+    pthread_mutex_t lock;
+} workers_t;
+
+/*
+ * Function: workers_start
+ *  Starts threads that run `task` for every index below `tasks`.
+ *  Tasks are claimed in increasing index order.
+ * Args:
+ *    threads - Number of threads, clamped to WORKERS_MAX_THREADS.  If
+ *              0, every task is run by `workers_join()` instead.
+ *    tasks - Number of tasks.
+ *    task - Task function.
+ *    context - Opaque pointer handed to `task`.
+ *    workers - Pointer to an uninitialized workers struct.
+ * Return:
+ *    OK if the threads were started.
+ *    NULL_ARG if `task` or `workers` are NULL.
+ *    FAILURE if the workers could not be initialized.  Threads that
+ *      fail to start are not reported, the remaining ones (or
+ *      `workers_join()`) run their tasks.
+ */
+status_t workers_start(
+    uint32_t threads, uint32_t tasks, worker_task_t task, void *context,
+    workers_t *workers);
+
+/*
+ * Function: workers_join
+ *  Waits until every task of started workers completed.
+ */
+status_t workers_join(workers_t *workers);
+
+/*
+ * Function: workers_run
+ *  Runs every task on `threads` threads and waits for them.  Runs on
+ *  the calling thread if `threads` is at most 1.
+ */
+status_t workers_run(
+    uint32_t threads, uint32_t tasks, worker_task_t task, void *context);
+
+#endif /* _WORKERS_H_ */
@@ -0,0 +1,421 @@
+/*
+ *  Image-Formats - Writer
+ *      Buffered output of PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <arpa/inet.h>  /* htonl */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>    /* writev */
+
+#include "engine.h"
+
+#include "writer.h"
+
+/* Size of the buffer used to coalesce small chunks. */
+static size_t const kStagingSize = 64 * 1024;
+/* Chunks up to this serialized size are always staged. */
+static size_t const kCoalesceLimit = 16 * 1024;
+/* Length, type and CRC fields of a chunk. */
+static size_t const kChunkOverhead = sizeof(uint32_t) * 3;
+/* Smallest allocation of a memory sink. */
+static size_t const kMemoryMinimum = 64 * 1024;
+
+static status_t writer_init(writer_sink_t sink, writer_t *writer)
+{
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    memset(writer, 0, sizeof(writer_t));
+    writer->sink = sink;
+    writer->fd = -1;
+    return STATUS_OK;
+}
+
+status_t writer_init_memory(writer_t *writer)
+{
+    return writer_init(WRITER_SINK_MEMORY, writer);
+}
+
+status_t writer_init_fd(int fd, writer_t *writer)
+{
+    status_t status;
+
+    if (fd < 0)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+    status = writer_init(WRITER_SINK_FD, writer);
+    if (status == STATUS_OK)
+    {
+        writer->fd = fd;
+    }
+    return status;
+}
+
+status_t writer_init_callback(
+    writer_callback_t callback, void *context, writer_t *writer)
+{
+    status_t status;
+
+    if (!callback)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    status = writer_init(WRITER_SINK_CALLBACK, writer);
+    if (status == STATUS_OK)
+    {
+        writer->callback = callback;
+        writer->context = context;
+    }
+    return status;
+}
+
+/* Writes every buffer to a file descriptor, resuming partial writes. */
+static status_t emit_fd(writer_t *writer, struct iovec *iov, int count)
+{
+    ssize_t written;
+    size_t done;
+
+    while (count > 0)
+    {
+        written = writev(writer->fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return STATUS_FAILURE;
+        }
+
+        done = (size_t)written;
+        while (count > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Appends every buffer to the memory sink. */
+static status_t emit_memory(writer_t *writer, struct iovec *iov, int count)
+{
+    size_t needed, capacity;
+    uint8_t *memory;
+    int i;
+
+    needed = writer->memory_length;
+    for (i = 0; i < count; i++)
+    {
+        needed += iov[i].iov_len;
+    }
+
+    if (needed > writer->memory_capacity)
+    {
+        capacity = writer->memory_capacity * 2;
+        if (capacity < kMemoryMinimum)
+        {
+            capacity = kMemoryMinimum;
+        }
+        if (capacity < needed)
+        {
+            capacity = needed;
+        }
+        memory = (uint8_t *)realloc(writer->memory, capacity);
+        if (!memory)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+        writer->memory = memory;
+        writer->memory_capacity = capacity;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(writer->memory + writer->memory_length,
+               iov[i].iov_base, iov[i].iov_len);
+        writer->memory_length += iov[i].iov_len;
+    }
+    return STATUS_OK;
+}
+
+/* Hands every non-empty buffer to the callback. */
+static status_t emit_callback(writer_t *writer, struct iovec *iov, int count)
+{
+    status_t status;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (iov[i].iov_len == 0)
+        {
+            continue;
+        }
+        status = writer->callback(
+            writer->context, iov[i].iov_base, iov[i].iov_len);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return STATUS_OK;
+}
+
+/* Sends a list of buffers to the sink, in order. */
+static status_t writer_emit(writer_t *writer, struct iovec *iov, int count)
+{
+    switch (writer->sink)
+    {
+        case WRITER_SINK_FD:
+            return emit_fd(writer, iov, count);
+        case WRITER_SINK_MEMORY:
+            return emit_memory(writer, iov, count);
+        case WRITER_SINK_CALLBACK:
+            return emit_callback(writer, iov, count);
+        default:
+            return STATUS_ILLEGAL_ARGUMENT;
+    }
+}
+
+static status_t writer_reserve_staging(writer_t *writer)
+{
+    if (!writer->staging)
+    {
+        writer->staging = (uint8_t *)engine_allocate(kStagingSize);
+        if (!writer->staging)
+        {
+            return STATUS_OUT_OF_MEMORY;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_t writer_flush(writer_t *writer)
+{
+    struct iovec iov;
+    status_t status;
+
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (writer->staged == 0)
+    {
+        return STATUS_OK;
+    }
+
+    iov.iov_base = writer->staging;
+    iov.iov_len = writer->staged;
+    status = writer_emit(writer, &iov, 1);
+    if (status == STATUS_OK)
+    {
+        writer->staged = 0;
+    }
+    return status;
+}
+
+status_t writer_write_signature(writer_t *writer)
+{
+    size_t length;
+    status_t status;
+
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    status = writer_reserve_staging(writer);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    if (kStagingSize - writer->staged < PNG_SIGNATURE_SIZE)
+    {
+        status = writer_flush(writer);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    length = kStagingSize - writer->staged;
+    status = png_signature_serialize(writer->staging + writer->staged, &length);
+    if (status == STATUS_OK)
+    {
+        writer->staged += length;
+        writer->total += length;
+    }
+    return status;
+}
+
+/* Sends staged bytes and a large chunk with a single vectored write. */
+static status_t writer_write_direct(writer_t *writer, chunk_t const *chunk)
+{
+    uint8_t header[sizeof(uint32_t) * 2], trailer[sizeof(uint32_t)];
+    uint32_t nvalue, crc;
+    struct iovec iov[4];
+    status_t status;
+
+    status = chunk_calculate_crc(chunk, &crc);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    nvalue = htonl(chunk->length);
+    memcpy(header, &nvalue, sizeof(uint32_t));
+    nvalue = htonl(chunk->type);
+    memcpy(header + sizeof(uint32_t), &nvalue, sizeof(uint32_t));
+    nvalue = htonl(crc);
+    memcpy(trailer, &nvalue, sizeof(uint32_t));
+
+    iov[0].iov_base = writer->staging;
+    iov[0].iov_len = writer->staged;
+    iov[1].iov_base = header;
+    iov[1].iov_len = sizeof(header);
+    iov[2].iov_base = chunk->data;
+    iov[2].iov_len = chunk->length;
+    iov[3].iov_base = trailer;
+    iov[3].iov_len = sizeof(trailer);
+
+    status = writer_emit(writer, iov, 4);
+    if (status == STATUS_OK)
+    {
+        writer->staged = 0;
+    }
+    return status;
+}
+
+status_t writer_write_chunk(writer_t *writer, chunk_t const *chunk)
+{
+    size_t serlength, length;
+    status_t status;
+
+    if (!writer || !chunk)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (chunk->length > 0 && !chunk->data)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    status = writer_reserve_staging(writer);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+
+    serlength = (size_t)chunk->length + kChunkOverhead;
+    if (serlength > kStagingSize - writer->staged)
+    {
+        if (serlength > kCoalesceLimit)
+        {
+            status = writer_write_direct(writer, chunk);
+            if (status == STATUS_OK)
+            {
+                writer->total += serlength;
+            }
+            return status;
+        }
+
+        status = writer_flush(writer);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+    }
+
+    length = kStagingSize - writer->staged;
+    status = chunk_serialize(chunk, writer->staging + writer->staged, &length);
+    if (status == STATUS_OK)
+    {
+        writer->staged += length;
+        writer->total += length;
+    }
+    return status;
+}
+
+status_t writer_write_data(
+    writer_t *writer, uint32_t type, uint8_t const *data, uint32_t length)
+{
+    chunk_t chunk;
+    status_t status;
+
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    /* The chunk only borrows the data and is never modified. */
+    status = chunk_create(type, (uint8_t *)data, length, &chunk);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    return writer_write_chunk(writer, &chunk);
+}
+
+status_t writer_get_memory(
+    writer_t *writer, uint8_t const **outbuf, size_t *outlen)
+{
+    status_t status;
+
+    if (!writer || !outbuf || !outlen)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+
+    if (writer->sink != WRITER_SINK_MEMORY)
+    {
+        return STATUS_ILLEGAL_ARGUMENT;
+    }
+
+    status = writer_flush(writer);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    *outbuf = writer->memory;
+    *outlen = writer->memory_length;
+    return STATUS_OK;
+}
+
+status_t writer_reset(writer_t *writer)
+{
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    writer->staged = 0;
+    writer->memory_length = 0;
+    writer->total = 0;
+    return STATUS_OK;
+}
+
+status_t writer_free(writer_t *writer)
+{
+    if (!writer)
+    {
+        return STATUS_NULL_ARGUMENT;
+    }
+    free(writer->staging);
+    free(writer->memory);
+    memset(writer, 0, sizeof(writer_t));
+    writer->fd = -1;
+    return STATUS_OK;
+}
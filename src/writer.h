@@ -0,0 +1,128 @@
+/*
+ *  Image-Formats - Writer
+ *      Buffered output of PNG datastreams.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include "base.h"
+#include "chunk.h"
+
+/*
+ * Type: writer_callback_t
+ *  Consumes `length` bytes of output.  Anything other than OK aborts
+ *  the write and is returned to the caller.
+ */
+typedef status_t (*writer_callback_t)(
+    void *context, uint8_t const *data, size_t length);
+
+typedef enum {
+    WRITER_SINK_MEMORY,
+    WRITER_SINK_FD,
+    WRITER_SINK_CALLBACK
+} writer_sink_t;
+
+typedef struct {
+    writer_sink_t sink;
+    /* File descriptor sink. */
+    int fd;
+    /* Callback sink. */
+    writer_callback_t callback;
+    void *context;
+    /* Memory sink, grown as needed and kept across resets. */
+    uint8_t *memory;
+    size_t memory_length;
+    size_t memory_capacity;
+    /* Small chunks are coalesced here before reaching the sink. */
+    uint8_t *staging;
+    size_t staged;
+    /* Total number of bytes handed to the writer since the last reset. */
+    size_t total;
+} writer_t;
+
+/*
+ * Function: writer_init_memory
+ *  Initializes a writer that collects its output in a heap buffer.
+ */
+status_t writer_init_memory(writer_t *writer);
+
+/*
+ * Function: writer_init_fd
+ *  Initializes a writer that outputs to a file descriptor.  Large
+ *  chunks are written together with the staged data using a single
+ *  vectored write.  The descriptor is not closed by the writer.
+ */
+status_t writer_init_fd(int fd, writer_t *writer);
+
+/*
+ * Function: writer_init_callback
+ *  Initializes a writer that hands its output to `callback`.
+ */
+status_t writer_init_callback(
+    writer_callback_t callback, void *context, writer_t *writer);
+
+/*
+ * Function: writer_write_signature
+ *  Writes the PNG datastream signature.
+ */
+status_t writer_write_signature(writer_t *writer);
+
+/*
+ * Function: writer_write_chunk
+ *  Writes a serialized chunk.  Chunks that fit in the staging buffer
+ *  are copied there and reach the sink with the next flush.  Larger
+ *  chunks are sent straight from their data, after any staged bytes.
+ * Args:
+ *    writer - Pointer to an initialized writer.
+ *    chunk - Chunk to be written.
+ * Return:
+ *    OK if the chunk was written or staged.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the chunk is missing its data.
+ *    OUT_OF_MEM if a buffer could not be allocated.
+ *    FAILURE if the sink could not be written to.
+ */
+status_t writer_write_chunk(writer_t *writer, chunk_t const *chunk);
+
+/*
+ * Function: writer_write_data
+ *  Same as `writer_write_chunk()`, for data not held in a chunk.
+ */
+status_t writer_write_data(
+    writer_t *writer, uint32_t type, uint8_t const *data, uint32_t length);
+
+/*
+ * Function: writer_flush
+ *  Sends all staged bytes to the sink.
+ */
+status_t writer_flush(writer_t *writer);
+
+/*
+ * Function: writer_get_memory
+ *  Flushes a memory writer and returns its output.  The buffer stays
+ *  owned by the writer and is valid until the next write or reset.
+ * Return:
+ *    OK if the output was returned.
+ *    NULL_ARG if any of the arguments are NULL.
+ *    ILLEGAL_ARG if the writer does not use a memory sink.
+ */
+status_t writer_get_memory(
+    writer_t *writer, uint8_t const **outbuf, size_t *outlen);
+
+/*
+ * Function: writer_reset
+ *  Discards staged and collected output so that the writer can be
+ *  used for another datastream.  Buffers are kept for reuse.
+ */
+status_t writer_reset(writer_t *writer);
+
+/*
+ * Function: writer_free
+ *  Releases the buffers of a writer and clears it.
+ */
+status_t writer_free(writer_t *writer);
+
+#endif /* _WRITER_H_ */
@@ -0,0 +1,268 @@
+/*
+ *  Image-Formats - APNG Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "anichunk.h"
+#include "apngdec.h"
+#include "apngenc.h"
+#include "encoder.h"
+#include "writer.h"
+
+#include "fixture.h"
+#include "test.h"
+
+#define FRAME_COUNT 2
+
+typedef struct {
+    writer_t *writer;
+    uint32_t sequence;
+    /* Sequence number followed by a piece of the image data. */
+    uint8_t fdat[4 + 64 * 1024];
+} fdat_context_t;
+
+/* Writes every piece of the compressed frame as an fdAT chunk. */
+static status_t fdat_sink(void *context, uint8_t const *data, size_t length)
+{
+    fdat_context_t *ctx;
+
+    ctx = (fdat_context_t *)context;
+    ctx->fdat[0] = (uint8_t)(ctx->sequence >> 24);
+    ctx->fdat[1] = (uint8_t)(ctx->sequence >> 16);
+    ctx->fdat[2] = (uint8_t)(ctx->sequence >> 8);
+    ctx->fdat[3] = (uint8_t)ctx->sequence;
+    ctx->sequence++;
+    memcpy(ctx->fdat + 4, data, length);
+    return writer_write_data(
+        ctx->writer, FDAT_TYPE, ctx->fdat, (uint32_t)length + 4);
+}
+
+/* Writes a full canvas fcTL with the given sequence number. */
+static status_t write_fctl(
+    writer_t *writer, uint32_t sequence, uint32_t side, uint8_t dispose_op)
+{
+    fctl_t fctl;
+    uint8_t data[26];
+    uint32_t length;
+    status_t status;
+
+    memset(&fctl, 0, sizeof(fctl_t));
+    fctl.sequence_number = sequence;
+    fctl.width = side;
+    fctl.height = side;
+    fctl.delay_den = 100;
+    fctl.dispose_op = dispose_op;
+    fctl.blend_op = FCTL_BLEND_SOURCE;
+    length = sizeof(data);
+    status = fctl_serialize(&fctl, data, &length);
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, FCTL_TYPE, data, length);
+    }
+    return status;
+}
+
+/*
+ * Writes an animation of full canvas frames, disposing every frame to
+ * the previous content so that the decoder saves whole regions.
+ */
+static status_t write_animation(
+    uint8_t *const *frames, uint32_t side, writer_t *writer)
+{
+    static fdat_context_t fdat;
+    encoder_t encoder;
+    ihdr_t ihdr;
+    actl_t actl;
+    uint8_t data[13];
+    uint32_t i, length;
+    status_t status;
+
+    fixture_ihdr(side, side, 6, 0, &ihdr);
+    actl.num_frames = FRAME_COUNT;
+    actl.num_plays = 0;
+
+    status = encoder_init(NULL, &encoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    fdat.writer = writer;
+    fdat.sequence = 0;
+
+    status = writer_write_signature(writer);
+    length = sizeof(data);
+    if (status == STATUS_OK &&
+        (status = ihdr_serialize(&ihdr, data, &length)) == STATUS_OK)
+    {
+        status = writer_write_data(writer, IHDR_TYPE, data, length);
+    }
+    length = sizeof(data);
+    if (status == STATUS_OK &&
+        (status = actl_serialize(&actl, data, &length)) == STATUS_OK)
+    {
+        status = writer_write_data(writer, ACTL_TYPE, data, length);
+    }
+    for (i = 0; i < FRAME_COUNT && status == STATUS_OK; i++)
+    {
+        status = write_fctl(
+            writer, fdat.sequence++, side, FCTL_DISPOSE_PREVIOUS);
+        if (status != STATUS_OK)
+        {
+            break;
+        }
+        if (i == 0)
+        {
+            /* The default image is the first frame. */
+            status = encoder_compress(
+                &encoder, &ihdr, frames[i], fixture_idat_sink, writer);
+        }
+        else
+        {
+            status = encoder_compress(
+                &encoder, &ihdr, frames[i], fdat_sink, &fdat);
+        }
+    }
+    if (status == STATUS_OK)
+    {
+        status = writer_write_data(writer, IEND_TYPE, NULL, 0);
+    }
+    encoder_free(&encoder);
+    return status;
+}
+
+typedef struct {
+    uint8_t *const *frames;
+    size_t size;
+    uint32_t matched;
+} frames_context_t;
+
+static status_t check_frame(
+    void *context, uint32_t index, fctl_t const *fctl, uint8_t const *canvas)
+{
+    frames_context_t *ctx;
+
+    (void)fctl;
+    ctx = (frames_context_t *)context;
+    if (index < FRAME_COUNT &&
+        memcmp(canvas, ctx->frames[index], ctx->size) == 0)
+    {
+        ctx->matched++;
+    }
+    return STATUS_OK;
+}
+
+/* Allocates the frames of a large animation, each different. */
+static bool_t make_frames(uint8_t **frames)
+{
+    uint32_t i;
+    bool_t made;
+
+    made = true;
+    for (i = 0; i < FRAME_COUNT; i++)
+    {
+        frames[i] = fixture_pixels(
+            FIXTURE_LARGE_SIDE, FIXTURE_LARGE_SIDE, 4, i);
+        made = made && frames[i] != NULL;
+    }
+    return made;
+}
+
+static void free_frames(uint8_t **frames)
+{
+    uint32_t i;
+
+    for (i = 0; i < FRAME_COUNT; i++)
+    {
+        free(frames[i]);
+    }
+}
+
+/* Decodes a large animation on `threads` threads, counting the frames. */
+static uint32_t count_matching_frames(
+    writer_t *writer, uint8_t *const *frames, uint32_t threads)
+{
+    frames_context_t context;
+    apng_decoder_t apng;
+    uint8_t const *data;
+    uint8_t *canvas;
+    size_t length, size;
+
+    size = (size_t)FIXTURE_LARGE_SIDE * FIXTURE_LARGE_SIDE * 4;
+    canvas = (uint8_t *)malloc(size);
+    context.frames = frames;
+    context.size = size;
+    context.matched = 0;
+    writer_get_memory(writer, &data, &length);
+    if (canvas && apng_decoder_open(data, length, NULL, &apng) == STATUS_OK)
+    {
+        TEST_STATUS(apng_decoder_decode(&apng, threads, canvas, &size,
+                                        check_frame, &context), STATUS_OK);
+        apng_decoder_close(&apng);
+    }
+    free(canvas);
+    return context.matched;
+}
+
+/* Frames and saved regions larger than 4 MiB are decoded. */
+static void test_decode_large_frames(void)
+{
+    uint8_t *frames[FRAME_COUNT];
+    writer_t writer;
+
+    writer_init_memory(&writer);
+    TEST_CHECK(make_frames(frames));
+    if (frames[0] && frames[1])
+    {
+        TEST_STATUS(write_animation(frames, FIXTURE_LARGE_SIDE, &writer),
+                    STATUS_OK);
+        TEST_CHECK(count_matching_frames(&writer, frames, 2) == FRAME_COUNT);
+    }
+    writer_free(&writer);
+    free_frames(frames);
+}
+
+/* Frames larger than 4 MiB are encoded, up to the pixel limit. */
+static void test_encode_large_frames(void)
+{
+    apng_source_frame_t sources[FRAME_COUNT];
+    uint8_t *frames[FRAME_COUNT];
+    apng_encoder_t encoder;
+    writer_t writer;
+    uint32_t i, side;
+
+    side = FIXTURE_LARGE_SIDE;
+    writer_init_memory(&writer);
+    TEST_CHECK(make_frames(frames));
+    for (i = 0; i < FRAME_COUNT; i++)
+    {
+        sources[i].pixels = frames[i];
+        sources[i].delay_num = 1;
+        sources[i].delay_den = 10;
+    }
+    TEST_STATUS(apng_encoder_init(NULL, 2, &encoder), STATUS_OK);
+    if (frames[0] && frames[1])
+    {
+        TEST_STATUS(apng_encoder_encode(&encoder, side, side, 0, sources,
+                                        FRAME_COUNT, &writer), STATUS_OK);
+        TEST_CHECK(count_matching_frames(&writer, frames, 1) == FRAME_COUNT);
+
+        encoder.max_pixels = (uint64_t)side * side - 1;
+        TEST_STATUS(apng_encoder_encode(&encoder, side, side, 0, sources,
+                                        FRAME_COUNT, &writer),
+                    STATUS_LIMIT_EXCEEDED);
+    }
+    apng_encoder_free(&encoder);
+    writer_free(&writer);
+    free_frames(frames);
+}
+
+int main(void)
+{
+    test_decode_large_frames();
+    test_encode_large_frames();
+    return TEST_EXIT("apng_test");
+}
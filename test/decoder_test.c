@@ -0,0 +1,279 @@
+/*
+ *  Image-Formats - Decoder Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "encoder.h"
+#include "writer.h"
+
+#include "fixture.h"
+#include "test.h"
+
+/* Decodes a thumbnail of an encoded image. */
+static status_t thumbnail(
+    writer_t *writer, uint32_t width, uint32_t height, uint8_t *out)
+{
+    decoder_t decoder;
+    uint8_t const *data;
+    size_t length, outlen;
+    status_t status;
+
+    writer_get_memory(writer, &data, &length);
+    status = decoder_open(data, length, NULL, &decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    outlen = (size_t)width * height * 4;
+    status = decoder_decode_thumbnail(&decoder, width, height, out, &outlen);
+    decoder_close(&decoder);
+    return status;
+}
+
+/*
+ * Interlaced thumbnails whose sums exceed 4 MiB are decoded in bands
+ * and match the thumbnail of the same image not interlaced.
+ */
+static void test_interlaced_thumbnail(void)
+{
+    static uint32_t const kWidth = 2048, kHeight = 600;
+    static uint32_t const kThumbWidth = 1024, kThumbHeight = 300;
+    writer_t plain, interlaced;
+    ihdr_t ihdr;
+    uint8_t *pixels, *expected, *actual;
+    size_t size;
+
+    pixels = fixture_pixels(kWidth, kHeight, 4, 0);
+    size = (size_t)kThumbWidth * kThumbHeight * 4;
+    expected = (uint8_t *)malloc(size);
+    actual = (uint8_t *)malloc(size);
+    TEST_CHECK(pixels && expected && actual);
+    if (!pixels || !expected || !actual)
+    {
+        free(pixels);
+        free(expected);
+        free(actual);
+        return;
+    }
+    /* Sums of all thumbnail rows: 1024 * 300 * 32 bytes. */
+    TEST_CHECK((size_t)kThumbWidth * kThumbHeight * 32 > kMallocLimit);
+
+    writer_init_memory(&plain);
+    writer_init_memory(&interlaced);
+    fixture_ihdr(kWidth, kHeight, 6, 0, &ihdr);
+    TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &plain), STATUS_OK);
+    fixture_ihdr(kWidth, kHeight, 6, 1, &ihdr);
+    TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &interlaced), STATUS_OK);
+    TEST_STATUS(thumbnail(&plain, kThumbWidth, kThumbHeight, expected),
+                STATUS_OK);
+    TEST_STATUS(thumbnail(&interlaced, kThumbWidth, kThumbHeight, actual),
+                STATUS_OK);
+    TEST_CHECK(memcmp(expected, actual, size) == 0);
+
+    writer_free(&plain);
+    writer_free(&interlaced);
+    free(pixels);
+    free(expected);
+    free(actual);
+}
+
+/* Decodes an encoded image into YUV420 planes. */
+static status_t yuv420(writer_t *writer, uint8_t *out, size_t size)
+{
+    decoder_t decoder;
+    uint8_t const *data;
+    size_t length;
+    status_t status;
+
+    writer_get_memory(writer, &data, &length);
+    status = decoder_open(data, length, NULL, &decoder);
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = decoder_decode_pixels(
+        &decoder, PIXEL_FORMAT_YUV420, 1, out, &size);
+    decoder_close(&decoder);
+    return status;
+}
+
+/*
+ * Interlaced YUV420 images whose chroma sums exceed 4 MiB are decoded
+ * in bands and match the same image not interlaced.  The odd height
+ * leaves a last chroma row of a single image row.
+ */
+static void test_interlaced_yuv420(void)
+{
+    static uint32_t const kWidth = 2560, kHeight = 1441;
+    writer_t plain, interlaced;
+    ihdr_t ihdr;
+    uint8_t *pixels, *expected, *actual;
+    uint64_t size;
+
+    TEST_STATUS(pixconv_format_size(
+                    PIXEL_FORMAT_YUV420, kWidth, kHeight, &size),
+                STATUS_OK);
+    pixels = fixture_pixels(kWidth, kHeight, 3, 0);
+    expected = (uint8_t *)malloc((size_t)size);
+    actual = (uint8_t *)malloc((size_t)size);
+    TEST_CHECK(pixels && expected && actual);
+    if (!pixels || !expected || !actual)
+    {
+        free(pixels);
+        free(expected);
+        free(actual);
+        return;
+    }
+    /* Sums of all chroma rows: 1280 * 721 * 6 bytes. */
+    TEST_CHECK((size_t)(kWidth / 2) * (kHeight / 2 + 1) * 6 > kMallocLimit);
+
+    writer_init_memory(&plain);
+    writer_init_memory(&interlaced);
+    fixture_ihdr(kWidth, kHeight, 2, 0, &ihdr);
+    TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &plain), STATUS_OK);
+    fixture_ihdr(kWidth, kHeight, 2, 1, &ihdr);
+    TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &interlaced), STATUS_OK);
+    TEST_STATUS(yuv420(&plain, expected, (size_t)size), STATUS_OK);
+    TEST_STATUS(yuv420(&interlaced, actual, (size_t)size), STATUS_OK);
+    TEST_CHECK(memcmp(expected, actual, (size_t)size) == 0);
+
+    writer_free(&plain);
+    writer_free(&interlaced);
+    free(pixels);
+    free(expected);
+    free(actual);
+}
+
+/*
+ * Writes a 4x4 RGB8 datastream made of the chunks of `types`, in
+ * order, up to a type of 0.  IDAT stands for the whole image data.
+ */
+static status_t write_chunks(uint32_t const *types, writer_t *writer)
+{
+    static uint8_t const kPixels[4 * 4 * 3] = { 0 };
+    static uint8_t const kGama[4] = { 0x00, 0x00, 0xb1, 0x8f };
+    static uint8_t const kPlte[6] = { 0, 0, 0, 255, 255, 255 };
+    encoder_t encoder;
+    ihdr_t ihdr;
+    uint8_t data[13];
+    uint32_t length;
+    status_t status;
+
+    fixture_ihdr(4, 4, 2, 0, &ihdr);
+    length = sizeof(data);
+    status = ihdr_serialize(&ihdr, data, &length);
+    if (status != STATUS_OK || encoder_init(NULL, &encoder) != STATUS_OK)
+    {
+        return STATUS_FAILURE;
+    }
+
+    status = writer_write_signature(writer);
+    for (; *types != 0 && status == STATUS_OK; types++)
+    {
+        switch (*types)
+        {
+            case IHDR_TYPE:
+                status = writer_write_data(writer, IHDR_TYPE, data, length);
+                break;
+            case PLTE_TYPE:
+                status = writer_write_data(
+                    writer, PLTE_TYPE, kPlte, sizeof(kPlte));
+                break;
+            case GAMA_TYPE:
+                status = writer_write_data(
+                    writer, GAMA_TYPE, kGama, sizeof(kGama));
+                break;
+            case IDAT_TYPE:
+                status = encoder_compress(
+                    &encoder, &ihdr, kPixels, fixture_idat_sink, writer);
+                break;
+            default:
+                status = writer_write_data(writer, *types, NULL, 0);
+                break;
+        }
+    }
+    encoder_free(&encoder);
+    return status;
+}
+
+/* Opens a datastream of the chunks of `types`, or returns why not. */
+static status_t open_chunks(uint32_t const *types, uint32_t *gamma)
+{
+    decoder_t decoder;
+    writer_t writer;
+    uint8_t const *data;
+    size_t length;
+    status_t status;
+
+    writer_init_memory(&writer);
+    status = write_chunks(types, &writer);
+    if (status == STATUS_OK)
+    {
+        writer_get_memory(&writer, &data, &length);
+        status = decoder_open(data, length, NULL, &decoder);
+        if (status == STATUS_OK)
+        {
+            *gamma = decoder.color.gamma;
+            decoder_close(&decoder);
+        }
+    }
+    writer_free(&writer);
+    return status;
+}
+
+/*
+ * Critical chunks out of order or repeated are rejected, ancillary
+ * ones are ignored.
+ */
+static void test_chunk_order(void)
+{
+    static uint32_t const kValid[] = {
+        IHDR_TYPE, GAMA_TYPE, PLTE_TYPE, IDAT_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kPlteAfterIdat[] = {
+        IHDR_TYPE, IDAT_TYPE, PLTE_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kTwoPlte[] = {
+        IHDR_TYPE, PLTE_TYPE, PLTE_TYPE, IDAT_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kTwoIhdr[] = {
+        IHDR_TYPE, IHDR_TYPE, IDAT_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kIhdrAfterIdat[] = {
+        IHDR_TYPE, IDAT_TYPE, IHDR_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kGamaAfterPlte[] = {
+        IHDR_TYPE, PLTE_TYPE, GAMA_TYPE, IDAT_TYPE, IEND_TYPE, 0
+    };
+    static uint32_t const kTwoGama[] = {
+        IHDR_TYPE, GAMA_TYPE, GAMA_TYPE, IDAT_TYPE, IEND_TYPE, 0
+    };
+    uint32_t gamma;
+
+    gamma = 0;
+    TEST_STATUS(open_chunks(kValid, &gamma), STATUS_OK);
+    TEST_CHECK(gamma == 45455);
+    TEST_STATUS(open_chunks(kPlteAfterIdat, &gamma), STATUS_BAD_PACKET);
+    TEST_STATUS(open_chunks(kTwoPlte, &gamma), STATUS_BAD_PACKET);
+    TEST_STATUS(open_chunks(kTwoIhdr, &gamma), STATUS_BAD_PACKET);
+    TEST_STATUS(open_chunks(kIhdrAfterIdat, &gamma), STATUS_BAD_PACKET);
+
+    gamma = 1;
+    TEST_STATUS(open_chunks(kGamaAfterPlte, &gamma), STATUS_OK);
+    TEST_CHECK(gamma == 0);
+    TEST_STATUS(open_chunks(kTwoGama, &gamma), STATUS_OK);
+    TEST_CHECK(gamma == 45455);
+}
+
+int main(void)
+{
+    test_interlaced_thumbnail();
+    test_interlaced_yuv420();
+    test_chunk_order();
+    return TEST_EXIT("decoder_test");
+}
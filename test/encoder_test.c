@@ -0,0 +1,101 @@
+/*
+ *  Image-Formats - Encoder Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoder.h"
+#include "writer.h"
+
+#include "fixture.h"
+#include "test.h"
+
+/* Compares the datastreams held by two memory writers. */
+static bool_t same_datastream(writer_t *a, writer_t *b)
+{
+    uint8_t const *data_a, *data_b;
+    size_t length_a, length_b;
+
+    writer_get_memory(a, &data_a, &length_a);
+    writer_get_memory(b, &data_b, &length_b);
+    return length_a == length_b && memcmp(data_a, data_b, length_a) == 0;
+}
+
+/*
+ * Segmented encoding writes the same datastream whatever the number of
+ * threads compressing the segments.
+ */
+static void test_segments_ignore_threads(void)
+{
+    static uint32_t const kThreads[] = { 2, 4, 8 };
+    static uint32_t const kSide = 512;
+    encoder_options_t options;
+    writer_t single, multi;
+    ihdr_t ihdr;
+    uint8_t *pixels;
+    size_t i;
+
+    fixture_ihdr(kSide, kSide, 6, 0, &ihdr);
+    pixels = fixture_pixels(kSide, kSide, 4, 0);
+    TEST_CHECK(pixels != NULL);
+
+    encoder_options_default(&options);
+    options.compressor = &kDeflateCompressor;
+    options.segment_size = 64 * 1024;
+    writer_init_memory(&single);
+    writer_init_memory(&multi);
+    if (pixels)
+    {
+        options.threads = 1;
+        TEST_STATUS(fixture_encode(&options, &ihdr, pixels, &single),
+                    STATUS_OK);
+        for (i = 0; i < sizeof(kThreads) / sizeof(kThreads[0]); i++)
+        {
+            options.threads = kThreads[i];
+            writer_reset(&multi);
+            TEST_STATUS(fixture_encode(&options, &ihdr, pixels, &multi),
+                        STATUS_OK);
+            TEST_CHECK(same_datastream(&single, &multi));
+        }
+    }
+
+    writer_free(&single);
+    writer_free(&multi);
+    free(pixels);
+}
+
+/* IDAT chunks may be larger than 4 MiB, up to the PNG chunk limit. */
+static void test_large_idat_size(void)
+{
+    encoder_options_t options;
+    writer_t writer;
+    ihdr_t ihdr;
+    uint8_t *pixels;
+
+    fixture_ihdr(16, 16, 6, 0, &ihdr);
+    pixels = fixture_pixels(16, 16, 4, 0);
+    TEST_CHECK(pixels != NULL);
+
+    encoder_options_default(&options);
+    options.idat_size = 8 * 1024 * 1024;
+    TEST_CHECK(options.idat_size > kMallocLimit);
+    writer_init_memory(&writer);
+    if (pixels)
+    {
+        TEST_STATUS(fixture_encode(&options, &ihdr, pixels, &writer),
+                    STATUS_OK);
+    }
+
+    writer_free(&writer);
+    free(pixels);
+}
+
+int main(void)
+{
+    test_segments_ignore_threads();
+    test_large_idat_size();
+    return TEST_EXIT("encoder_test");
+}
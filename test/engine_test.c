@@ -0,0 +1,74 @@
+/*
+ *  Image-Formats - Engine Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#include "test.h"
+
+/*
+ * A large buffer handed out for a small request is pooled again at its
+ * full capacity, so it stays reusable for large requests.
+ */
+static void test_pool_keeps_capacity(void)
+{
+    engine_pool_t pool;
+    uint8_t *large, *small, *again;
+
+    TEST_STATUS(engine_pool_init(1 << 20, &pool), STATUS_OK);
+    large = (uint8_t *)engine_pool_allocate(&pool, 4096);
+    TEST_CHECK(large != NULL);
+    engine_pool_release(&pool, large);
+    TEST_CHECK(pool.count == 1 && pool.bytes == 4096);
+
+    small = (uint8_t *)engine_pool_allocate(&pool, 16);
+    TEST_CHECK(small == large);
+    TEST_CHECK(pool.count == 0 && pool.bytes == 0);
+    engine_pool_release(&pool, small);
+    TEST_CHECK(pool.count == 1 && pool.bytes == 4096);
+
+    again = (uint8_t *)engine_pool_allocate(&pool, 4096);
+    TEST_CHECK(again == large);
+    if (again)
+    {
+        memset(again, 0xa5, 4096);
+    }
+    engine_pool_release(&pool, again);
+    engine_pool_free(&pool);
+}
+
+/* Buffers are only pooled while their capacity fits in `max_bytes`. */
+static void test_pool_max_bytes(void)
+{
+    engine_pool_t pool;
+    void *first, *second;
+
+    TEST_STATUS(engine_pool_init(6000, &pool), STATUS_OK);
+    first = engine_pool_allocate(&pool, 4096);
+    second = engine_pool_allocate(&pool, 4096);
+    TEST_CHECK(first && second);
+    engine_pool_release(&pool, first);
+    engine_pool_release(&pool, second);
+    TEST_CHECK(pool.count == 1 && pool.bytes == 4096);
+
+    /* Reused for a small request, then released at its capacity. */
+    first = engine_pool_allocate(&pool, 100);
+    second = engine_pool_allocate(&pool, 4096);
+    engine_pool_release(&pool, first);
+    engine_pool_release(&pool, second);
+    TEST_CHECK(pool.count == 1 && pool.bytes == 4096);
+    TEST_CHECK(pool.bytes <= pool.max_bytes);
+    engine_pool_free(&pool);
+}
+
+int main(void)
+{
+    test_pool_keeps_capacity();
+    test_pool_max_bytes();
+    return TEST_EXIT("engine_test");
+}
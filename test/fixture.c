@@ -0,0 +1,66 @@
+/*
+ *  Image-Formats - Test Fixtures
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fixture.h"
+
+void fixture_ihdr(
+    uint32_t width, uint32_t height, uint8_t color_type, uint8_t interlace,
+    ihdr_t *ihdr)
+{
+    memset(ihdr, 0, sizeof(ihdr_t));
+    ihdr->width = width;
+    ihdr->height = height;
+    ihdr->bit_depth = 8;
+    ihdr->color_type = color_type;
+    ihdr->interlace_method = interlace;
+}
+
+uint8_t *fixture_pixels(
+    uint32_t width, uint32_t height, uint32_t channels, uint32_t seed)
+{
+    uint8_t *pixels, *sample;
+    uint32_t x, y, c;
+
+    pixels = (uint8_t *)malloc((size_t)width * height * channels);
+    sample = pixels;
+    for (y = 0; pixels && y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                *sample++ = (uint8_t)(x * (c + 1) + y * (c * 2 + 3) +
+                                      (x >> 8) * 16 + c * 64 + seed * 37);
+            }
+        }
+    }
+    return pixels;
+}
+
+status_t fixture_encode(
+    encoder_options_t const *options, ihdr_t const *ihdr,
+    uint8_t const *pixels, writer_t *writer)
+{
+    encoder_t encoder;
+    status_t status;
+
+    status = encoder_init(options, &encoder);
+    if (status == STATUS_OK)
+    {
+        status = encoder_encode(&encoder, ihdr, NULL, pixels, writer);
+    }
+    encoder_free(&encoder);
+    return status;
+}
+
+status_t fixture_idat_sink(void *context, uint8_t const *data, size_t length)
+{
+    return writer_write_data(
+        (writer_t *)context, IDAT_TYPE, data, (uint32_t)length);
+}
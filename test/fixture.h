@@ -0,0 +1,58 @@
+/*
+ *  Image-Formats - Test Fixtures
+ *      Images and datastreams shared by the test programs.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _FIXTURE_H_
+#define _FIXTURE_H_
+
+#include "base.h"
+#include "encoder.h"
+#include "imgchunk.h"
+#include "writer.h"
+
+/*
+ * Side of a square 8-bit image whose RGB or RGBA pixels take more
+ * than kMallocLimit.
+ */
+#define FIXTURE_LARGE_SIDE 1200
+
+/*
+ * Function: fixture_ihdr
+ *  Initializes the header of a 8-bit image.
+ */
+void fixture_ihdr(
+    uint32_t width, uint32_t height, uint8_t color_type, uint8_t interlace,
+    ihdr_t *ihdr);
+
+/*
+ * Function: fixture_pixels
+ *  Allocates 8-bit pixels of `channels` samples filled with a pattern
+ *  of more colors than a palette holds, and channels that differ, so
+ *  that no lossless reduction applies.  Images of different `seed`
+ *  differ in every pixel.
+ * Return:
+ *    The pixels, to be freed, or NULL if out of memory.
+ */
+uint8_t *fixture_pixels(
+    uint32_t width, uint32_t height, uint32_t channels, uint32_t seed);
+
+/*
+ * Function: fixture_encode
+ *  Encodes an image into `writer` with `options`, or the defaults if
+ *  NULL.
+ */
+status_t fixture_encode(
+    encoder_options_t const *options, ihdr_t const *ihdr,
+    uint8_t const *pixels, writer_t *writer);
+
+/*
+ * Function: fixture_idat_sink
+ *  Compression sink writing every piece of image data as an IDAT chunk
+ *  into the writer passed as `context`.
+ */
+status_t fixture_idat_sink(void *context, uint8_t const *data, size_t length);
+
+#endif /* _FIXTURE_H_ */
@@ -0,0 +1,136 @@
+/*
+ *  Image-Formats - Optimizer Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "optimize.h"
+#include "writer.h"
+
+#include "fixture.h"
+#include "test.h"
+
+/* Decodes a datastream and compares it with RGB8 pixels. */
+static bool_t matches(
+    writer_t *writer, uint8_t const *pixels, uint32_t width, uint32_t height)
+{
+    decoder_t decoder;
+    uint8_t const *data;
+    uint8_t *out;
+    size_t length, size;
+    bool_t same;
+
+    writer_get_memory(writer, &data, &length);
+    if (decoder_open(data, length, NULL, &decoder) != STATUS_OK)
+    {
+        return false;
+    }
+    size = (size_t)width * height * 3;
+    out = (uint8_t *)malloc(size);
+    same = out && decoder.ihdr.color_type == 2 &&
+           decoder.ihdr.bit_depth == 8 &&
+           decoder_decode_region(&decoder, NULL, out, &size) == STATUS_OK &&
+           memcmp(out, pixels, size) == 0;
+    decoder_close(&decoder);
+    free(out);
+    return same;
+}
+
+/* Images larger than 4 MiB are optimized, up to the pixel limit. */
+static void test_optimize_large_image(void)
+{
+    optimize_options_t options;
+    writer_t input, output;
+    uint8_t const *data;
+    ihdr_t ihdr;
+    uint8_t *pixels;
+    size_t length;
+    uint32_t side;
+
+    side = FIXTURE_LARGE_SIDE;
+    TEST_CHECK((size_t)side * side * 3 > kMallocLimit);
+    fixture_ihdr(side, side, 2, 0, &ihdr);
+    pixels = fixture_pixels(side, side, 3, 0);
+    TEST_CHECK(pixels != NULL);
+
+    writer_init_memory(&input);
+    writer_init_memory(&output);
+    if (pixels)
+    {
+        TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &input), STATUS_OK);
+        writer_get_memory(&input, &data, &length);
+
+        optimize_options_default(&options);
+        options.level = 1;
+        TEST_STATUS(optimize_png(data, length, &options, &output, NULL),
+                    STATUS_OK);
+        TEST_CHECK(matches(&output, pixels, side, side));
+
+        options.max_pixels = (uint64_t)side * side - 1;
+        TEST_STATUS(optimize_png(data, length, &options, &output, NULL),
+                    STATUS_LIMIT_EXCEEDED);
+    }
+
+    writer_free(&input);
+    writer_free(&output);
+    free(pixels);
+}
+
+/*
+ * Deflate trials compress the best filter strategy again at the
+ * maximum level of each backend, and are never larger without them.
+ */
+static void test_deflate_trials(void)
+{
+    static uint32_t const kSide = 256;
+    optimize_options_t options;
+    optimize_result_t single, trials;
+    writer_t input, output;
+    uint8_t const *data;
+    ihdr_t ihdr;
+    uint8_t *pixels;
+    size_t length;
+
+    fixture_ihdr(kSide, kSide, 2, 0, &ihdr);
+    pixels = fixture_pixels(kSide, kSide, 3, 0);
+    TEST_CHECK(pixels != NULL);
+
+    writer_init_memory(&input);
+    writer_init_memory(&output);
+    if (pixels)
+    {
+        TEST_STATUS(fixture_encode(NULL, &ihdr, pixels, &input), STATUS_OK);
+        writer_get_memory(&input, &data, &length);
+
+        optimize_options_default(&options);
+        options.level = 1;
+        options.deflate_trials = false;
+        TEST_STATUS(optimize_png(data, length, &options, &output, &single),
+                    STATUS_OK);
+        TEST_CHECK(!single.kept_input && single.level == 1);
+
+        writer_reset(&output);
+        options.deflate_trials = true;
+        TEST_STATUS(optimize_png(data, length, &options, &output, &trials),
+                    STATUS_OK);
+        TEST_CHECK(trials.output_size <= single.output_size);
+        TEST_CHECK(!trials.kept_input &&
+                   trials.level == trials.compressor->max_level);
+        TEST_CHECK(matches(&output, pixels, kSide, kSide));
+    }
+
+    writer_free(&input);
+    writer_free(&output);
+    free(pixels);
+}
+
+int main(void)
+{
+    test_optimize_large_image();
+    test_deflate_trials();
+    return TEST_EXIT("optimize_test");
+}
@@ -0,0 +1,63 @@
+/*
+ *  Image-Formats - Quantization Tests
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "quantize.h"
+
+#include "test.h"
+
+#define WIDTH 64
+#define HEIGHT 48
+#define PIXELS (WIDTH * HEIGHT)
+
+/* Opaque RGBA is quantized exactly as the same RGB image. */
+static void test_opaque_rgba(void)
+{
+    static uint8_t rgb[PIXELS * 3], rgba[PIXELS * 4];
+    static uint8_t rgb_indices[PIXELS], rgba_indices[PIXELS];
+    palette_t rgb_palette, rgba_palette;
+    uint32_t i;
+
+    for (i = 0; i < PIXELS; i++)
+    {
+        rgb[i * 3] = rgba[i * 4] = (uint8_t)(i * 5);
+        rgb[i * 3 + 1] = rgba[i * 4 + 1] = (uint8_t)(i >> 3);
+        rgb[i * 3 + 2] = rgba[i * 4 + 2] = (uint8_t)(i * 11 + 7);
+        rgba[i * 4 + 3] = 0xff;
+    }
+
+    TEST_STATUS(quantize_image(rgb, WIDTH, HEIGHT, 3, NULL, rgb_indices,
+                               &rgb_palette), STATUS_OK);
+    TEST_STATUS(quantize_image(rgba, WIDTH, HEIGHT, 4, NULL, rgba_indices,
+                               &rgba_palette), STATUS_OK);
+    TEST_CHECK(rgb_palette.size == rgba_palette.size);
+    TEST_CHECK(memcmp(rgb_indices, rgba_indices, PIXELS) == 0);
+    TEST_CHECK(memcmp(rgb_palette.colors, rgba_palette.colors,
+                      sizeof(rgb_t) * rgb_palette.size) == 0);
+    palette_free(&rgb_palette);
+    palette_free(&rgba_palette);
+}
+
+/* Translucent RGBA is rejected instead of losing its alpha. */
+static void test_translucent_rgba(void)
+{
+    static uint8_t rgba[PIXELS * 4], indices[PIXELS];
+    palette_t palette;
+
+    memset(rgba, 0xff, sizeof(rgba));
+    rgba[PIXELS * 4 - 1] = 0x80;
+    TEST_STATUS(quantize_image(rgba, WIDTH, HEIGHT, 4, NULL, indices,
+                               &palette), STATUS_ILLEGAL_ARGUMENT);
+}
+
+int main(void)
+{
+    test_opaque_rgba();
+    test_translucent_rgba();
+    return TEST_EXIT("quantize_test");
+}
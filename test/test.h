@@ -0,0 +1,52 @@
+/*
+ *  Image-Formats - Tests
+ *      Checks shared by the test programs.  Every program runs all of
+ *      its cases and exits with 1 if any check failed.
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for details
+ */
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "base.h"
+
+/* Number of failed checks of the program. */
+static uint32_t test_failures = 0;
+
+#define TEST_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+/* Checks the status returned by a call. */
+#define TEST_STATUS(call, expected) \
+    do \
+    { \
+        status_t test_status_ = (call); \
+        if (test_status_ != (expected)) \
+        { \
+            fprintf(stderr, "%s:%d: %s returned %s, expected %s\n", \
+                    __FILE__, __LINE__, #call, \
+                    status_string(test_status_), \
+                    status_string(expected)); \
+            test_failures++; \
+        } \
+    } while (0)
+
+/* Reports the checks of the program and returns its exit status. */
+#define TEST_EXIT(name) \
+    (printf("%s: %s\n", (name), \
+            test_failures == 0 ? "ok" : "FAILED"), \
+     test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif /* _TEST_H_ */